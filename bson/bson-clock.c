@@ -20,6 +20,7 @@
 #include <mach/mach.h>
 #endif
 
+#include <sys/time.h>
 #include <time.h>
 
 #include "bson-clock.h"
@@ -55,3 +56,24 @@ bson_get_monotonic_time (void)
    }
 #endif
 }
+
+
+bson_int64_t
+bson_get_coarse_real_time (void)
+{
+#ifdef CLOCK_REALTIME_COARSE
+   {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+      return (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000L);
+   }
+#else
+   {
+      struct timeval tv;
+
+      gettimeofday(&tv, NULL);
+      return (tv.tv_sec * 1000000LL) + tv.tv_usec;
+   }
+#endif
+}
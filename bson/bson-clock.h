@@ -38,6 +38,22 @@ BSON_BEGIN_DECLS
 bson_int64_t bson_get_monotonic_time (void);
 
 
+/**
+ * bson_get_coarse_real_time:
+ *
+ * Returns the wall clock time as cheaply as possible, at the cost of
+ * precision. On Linux this reads CLOCK_REALTIME_COARSE, which is updated
+ * once per scheduler tick (typically every 1 to 4 milliseconds) and never
+ * enters the kernel. Other systems fall back to the regular wall clock.
+ *
+ * Use this instead of gettimeofday() when millisecond granularity is
+ * enough, as bson_append_now_utc_coarse() does.
+ *
+ * Returns: The number of microseconds since the UNIX epoch.
+ */
+bson_int64_t bson_get_coarse_real_time (void);
+
+
 BSON_END_DECLS
 
 
@@ -0,0 +1,1356 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bson.h"
+#include "bson-column.h"
+#include "bson-writer-private.h"
+
+
+#define MIN_ROWS 64
+#define MIN_DICT 16
+
+/*
+ * The validity bits of the 8 rows starting at @row, which is a multiple
+ * of 8. Columns without a bitmap are all valid.
+ */
+#define VALID_BYTE(valid, row) ((valid) ? (valid)[(row) >> 3] : 0xFF)
+
+#if defined(__GNUC__)
+#  define POPCOUNT(v) __builtin_popcount((v))
+#else
+#  define POPCOUNT(v) bson_column_popcount((v))
+#endif
+
+
+typedef struct _bson_extractor_node_t bson_extractor_node_t;
+
+
+struct _bson_extractor_node_t
+{
+   char                  *key;
+   int                    column;     /* -1 if no column ends here. */
+   bson_extractor_node_t *children;
+   size_t                 n_children;
+};
+
+
+struct _bson_extractor_t
+{
+   bson_extractor_node_t  root;
+   bson_column_t         *columns;
+   int                    n_columns;
+   size_t                 n_rows;
+   int                    n_found;    /* Columns set in the current row. */
+};
+
+
+#if !defined(__GNUC__)
+static BSON_INLINE int
+bson_column_popcount (unsigned int v)
+{
+   int n = 0;
+
+   for (; v; v &= v - 1) {
+      n++;
+   }
+
+   return n;
+}
+#endif
+
+
+static size_t
+bson_column_value_size (bson_column_type_t type)
+{
+   switch (type) {
+   case BSON_COLUMN_INT32:
+   case BSON_COLUMN_STRING:
+      return 4;
+   case BSON_COLUMN_INT64:
+   case BSON_COLUMN_DOUBLE:
+   case BSON_COLUMN_DATE_TIME:
+      return 8;
+   case BSON_COLUMN_BOOL:
+      return 1;
+   default:
+      return 0;
+   }
+}
+
+
+size_t
+bson_column_count (const bson_column_t *column)
+{
+   size_t count = 0;
+   size_t i;
+
+   bson_return_val_if_fail(column, 0);
+
+   if (!column->valid) {
+      return column->n_rows;
+   }
+
+   for (i = 0; (i + 8) <= column->n_rows; i += 8) {
+      count += POPCOUNT(column->valid[i >> 3]);
+   }
+
+   if (i < column->n_rows) {
+      count += POPCOUNT(column->valid[i >> 3] &
+                        ((1U << (column->n_rows - i)) - 1));
+   }
+
+   return count;
+}
+
+
+/*
+ * The kernels below walk the rows 8 at a time, one byte of the validity
+ * bitmap per step. Blocks where every row is valid go through SSE2 where
+ * available, others are handled row by row.
+ */
+
+
+static bson_uint64_t
+bson_column_sum_i32 (const bson_int32_t *values,
+                     const bson_uint8_t *valid,
+                     size_t              n_rows)
+{
+   bson_uint64_t sum = 0;
+   bson_uint8_t mask;
+   size_t i;
+   size_t j;
+#ifdef __SSE2__
+   bson_uint64_t lanes[2];
+   __m128i acc = _mm_setzero_si128();
+   __m128i v;
+   __m128i sign;
+#endif
+
+   for (i = 0; (i + 8) <= n_rows; i += 8) {
+      mask = VALID_BYTE(valid, i);
+#ifdef __SSE2__
+      if (mask == 0xFF) {
+         for (j = 0; j < 8; j += 4) {
+            v = _mm_loadu_si128((const __m128i *)(values + i + j));
+            sign = _mm_srai_epi32(v, 31);
+            acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+            acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+         }
+         continue;
+      }
+#endif
+      for (j = 0; mask; j++, mask >>= 1) {
+         if ((mask & 1)) {
+            sum += (bson_int64_t)values[i + j];
+         }
+      }
+   }
+
+   for (; i < n_rows; i++) {
+      if (!valid || (valid[i >> 3] & (1 << (i & 7)))) {
+         sum += (bson_int64_t)values[i];
+      }
+   }
+
+#ifdef __SSE2__
+   _mm_storeu_si128((__m128i *)lanes, acc);
+   sum += lanes[0] + lanes[1];
+#endif
+
+   return sum;
+}
+
+
+static bson_uint64_t
+bson_column_sum_i64 (const bson_int64_t *values,
+                     const bson_uint8_t *valid,
+                     size_t              n_rows)
+{
+   bson_uint64_t sum = 0;
+   bson_uint8_t mask;
+   size_t i;
+   size_t j;
+#ifdef __SSE2__
+   bson_uint64_t lanes[2];
+   __m128i acc = _mm_setzero_si128();
+#endif
+
+   for (i = 0; (i + 8) <= n_rows; i += 8) {
+      mask = VALID_BYTE(valid, i);
+#ifdef __SSE2__
+      if (mask == 0xFF) {
+         for (j = 0; j < 8; j += 2) {
+            acc = _mm_add_epi64(
+               acc, _mm_loadu_si128((const __m128i *)(values + i + j)));
+         }
+         continue;
+      }
+#endif
+      for (j = 0; mask; j++, mask >>= 1) {
+         if ((mask & 1)) {
+            sum += (bson_uint64_t)values[i + j];
+         }
+      }
+   }
+
+   for (; i < n_rows; i++) {
+      if (!valid || (valid[i >> 3] & (1 << (i & 7)))) {
+         sum += (bson_uint64_t)values[i];
+      }
+   }
+
+#ifdef __SSE2__
+   _mm_storeu_si128((__m128i *)lanes, acc);
+   sum += lanes[0] + lanes[1];
+#endif
+
+   return sum;
+}
+
+
+bson_bool_t
+bson_column_sum_int64 (const bson_column_t *column,
+                       bson_int64_t        *sum)
+{
+   bson_return_val_if_fail(column, FALSE);
+   bson_return_val_if_fail(sum, FALSE);
+
+   switch (column->type) {
+   case BSON_COLUMN_INT32:
+      *sum = (bson_int64_t)bson_column_sum_i32(column->values, column->valid,
+                                               column->n_rows);
+      return TRUE;
+   case BSON_COLUMN_INT64:
+      *sum = (bson_int64_t)bson_column_sum_i64(column->values, column->valid,
+                                               column->n_rows);
+      return TRUE;
+   case BSON_COLUMN_DOUBLE:
+   case BSON_COLUMN_BOOL:
+   case BSON_COLUMN_DATE_TIME:
+   case BSON_COLUMN_STRING:
+   default:
+      return FALSE;
+   }
+}
+
+
+bson_bool_t
+bson_column_sum_double (const bson_column_t *column,
+                        double              *sum)
+{
+   const double *values;
+   const bson_uint8_t *valid;
+   bson_uint8_t mask;
+   double total = 0.0;
+   size_t i;
+   size_t j;
+#ifdef __SSE2__
+   double lanes[2];
+   __m128d acc0 = _mm_setzero_pd();
+   __m128d acc1 = _mm_setzero_pd();
+#endif
+
+   bson_return_val_if_fail(column, FALSE);
+   bson_return_val_if_fail(sum, FALSE);
+
+   if (column->type != BSON_COLUMN_DOUBLE) {
+      return FALSE;
+   }
+
+   values = column->values;
+   valid = column->valid;
+
+   for (i = 0; (i + 8) <= column->n_rows; i += 8) {
+      mask = VALID_BYTE(valid, i);
+#ifdef __SSE2__
+      if (mask == 0xFF) {
+         acc0 = _mm_add_pd(acc0, _mm_loadu_pd(values + i));
+         acc1 = _mm_add_pd(acc1, _mm_loadu_pd(values + i + 2));
+         acc0 = _mm_add_pd(acc0, _mm_loadu_pd(values + i + 4));
+         acc1 = _mm_add_pd(acc1, _mm_loadu_pd(values + i + 6));
+         continue;
+      }
+#endif
+      for (j = 0; mask; j++, mask >>= 1) {
+         if ((mask & 1)) {
+            total += values[i + j];
+         }
+      }
+   }
+
+   for (; i < column->n_rows; i++) {
+      if (BSON_COLUMN_IS_VALID(column, i)) {
+         total += values[i];
+      }
+   }
+
+#ifdef __SSE2__
+   _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+   total += lanes[0] + lanes[1];
+#endif
+
+   *sum = total;
+
+   return TRUE;
+}
+
+
+#ifdef __SSE2__
+static BSON_INLINE __m128i
+bson_column_min_epi32 (__m128i a,
+                       __m128i b)
+{
+   __m128i gt = _mm_cmpgt_epi32(a, b);
+
+   return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+
+static BSON_INLINE __m128i
+bson_column_max_epi32 (__m128i a,
+                       __m128i b)
+{
+   __m128i gt = _mm_cmpgt_epi32(a, b);
+
+   return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+#endif
+
+
+static bson_bool_t
+bson_column_range_i32 (const bson_int32_t *values,
+                       const bson_uint8_t *valid,
+                       size_t              n_rows,
+                       bson_int64_t       *minp,
+                       bson_int64_t       *maxp)
+{
+   bson_int32_t min = INT32_MAX;
+   bson_int32_t max = INT32_MIN;
+   bson_bool_t found = FALSE;
+   bson_uint8_t mask;
+   size_t i;
+   size_t j;
+#ifdef __SSE2__
+   bson_int32_t lanes[4];
+   __m128i vmin = _mm_set1_epi32(INT32_MAX);
+   __m128i vmax = _mm_set1_epi32(INT32_MIN);
+   __m128i v;
+#endif
+
+   for (i = 0; (i + 8) <= n_rows; i += 8) {
+      mask = VALID_BYTE(valid, i);
+#ifdef __SSE2__
+      if (mask == 0xFF) {
+         for (j = 0; j < 8; j += 4) {
+            v = _mm_loadu_si128((const __m128i *)(values + i + j));
+            vmin = bson_column_min_epi32(vmin, v);
+            vmax = bson_column_max_epi32(vmax, v);
+         }
+         found = TRUE;
+         continue;
+      }
+#endif
+      for (j = 0; mask; j++, mask >>= 1) {
+         if ((mask & 1)) {
+            min = MIN(min, values[i + j]);
+            max = MAX(max, values[i + j]);
+            found = TRUE;
+         }
+      }
+   }
+
+   for (; i < n_rows; i++) {
+      if (!valid || (valid[i >> 3] & (1 << (i & 7)))) {
+         min = MIN(min, values[i]);
+         max = MAX(max, values[i]);
+         found = TRUE;
+      }
+   }
+
+#ifdef __SSE2__
+   _mm_storeu_si128((__m128i *)lanes, vmin);
+   for (j = 0; j < 4; j++) {
+      min = MIN(min, lanes[j]);
+   }
+   _mm_storeu_si128((__m128i *)lanes, vmax);
+   for (j = 0; j < 4; j++) {
+      max = MAX(max, lanes[j]);
+   }
+#endif
+
+   *minp = min;
+   *maxp = max;
+
+   return found;
+}
+
+
+/*
+ * SSE2 has no 64-bit compare, so this one is left to the compiler.
+ */
+static bson_bool_t
+bson_column_range_i64 (const bson_int64_t *values,
+                       const bson_uint8_t *valid,
+                       size_t              n_rows,
+                       bson_int64_t       *minp,
+                       bson_int64_t       *maxp)
+{
+   bson_int64_t min = INT64_MAX;
+   bson_int64_t max = INT64_MIN;
+   bson_bool_t found = FALSE;
+   bson_uint8_t mask;
+   size_t i;
+   size_t j;
+
+   for (i = 0; (i + 8) <= n_rows; i += 8) {
+      mask = VALID_BYTE(valid, i);
+      if (mask == 0xFF) {
+         for (j = 0; j < 8; j++) {
+            min = MIN(min, values[i + j]);
+            max = MAX(max, values[i + j]);
+         }
+         found = TRUE;
+         continue;
+      }
+      for (j = 0; mask; j++, mask >>= 1) {
+         if ((mask & 1)) {
+            min = MIN(min, values[i + j]);
+            max = MAX(max, values[i + j]);
+            found = TRUE;
+         }
+      }
+   }
+
+   for (; i < n_rows; i++) {
+      if (!valid || (valid[i >> 3] & (1 << (i & 7)))) {
+         min = MIN(min, values[i]);
+         max = MAX(max, values[i]);
+         found = TRUE;
+      }
+   }
+
+   *minp = min;
+   *maxp = max;
+
+   return found;
+}
+
+
+static bson_bool_t
+bson_column_range_int64 (const bson_column_t *column,
+                         bson_int64_t        *min,
+                         bson_int64_t        *max)
+{
+   switch (column->type) {
+   case BSON_COLUMN_INT32:
+      return bson_column_range_i32(column->values, column->valid,
+                                   column->n_rows, min, max);
+   case BSON_COLUMN_INT64:
+   case BSON_COLUMN_DATE_TIME:
+      return bson_column_range_i64(column->values, column->valid,
+                                   column->n_rows, min, max);
+   case BSON_COLUMN_DOUBLE:
+   case BSON_COLUMN_BOOL:
+   case BSON_COLUMN_STRING:
+   default:
+      return FALSE;
+   }
+}
+
+
+bson_bool_t
+bson_column_min_int64 (const bson_column_t *column,
+                       bson_int64_t        *min)
+{
+   bson_int64_t max;
+
+   bson_return_val_if_fail(column, FALSE);
+   bson_return_val_if_fail(min, FALSE);
+
+   return bson_column_range_int64(column, min, &max);
+}
+
+
+bson_bool_t
+bson_column_max_int64 (const bson_column_t *column,
+                       bson_int64_t        *max)
+{
+   bson_int64_t min;
+
+   bson_return_val_if_fail(column, FALSE);
+   bson_return_val_if_fail(max, FALSE);
+
+   return bson_column_range_int64(column, &min, max);
+}
+
+
+static bson_bool_t
+bson_column_range_double (const bson_column_t *column,
+                          double              *minp,
+                          double              *maxp)
+{
+   const double *values;
+   const bson_uint8_t *valid;
+   double min = HUGE_VAL;
+   double max = -HUGE_VAL;
+   bson_bool_t found = FALSE;
+   bson_uint8_t mask;
+   size_t i;
+   size_t j;
+#ifdef __SSE2__
+   double lanes[2];
+   __m128d vmin = _mm_set1_pd(HUGE_VAL);
+   __m128d vmax = _mm_set1_pd(-HUGE_VAL);
+   __m128d v;
+#endif
+
+   if (column->type != BSON_COLUMN_DOUBLE) {
+      return FALSE;
+   }
+
+   values = column->values;
+   valid = column->valid;
+
+   for (i = 0; (i + 8) <= column->n_rows; i += 8) {
+      mask = VALID_BYTE(valid, i);
+#ifdef __SSE2__
+      if (mask == 0xFF) {
+         for (j = 0; j < 8; j += 2) {
+            v = _mm_loadu_pd(values + i + j);
+            vmin = _mm_min_pd(vmin, v);
+            vmax = _mm_max_pd(vmax, v);
+         }
+         found = TRUE;
+         continue;
+      }
+#endif
+      for (j = 0; mask; j++, mask >>= 1) {
+         if ((mask & 1)) {
+            min = MIN(min, values[i + j]);
+            max = MAX(max, values[i + j]);
+            found = TRUE;
+         }
+      }
+   }
+
+   for (; i < column->n_rows; i++) {
+      if (BSON_COLUMN_IS_VALID(column, i)) {
+         min = MIN(min, values[i]);
+         max = MAX(max, values[i]);
+         found = TRUE;
+      }
+   }
+
+#ifdef __SSE2__
+   _mm_storeu_pd(lanes, vmin);
+   min = MIN(min, lanes[0]);
+   min = MIN(min, lanes[1]);
+   _mm_storeu_pd(lanes, vmax);
+   max = MAX(max, lanes[0]);
+   max = MAX(max, lanes[1]);
+#endif
+
+   *minp = min;
+   *maxp = max;
+
+   return found;
+}
+
+
+bson_bool_t
+bson_column_min_double (const bson_column_t *column,
+                        double              *min)
+{
+   double max;
+
+   bson_return_val_if_fail(column, FALSE);
+   bson_return_val_if_fail(min, FALSE);
+
+   return bson_column_range_double(column, min, &max);
+}
+
+
+bson_bool_t
+bson_column_max_double (const bson_column_t *column,
+                        double              *max)
+{
+   double min;
+
+   bson_return_val_if_fail(column, FALSE);
+   bson_return_val_if_fail(max, FALSE);
+
+   return bson_column_range_double(column, &min, max);
+}
+
+
+static void
+bson_column_destroy (bson_column_t *column)
+{
+   bson_uint32_t i;
+
+   for (i = 0; i < column->n_dict; i++) {
+      bson_free(column->dict[i]);
+   }
+
+   bson_free(column->dict);
+   bson_free(column->dict_lengths);
+   bson_free(column->dict_hashes);
+   bson_free(column->dict_slots);
+   bson_free(column->values);
+   bson_free(column->valid);
+}
+
+
+/*
+ * Doubles the hash table of the dictionary of @column, or allocates it.
+ */
+static void
+bson_column_dict_grow (bson_column_t *column)
+{
+   bson_uint32_t n_slots;
+   bson_uint32_t code;
+   bson_uint32_t i;
+
+   n_slots = column->dict_slots ? (column->dict_mask + 1) * 2 : MIN_DICT;
+
+   bson_free(column->dict_slots);
+   column->dict_slots = bson_malloc0(n_slots * sizeof *column->dict_slots);
+   column->dict_mask = n_slots - 1;
+
+   for (code = 0; code < column->n_dict; code++) {
+      i = column->dict_hashes[code] & column->dict_mask;
+      while (column->dict_slots[i]) {
+         i = (i + 1) & column->dict_mask;
+      }
+      column->dict_slots[i] = code + 1;
+   }
+}
+
+
+/*
+ * Fetches the code of @str in the dictionary of @column, adding it if
+ * this is the first time it is seen.
+ */
+static bson_uint32_t
+bson_column_dict_code (bson_column_t *column,
+                       const char    *str,
+                       bson_uint32_t  len)
+{
+   bson_uint32_t hash;
+   bson_uint32_t code;
+   bson_uint32_t i;
+   size_t n_alloc;
+
+   if (!column->dict_slots ||
+       ((column->n_dict + 1) * 2 > (column->dict_mask + 1))) {
+      bson_column_dict_grow(column);
+   }
+
+   hash = (bson_uint32_t)bson_hash_data(str, len, 0);
+
+   for (i = hash & column->dict_mask;
+        column->dict_slots[i];
+        i = (i + 1) & column->dict_mask) {
+      code = column->dict_slots[i] - 1;
+      if ((column->dict_hashes[code] == hash) &&
+          (column->dict_lengths[code] == len) &&
+          !memcmp(column->dict[code], str, len)) {
+         return code;
+      }
+   }
+
+   code = column->n_dict++;
+
+   /*
+    * The dictionary arrays double whenever the count reaches a power of
+    * two, so they need no capacity of their own.
+    */
+   if (!(code & (code - 1))) {
+      n_alloc = code ? (code * 2) : 1;
+      column->dict = bson_realloc(column->dict,
+                                  n_alloc * sizeof *column->dict);
+      column->dict_lengths = bson_realloc(column->dict_lengths,
+                                          n_alloc *
+                                          sizeof *column->dict_lengths);
+      column->dict_hashes = bson_realloc(column->dict_hashes,
+                                         n_alloc *
+                                         sizeof *column->dict_hashes);
+   }
+
+   column->dict[code] = bson_malloc(len + 1);
+   memcpy(column->dict[code], str, len);
+   column->dict[code][len] = '\0';
+   column->dict_lengths[code] = len;
+   column->dict_hashes[code] = hash;
+   column->dict_slots[i] = code + 1;
+
+   return code;
+}
+
+
+bson_extractor_t *
+bson_extractor_new (void)
+{
+   bson_extractor_t *extractor;
+
+   extractor = bson_malloc0(sizeof *extractor);
+   extractor->root.column = -1;
+
+   return extractor;
+}
+
+
+static void
+bson_extractor_node_destroy (bson_extractor_node_t *node)
+{
+   size_t i;
+
+   for (i = 0; i < node->n_children; i++) {
+      bson_extractor_node_destroy(&node->children[i]);
+   }
+
+   bson_free(node->children);
+   bson_free(node->key);
+}
+
+
+void
+bson_extractor_destroy (bson_extractor_t *extractor)
+{
+   int i;
+
+   if (extractor) {
+      for (i = 0; i < extractor->n_columns; i++) {
+         bson_column_destroy(&extractor->columns[i]);
+      }
+
+      bson_free(extractor->columns);
+      bson_extractor_node_destroy(&extractor->root);
+      bson_free(extractor);
+   }
+}
+
+
+int
+bson_extractor_add_column (bson_extractor_t   *extractor,
+                           const char         *path,
+                           bson_column_type_t  type)
+{
+   bson_extractor_node_t *node;
+   bson_extractor_node_t *child;
+   bson_column_t *column;
+   const char *dot;
+   size_t len;
+   size_t i;
+
+   bson_return_val_if_fail(extractor, -1);
+   bson_return_val_if_fail(path, -1);
+   bson_return_val_if_fail(bson_column_value_size(type), -1);
+   bson_return_val_if_fail(!extractor->n_rows, -1);
+
+   node = &extractor->root;
+
+   for (;;) {
+      dot = strchr(path, '.');
+      len = dot ? (size_t)(dot - path) : strlen(path);
+
+      child = NULL;
+      for (i = 0; i < node->n_children; i++) {
+         if (!strncmp(node->children[i].key, path, len) &&
+             !node->children[i].key[len]) {
+            child = &node->children[i];
+            break;
+         }
+      }
+
+      if (!child) {
+         node->children = bson_realloc(node->children,
+                                       (node->n_children + 1) *
+                                       sizeof *node->children);
+         child = &node->children[node->n_children++];
+         memset(child, 0, sizeof *child);
+         child->key = bson_strndup(path, len);
+         child->column = -1;
+      }
+
+      node = child;
+
+      if (!dot) {
+         break;
+      }
+
+      path = dot + 1;
+   }
+
+   if (node->column >= 0) {
+      return -1;
+   }
+
+   extractor->columns = bson_realloc(extractor->columns,
+                                     (extractor->n_columns + 1) *
+                                     sizeof *extractor->columns);
+   column = &extractor->columns[extractor->n_columns];
+   memset(column, 0, sizeof *column);
+   column->type = type;
+
+   node->column = extractor->n_columns++;
+
+   return node->column;
+}
+
+
+/*
+ * Makes room for one more row in every column and appends it as null.
+ */
+static void
+bson_extractor_add_row (bson_extractor_t *extractor)
+{
+   bson_column_t *column;
+   size_t row = extractor->n_rows;
+   size_t capacity;
+   size_t size;
+   int i;
+
+   for (i = 0; i < extractor->n_columns; i++) {
+      column = &extractor->columns[i];
+      size = bson_column_value_size(column->type);
+
+      if (row == column->capacity) {
+         capacity = MAX(MIN_ROWS, column->capacity * 2);
+         column->values = bson_realloc(column->values, capacity * size);
+         column->valid = bson_realloc(column->valid, capacity / 8);
+         column->capacity = capacity;
+      }
+
+      memset((bson_uint8_t *)column->values + (row * size), 0, size);
+
+      if (!(row & 7)) {
+         column->valid[row >> 3] = 0;
+      }
+
+      column->n_rows = row + 1;
+   }
+
+   extractor->n_rows = row + 1;
+   extractor->n_found = 0;
+}
+
+
+/*
+ * Stores the value @iter is located on into the current row of @column if
+ * it converts to the type of the column. The first match of a row wins.
+ */
+static void
+bson_extractor_store (bson_extractor_t  *extractor,
+                      bson_column_t     *column,
+                      const bson_iter_t *iter)
+{
+   size_t row = extractor->n_rows - 1;
+   bson_uint32_t len;
+   const char *str;
+   bson_type_t type;
+   bson_int64_t i64;
+   double d;
+
+   if ((column->valid[row >> 3] & (1 << (row & 7)))) {
+      return;
+   }
+
+   type = bson_iter_type(iter);
+
+   /*
+    * Values that do not fit the column, including NaN, leave the row null
+    * as converting them is undefined.
+    */
+   switch (column->type) {
+   case BSON_COLUMN_INT32:
+      if (type == BSON_TYPE_INT32) {
+         ((bson_int32_t *)column->values)[row] = bson_iter_int32(iter);
+      } else if (type == BSON_TYPE_INT64) {
+         i64 = bson_iter_int64(iter);
+         if ((i64 < INT32_MIN) || (i64 > INT32_MAX)) {
+            return;
+         }
+         ((bson_int32_t *)column->values)[row] = (bson_int32_t)i64;
+      } else if (type == BSON_TYPE_DOUBLE) {
+         d = bson_iter_double(iter);
+         if (!((d > -2147483649.0) && (d < 2147483648.0))) {
+            return;
+         }
+         ((bson_int32_t *)column->values)[row] = (bson_int32_t)d;
+      } else {
+         return;
+      }
+      break;
+   case BSON_COLUMN_INT64:
+      if (type == BSON_TYPE_INT64) {
+         ((bson_int64_t *)column->values)[row] = bson_iter_int64(iter);
+      } else if (type == BSON_TYPE_INT32) {
+         ((bson_int64_t *)column->values)[row] = bson_iter_int32(iter);
+      } else if (type == BSON_TYPE_DOUBLE) {
+         d = bson_iter_double(iter);
+         if (!((d >= -9223372036854775808.0) &&
+               (d < 9223372036854775808.0))) {
+            return;
+         }
+         ((bson_int64_t *)column->values)[row] = (bson_int64_t)d;
+      } else {
+         return;
+      }
+      break;
+   case BSON_COLUMN_DOUBLE:
+      if (type == BSON_TYPE_DOUBLE) {
+         ((double *)column->values)[row] = bson_iter_double(iter);
+      } else if (type == BSON_TYPE_INT32) {
+         ((double *)column->values)[row] = bson_iter_int32(iter);
+      } else if (type == BSON_TYPE_INT64) {
+         ((double *)column->values)[row] = (double)bson_iter_int64(iter);
+      } else {
+         return;
+      }
+      break;
+   case BSON_COLUMN_BOOL:
+      if (type != BSON_TYPE_BOOL) {
+         return;
+      }
+      ((bson_uint8_t *)column->values)[row] = !!bson_iter_bool(iter);
+      break;
+   case BSON_COLUMN_DATE_TIME:
+      if (type != BSON_TYPE_DATE_TIME) {
+         return;
+      }
+      ((bson_int64_t *)column->values)[row] = bson_iter_date_time(iter);
+      break;
+   case BSON_COLUMN_STRING:
+      if (type != BSON_TYPE_UTF8) {
+         return;
+      }
+      str = bson_iter_utf8(iter, &len);
+      ((bson_uint32_t *)column->values)[row] =
+         bson_column_dict_code(column, str, len);
+      break;
+   default:
+      return;
+   }
+
+   column->valid[row >> 3] |= (1 << (row & 7));
+   extractor->n_found++;
+}
+
+
+/*
+ * Walks the document @iter iterates, matching keys against the children
+ * of @node. Like bson_struct_decode(), the child after the previous match
+ * is tried first. Stops early once every column of the row is set.
+ */
+static bson_bool_t
+bson_extractor_visit (bson_extractor_t            *extractor,
+                      const bson_extractor_node_t *node,
+                      bson_iter_t                 *iter)
+{
+   const bson_extractor_node_t *child;
+   bson_iter_t sub;
+   const char *key;
+   size_t next = 0;
+   size_t i;
+
+   while (bson_iter_next(iter)) {
+      key = bson_iter_key(iter);
+
+      if ((next < node->n_children) &&
+          !strcmp(key, node->children[next].key)) {
+         child = &node->children[next];
+      } else {
+         child = NULL;
+         for (i = 0; i < node->n_children; i++) {
+            if (!strcmp(key, node->children[i].key)) {
+               child = &node->children[i];
+               break;
+            }
+         }
+         if (!child) {
+            continue;
+         }
+      }
+
+      next = (child - node->children) + 1;
+
+      if (child->column >= 0) {
+         bson_extractor_store(extractor, &extractor->columns[child->column],
+                              iter);
+      }
+
+      if (child->n_children &&
+          (BSON_ITER_HOLDS_DOCUMENT(iter) || BSON_ITER_HOLDS_ARRAY(iter)) &&
+          bson_iter_recurse(iter, &sub) &&
+          !bson_extractor_visit(extractor, child, &sub)) {
+         return FALSE;
+      }
+
+      if (extractor->n_found == extractor->n_columns) {
+         return TRUE;
+      }
+   }
+
+   return !iter->err_offset;
+}
+
+
+bson_bool_t
+bson_extractor_add_document (bson_extractor_t *extractor,
+                             const bson_t     *bson)
+{
+   bson_iter_t iter;
+
+   bson_return_val_if_fail(extractor, FALSE);
+   bson_return_val_if_fail(bson, FALSE);
+
+   bson_extractor_add_row(extractor);
+
+   if (!bson_iter_init(&iter, bson)) {
+      return FALSE;
+   }
+
+   return bson_extractor_visit(extractor, &extractor->root, &iter);
+}
+
+
+size_t
+bson_extractor_read (bson_extractor_t *extractor,
+                     bson_reader_t    *reader,
+                     size_t            max_docs,
+                     bson_bool_t      *reached_eof)
+{
+   const bson_t *bson;
+   bson_bool_t eof = FALSE;
+   size_t n_docs = 0;
+
+   bson_return_val_if_fail(extractor, 0);
+   bson_return_val_if_fail(reader, 0);
+
+   while ((!max_docs || (n_docs < max_docs)) &&
+          (bson = bson_reader_read(reader, &eof))) {
+      bson_extractor_add_document(extractor, bson);
+      n_docs++;
+   }
+
+   if (reached_eof) {
+      *reached_eof = eof;
+   }
+
+   return n_docs;
+}
+
+
+const bson_column_t *
+bson_extractor_get_column (const bson_extractor_t *extractor,
+                           int                     column)
+{
+   bson_return_val_if_fail(extractor, NULL);
+   bson_return_val_if_fail((column >= 0) && (column < extractor->n_columns),
+                           NULL);
+
+   return &extractor->columns[column];
+}
+
+
+void
+bson_extractor_reset (bson_extractor_t *extractor)
+{
+   int i;
+
+   bson_return_if_fail(extractor);
+
+   for (i = 0; i < extractor->n_columns; i++) {
+      extractor->columns[i].n_rows = 0;
+   }
+
+   extractor->n_rows = 0;
+}
+
+
+typedef struct
+{
+   const bson_column_t *column;
+   bson_uint8_t        *prefix;      /* Type byte, key and NUL. */
+   size_t               prefix_len;
+} bson_column_encoder_field_t;
+
+
+struct _bson_column_encoder_t
+{
+   bson_column_encoder_field_t *fields;
+   size_t                       n_fields;
+};
+
+
+bson_column_encoder_t *
+bson_column_encoder_new (void)
+{
+   return bson_malloc0(sizeof(bson_column_encoder_t));
+}
+
+
+void
+bson_column_encoder_destroy (bson_column_encoder_t *encoder)
+{
+   size_t i;
+
+   if (encoder) {
+      for (i = 0; i < encoder->n_fields; i++) {
+         bson_free(encoder->fields[i].prefix);
+      }
+
+      bson_free(encoder->fields);
+      bson_free(encoder);
+   }
+}
+
+
+bson_bool_t
+bson_column_encoder_add_column (bson_column_encoder_t *encoder,
+                                const char            *key,
+                                int                    key_length,
+                                const bson_column_t   *column)
+{
+   bson_column_encoder_field_t *field;
+   bson_type_t type;
+
+   bson_return_val_if_fail(encoder, FALSE);
+   bson_return_val_if_fail(key, FALSE);
+   bson_return_val_if_fail(column, FALSE);
+
+   switch (column->type) {
+   case BSON_COLUMN_INT32:
+      type = BSON_TYPE_INT32;
+      break;
+   case BSON_COLUMN_INT64:
+      type = BSON_TYPE_INT64;
+      break;
+   case BSON_COLUMN_DOUBLE:
+      type = BSON_TYPE_DOUBLE;
+      break;
+   case BSON_COLUMN_BOOL:
+      type = BSON_TYPE_BOOL;
+      break;
+   case BSON_COLUMN_DATE_TIME:
+      type = BSON_TYPE_DATE_TIME;
+      break;
+   case BSON_COLUMN_STRING:
+      type = BSON_TYPE_UTF8;
+      break;
+   default:
+      return FALSE;
+   }
+
+   if (key_length < 0) {
+      key_length = (int)strlen(key);
+   }
+
+   encoder->fields = bson_realloc(encoder->fields,
+                                  (encoder->n_fields + 1) *
+                                  sizeof *encoder->fields);
+   field = &encoder->fields[encoder->n_fields++];
+   field->column = column;
+   field->prefix_len = key_length + 2;
+   field->prefix = bson_malloc(field->prefix_len);
+   field->prefix[0] = type;
+   memcpy(field->prefix + 1, key, key_length);
+   field->prefix[key_length + 1] = '\0';
+
+   return TRUE;
+}
+
+
+/*
+ * Computes the size of the whole batch column by column rather than row by
+ * row, along with the largest a single document may get. Returns FALSE if
+ * the columns cannot be encoded.
+ */
+static bson_bool_t
+bson_column_encoder_measure (const bson_column_encoder_t *encoder,
+                             size_t                      *n_rows,
+                             size_t                      *size)
+{
+   const bson_column_encoder_field_t *field;
+   const bson_column_t *column;
+   const bson_uint32_t *codes;
+   bson_uint32_t max_string;
+   size_t max_doc = 5;
+   size_t total;
+   size_t valid;
+   size_t i;
+   size_t row;
+
+   *n_rows = encoder->n_fields ? encoder->fields[0].column->n_rows : 0;
+   total = *n_rows * 5;
+
+   for (i = 0; i < encoder->n_fields; i++) {
+      field = &encoder->fields[i];
+      column = field->column;
+
+      if (column->n_rows != *n_rows) {
+         return FALSE;
+      }
+
+      valid = bson_column_count(column);
+      total += *n_rows * field->prefix_len;
+
+      if (column->type == BSON_COLUMN_STRING) {
+         codes = column->values;
+         total += valid * 5;
+         for (row = 0; row < *n_rows; row++) {
+            if (BSON_COLUMN_IS_VALID(column, row)) {
+               if (codes[row] >= column->n_dict) {
+                  return FALSE;
+               }
+               total += column->dict_lengths[codes[row]];
+            }
+         }
+         max_string = 0;
+         for (row = 0; row < column->n_dict; row++) {
+            max_string = MAX(max_string, column->dict_lengths[row]);
+         }
+         max_doc += field->prefix_len + 5 + max_string;
+      } else {
+         total += valid * bson_column_value_size(column->type);
+         max_doc += field->prefix_len + 8;
+      }
+   }
+
+   if (max_doc > INT32_MAX) {
+      return FALSE;
+   }
+
+   *size = total;
+
+   return TRUE;
+}
+
+
+size_t
+bson_column_encoder_get_size (const bson_column_encoder_t *encoder)
+{
+   size_t n_rows;
+   size_t size;
+
+   bson_return_val_if_fail(encoder, 0);
+
+   if (!bson_column_encoder_measure(encoder, &n_rows, &size)) {
+      return 0;
+   }
+
+   return size;
+}
+
+
+bson_bool_t
+bson_column_encoder_write (const bson_column_encoder_t *encoder,
+                           bson_writer_t               *writer,
+                           size_t                      *n_docs)
+{
+   const bson_column_encoder_field_t *field;
+   const bson_column_t *column;
+   bson_uint8_t *data;
+   bson_uint8_t *doc;
+   bson_uint32_t code;
+   bson_uint32_t u32;
+   bson_uint64_t u64;
+   double dbl;
+   size_t n_rows;
+   size_t size;
+   size_t row;
+   size_t i;
+
+   bson_return_val_if_fail(encoder, FALSE);
+   bson_return_val_if_fail(writer, FALSE);
+
+   if (!bson_column_encoder_measure(encoder, &n_rows, &size) ||
+       !(data = bson_writer_append_raw(writer, size))) {
+      return FALSE;
+   }
+
+   for (row = 0; row < n_rows; row++) {
+      doc = data;
+      data += 4;
+
+      for (i = 0; i < encoder->n_fields; i++) {
+         field = &encoder->fields[i];
+         column = field->column;
+
+         memcpy(data, field->prefix, field->prefix_len);
+
+         if (!BSON_COLUMN_IS_VALID(column, row)) {
+            *data = BSON_TYPE_NULL;
+            data += field->prefix_len;
+            continue;
+         }
+
+         data += field->prefix_len;
+
+         switch (column->type) {
+         case BSON_COLUMN_INT32:
+            u32 = BSON_UINT32_TO_LE(((bson_uint32_t *)column->values)[row]);
+            memcpy(data, &u32, 4);
+            data += 4;
+            break;
+         case BSON_COLUMN_INT64:
+         case BSON_COLUMN_DATE_TIME:
+            u64 = BSON_UINT64_TO_LE(((bson_uint64_t *)column->values)[row]);
+            memcpy(data, &u64, 8);
+            data += 8;
+            break;
+         case BSON_COLUMN_DOUBLE:
+            dbl = BSON_DOUBLE_TO_LE(((double *)column->values)[row]);
+            memcpy(data, &dbl, 8);
+            data += 8;
+            break;
+         case BSON_COLUMN_BOOL:
+            *data++ = !!((bson_uint8_t *)column->values)[row];
+            break;
+         case BSON_COLUMN_STRING:
+            code = ((bson_uint32_t *)column->values)[row];
+            u32 = BSON_UINT32_TO_LE(column->dict_lengths[code] + 1);
+            memcpy(data, &u32, 4);
+            memcpy(data + 4, column->dict[code], column->dict_lengths[code]);
+            data += 4 + column->dict_lengths[code];
+            *data++ = '\0';
+            break;
+         default:
+            BSON_ASSERT(FALSE);
+            break;
+         }
+      }
+
+      *data++ = '\0';
+      u32 = BSON_UINT32_TO_LE((bson_uint32_t)(data - doc));
+      memcpy(doc, &u32, 4);
+   }
+
+   if (n_docs) {
+      *n_docs = n_rows;
+   }
+
+   return TRUE;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_COLUMN_H
+#define BSON_COLUMN_H
+
+
+#include "bson-macros.h"
+#include "bson-reader.h"
+#include "bson-types.h"
+#include "bson-writer.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_column_type_t:
+ *
+ * The type of the values of a bson_column_t.
+ *
+ * %BSON_COLUMN_INT32: bson_int32_t values. Int64 and double fields are
+ *    converted with a C cast if they fit, so doubles are truncated.
+ * %BSON_COLUMN_INT64: bson_int64_t values. Int32 and double fields are
+ *    converted with a C cast if they fit, so doubles are truncated.
+ * %BSON_COLUMN_DOUBLE: double values. Int32 and int64 fields are
+ *    converted with a C cast.
+ * %BSON_COLUMN_BOOL: bson_uint8_t values of 0 or 1.
+ * %BSON_COLUMN_DATE_TIME: bson_int64_t milliseconds since the UNIX epoch.
+ * %BSON_COLUMN_STRING: bson_uint32_t codes indexing the dictionary of the
+ *    column, which holds every distinct string once.
+ */
+typedef enum
+{
+   BSON_COLUMN_INT32 = 1,
+   BSON_COLUMN_INT64,
+   BSON_COLUMN_DOUBLE,
+   BSON_COLUMN_BOOL,
+   BSON_COLUMN_DATE_TIME,
+   BSON_COLUMN_STRING
+} bson_column_type_t;
+
+
+/**
+ * bson_column_t:
+ *
+ * A column of typed values with a validity bitmap. Bit (row % 8) of
+ * valid[row / 8] is set if the row has a value; null rows have a value of
+ * zero. @valid may be NULL if every row has a value. See
+ * BSON_COLUMN_IS_VALID().
+ *
+ * String columns are dictionary encoded: values holds a code per row and
+ * dict[code] is the string, which is NUL terminated and dict_lengths[code]
+ * bytes long.
+ *
+ * The fields after n_dict are internal.
+ */
+typedef struct
+{
+   bson_column_type_t   type;
+   size_t               n_rows;
+   void                *values;
+   bson_uint8_t        *valid;
+   char               **dict;
+   bson_uint32_t       *dict_lengths;
+   bson_uint32_t        n_dict;
+
+   size_t               capacity;
+   bson_uint32_t       *dict_hashes;
+   bson_uint32_t       *dict_slots;
+   bson_uint32_t        dict_mask;
+} bson_column_t;
+
+
+#define BSON_COLUMN_IS_VALID(column, row) \
+   (!(column)->valid || ((column)->valid[(row) >> 3] & (1 << ((row) & 7))))
+
+
+/**
+ * bson_column_count:
+ * @column: A bson_column_t.
+ *
+ * Counts the rows of @column that are not null.
+ *
+ * Returns: The number of valid rows.
+ */
+size_t
+bson_column_count (const bson_column_t *column);
+
+
+/**
+ * bson_column_sum_int64:
+ * @column: A bson_column_t of type %BSON_COLUMN_INT32 or
+ *    %BSON_COLUMN_INT64.
+ * @sum: (out): A location for the sum.
+ *
+ * Sums the valid rows of @column, wrapping around on overflow. Blocks of
+ * eight valid rows are summed with SSE2 where available.
+ *
+ * Returns: TRUE if successful; FALSE if @column has another type.
+ */
+bson_bool_t
+bson_column_sum_int64 (const bson_column_t *column,
+                       bson_int64_t        *sum);
+
+
+/**
+ * bson_column_sum_double:
+ * @column: A bson_column_t of type %BSON_COLUMN_DOUBLE.
+ * @sum: (out): A location for the sum.
+ *
+ * Sums the valid rows of @column. The values are added in several lanes,
+ * so the result may differ from a sequential sum in the last bits.
+ *
+ * Returns: TRUE if successful; FALSE if @column has another type.
+ */
+bson_bool_t
+bson_column_sum_double (const bson_column_t *column,
+                        double              *sum);
+
+
+/**
+ * bson_column_min_int64:
+ * @column: A bson_column_t of type %BSON_COLUMN_INT32, %BSON_COLUMN_INT64
+ *    or %BSON_COLUMN_DATE_TIME.
+ * @min: (out): A location for the smallest value.
+ *
+ * Finds the smallest value among the valid rows of @column.
+ * bson_column_max_int64() finds the largest.
+ *
+ * Returns: TRUE if successful; FALSE if @column has another type or no
+ *    valid rows.
+ */
+bson_bool_t
+bson_column_min_int64 (const bson_column_t *column,
+                       bson_int64_t        *min);
+
+
+bson_bool_t
+bson_column_max_int64 (const bson_column_t *column,
+                       bson_int64_t        *max);
+
+
+/**
+ * bson_column_min_double:
+ * @column: A bson_column_t of type %BSON_COLUMN_DOUBLE.
+ * @min: (out): A location for the smallest value.
+ *
+ * Finds the smallest value among the valid rows of @column.
+ * bson_column_max_double() finds the largest. NaN values are not ordered
+ * and may or may not be skipped.
+ *
+ * Returns: TRUE if successful; FALSE if @column has another type or no
+ *    valid rows.
+ */
+bson_bool_t
+bson_column_min_double (const bson_column_t *column,
+                        double              *min);
+
+
+bson_bool_t
+bson_column_max_double (const bson_column_t *column,
+                        double              *max);
+
+
+/**
+ * bson_extractor_t:
+ *
+ * Pulls fields out of a stream of documents into a set of columns, one row
+ * per document. Add a column per dotted path with
+ * bson_extractor_add_column() and feed documents with
+ * bson_extractor_read() or bson_extractor_add_document().
+ *
+ * All paths are matched in a single pass over each document. Fields that
+ * are missing, or whose type does not convert to the type of their
+ * column, are null.
+ */
+typedef struct _bson_extractor_t bson_extractor_t;
+
+
+bson_extractor_t *
+bson_extractor_new (void);
+
+
+void
+bson_extractor_destroy (bson_extractor_t *extractor);
+
+
+/**
+ * bson_extractor_add_column:
+ * @extractor: A bson_extractor_t.
+ * @path: A dotted path such as "a.b.c".
+ * @type: The type of the column.
+ *
+ * Adds a column for @path. Columns may only be added before the first
+ * document. Paths descend into embedded documents and arrays, so "a.0" is
+ * the first element of the array "a".
+ *
+ * Returns: The index of the new column, or -1 on failure.
+ */
+int
+bson_extractor_add_column (bson_extractor_t   *extractor,
+                           const char         *path,
+                           bson_column_type_t  type);
+
+
+/**
+ * bson_extractor_add_document:
+ * @extractor: A bson_extractor_t.
+ * @bson: A bson_t.
+ *
+ * Appends a row for @bson to every column.
+ *
+ * Returns: TRUE if successful; FALSE if @bson is corrupt, in which case the
+ *    row holds the fields found before the corruption.
+ */
+bson_bool_t
+bson_extractor_add_document (bson_extractor_t *extractor,
+                             const bson_t     *bson);
+
+
+/**
+ * bson_extractor_read:
+ * @extractor: A bson_extractor_t.
+ * @reader: A bson_reader_t.
+ * @max_docs: The maximum number of documents to read, or 0 for no limit.
+ * @reached_eof: (out) (allow-none): A location for whether the end of
+ *    @reader was reached.
+ *
+ * Reads documents from @reader and appends a row for each of them.
+ *
+ * Returns: The number of documents read.
+ */
+size_t
+bson_extractor_read (bson_extractor_t *extractor,
+                     bson_reader_t    *reader,
+                     size_t            max_docs,
+                     bson_bool_t      *reached_eof);
+
+
+/**
+ * bson_extractor_get_column:
+ * @extractor: A bson_extractor_t.
+ * @column: The index returned by bson_extractor_add_column().
+ *
+ * Fetches a column. It is valid until the next document is added.
+ *
+ * Returns: A bson_column_t owned by @extractor, or NULL.
+ */
+const bson_column_t *
+bson_extractor_get_column (const bson_extractor_t *extractor,
+                           int                     column);
+
+
+/**
+ * bson_extractor_reset:
+ * @extractor: A bson_extractor_t.
+ *
+ * Removes all rows so the next batch of documents can be extracted
+ * without reallocating. The dictionaries of string columns are kept, so
+ * their codes stay the same across batches.
+ */
+void
+bson_extractor_reset (bson_extractor_t *extractor);
+
+
+/**
+ * bson_column_encoder_t:
+ *
+ * The reverse of bson_extractor_t: writes one document per row of a set of
+ * columns. Each column becomes a field whose key is encoded once when the
+ * column is added, and null rows become BSON nulls.
+ *
+ * The columns are borrowed, not copied, and are read when
+ * bson_column_encoder_write() is called. They may be the columns of a
+ * bson_extractor_t or filled in by hand.
+ */
+typedef struct _bson_column_encoder_t bson_column_encoder_t;
+
+
+bson_column_encoder_t *
+bson_column_encoder_new (void);
+
+
+void
+bson_column_encoder_destroy (bson_column_encoder_t *encoder);
+
+
+/**
+ * bson_column_encoder_add_column:
+ * @encoder: A bson_column_encoder_t.
+ * @key: The key for the field.
+ * @key_length: The length of @key in bytes not including NUL or -1
+ *    if @key_length is NUL terminated.
+ * @column: A bson_column_t that must outlive @encoder.
+ *
+ * Appends a field to the documents written by @encoder. Fields are written
+ * in the order they are added.
+ *
+ * Returns: TRUE if successful; FALSE if @column has an unknown type.
+ */
+bson_bool_t
+bson_column_encoder_add_column (bson_column_encoder_t *encoder,
+                                const char            *key,
+                                int                    key_length,
+                                const bson_column_t   *column);
+
+
+/**
+ * bson_column_encoder_get_size:
+ * @encoder: A bson_column_encoder_t.
+ *
+ * Computes the exact number of bytes bson_column_encoder_write() would
+ * write for the current contents of the columns.
+ *
+ * Returns: The size in bytes, or 0 if the columns cannot be encoded. See
+ *    bson_column_encoder_write().
+ */
+size_t
+bson_column_encoder_get_size (const bson_column_encoder_t *encoder);
+
+
+/**
+ * bson_column_encoder_write:
+ * @encoder: A bson_column_encoder_t.
+ * @writer: A bson_writer_t that is not in the middle of a document.
+ * @n_docs: (out) (allow-none): A location for the number of documents.
+ *
+ * Writes a document per row to @writer. The size of the batch is computed
+ * up front, so the buffer of @writer grows at most once and the documents
+ * are written straight into it. The result can be read back with
+ * bson_reader_new_from_data().
+ *
+ * Returns: TRUE if successful; FALSE if the columns have different numbers
+ *    of rows, a string code is not in its dictionary, a document would
+ *    overflow max size or the batch does not fit in a writer of fixed
+ *    capacity. Nothing is written in that case.
+ */
+bson_bool_t
+bson_column_encoder_write (const bson_column_encoder_t *encoder,
+                           bson_writer_t               *writer,
+                           size_t                      *n_docs);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_COLUMN_H */
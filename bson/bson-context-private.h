@@ -27,20 +27,20 @@
 BSON_BEGIN_DECLS
 
 
+/*
+ * Number of sequence numbers a thread reserves at a time when the context
+ * was created with BSON_CONTEXT_SEQ_PER_THREAD.
+ */
+#define BSON_CONTEXT_SEQ_BLOCK 1024
+
+
 struct _bson_context_t
 {
    bson_context_flags_t   flags : 7;
    bson_bool_t            pidbe_once : 1;
    bson_uint8_t           pidbe[2];
    bson_uint8_t           md5[3];
-   bson_uint32_t          seq32;
-   bson_uint64_t          seq64;
-#if defined WITH_OID32_PT
-   bson_mutex_t           _m32;
-#endif
-#if defined WITH_OID64_PT
-   bson_mutex_t           _m64;
-#endif
+   bson_uint32_t          serial;
 
    void (*oid_get_host)  (bson_context_t *context,
                           bson_oid_t     *oid);
@@ -50,9 +50,29 @@ struct _bson_context_t
                           bson_oid_t     *oid);
    void (*oid_get_seq64) (bson_context_t *context,
                           bson_oid_t     *oid);
+
+   /*
+    * Keep the counters that are written by every thread off of the cache
+    * line holding the fields above, which are read for every ObjectId.
+    */
+   bson_uint8_t           _pad[64];
+
+   bson_uint32_t          seq32;
+   bson_uint64_t          seq64;
+#if defined WITH_OID32_PT
+   bson_mutex_t           _m32;
+#endif
+#if defined WITH_OID64_PT
+   bson_mutex_t           _m64;
+#endif
 };
 
 
+bson_uint32_t
+bson_context_reserve_seq32 (bson_context_t *context,
+                            bson_uint32_t   n);
+
+
 BSON_END_DECLS
 
 
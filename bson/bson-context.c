@@ -45,9 +45,52 @@
 #endif
 
 
+/*
+ * Per-thread sequence blocks need both __thread and atomics to refill them.
+ * Without either, BSON_CONTEXT_SEQ_PER_THREAD behaves like
+ * BSON_CONTEXT_THREAD_SAFE.
+ */
+#if defined(HAVE_TLS) && !defined(WITH_OID32_PT)
+#define WITH_SEQ_PER_THREAD 1
+#endif
+
+
+#define BSON_CONTEXT_FLAGS_SHARED \
+   (BSON_CONTEXT_THREAD_SAFE | BSON_CONTEXT_SEQ_PER_THREAD)
+
+
 static bson_context_t *gContextDefault;
 
 
+#if defined(WITH_SEQ_PER_THREAD)
+typedef struct
+{
+   bson_uint32_t serial;
+   bson_uint32_t seq;
+   bson_uint32_t end;
+} bson_context_seq_block_t;
+
+
+/*
+ * Number of contexts a thread can hold a block for at once. Threads that
+ * switch between more contexts than this fall back to one shared increment
+ * per ObjectId for the rest, rather than dropping a block that still has
+ * unused sequence numbers, which would wrap the 24-bit counter.
+ */
+#define BSON_CONTEXT_SEQ_SLOTS 4
+
+
+/*
+ * Contexts are identified by serial number rather than by address so that
+ * a block reserved from a destroyed context is never used for a new one
+ * allocated at the same address. Serials start at 1, so a zeroed slot is
+ * free.
+ */
+static bson_uint32_t gContextSerial;
+static __thread bson_context_seq_block_t gSeqBlocks[BSON_CONTEXT_SEQ_SLOTS];
+#endif
+
+
 #if defined(__linux__)
 static bson_uint16_t
 gettid (void)
@@ -140,6 +183,54 @@ bson_context_get_oid_seq32_threadsafe (bson_context_t *context,
 }
 
 
+#if defined(WITH_SEQ_PER_THREAD)
+static void
+bson_context_get_oid_seq32_per_thread (bson_context_t *context,
+                                       bson_oid_t     *oid)
+{
+   bson_context_seq_block_t *block = NULL;
+   bson_uint32_t seq;
+   int i;
+
+   for (i = 0; i < BSON_CONTEXT_SEQ_SLOTS; i++) {
+      if (gSeqBlocks[i].serial == context->serial) {
+         block = &gSeqBlocks[i];
+         break;
+      }
+   }
+
+   if (BSON_UNLIKELY(!block || (block->seq == block->end))) {
+      /*
+       * Only take over a slot whose block is used up, so that no sequence
+       * numbers are thrown away.
+       */
+      for (i = 0; !block && (i < BSON_CONTEXT_SEQ_SLOTS); i++) {
+         if (gSeqBlocks[i].seq == gSeqBlocks[i].end) {
+            block = &gSeqBlocks[i];
+         }
+      }
+
+      if (!block) {
+         seq = __sync_fetch_and_add_4(&context->seq32, 1);
+         seq = BSON_UINT32_TO_BE(seq);
+         memcpy(&oid->bytes[9], ((bson_uint8_t *)&seq) + 1, 3);
+         return;
+      }
+
+      block->serial = context->serial;
+      block->seq = __sync_fetch_and_add_4(&context->seq32,
+                                          BSON_CONTEXT_SEQ_BLOCK);
+      block->end = block->seq + BSON_CONTEXT_SEQ_BLOCK;
+   }
+
+   seq = block->seq++;
+
+   seq = BSON_UINT32_TO_BE(seq);
+   memcpy(&oid->bytes[9], ((bson_uint8_t *)&seq) + 1, 3);
+}
+#endif
+
+
 static void
 bson_context_get_oid_seq64 (bson_context_t *context,
                             bson_oid_t     *oid)
@@ -169,12 +260,60 @@ bson_context_get_oid_seq64_threadsafe (bson_context_t *context,
 }
 
 
+/*
+ * Reserves @n consecutive values of the 32-bit sequence and returns the
+ * first one. Only the low 24 bits end up in an ObjectId, so callers are
+ * expected to mask each value rather than assume the range does not wrap.
+ */
+bson_uint32_t
+bson_context_reserve_seq32 (bson_context_t *context,
+                            bson_uint32_t   n)
+{
+   bson_uint32_t seq;
+
+   if (!(context->flags & BSON_CONTEXT_FLAGS_SHARED)) {
+      seq = context->seq32;
+      context->seq32 += n;
+      return seq;
+   }
+
+#if defined WITH_OID32_PT
+   bson_mutex_lock(&context->_m32);
+   seq = context->seq32;
+   context->seq32 += n;
+   bson_mutex_unlock(&context->_m32);
+#else
+   seq = __sync_fetch_and_add_4(&context->seq32, n);
+#endif
+
+   return seq;
+}
+
+
+static void
+bson_context_cache_pid (bson_context_t *context)
+{
+   bson_uint16_t pid;
+
+   pid = getpid();
+   pid = BSON_UINT16_TO_BE(pid);
+#if defined(__linux__)
+   if ((context->flags & BSON_CONTEXT_USE_TASK_ID)) {
+      bson_int32_t tid;
+      if ((tid = gettid())) {
+         pid = BSON_UINT16_TO_BE(tid);
+      }
+   }
+#endif
+   memcpy(&context->pidbe[0], &pid, 2);
+}
+
+
 bson_context_t *
 bson_context_new (bson_context_flags_t  flags)
 {
    bson_context_t *context;
    struct timeval tv;
-   bson_uint16_t pid;
    unsigned int seed[3];
    unsigned int real_seed;
    bson_oid_t oid;
@@ -211,7 +350,7 @@ bson_context_new (bson_context_flags_t  flags)
       context->md5[2] = oid.bytes[6];
    }
 
-   if ((flags & BSON_CONTEXT_THREAD_SAFE)) {
+   if ((flags & BSON_CONTEXT_FLAGS_SHARED)) {
 #if defined WITH_OID32_PT
       bson_mutex_init(&context->_m32, NULL);
 #endif
@@ -222,20 +361,18 @@ bson_context_new (bson_context_flags_t  flags)
       context->oid_get_seq64 = bson_context_get_oid_seq64_threadsafe;
    }
 
+#if defined(WITH_SEQ_PER_THREAD)
+   context->serial = __sync_add_and_fetch_4(&gContextSerial, 1);
+
+   if ((flags & BSON_CONTEXT_SEQ_PER_THREAD)) {
+      context->oid_get_seq32 = bson_context_get_oid_seq32_per_thread;
+   }
+#endif
+
    if ((flags & BSON_CONTEXT_DISABLE_PID_CACHE)) {
       context->oid_get_pid = bson_context_get_oid_pid;
    } else {
-      pid = getpid();
-      pid = BSON_UINT16_TO_BE(pid);
-#if defined(__linux__)
-      if ((flags & BSON_CONTEXT_USE_TASK_ID)) {
-         bson_int32_t tid;
-         if ((tid = gettid())) {
-            pid = BSON_UINT16_TO_BE(tid);
-         }
-      }
-#endif
-      memcpy(&context->pidbe[0], &pid, 2);
+      bson_context_cache_pid(context);
    }
 
    return context;
@@ -258,11 +395,23 @@ bson_context_destroy (bson_context_t *context)
 }
 
 
+/*
+ * The default context caches the pid like any other context, which saves a
+ * getpid() call per ObjectId. A forked child refreshes it before returning
+ * from fork() so that it never generates ObjectIds with its parent's pid.
+ */
+static void
+bson_context_atfork_child (void)
+{
+   bson_context_cache_pid(gContextDefault);
+}
+
+
 static void
 bson_context_init_default (void)
 {
-   gContextDefault = bson_context_new((BSON_CONTEXT_THREAD_SAFE |
-                                       BSON_CONTEXT_DISABLE_PID_CACHE));
+   gContextDefault = bson_context_new(BSON_CONTEXT_THREAD_SAFE);
+   pthread_atfork(NULL, NULL, bson_context_atfork_child);
 }
 
 
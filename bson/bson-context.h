@@ -46,6 +46,13 @@ BSON_BEGIN_DECLS
  * more than one thread, then BSON_CONTEXT_THREAD_SAFE should be bitwise or'd
  * with your flags. This requires synchronization between threads.
  *
+ * BSON_CONTEXT_SEQ_PER_THREAD also makes the context safe to share, but each
+ * thread reserves a block of sequence numbers at a time so that threads only
+ * synchronize once per block. A thread holds blocks for a few such contexts
+ * at a time; beyond that it increments the shared counter for each ObjectId
+ * instead. ObjectIds remain unique, but those generated by different threads
+ * within the same second are no longer ordered by creation time.
+ *
  * If you expect your hostname to change often, you may consider specifying
  * BSON_CONTEXT_DISABLE_HOST_CACHE so that gethostname() is called for every
  * OID generated. This is much slower.
@@ -78,6 +85,9 @@ bson_context_destroy (bson_context_t *context);
  * If you need faster generation, it is recommended you create your
  * own bson_context_t with bson_context_new().
  *
+ * The default context caches the result of getpid() and refreshes it in the
+ * child after fork(), so it is safe to keep using it in forked processes.
+ *
  * Returns: A shared instance to a bson_context_t. This should not
  *    be modified or freed.
  */
@@ -0,0 +1,803 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "bson.h"
+#include "bson-diff.h"
+
+
+#define BSON_DIFF_N_STACK 32
+
+
+/*
+ * The raw location of an element in the document it was read from.
+ */
+typedef struct
+{
+   const char         *key;
+   const bson_uint8_t *value;
+   bson_uint32_t       value_len;
+   bson_uint8_t        type;
+   bson_bool_t         used;
+} bson_diff_elem_t;
+
+
+/*
+ * The elements of a document in order, plus a hash table over their keys
+ * that is only built once something has to be looked up out of order.
+ */
+typedef struct
+{
+   bson_diff_elem_t *elems;
+   bson_uint32_t     n_elems;
+   bson_uint32_t     n_alloc;
+   bson_uint32_t    *slots;
+   bson_uint32_t     mask;
+   bson_bool_t       has_dups;
+   bson_diff_elem_t  stack[BSON_DIFF_N_STACK];
+} bson_diff_elems_t;
+
+
+/*
+ * The entries of one section of a patch, consumed in order.
+ */
+typedef struct
+{
+   bson_t      section;
+   bson_iter_t iter;
+   bson_bool_t more;
+} bson_patch_cursor_t;
+
+
+static bson_bool_t
+bson_diff_doc (const bson_t *from,
+               const bson_t *to,
+               bson_t       *patch);
+
+
+static bson_bool_t
+bson_patch_apply_doc (bson_t       *result,
+                      const bson_t *doc,
+                      const bson_t *patch);
+
+
+static void
+bson_diff_elem_init (bson_diff_elem_t  *elem,
+                     const bson_iter_t *iter)
+{
+   elem->key = bson_iter_key(iter);
+   elem->value = iter->key + strlen(elem->key) + 1;
+   elem->value_len = (bson_uint32_t)(iter->next_offset - iter->offset -
+                                     (elem->value - iter->type));
+   elem->type = *iter->type;
+   elem->used = FALSE;
+}
+
+
+static BSON_INLINE bson_bool_t
+bson_diff_elem_equal (const bson_diff_elem_t *a,
+                      const bson_diff_elem_t *b)
+{
+   return ((a->type == b->type) &&
+           (a->value_len == b->value_len) &&
+           !memcmp(a->value, b->value, a->value_len));
+}
+
+
+static void
+bson_diff_elems_init (bson_diff_elems_t *elems,
+                      const bson_t      *bson)
+{
+   bson_diff_elem_t *grown;
+   bson_iter_t iter;
+
+   elems->elems = elems->stack;
+   elems->n_elems = 0;
+   elems->n_alloc = BSON_DIFF_N_STACK;
+   elems->slots = NULL;
+   elems->mask = 0;
+   elems->has_dups = FALSE;
+
+   if (!bson_iter_init(&iter, bson)) {
+      return;
+   }
+
+   while (bson_iter_next(&iter)) {
+      if (elems->n_elems == elems->n_alloc) {
+         elems->n_alloc *= 2;
+         grown = bson_malloc(elems->n_alloc * sizeof *grown);
+         memcpy(grown, elems->elems, elems->n_elems * sizeof *grown);
+         if (elems->elems != elems->stack) {
+            bson_free(elems->elems);
+         }
+         elems->elems = grown;
+      }
+
+      bson_diff_elem_init(&elems->elems[elems->n_elems++], &iter);
+   }
+}
+
+
+static void
+bson_diff_elems_destroy (bson_diff_elems_t *elems)
+{
+   if (elems->elems != elems->stack) {
+      bson_free(elems->elems);
+   }
+
+   bson_free(elems->slots);
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_diff_hash_key (const char *key)
+{
+   bson_uint32_t h = 2166136261U;
+
+   for (; *key; key++) {
+      h = (h ^ (bson_uint8_t)*key) * 16777619U;
+   }
+
+   return h;
+}
+
+
+static void
+bson_diff_elems_build (bson_diff_elems_t *elems)
+{
+   bson_uint32_t n_slots = 8;
+   bson_uint32_t h;
+   bson_uint32_t i;
+   bson_uint32_t j;
+
+   while (n_slots < (elems->n_elems * 2)) {
+      n_slots <<= 1;
+   }
+
+   elems->slots = bson_malloc0(n_slots * sizeof *elems->slots);
+   elems->mask = n_slots - 1;
+
+   for (i = 0; i < elems->n_elems; i++) {
+      h = bson_diff_hash_key(elems->elems[i].key) & elems->mask;
+
+      for (; (j = elems->slots[h]); h = (h + 1) & elems->mask) {
+         if (!strcmp(elems->elems[j - 1].key, elems->elems[i].key)) {
+            elems->has_dups = TRUE;
+            break;
+         }
+      }
+
+      if (!j) {
+         elems->slots[h] = i + 1;
+      }
+   }
+}
+
+
+/*
+ * Patch entries are addressed by key, so they can only be produced for
+ * documents whose keys are unique.
+ */
+static bson_bool_t
+bson_diff_elems_unique (bson_diff_elems_t *elems)
+{
+   if (!elems->slots) {
+      bson_diff_elems_build(elems);
+   }
+
+   return !elems->has_dups;
+}
+
+
+static bson_bool_t
+bson_diff_elems_lookup (bson_diff_elems_t *elems,
+                        const char        *key,
+                        bson_uint32_t     *idx)
+{
+   bson_uint32_t h;
+   bson_uint32_t j;
+
+   if (!elems->slots) {
+      bson_diff_elems_build(elems);
+   }
+
+   h = bson_diff_hash_key(key) & elems->mask;
+
+   for (; (j = elems->slots[h]); h = (h + 1) & elems->mask) {
+      if (!strcmp(elems->elems[j - 1].key, key)) {
+         *idx = j - 1;
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+
+static bson_bool_t
+bson_diff_elems_is_array (const bson_diff_elems_t *elems)
+{
+   const char *key;
+   bson_uint32_t i;
+   char str[16];
+
+   for (i = 0; i < elems->n_elems; i++) {
+      bson_uint32_to_string(i, &key, str, sizeof str);
+      if (strcmp(key, elems->elems[i].key)) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/*
+ * Adds a "$diff" entry for the embedded document at @iter if its patch is
+ * smaller than the new document.
+ */
+static bson_bool_t
+bson_diff_child (bson_t                 *diff,
+                 const bson_diff_elem_t *old,
+                 const bson_iter_t      *iter)
+{
+   const bson_uint8_t *data = NULL;
+   bson_uint32_t len = 0;
+   bson_bool_t ret;
+   bson_t from;
+   bson_t to;
+   bson_t sub;
+
+   bson_iter_document(iter, &len, &data);
+
+   if (!bson_init_static(&from, old->value, old->value_len) ||
+       !bson_init_static(&to, data, len)) {
+      return FALSE;
+   }
+
+   bson_init(&sub);
+   ret = (bson_diff_doc(&from, &to, &sub) &&
+          (sub.len < len) &&
+          bson_append_document(diff, old->key, -1, &sub));
+   bson_destroy(&sub);
+
+   return ret;
+}
+
+
+/*
+ * Adds a "$splice" entry for the array at @iter replacing everything between
+ * the common prefix and the common suffix of both arrays, if that is smaller
+ * than the new array.
+ */
+static bson_bool_t
+bson_diff_splice (bson_t                 *splice,
+                  const bson_diff_elem_t *old,
+                  const bson_iter_t      *iter)
+{
+   const bson_uint8_t *data = NULL;
+   bson_diff_elems_t a;
+   bson_diff_elems_t b;
+   bson_uint32_t len = 0;
+   bson_uint32_t n;
+   bson_uint32_t p;
+   bson_uint32_t s;
+   bson_uint32_t i;
+   bson_iter_t child_iter;
+   bson_bool_t ret = FALSE;
+   const char *key;
+   bson_t from;
+   bson_t to;
+   bson_t op;
+   bson_t child;
+   char str[16];
+
+   bson_iter_array(iter, &len, &data);
+
+   if (!bson_init_static(&from, old->value, old->value_len) ||
+       !bson_init_static(&to, data, len)) {
+      return FALSE;
+   }
+
+   bson_diff_elems_init(&a, &from);
+   bson_diff_elems_init(&b, &to);
+
+   /*
+    * The patched array is renumbered, so arrays with unusual keys have to
+    * be set as a whole to come out byte for byte identical.
+    */
+   if (!bson_diff_elems_is_array(&a) || !bson_diff_elems_is_array(&b)) {
+      goto cleanup;
+   }
+
+   n = MIN(a.n_elems, b.n_elems);
+
+   for (p = 0; (p < n) && bson_diff_elem_equal(&a.elems[p], &b.elems[p]);
+        p++) {
+   }
+
+   for (s = 0;
+        (s < (n - p)) &&
+        bson_diff_elem_equal(&a.elems[a.n_elems - 1 - s],
+                             &b.elems[b.n_elems - 1 - s]);
+        s++) {
+   }
+
+   bson_init(&op);
+   bson_append_int32(&op, "p", 1, p);
+   bson_append_int32(&op, "d", 1, a.n_elems - p - s);
+   bson_append_array_begin(&op, "i", 1, &child);
+
+   if (bson_iter_init(&child_iter, &to)) {
+      for (i = 0; bson_iter_next(&child_iter) && (i < (b.n_elems - s)); i++) {
+         if (i >= p) {
+            bson_uint32_to_string(i - p, &key, str, sizeof str);
+            bson_append_iter(&child, key, -1, &child_iter);
+         }
+      }
+   }
+
+   bson_append_array_end(&op, &child);
+   ret = ((op.len < len) &&
+          bson_append_document(splice, old->key, -1, &op));
+   bson_destroy(&op);
+
+cleanup:
+   bson_diff_elems_destroy(&a);
+   bson_diff_elems_destroy(&b);
+
+   return ret;
+}
+
+
+/*
+ * Walks @to in order, pairing each field with the next field of @from of the
+ * same name. As long as that succeeds the fields are patched in place. The
+ * first field that is new or out of order, and every field after it, is
+ * unset (if present in @from) and set again at the end of the document.
+ *
+ * Returns FALSE if the difference cannot be expressed as a patch.
+ */
+static bson_bool_t
+bson_diff_doc (const bson_t *from,
+               const bson_t *to,
+               bson_t       *patch)
+{
+   bson_diff_elems_t elems;
+   bson_diff_elem_t *old;
+   bson_diff_elem_t cur;
+   bson_uint32_t next = 0;
+   bson_uint32_t idx = 0;
+   bson_uint32_t i;
+   bson_iter_t iter;
+   bson_bool_t appending = FALSE;
+   bson_bool_t ret = FALSE;
+   const char *key;
+   bson_t set;
+   bson_t unset;
+   bson_t diff;
+   bson_t splice;
+
+   bson_diff_elems_init(&elems, from);
+
+   bson_init(&set);
+   bson_init(&unset);
+   bson_init(&diff);
+   bson_init(&splice);
+
+   if (!bson_iter_init(&iter, to)) {
+      goto cleanup;
+   }
+
+   while (bson_iter_next(&iter)) {
+      key = bson_iter_key(&iter);
+
+      if (!appending) {
+         if ((next < elems.n_elems) && !strcmp(elems.elems[next].key, key)) {
+            idx = next;
+         } else if (!bson_diff_elems_lookup(&elems, key, &idx) ||
+                    (idx < next)) {
+            appending = TRUE;
+         }
+      }
+
+      if (appending) {
+         /*
+          * A field that is set at the end may not share its key with one
+          * that stays in place, or the two could not be told apart.
+          */
+         if (!bson_diff_elems_unique(&elems) ||
+             (bson_diff_elems_lookup(&elems, key, &idx) &&
+              elems.elems[idx].used)) {
+            goto cleanup;
+         }
+         bson_append_iter(&set, NULL, 0, &iter);
+         continue;
+      }
+
+      old = &elems.elems[idx];
+      old->used = TRUE;
+      next = idx + 1;
+
+      bson_diff_elem_init(&cur, &iter);
+
+      if (bson_diff_elem_equal(old, &cur)) {
+         continue;
+      }
+
+      if (!bson_diff_elems_unique(&elems)) {
+         goto cleanup;
+      }
+
+      if ((old->type == BSON_TYPE_DOCUMENT) &&
+          (cur.type == BSON_TYPE_DOCUMENT)) {
+         if (bson_diff_child(&diff, old, &iter)) {
+            continue;
+         }
+      } else if ((old->type == BSON_TYPE_ARRAY) &&
+                 (cur.type == BSON_TYPE_ARRAY)) {
+         if (bson_diff_splice(&splice, old, &iter)) {
+            continue;
+         }
+      }
+
+      bson_append_iter(&set, NULL, 0, &iter);
+   }
+
+   for (i = 0; i < elems.n_elems; i++) {
+      if (!elems.elems[i].used) {
+         if (!bson_diff_elems_unique(&elems)) {
+            goto cleanup;
+         }
+         bson_append_bool(&unset, elems.elems[i].key, -1, TRUE);
+      }
+   }
+
+   if (!bson_empty(&set)) {
+      bson_append_document(patch, "$set", 4, &set);
+   }
+
+   if (!bson_empty(&unset)) {
+      bson_append_document(patch, "$unset", 6, &unset);
+   }
+
+   if (!bson_empty(&diff)) {
+      bson_append_document(patch, "$diff", 5, &diff);
+   }
+
+   if (!bson_empty(&splice)) {
+      bson_append_document(patch, "$splice", 7, &splice);
+   }
+
+   ret = TRUE;
+
+cleanup:
+   bson_destroy(&set);
+   bson_destroy(&unset);
+   bson_destroy(&diff);
+   bson_destroy(&splice);
+   bson_diff_elems_destroy(&elems);
+
+   return ret;
+}
+
+
+void
+bson_diff (const bson_t *from,
+           const bson_t *to,
+           bson_t       *patch)
+{
+   bson_return_if_fail(from);
+   bson_return_if_fail(to);
+   bson_return_if_fail(patch);
+
+   bson_init(patch);
+
+   if (!bson_diff_doc(from, to, patch)) {
+      bson_append_document(patch, "$replace", 8, to);
+   }
+}
+
+
+static void
+bson_patch_cursor_init (bson_patch_cursor_t *cursor,
+                        const bson_iter_t   *iter)
+{
+   const bson_uint8_t *data = NULL;
+   bson_uint32_t len = 0;
+
+   bson_iter_document(iter, &len, &data);
+
+   cursor->more = (bson_init_static(&cursor->section, data, len) &&
+                   bson_iter_init(&cursor->iter, &cursor->section) &&
+                   bson_iter_next(&cursor->iter));
+}
+
+
+static BSON_INLINE bson_bool_t
+bson_patch_cursor_match (const bson_patch_cursor_t *cursor,
+                         const char                *key)
+{
+   return cursor->more && !strcmp(bson_iter_key(&cursor->iter), key);
+}
+
+
+static BSON_INLINE void
+bson_patch_cursor_next (bson_patch_cursor_t *cursor)
+{
+   cursor->more = bson_iter_next(&cursor->iter);
+}
+
+
+static bson_bool_t
+bson_patch_apply_child (bson_t            *result,
+                        const bson_iter_t *iter,
+                        const bson_iter_t *patch_iter)
+{
+   const bson_uint8_t *data = NULL;
+   bson_uint32_t len = 0;
+   bson_bool_t ret;
+   bson_t doc;
+   bson_t patch;
+   bson_t child;
+
+   if (!BSON_ITER_HOLDS_DOCUMENT(iter) ||
+       !BSON_ITER_HOLDS_DOCUMENT(patch_iter)) {
+      return FALSE;
+   }
+
+   bson_iter_document(iter, &len, &data);
+   if (!bson_init_static(&doc, data, len)) {
+      return FALSE;
+   }
+
+   bson_iter_document(patch_iter, &len, &data);
+   if (!bson_init_static(&patch, data, len)) {
+      return FALSE;
+   }
+
+   if (!bson_append_document_begin(result, bson_iter_key(iter), -1, &child)) {
+      return FALSE;
+   }
+
+   ret = bson_patch_apply_doc(&child, &doc, &patch);
+
+   return bson_append_document_end(result, &child) && ret;
+}
+
+
+static bson_bool_t
+bson_patch_apply_splice (bson_t            *result,
+                         const bson_iter_t *iter,
+                         const bson_iter_t *patch_iter)
+{
+   bson_int64_t pos = -1;
+   bson_int64_t n_deleted = -1;
+   bson_int64_t i;
+   bson_uint32_t n = 0;
+   bson_iter_t op;
+   bson_iter_t insert;
+   bson_iter_t child_iter;
+   bson_bool_t has_insert = FALSE;
+   bson_bool_t more;
+   bson_bool_t ret = TRUE;
+   const char *key;
+   bson_t child;
+   char str[16];
+
+   if (!BSON_ITER_HOLDS_ARRAY(iter) ||
+       !BSON_ITER_HOLDS_DOCUMENT(patch_iter) ||
+       !bson_iter_recurse(patch_iter, &op)) {
+      return FALSE;
+   }
+
+   while (bson_iter_next(&op)) {
+      key = bson_iter_key(&op);
+
+      if (!strcmp(key, "p") && BSON_ITER_HOLDS_INT32(&op)) {
+         pos = bson_iter_int32(&op);
+      } else if (!strcmp(key, "d") && BSON_ITER_HOLDS_INT32(&op)) {
+         n_deleted = bson_iter_int32(&op);
+      } else if (!strcmp(key, "i") && BSON_ITER_HOLDS_ARRAY(&op)) {
+         has_insert = bson_iter_recurse(&op, &insert);
+      } else {
+         return FALSE;
+      }
+   }
+
+   if ((pos < 0) || (n_deleted < 0) || !has_insert ||
+       !bson_iter_recurse(iter, &child_iter)) {
+      return FALSE;
+   }
+
+   if (!bson_append_array_begin(result, bson_iter_key(iter), -1, &child)) {
+      return FALSE;
+   }
+
+   for (i = 0; ; i++) {
+      more = bson_iter_next(&child_iter);
+
+      if (i == pos) {
+         while (ret && bson_iter_next(&insert)) {
+            bson_uint32_to_string(n++, &key, str, sizeof str);
+            ret = bson_append_iter(&child, key, -1, &insert);
+         }
+      }
+
+      if (!more || !ret) {
+         break;
+      }
+
+      if ((i < pos) || (i >= (pos + n_deleted))) {
+         bson_uint32_to_string(n++, &key, str, sizeof str);
+         ret = bson_append_iter(&child, key, -1, &child_iter);
+      }
+   }
+
+   /*
+    * The spliced range must lie within the original array.
+    */
+   ret = ret && ((pos + n_deleted) <= i);
+
+   return bson_append_array_end(result, &child) && ret;
+}
+
+
+static bson_bool_t
+bson_patch_apply_doc (bson_t       *result,
+                      const bson_t *doc,
+                      const bson_t *patch)
+{
+   bson_patch_cursor_t set;
+   bson_patch_cursor_t unset;
+   bson_patch_cursor_t diff;
+   bson_patch_cursor_t splice;
+   bson_iter_t iter;
+   bson_iter_t run;
+   bson_bool_t in_run = FALSE;
+   const char *key;
+
+   set.more = FALSE;
+   unset.more = FALSE;
+   diff.more = FALSE;
+   splice.more = FALSE;
+
+   if (!bson_iter_init(&iter, patch)) {
+      return FALSE;
+   }
+
+   while (bson_iter_next(&iter)) {
+      key = bson_iter_key(&iter);
+
+      if (!BSON_ITER_HOLDS_DOCUMENT(&iter)) {
+         return FALSE;
+      } else if (!strcmp(key, "$set")) {
+         bson_patch_cursor_init(&set, &iter);
+      } else if (!strcmp(key, "$unset")) {
+         bson_patch_cursor_init(&unset, &iter);
+      } else if (!strcmp(key, "$diff")) {
+         bson_patch_cursor_init(&diff, &iter);
+      } else if (!strcmp(key, "$splice")) {
+         bson_patch_cursor_init(&splice, &iter);
+      } else {
+         return FALSE;
+      }
+   }
+
+   /*
+    * Every section lists its entries in the order of @doc, so a single
+    * lockstep pass is enough. Whatever is left of "$set" at the end are new
+    * fields.
+    */
+   if (!bson_iter_init(&iter, doc)) {
+      return FALSE;
+   }
+
+   while (bson_iter_next(&iter)) {
+      key = bson_iter_key(&iter);
+
+      if (!bson_patch_cursor_match(&unset, key) &&
+          !bson_patch_cursor_match(&set, key) &&
+          !bson_patch_cursor_match(&diff, key) &&
+          !bson_patch_cursor_match(&splice, key)) {
+         if (!in_run) {
+            run = iter;
+            in_run = TRUE;
+         }
+         continue;
+      }
+
+      /*
+       * Unchanged fields are copied a run at a time.
+       */
+      if (in_run && !bson_append_iter_range(result, &run, &iter)) {
+         return FALSE;
+      }
+
+      in_run = FALSE;
+
+      if (bson_patch_cursor_match(&unset, key)) {
+         bson_patch_cursor_next(&unset);
+      } else if (bson_patch_cursor_match(&set, key)) {
+         if (!bson_append_iter(result, NULL, 0, &set.iter)) {
+            return FALSE;
+         }
+         bson_patch_cursor_next(&set);
+      } else if (bson_patch_cursor_match(&diff, key)) {
+         if (!bson_patch_apply_child(result, &iter, &diff.iter)) {
+            return FALSE;
+         }
+         bson_patch_cursor_next(&diff);
+      } else {
+         if (!bson_patch_apply_splice(result, &iter, &splice.iter)) {
+            return FALSE;
+         }
+         bson_patch_cursor_next(&splice);
+      }
+   }
+
+   if (in_run && !bson_append_iter_range(result, &run, NULL)) {
+      return FALSE;
+   }
+
+   if (unset.more || diff.more || splice.more) {
+      return FALSE;
+   }
+
+   for (; set.more; bson_patch_cursor_next(&set)) {
+      if (!bson_append_iter(result, NULL, 0, &set.iter)) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_patch_apply (const bson_t *doc,
+                  const bson_t *patch,
+                  bson_t       *result)
+{
+   const bson_uint8_t *data = NULL;
+   bson_uint32_t len = 0;
+   bson_iter_t iter;
+   bson_t replace;
+
+   bson_return_val_if_fail(doc, FALSE);
+   bson_return_val_if_fail(patch, FALSE);
+   bson_return_val_if_fail(result, FALSE);
+
+   bson_init(result);
+
+   if (bson_iter_init(&iter, patch) &&
+       bson_iter_next(&iter) &&
+       !strcmp(bson_iter_key(&iter), "$replace")) {
+      if (!BSON_ITER_HOLDS_DOCUMENT(&iter)) {
+         return FALSE;
+      }
+
+      bson_iter_document(&iter, &len, &data);
+
+      return (!bson_iter_next(&iter) &&
+              bson_init_static(&replace, data, len) &&
+              bson_concat(result, &replace));
+   }
+
+   return bson_patch_apply_doc(result, doc, patch);
+}
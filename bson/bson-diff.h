@@ -0,0 +1,91 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_DIFF_H
+#define BSON_DIFF_H
+
+
+#include "bson-macros.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_diff:
+ * @from: A bson_t.
+ * @to: A bson_t.
+ * @patch: (out): A location for the patch.
+ *
+ * Computes a patch that turns @from into @to when given to
+ * bson_patch_apply(). Both documents are walked in a single pass and only
+ * the fields that differ end up in the patch, which has the form:
+ *
+ *   { "$set": { key: value, ... },
+ *     "$unset": { key: true, ... },
+ *     "$diff": { key: patch, ... },
+ *     "$splice": { key: { "p": pos, "d": n_deleted, "i": [ value, ... ] } } }
+ *
+ * Sections without entries are left out, so identical documents produce an
+ * empty patch. "$diff" holds patches for embedded documents and "$splice"
+ * replaces a single range of an array; either is only used when it is
+ * smaller than setting the new value outright.
+ *
+ * Fields stay in place when they keep their relative order. Fields that are
+ * added, or that move ahead of fields they used to follow, are unset and
+ * set again at the end of the document. If @from contains duplicate keys
+ * the patch is { "$replace": @to }.
+ *
+ * @patch is initialized and should be freed with bson_destroy().
+ */
+void
+bson_diff (const bson_t *from,
+           const bson_t *to,
+           bson_t       *patch);
+
+
+/**
+ * bson_patch_apply:
+ * @doc: A bson_t.
+ * @patch: A patch created by bson_diff().
+ * @result: (out): A location for the patched document.
+ *
+ * Applies @patch to @doc, building the new document in @result in a single
+ * pass over @doc.
+ *
+ * @result is initialized in either case and should be freed with
+ * bson_destroy().
+ *
+ * Returns: TRUE if successful; FALSE if @patch is malformed or does not
+ *    apply to @doc.
+ */
+bson_bool_t
+bson_patch_apply (const bson_t *doc,
+                  const bson_t *patch,
+                  bson_t       *result);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_DIFF_H */
@@ -26,6 +26,18 @@
 BSON_BEGIN_DECLS
 
 
+/**
+ * bson_error_domain_t:
+ *
+ * The domains used for errors reported by libbson. Each domain defines its
+ * own set of error codes.
+ */
+typedef enum
+{
+   BSON_ERROR_SORTER = 1,
+} bson_error_domain_t;
+
+
 void
 bson_set_error (bson_error_t  *error,
                 bson_uint32_t  domain,
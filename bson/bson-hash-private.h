@@ -0,0 +1,59 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_HASH_PRIVATE_H
+#define BSON_HASH_PRIVATE_H
+
+
+#include "bson-macros.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * The hash consumes its input in stripes of 32 bytes, one 8-byte word per
+ * lane. A running hash only needs to keep the four lanes and the number of
+ * bytes consumed; the remaining tail is read from the document when the
+ * hash is finished.
+ */
+#define BSON_HASH_STRIPE 32
+
+
+void
+bson_hash_lanes_init (bson_uint64_t lanes[4],
+                      bson_uint64_t seed);
+
+
+void
+bson_hash_lanes_update (bson_uint64_t       lanes[4],
+                        const bson_uint8_t *data,
+                        size_t              length);
+
+
+bson_uint64_t
+bson_hash_lanes_finish (const bson_uint64_t  lanes[4],
+                        bson_uint64_t        seed,
+                        const bson_uint8_t  *tail,
+                        size_t               length);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_HASH_PRIVATE_H */
@@ -0,0 +1,278 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "bson.h"
+#include "bson-hash.h"
+#include "bson-hash-private.h"
+#include "bson-private.h"
+
+
+/*
+ * This is XXH64. It is fast on both short values and whole documents and its
+ * streaming form allows bson_t to keep a running hash while appending.
+ */
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+
+static BSON_INLINE bson_uint64_t
+bson_hash_rotl (bson_uint64_t v,
+                int           r)
+{
+   return (v << r) | (v >> (64 - r));
+}
+
+
+static BSON_INLINE bson_uint64_t
+bson_hash_read64 (const bson_uint8_t *data)
+{
+   bson_uint64_t v;
+
+   memcpy(&v, data, 8);
+   return BSON_UINT64_FROM_LE(v);
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_hash_read32 (const bson_uint8_t *data)
+{
+   bson_uint32_t v;
+
+   memcpy(&v, data, 4);
+   return BSON_UINT32_FROM_LE(v);
+}
+
+
+static BSON_INLINE bson_uint64_t
+bson_hash_round (bson_uint64_t acc,
+                 bson_uint64_t input)
+{
+   acc += input * PRIME64_2;
+   acc = bson_hash_rotl(acc, 31);
+   return acc * PRIME64_1;
+}
+
+
+static BSON_INLINE bson_uint64_t
+bson_hash_merge_round (bson_uint64_t acc,
+                       bson_uint64_t lane)
+{
+   acc ^= bson_hash_round(0, lane);
+   return (acc * PRIME64_1) + PRIME64_4;
+}
+
+
+void
+bson_hash_lanes_init (bson_uint64_t lanes[4],
+                      bson_uint64_t seed)
+{
+   lanes[0] = seed + PRIME64_1 + PRIME64_2;
+   lanes[1] = seed + PRIME64_2;
+   lanes[2] = seed;
+   lanes[3] = seed - PRIME64_1;
+}
+
+
+void
+bson_hash_lanes_update (bson_uint64_t       lanes[4],
+                        const bson_uint8_t *data,
+                        size_t              length)
+{
+   const bson_uint8_t *end = data + length;
+   bson_uint64_t v1 = lanes[0];
+   bson_uint64_t v2 = lanes[1];
+   bson_uint64_t v3 = lanes[2];
+   bson_uint64_t v4 = lanes[3];
+
+   BSON_ASSERT(!(length % BSON_HASH_STRIPE));
+
+   for (; data < end; data += BSON_HASH_STRIPE) {
+      v1 = bson_hash_round(v1, bson_hash_read64(data));
+      v2 = bson_hash_round(v2, bson_hash_read64(data + 8));
+      v3 = bson_hash_round(v3, bson_hash_read64(data + 16));
+      v4 = bson_hash_round(v4, bson_hash_read64(data + 24));
+   }
+
+   lanes[0] = v1;
+   lanes[1] = v2;
+   lanes[2] = v3;
+   lanes[3] = v4;
+}
+
+
+bson_uint64_t
+bson_hash_lanes_finish (const bson_uint64_t  lanes[4],
+                        bson_uint64_t        seed,
+                        const bson_uint8_t  *tail,
+                        size_t               length)
+{
+   bson_uint64_t h;
+   size_t n = length % BSON_HASH_STRIPE;
+
+   if (length >= BSON_HASH_STRIPE) {
+      h = (bson_hash_rotl(lanes[0], 1) +
+           bson_hash_rotl(lanes[1], 7) +
+           bson_hash_rotl(lanes[2], 12) +
+           bson_hash_rotl(lanes[3], 18));
+      h = bson_hash_merge_round(h, lanes[0]);
+      h = bson_hash_merge_round(h, lanes[1]);
+      h = bson_hash_merge_round(h, lanes[2]);
+      h = bson_hash_merge_round(h, lanes[3]);
+   } else {
+      h = seed + PRIME64_5;
+   }
+
+   h += length;
+
+   for (; n >= 8; n -= 8, tail += 8) {
+      h ^= bson_hash_round(0, bson_hash_read64(tail));
+      h = (bson_hash_rotl(h, 27) * PRIME64_1) + PRIME64_4;
+   }
+
+   if (n >= 4) {
+      h ^= (bson_uint64_t)bson_hash_read32(tail) * PRIME64_1;
+      h = (bson_hash_rotl(h, 23) * PRIME64_2) + PRIME64_3;
+      n -= 4;
+      tail += 4;
+   }
+
+   for (; n; n--, tail++) {
+      h ^= (*tail) * PRIME64_5;
+      h = bson_hash_rotl(h, 11) * PRIME64_1;
+   }
+
+   h ^= h >> 33;
+   h *= PRIME64_2;
+   h ^= h >> 29;
+   h *= PRIME64_3;
+   h ^= h >> 32;
+
+   return h;
+}
+
+
+bson_uint64_t
+bson_hash_data (const void    *data,
+                size_t         length,
+                bson_uint64_t  seed)
+{
+   bson_uint64_t lanes[4];
+   size_t stripes;
+
+   bson_return_val_if_fail(data || !length, 0);
+
+   stripes = length - (length % BSON_HASH_STRIPE);
+
+   bson_hash_lanes_init(lanes, seed);
+   bson_hash_lanes_update(lanes, data, stripes);
+
+   return bson_hash_lanes_finish(lanes, seed,
+                                 (const bson_uint8_t *)data + stripes,
+                                 length);
+}
+
+
+bson_uint64_t
+bson_hash (const bson_t *bson)
+{
+   const bson_impl_alloc_t *impl = (const bson_impl_alloc_t *)bson;
+   const bson_uint8_t *data;
+   bson_uint64_t lanes[4];
+   bson_uint32_t done = 0;
+   bson_uint32_t len;
+   bson_uint32_t stripes;
+
+   bson_return_val_if_fail(bson, 0);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_IN_CHILD), 0);
+
+   /*
+    * Only the elements are hashed, skipping the length prefix and the
+    * trailing nul byte.
+    */
+   data = bson_get_data(bson) + 4;
+   len = bson->len - 5;
+
+   if ((bson->flags & BSON_FLAG_HASHED) && (impl->hash_len <= len)) {
+      memcpy(lanes, impl->hash, sizeof lanes);
+      done = impl->hash_len;
+   } else {
+      bson_hash_lanes_init(lanes, 0);
+   }
+
+   stripes = (len - done) - ((len - done) % BSON_HASH_STRIPE);
+   bson_hash_lanes_update(lanes, data + done, stripes);
+   done += stripes;
+
+   return bson_hash_lanes_finish(lanes, 0, data + done, len);
+}
+
+
+bson_uint64_t
+bson_iter_hash (const bson_iter_t *iter)
+{
+   const bson_uint8_t *value;
+   size_t len;
+
+   bson_return_val_if_fail(iter, 0);
+   bson_return_val_if_fail(iter->type, 0);
+
+   /*
+    * data1 is NULL for null, undefined, minkey and maxkey, which hash as an
+    * empty value seeded with their type.
+    */
+   value = iter->key + strlen((const char *)iter->key) + 1;
+   len = iter->next_offset - iter->offset - (value - iter->type);
+
+   return bson_hash_data(value, len, *iter->type);
+}
+
+
+void
+bson_init_hashed (bson_t *bson)
+{
+   bson_impl_alloc_t *impl = (bson_impl_alloc_t *)bson;
+
+   bson_return_if_fail(bson);
+
+   /*
+    * The running hash does not fit beside the inline buffer, so hashed
+    * documents always start out with an allocated buffer.
+    */
+   impl->flags = BSON_FLAG_STATIC | BSON_FLAG_HASHED;
+   impl->len = 5;
+   impl->parent = NULL;
+   impl->depth = 0;
+   impl->buf = &impl->alloc;
+   impl->buflen = &impl->alloclen;
+   impl->offset = 0;
+   impl->alloclen = 128;
+   impl->alloc = bson_malloc(impl->alloclen);
+   impl->alloc[0] = 5;
+   impl->alloc[1] = 0;
+   impl->alloc[2] = 0;
+   impl->alloc[3] = 0;
+   impl->alloc[4] = 0;
+   impl->realloc = bson_realloc;
+
+   bson_hash_lanes_init(impl->hash, 0);
+   impl->hash_len = 0;
+}
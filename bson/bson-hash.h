@@ -0,0 +1,97 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_HASH_H
+#define BSON_HASH_H
+
+
+#include "bson-macros.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_hash_data:
+ * @data: The bytes to hash.
+ * @length: The number of bytes in @data.
+ * @seed: A seed for the hash.
+ *
+ * Computes a fast, non-cryptographic, 64-bit hash of @data. The result is
+ * the same as XXH64(@data, @length, @seed).
+ *
+ * Returns: A 64-bit hash.
+ */
+bson_uint64_t
+bson_hash_data (const void    *data,
+                size_t         length,
+                bson_uint64_t  seed);
+
+
+/**
+ * bson_hash:
+ * @bson: A bson_t.
+ *
+ * Computes a 64-bit hash of the elements of @bson. Two documents with the
+ * same fields, values and field order always hash the same.
+ *
+ * If @bson was initialized with bson_init_hashed(), most of the hash has
+ * already been computed while fields were appended and only the last few
+ * bytes are hashed.
+ *
+ * Returns: A 64-bit hash.
+ */
+bson_uint64_t
+bson_hash (const bson_t *bson);
+
+
+/**
+ * bson_iter_hash:
+ * @iter: A bson_iter_t.
+ *
+ * Computes a 64-bit hash of the value the iter currently observes. The type
+ * of the value is part of the hash, so an int32 and an int64 holding the
+ * same number hash differently. The key is not part of the hash.
+ *
+ * Returns: A 64-bit hash.
+ */
+bson_uint64_t
+bson_iter_hash (const bson_iter_t *iter);
+
+
+/**
+ * bson_init_hashed:
+ * @bson: A bson_t.
+ *
+ * Initializes @bson like bson_init() but keeps a running hash of the
+ * document as fields are appended, so that bson_hash() costs next to
+ * nothing on a freshly built document.
+ */
+void
+bson_init_hashed (bson_t *bson);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_HASH_H */
@@ -16,6 +16,7 @@
 
 
 #include "bson-iter.h"
+#include "bson-private.h"
 
 
 bson_bool_t
@@ -32,6 +33,7 @@ bson_iter_init (bson_iter_t  *iter,
    memset(iter, 0, sizeof *iter);
 
    iter->bson = bson;
+   iter->root = bson;
    iter->offset = 0;
    iter->next_offset = 4;
 
@@ -72,6 +74,11 @@ bson_iter_recurse (const bson_iter_t *iter,
    }
 
    child->bson = &child->inl_bson;
+   child->root = iter->root;
+
+   if ((iter->bson->flags & BSON_FLAG_VALID)) {
+      child->inl_bson.flags |= BSON_FLAG_VALID;
+   }
 
    return TRUE;
 }
@@ -205,6 +212,117 @@ bson_iter_type (const bson_iter_t *iter)
 }
 
 
+/*
+ * bson_iter_next_valid:
+ *
+ * bson_iter_next() for documents marked with bson_mark_validated(). The
+ * element layout is trusted, so each element costs a strlen() of the key
+ * and a switch on its type.
+ */
+static BSON_INLINE bson_bool_t
+bson_iter_next_valid (bson_iter_t  *iter,
+                      const bson_t *b)
+{
+   const bson_impl_alloc_t *impl = (const bson_impl_alloc_t *)b;
+   const bson_uint8_t *data;
+   bson_uint32_t l;
+   size_t o;
+
+   /* bson_get_data() without the precondition check. */
+   if ((b->flags & BSON_FLAG_INLINE)) {
+      data = ((const bson_impl_inline_t *)b)->data;
+   } else {
+      data = *impl->buf + impl->offset;
+   }
+
+   iter->offset = iter->next_offset;
+
+   if (BSON_UNLIKELY((iter->offset + 1) >= b->len)) {
+      iter->bson = NULL;
+      return FALSE;
+   }
+
+   iter->type = &data[iter->offset];
+   iter->key = &data[iter->offset + 1];
+   o = iter->offset + 2 + strlen((const char *)iter->key);
+   iter->data1 = &data[o];
+   iter->data2 = NULL;
+   iter->data3 = NULL;
+   iter->data4 = NULL;
+
+   switch (*iter->type) {
+   case BSON_TYPE_DATE_TIME:
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_TIMESTAMP:
+      iter->next_offset = o + 8;
+      break;
+   case BSON_TYPE_INT32:
+      iter->next_offset = o + 4;
+      break;
+   case BSON_TYPE_BOOL:
+      iter->next_offset = o + 1;
+      break;
+   case BSON_TYPE_OID:
+      iter->next_offset = o + 12;
+      break;
+   case BSON_TYPE_CODE:
+   case BSON_TYPE_SYMBOL:
+   case BSON_TYPE_UTF8:
+      memcpy(&l, iter->data1, 4);
+      iter->data2 = &data[o + 4];
+      iter->next_offset = o + 4 + BSON_UINT32_FROM_LE(l);
+      break;
+   case BSON_TYPE_ARRAY:
+   case BSON_TYPE_DOCUMENT:
+      memcpy(&l, iter->data1, 4);
+      iter->next_offset = o + BSON_UINT32_FROM_LE(l);
+      break;
+   case BSON_TYPE_BINARY:
+      memcpy(&l, iter->data1, 4);
+      iter->data2 = &data[o + 4];
+      iter->data3 = &data[o + 5];
+      iter->next_offset = o + 5 + BSON_UINT32_FROM_LE(l);
+      break;
+   case BSON_TYPE_REGEX:
+      iter->data2 = &data[o + strlen((const char *)iter->data1) + 1];
+      iter->next_offset = (iter->data2 - data) +
+                          strlen((const char *)iter->data2) + 1;
+      break;
+   case BSON_TYPE_DBPOINTER:
+      memcpy(&l, iter->data1, 4);
+      l = BSON_UINT32_FROM_LE(l);
+      iter->data2 = &data[o + 4];
+      iter->data3 = &data[o + 4 + l];
+      iter->next_offset = o + 4 + l + 12;
+      break;
+   case BSON_TYPE_CODEWSCOPE:
+      memcpy(&l, iter->data1, 4);
+      iter->next_offset = o + BSON_UINT32_FROM_LE(l);
+      iter->data2 = &data[o + 4];
+      iter->data3 = &data[o + 8];
+      memcpy(&l, iter->data2, 4);
+      iter->data4 = &data[o + 8 + BSON_UINT32_FROM_LE(l)];
+      break;
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_UNDEFINED:
+      iter->data1 = NULL;
+      iter->next_offset = o;
+      break;
+   case BSON_TYPE_EOD:
+   default:
+      /* Not reachable for a document that really is valid. */
+      iter->err_offset = o;
+      iter->bson = NULL;
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+
 bson_bool_t
 bson_iter_next (bson_iter_t *iter)
 {
@@ -219,6 +337,11 @@ bson_iter_next (bson_iter_t *iter)
    }
 
    b = iter->bson;
+
+   if ((b->flags & BSON_FLAG_VALID)) {
+      return bson_iter_next_valid(iter, b);
+   }
+
    data = bson_get_data(b);
 
    iter->offset = iter->next_offset;
@@ -873,6 +996,7 @@ bson_iter_visit_all (bson_iter_t          *iter,
                      const bson_visitor_t *visitor,
                      void                 *data)
 {
+   bson_flags_t valid;
    const char *key;
 
    bson_return_val_if_fail(iter, FALSE);
@@ -881,6 +1005,14 @@ bson_iter_visit_all (bson_iter_t          *iter,
 #define VISIT_FIELD(name) \
    visitor->visit_##name && visitor->visit_##name
 
+   /*
+    * The element was bounds checked by bson_iter_next() and its type is
+    * known from the switch below, so the values are read with the unsafe
+    * accessors. Embedded documents inherit the mark of
+    * bson_mark_validated() from their parent.
+    */
+   valid = iter->bson ? (iter->bson->flags & BSON_FLAG_VALID) : 0;
+
    while (bson_iter_next(iter)) {
       key = bson_iter_key_unsafe(iter);
 
@@ -888,9 +1020,10 @@ bson_iter_visit_all (bson_iter_t          *iter,
          return TRUE;
       }
 
-      switch (bson_iter_type(iter)) {
+      switch (bson_iter_type_unsafe(iter)) {
       case BSON_TYPE_DOUBLE:
-         if (VISIT_FIELD(double)(iter, key, bson_iter_double(iter), data)) {
+         if (VISIT_FIELD(double)(iter, key, bson_iter_double_unsafe(iter),
+                                 data)) {
             return TRUE;
          }
          break;
@@ -898,7 +1031,7 @@ bson_iter_visit_all (bson_iter_t          *iter,
          {
             bson_uint32_t utf8_len;
             const char *utf8;
-            utf8 = bson_iter_utf8(iter, &utf8_len);
+            utf8 = bson_iter_utf8_unsafe(iter, &utf8_len);
             if (VISIT_FIELD(utf8)(iter, key, utf8_len, utf8, data)) {
                return TRUE;
             }
@@ -911,9 +1044,11 @@ bson_iter_visit_all (bson_iter_t          *iter,
             bson_t b;
 
             bson_iter_document(iter, &doclen, &docbuf);
-            if (bson_init_static(&b, docbuf, doclen) &&
-                VISIT_FIELD(document)(iter, key, &b, data)) {
-               return TRUE;
+            if (bson_init_static(&b, docbuf, doclen)) {
+               b.flags |= valid;
+               if (VISIT_FIELD(document)(iter, key, &b, data)) {
+                  return TRUE;
+               }
             }
          }
          break;
@@ -924,9 +1059,11 @@ bson_iter_visit_all (bson_iter_t          *iter,
             bson_t b;
 
             bson_iter_array(iter, &doclen, &docbuf);
-            if (bson_init_static(&b, docbuf, doclen)
-                && VISIT_FIELD(array)(iter, key, &b, data)) {
-               return TRUE;
+            if (bson_init_static(&b, docbuf, doclen)) {
+               b.flags |= valid;
+               if (VISIT_FIELD(array)(iter, key, &b, data)) {
+                  return TRUE;
+               }
             }
          }
          break;
@@ -949,18 +1086,18 @@ bson_iter_visit_all (bson_iter_t          *iter,
          }
          break;
       case BSON_TYPE_OID:
-         if (VISIT_FIELD(oid)(iter, key, bson_iter_oid(iter), data)) {
+         if (VISIT_FIELD(oid)(iter, key, bson_iter_oid_unsafe(iter), data)) {
             return TRUE;
          }
          break;
       case BSON_TYPE_BOOL:
-         if (VISIT_FIELD(bool)(iter, key, bson_iter_bool(iter), data)) {
+         if (VISIT_FIELD(bool)(iter, key, bson_iter_bool_unsafe(iter), data)) {
             return TRUE;
          }
          break;
       case BSON_TYPE_DATE_TIME:
          if (VISIT_FIELD(date_time)(iter, key,
-                                    bson_iter_date_time(iter), data)) {
+                                    bson_iter_int64_unsafe(iter), data)) {
             return TRUE;
          }
          break;
@@ -1030,7 +1167,7 @@ bson_iter_visit_all (bson_iter_t          *iter,
          }
          break;
       case BSON_TYPE_INT32:
-         if (VISIT_FIELD(int32)(iter, key, bson_iter_int32(iter), data)) {
+         if (VISIT_FIELD(int32)(iter, key, bson_iter_int32_unsafe(iter), data)) {
             return TRUE;
          }
          break;
@@ -1045,7 +1182,7 @@ bson_iter_visit_all (bson_iter_t          *iter,
          }
          break;
       case BSON_TYPE_INT64:
-         if (VISIT_FIELD(int64)(iter, key, bson_iter_int64(iter), data)) {
+         if (VISIT_FIELD(int64)(iter, key, bson_iter_int64_unsafe(iter), data)) {
             return TRUE;
          }
          break;
@@ -1081,6 +1218,23 @@ bson_iter_visit_all (bson_iter_t          *iter,
 }
 
 
+/*
+ * bson_iter_overwritten:
+ *
+ * Restarts the running hash of a document built with bson_init_hashed()
+ * if the value just overwritten at the iter was already folded into it.
+ */
+static void
+bson_iter_overwritten (const bson_iter_t *iter)
+{
+   bson_t *root = (bson_t *)iter->root;
+
+   if (root && (root->flags & BSON_FLAG_HASHED)) {
+      bson_hash_rewind(root, iter->data1 - (bson_get_data(root) + 4));
+   }
+}
+
+
 void
 bson_iter_overwrite_bool (bson_iter_t *iter,
                           bson_bool_t  value)
@@ -1090,6 +1244,7 @@ bson_iter_overwrite_bool (bson_iter_t *iter,
 
    if (*iter->type == BSON_TYPE_BOOL) {
       memcpy((void *)iter->data1, &value, 1);
+      bson_iter_overwritten(iter);
    }
 }
 
@@ -1105,6 +1260,7 @@ bson_iter_overwrite_int32 (bson_iter_t  *iter,
       value = BSON_UINT32_TO_LE(value);
 #endif
       memcpy((void *)iter->data1, &value, 4);
+      bson_iter_overwritten(iter);
    }
 }
 
@@ -1120,6 +1276,7 @@ bson_iter_overwrite_int64 (bson_iter_t  *iter,
       value = BSON_UINT64_TO_LE(value);
 #endif
       memcpy((void *)iter->data1, &value, 8);
+      bson_iter_overwritten(iter);
    }
 }
 
@@ -1133,5 +1290,6 @@ bson_iter_overwrite_double (bson_iter_t *iter,
    if (*iter->type == BSON_TYPE_DOUBLE) {
       value = BSON_DOUBLE_TO_LE(value);
       memcpy((void *)iter->data1, &value, 8);
+      bson_iter_overwritten(iter);
    }
 }
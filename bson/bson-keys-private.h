@@ -0,0 +1,46 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_KEYS_PRIVATE_H
+#define BSON_KEYS_PRIVATE_H
+
+
+#include "bson-keys.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * Room for the ten digits of the largest bson_uint32_t and a nul byte.
+ */
+#define BSON_UINT32_DIGITS_MAX 11
+
+
+/*
+ * Writes @value in decimal to @str, which must have room for
+ * BSON_UINT32_DIGITS_MAX bytes, and returns the number of digits written.
+ */
+size_t
+bson_uint32_to_digits (bson_uint32_t  value,
+                       char          *str);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_KEYS_PRIVATE_H */
@@ -15,9 +15,10 @@
  */
 
 
-#include <stdio.h>
+#include <string.h>
 
 #include "bson-keys.h"
+#include "bson-keys-private.h"
 
 
 static const char * gUint32Strs[] = {
@@ -123,6 +124,55 @@ static const char * gUint32Strs[] = {
 };
 
 
+/*
+ * The two digit strings "00" through "99", so that numbers can be converted
+ * two digits at a time.
+ */
+static const char gDigitPairs[] =
+   "00010203040506070809"
+   "10111213141516171819"
+   "20212223242526272829"
+   "30313233343536373839"
+   "40414243444546474849"
+   "50515253545556575859"
+   "60616263646566676869"
+   "70717273747576777879"
+   "80818283848586878889"
+   "90919293949596979899";
+
+
+size_t
+bson_uint32_to_digits (bson_uint32_t  value,
+                       char          *str)
+{
+   char buf[10];
+   char *p = buf + sizeof buf;
+   bson_uint32_t i;
+   size_t len;
+
+   while (value >= 100) {
+      i = (value % 100) * 2;
+      value /= 100;
+      *--p = gDigitPairs[i + 1];
+      *--p = gDigitPairs[i];
+   }
+
+   if (value >= 10) {
+      i = value * 2;
+      *--p = gDigitPairs[i + 1];
+      *--p = gDigitPairs[i];
+   } else {
+      *--p = '0' + value;
+   }
+
+   len = (buf + sizeof buf) - p;
+   memcpy(str, p, len);
+   str[len] = '\0';
+
+   return len;
+}
+
+
 void
 bson_uint32_to_string (bson_uint32_t   value,
                        const char    **strptr,
@@ -132,8 +182,21 @@ bson_uint32_to_string (bson_uint32_t   value,
    if (value <= 1000) {
       *strptr = gUint32Strs[value];
       return;
+   } else if (size >= BSON_UINT32_DIGITS_MAX) {
+      bson_uint32_to_digits(value, str);
+      *strptr = str;
    } else {
-      snprintf(str, size, "%u", value);
+      char buf[BSON_UINT32_DIGITS_MAX];
+      size_t len;
+
+      len = bson_uint32_to_digits(value, buf);
+
+      if (size) {
+         len = MIN(len, size - 1);
+         memcpy(str, buf, len);
+         str[len] = '\0';
+      }
+
       *strptr = str;
    }
 }
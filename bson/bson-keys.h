@@ -30,7 +30,7 @@ BSON_BEGIN_DECLS
  * bson_uint32_to_string:
  * @value: A bson_uint32_t to convert to string.
  * @strptr: (out): A pointer to the resulting string.
- * @str: (out): Storage for a string made with snprintf.
+ * @str: (out): Storage for the string if it is not a constant.
  * @size: Size of @str.
  *
  * Converts @value to a string.
@@ -38,8 +38,8 @@ BSON_BEGIN_DECLS
  * If @value is from 0 to 1000, it will use a constant string in the data
  * section of the library.
  *
- * If not, a string will be formatted using @str and snprintf(). This is much
- * slower, of course and therefore we try to optimize it out.
+ * If not, the digits are written to @str two at a time. Like snprintf(),
+ * the result is truncated if @size is less than 11 bytes.
  *
  * @strptr will always be set. It will either point to @str or a constant
  * string. You will want to use this as your key.
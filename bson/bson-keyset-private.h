@@ -0,0 +1,38 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BSON_KEYSET_PRIVATE_H
+#define BSON_KEYSET_PRIVATE_H
+
+
+#include <stdarg.h>
+
+#include "bson-keyset.h"
+
+
+BSON_BEGIN_DECLS
+
+
+bson_keyset_t *
+bson_keyset_new_va (const char *first_key,
+                    va_list     args);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_KEYSET_PRIVATE_H */
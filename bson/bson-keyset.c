@@ -0,0 +1,226 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "bson.h"
+#include "bson-keyset.h"
+#include "bson-keyset-private.h"
+
+
+typedef struct
+{
+   const char    *key;
+   bson_uint32_t  key_length;
+   bson_uint32_t  hash;
+} bson_keyset_slot_t;
+
+
+struct _bson_keyset_t
+{
+   bson_keyset_slot_t *slots;
+   bson_uint32_t       mask;
+   size_t              count;
+   bson_uint64_t       lengths;
+   char               *strings;
+};
+
+
+/*
+ * Bit n of the length mask is set if the set holds a key of length n. All
+ * keys of 63 bytes or more share the last bit.
+ */
+static BSON_INLINE bson_uint64_t
+bson_keyset_length_bit (size_t key_length)
+{
+   return 1ULL << MIN(key_length, 63);
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_keyset_hash (const char *key,
+                  size_t      key_length)
+{
+   return (bson_uint32_t)bson_hash_data(key, key_length, 0);
+}
+
+
+bson_keyset_t *
+bson_keyset_new_from_array (const char *const *keys,
+                            size_t             n_keys)
+{
+   bson_keyset_slot_t *slot;
+   bson_keyset_t *keyset;
+   bson_uint32_t n_slots = 8;
+   bson_uint32_t hash;
+   size_t key_length;
+   size_t n_bytes = 0;
+   size_t i;
+   bson_uint32_t j;
+   char *str;
+
+   bson_return_val_if_fail(keys || !n_keys, NULL);
+
+   for (i = 0; i < n_keys; i++) {
+      bson_return_val_if_fail(keys[i], NULL);
+      n_bytes += strlen(keys[i]) + 1;
+   }
+
+   while (n_slots < (n_keys * 2)) {
+      n_slots <<= 1;
+   }
+
+   keyset = bson_malloc0(sizeof *keyset);
+   keyset->slots = bson_malloc0(n_slots * sizeof *keyset->slots);
+   keyset->mask = n_slots - 1;
+   keyset->strings = str = bson_malloc(n_bytes + 1);
+
+   for (i = 0; i < n_keys; i++) {
+      key_length = strlen(keys[i]);
+      hash = bson_keyset_hash(keys[i], key_length);
+
+      for (j = hash & keyset->mask; ; j = (j + 1) & keyset->mask) {
+         slot = &keyset->slots[j];
+
+         if (!slot->key ||
+             ((slot->hash == hash) &&
+              (slot->key_length == key_length) &&
+              !memcmp(slot->key, keys[i], key_length))) {
+            break;
+         }
+      }
+
+      if (!slot->key) {
+         memcpy(str, keys[i], key_length + 1);
+         slot->key = str;
+         slot->key_length = (bson_uint32_t)key_length;
+         slot->hash = hash;
+         str += key_length + 1;
+
+         keyset->lengths |= bson_keyset_length_bit(key_length);
+         keyset->count++;
+      }
+   }
+
+   return keyset;
+}
+
+
+bson_keyset_t *
+bson_keyset_new_va (const char *first_key,
+                    va_list     args)
+{
+   bson_keyset_t *keyset;
+   const char **keys;
+   const char *key;
+   va_list args_copy;
+   size_t n_keys = 0;
+
+   va_copy(args_copy, args);
+   for (key = first_key; key; key = va_arg(args_copy, const char *)) {
+      n_keys++;
+   }
+   va_end(args_copy);
+
+   keys = bson_malloc((n_keys + 1) * sizeof *keys);
+
+   n_keys = 0;
+   va_copy(args_copy, args);
+   for (key = first_key; key; key = va_arg(args_copy, const char *)) {
+      keys[n_keys++] = key;
+   }
+   va_end(args_copy);
+
+   keyset = bson_keyset_new_from_array(keys, n_keys);
+
+   bson_free(keys);
+
+   return keyset;
+}
+
+
+bson_keyset_t *
+bson_keyset_new (const char *first_key,
+                 ...)
+{
+   bson_keyset_t *keyset;
+   va_list args;
+
+   va_start(args, first_key);
+   keyset = bson_keyset_new_va(first_key, args);
+   va_end(args);
+
+   return keyset;
+}
+
+
+void
+bson_keyset_destroy (bson_keyset_t *keyset)
+{
+   if (keyset) {
+      bson_free(keyset->slots);
+      bson_free(keyset->strings);
+      bson_free(keyset);
+   }
+}
+
+
+bson_bool_t
+bson_keyset_contains (const bson_keyset_t *keyset,
+                      const char          *key,
+                      int                  key_length)
+{
+   const bson_keyset_slot_t *slot;
+   bson_uint32_t hash;
+   bson_uint32_t i;
+
+   bson_return_val_if_fail(keyset, FALSE);
+   bson_return_val_if_fail(key, FALSE);
+
+   if (key_length < 0) {
+      key_length = (int)strlen(key);
+   }
+
+   if (!(keyset->lengths & bson_keyset_length_bit(key_length))) {
+      return FALSE;
+   }
+
+   hash = bson_keyset_hash(key, key_length);
+
+   for (i = hash & keyset->mask; ; i = (i + 1) & keyset->mask) {
+      slot = &keyset->slots[i];
+
+      if (!slot->key) {
+         return FALSE;
+      }
+
+      if ((slot->hash == hash) &&
+          (slot->key_length == (bson_uint32_t)key_length) &&
+          !memcmp(slot->key, key, key_length)) {
+         return TRUE;
+      }
+   }
+}
+
+
+size_t
+bson_keyset_count (const bson_keyset_t *keyset)
+{
+   bson_return_val_if_fail(keyset, 0);
+
+   return keyset->count;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_KEYSET_H
+#define BSON_KEYSET_H
+
+
+#include "bson-macros.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_keyset_t:
+ *
+ * An immutable set of field names, compiled once so that it can be checked
+ * against every field of many documents. Keys are stored with their lengths
+ * in an open-addressing hash table, and a mask of the key lengths present
+ * rejects most non-members before anything is hashed.
+ *
+ * See bson_copy_to_including_keyset() and bson_copy_to_excluding_keyset().
+ */
+typedef struct _bson_keyset_t bson_keyset_t;
+
+
+/**
+ * bson_keyset_new:
+ * @first_key: The first key.
+ *
+ * Creates a new bson_keyset_t from a NULL terminated list of keys.
+ * Duplicate keys are ignored.
+ *
+ * Returns: A newly allocated bson_keyset_t that should be freed with
+ *    bson_keyset_destroy().
+ */
+bson_keyset_t *
+bson_keyset_new (const char *first_key,
+                 ...) BSON_GNUC_NULL_TERMINATED;
+
+
+/**
+ * bson_keyset_new_from_array:
+ * @keys: An array of @n_keys keys.
+ * @n_keys: The number of elements in @keys.
+ *
+ * Like bson_keyset_new() but takes the keys from an array.
+ *
+ * Returns: A newly allocated bson_keyset_t that should be freed with
+ *    bson_keyset_destroy().
+ */
+bson_keyset_t *
+bson_keyset_new_from_array (const char *const *keys,
+                            size_t             n_keys);
+
+
+/**
+ * bson_keyset_destroy:
+ * @keyset: A bson_keyset_t.
+ *
+ * Frees @keyset.
+ */
+void
+bson_keyset_destroy (bson_keyset_t *keyset);
+
+
+/**
+ * bson_keyset_contains:
+ * @keyset: A bson_keyset_t.
+ * @key: The key to check for.
+ * @key_length: The length of @key or -1 to use strlen().
+ *
+ * Returns: TRUE if @key is in @keyset.
+ */
+bson_bool_t
+bson_keyset_contains (const bson_keyset_t *keyset,
+                      const char          *key,
+                      int                  key_length);
+
+
+/**
+ * bson_keyset_count:
+ * @keyset: A bson_keyset_t.
+ *
+ * Returns: The number of distinct keys in @keyset.
+ */
+size_t
+bson_keyset_count (const bson_keyset_t *keyset);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_KEYSET_H */
@@ -0,0 +1,611 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "bson.h"
+#include "bson-message.h"
+#include "bson-writer-private.h"
+
+
+struct _bson_message_t
+{
+   bson_message_opcode_t  opcode;
+   bson_uint32_t          request_id;
+   size_t                 max_message_size;
+   bson_uint32_t          max_batch_size;
+
+   /*
+    * Everything in a frame before its first document: the header, the
+    * flags and the collection name for OP_INSERT, or the flags, the body
+    * section and the start of the document sequence section for OP_MSG.
+    * The lengths and the request id are filled in per frame.
+    */
+   bson_uint8_t          *prefix;
+   size_t                 prefix_len;
+   size_t                 seq_offset;
+
+   bson_uint8_t          *buf;
+   size_t                 buflen;
+   bson_writer_t         *writer;
+   bson_t                *doc;
+   size_t                 end;
+
+   size_t                *frames;
+   size_t                 n_frames;
+   size_t                 n_alloc;
+   bson_uint32_t          n_docs;
+};
+
+
+static BSON_INLINE void
+bson_message_write_int32 (bson_uint8_t  *p,
+                          bson_uint32_t  v)
+{
+   v = BSON_UINT32_TO_LE(v);
+   memcpy(p, &v, 4);
+}
+
+
+bson_message_t *
+bson_message_new (bson_message_opcode_t  opcode,
+                  bson_uint32_t          flags,
+                  const char            *name,
+                  const bson_t          *body,
+                  size_t                 max_message_size,
+                  bson_uint32_t          max_batch_size)
+{
+   bson_message_t *message;
+   size_t seq_offset = 0;
+   size_t prefix_len;
+   size_t name_len;
+   bson_uint8_t *p;
+
+   bson_return_val_if_fail(name, NULL);
+
+   name_len = strlen(name) + 1;
+
+   switch (opcode) {
+   case BSON_MESSAGE_OP_INSERT:
+      bson_return_val_if_fail(!body, NULL);
+      prefix_len = BSON_MESSAGE_HEADER_SIZE + 4 + name_len;
+      break;
+   case BSON_MESSAGE_OP_MSG:
+      bson_return_val_if_fail(body, NULL);
+      seq_offset = BSON_MESSAGE_HEADER_SIZE + 4 + 1 + body->len + 1;
+      prefix_len = seq_offset + 4 + name_len;
+      break;
+   case BSON_MESSAGE_OP_REPLY:
+   default:
+      return NULL;
+   }
+
+   if ((max_message_size > INT32_MAX) || (prefix_len >= max_message_size)) {
+      return NULL;
+   }
+
+   message = bson_malloc0(sizeof *message);
+   message->opcode = opcode;
+   message->max_message_size = max_message_size;
+   message->max_batch_size = max_batch_size;
+   message->prefix_len = prefix_len;
+   message->seq_offset = seq_offset;
+   message->prefix = p = bson_malloc0(prefix_len);
+
+   bson_message_write_int32(p + 12, opcode);
+   bson_message_write_int32(p + 16, flags);
+   p += BSON_MESSAGE_HEADER_SIZE + 4;
+
+   if (opcode == BSON_MESSAGE_OP_MSG) {
+      *p++ = 0;
+      memcpy(p, bson_get_data(body), body->len);
+      p += body->len;
+      *p++ = 1;
+      p += 4;
+   }
+
+   memcpy(p, name, name_len);
+
+   message->writer = bson_writer_new(&message->buf, &message->buflen, 0,
+                                     bson_realloc);
+
+   return message;
+}
+
+
+void
+bson_message_destroy (bson_message_t *message)
+{
+   if (message) {
+      bson_writer_destroy(message->writer);
+      bson_free(message->buf);
+      bson_free(message->frames);
+      bson_free(message->prefix);
+      bson_free(message);
+   }
+}
+
+
+void
+bson_message_set_request_id (bson_message_t *message,
+                             bson_int32_t    request_id)
+{
+   bson_return_if_fail(message);
+
+   /*
+    * Request ids wrap around on long-lived connections, so they are kept
+    * unsigned to keep the arithmetic defined.
+    */
+   message->request_id = (bson_uint32_t)request_id;
+}
+
+
+/*
+ * Checks if a document of @len bytes fits at the end of the last frame.
+ */
+static BSON_INLINE bson_bool_t
+bson_message_fits (const bson_message_t *message,
+                   size_t                len)
+{
+   size_t used;
+
+   if (!message->n_frames) {
+      return FALSE;
+   }
+
+   if (message->max_batch_size &&
+       (message->n_docs >= message->max_batch_size)) {
+      return FALSE;
+   }
+
+   used = message->end - message->frames[message->n_frames - 1];
+
+   return (len <= (message->max_message_size - used));
+}
+
+
+/*
+ * Starts a frame at @offset, where the writer has already made room for
+ * the prefix.
+ */
+static void
+bson_message_open_frame (bson_message_t *message,
+                         size_t          offset)
+{
+   if (message->n_frames == message->n_alloc) {
+      message->n_alloc = message->n_alloc ? (message->n_alloc * 2) : 8;
+      message->frames = bson_realloc(message->frames,
+                                     message->n_alloc * sizeof(size_t));
+   }
+
+   memcpy(message->buf + offset, message->prefix, message->prefix_len);
+   bson_message_write_int32(message->buf + offset + 4,
+                            message->request_id +
+                            (bson_uint32_t)message->n_frames);
+
+   message->frames[message->n_frames++] = offset;
+   message->end = offset + message->prefix_len;
+   message->n_docs = 0;
+}
+
+
+/*
+ * Accounts for a document of @len bytes at the end of the last frame and
+ * patches the lengths of the frame.
+ */
+static void
+bson_message_add (bson_message_t *message,
+                  size_t          len)
+{
+   bson_uint8_t *frame;
+   size_t start;
+
+   message->end += len;
+   message->n_docs++;
+
+   start = message->frames[message->n_frames - 1];
+   frame = message->buf + start;
+
+   bson_message_write_int32(frame, (bson_uint32_t)(message->end - start));
+
+   if (message->seq_offset) {
+      bson_message_write_int32(frame + message->seq_offset,
+                               (bson_uint32_t)(message->end - start -
+                                               message->seq_offset));
+   }
+}
+
+
+bson_bool_t
+bson_message_append (bson_message_t *message,
+                     const bson_t   *bson)
+{
+   bson_uint8_t *data;
+   size_t offset;
+
+   bson_return_val_if_fail(message, FALSE);
+   bson_return_val_if_fail(!message->doc, FALSE);
+   bson_return_val_if_fail(bson, FALSE);
+
+   if (bson->len > (message->max_message_size - message->prefix_len)) {
+      return FALSE;
+   }
+
+   if (!bson_message_fits(message, bson->len)) {
+      offset = message->end;
+      bson_writer_append_raw(message->writer, message->prefix_len);
+      bson_message_open_frame(message, offset);
+   }
+
+   data = bson_writer_append_raw(message->writer, bson->len);
+   memcpy(data, bson_get_data(bson), bson->len);
+   bson_message_add(message, bson->len);
+
+   return TRUE;
+}
+
+
+void
+bson_message_begin_document (bson_message_t  *message,
+                             bson_t         **bson)
+{
+   bson_return_if_fail(message);
+   bson_return_if_fail(!message->doc);
+   bson_return_if_fail(bson);
+
+   bson_writer_begin(message->writer, &message->doc);
+   *bson = message->doc;
+}
+
+
+bson_bool_t
+bson_message_end_document (bson_message_t *message)
+{
+   size_t offset;
+   size_t len;
+
+   bson_return_val_if_fail(message, FALSE);
+   bson_return_val_if_fail(message->doc, FALSE);
+
+   len = message->doc->len;
+   message->doc = NULL;
+
+   if (len > (message->max_message_size - message->prefix_len)) {
+      bson_writer_rollback(message->writer);
+      return FALSE;
+   }
+
+   bson_writer_end(message->writer);
+
+   if (!bson_message_fits(message, len)) {
+      /*
+       * The document was built where the frame is about to start, so
+       * make room for the prefix and move the document behind it.
+       */
+      offset = message->end;
+      bson_writer_append_raw(message->writer, message->prefix_len);
+      memmove(message->buf + offset + message->prefix_len,
+              message->buf + offset,
+              len);
+      bson_message_open_frame(message, offset);
+   }
+
+   bson_message_add(message, len);
+
+   return TRUE;
+}
+
+
+void
+bson_message_rollback_document (bson_message_t *message)
+{
+   bson_return_if_fail(message);
+   bson_return_if_fail(message->doc);
+
+   bson_writer_rollback(message->writer);
+   message->doc = NULL;
+}
+
+
+size_t
+bson_message_get_n_frames (const bson_message_t *message)
+{
+   bson_return_val_if_fail(message, 0);
+
+   return message->n_frames;
+}
+
+
+#ifndef BSON_OS_WIN32
+size_t
+bson_message_get_iovecs (const bson_message_t *message,
+                         struct iovec         *iov,
+                         size_t                n_iov)
+{
+   size_t end;
+   size_t i;
+
+   bson_return_val_if_fail(message, 0);
+   bson_return_val_if_fail(iov || !n_iov, 0);
+
+   n_iov = MIN(n_iov, message->n_frames);
+
+   for (i = 0; i < n_iov; i++) {
+      end = ((i + 1) < message->n_frames) ? message->frames[i + 1]
+                                          : message->end;
+      iov[i].iov_base = message->buf + message->frames[i];
+      iov[i].iov_len = end - message->frames[i];
+   }
+
+   return n_iov;
+}
+#endif
+
+
+void
+bson_message_reset (bson_message_t *message)
+{
+   bson_return_if_fail(message);
+   bson_return_if_fail(!message->doc);
+
+   message->request_id += (bson_uint32_t)message->n_frames;
+   message->n_frames = 0;
+   message->n_docs = 0;
+   message->end = 0;
+
+   bson_writer_destroy(message->writer);
+   message->writer = bson_writer_new(&message->buf, &message->buflen, 0,
+                                     bson_realloc);
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_message_read_uint32 (const bson_uint8_t *p)
+{
+   bson_uint32_t v;
+
+   memcpy(&v, p, 4);
+   return BSON_UINT32_FROM_LE(v);
+}
+
+
+static bson_bool_t
+bson_message_parser_fail (bson_message_parser_t *parser,
+                          bson_uint32_t          offset)
+{
+   parser->err_offset = offset;
+   parser->offset = parser->end;
+   parser->section_end = 0;
+
+   return FALSE;
+}
+
+
+bson_bool_t
+bson_message_parser_init (bson_message_parser_t *parser,
+                          const bson_uint8_t    *data,
+                          size_t                 length,
+                          bson_bool_t           *incomplete)
+{
+   bson_uint32_t known;
+   bson_uint64_t cursor_id;
+
+   bson_return_val_if_fail(parser, FALSE);
+   bson_return_val_if_fail(data || !length, FALSE);
+
+   memset(parser, 0, sizeof *parser);
+
+   if (incomplete) {
+      *incomplete = FALSE;
+   }
+
+   if (length < 4) {
+      if (incomplete) {
+         *incomplete = TRUE;
+      }
+      return FALSE;
+   }
+
+   parser->length = bson_message_read_uint32(data);
+
+   if ((parser->length < BSON_MESSAGE_HEADER_SIZE) ||
+       (parser->length > INT32_MAX)) {
+      return FALSE;
+   }
+
+   if (parser->length > length) {
+      if (incomplete) {
+         *incomplete = TRUE;
+      }
+      return FALSE;
+   }
+
+   parser->request_id = (bson_int32_t)bson_message_read_uint32(data + 4);
+   parser->response_to = (bson_int32_t)bson_message_read_uint32(data + 8);
+   parser->opcode =
+      (bson_message_opcode_t)bson_message_read_uint32(data + 12);
+   parser->end = parser->length;
+
+   switch (parser->opcode) {
+   case BSON_MESSAGE_OP_REPLY:
+      if (parser->length < 36) {
+         return FALSE;
+      }
+      parser->flags = bson_message_read_uint32(data + 16);
+      memcpy(&cursor_id, data + 20, 8);
+      parser->cursor_id = (bson_int64_t)BSON_UINT64_FROM_LE(cursor_id);
+      parser->starting_from =
+         (bson_int32_t)bson_message_read_uint32(data + 28);
+      parser->number_returned =
+         (bson_int32_t)bson_message_read_uint32(data + 32);
+      parser->offset = 36;
+      break;
+   case BSON_MESSAGE_OP_MSG:
+      if (parser->length < 20) {
+         return FALSE;
+      }
+      parser->flags = bson_message_read_uint32(data + 16);
+      parser->offset = 20;
+
+      /*
+       * The low 16 bits are required: a flag we do not know there means
+       * we cannot parse the message.
+       */
+      known = (BSON_MESSAGE_MSG_CHECKSUM_PRESENT |
+               BSON_MESSAGE_MSG_MORE_TO_COME);
+      if ((parser->flags & 0xFFFF & ~known)) {
+         return FALSE;
+      }
+
+      if ((parser->flags & BSON_MESSAGE_MSG_CHECKSUM_PRESENT)) {
+         if (parser->length < 24) {
+            return FALSE;
+         }
+         parser->end -= 4;
+      }
+      break;
+   case BSON_MESSAGE_OP_INSERT:
+   default:
+      return FALSE;
+   }
+
+   parser->data = data;
+
+   return TRUE;
+}
+
+
+/*
+ * Initializes @bson as a view of the document at the offset of @parser,
+ * which must end by @end.
+ */
+static bson_bool_t
+bson_message_parser_document (bson_message_parser_t *parser,
+                              bson_uint32_t          end,
+                              bson_t                *bson)
+{
+   bson_uint32_t len;
+
+   if ((end - parser->offset) < 5) {
+      return bson_message_parser_fail(parser, parser->offset);
+   }
+
+   len = bson_message_read_uint32(parser->data + parser->offset);
+
+   if ((len > (end - parser->offset)) ||
+       !bson_init_static(bson, parser->data + parser->offset, len)) {
+      return bson_message_parser_fail(parser, parser->offset);
+   }
+
+   parser->offset += len;
+   parser->n_docs++;
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_message_parser_next (bson_message_parser_t  *parser,
+                          bson_t                 *bson,
+                          const char            **identifier)
+{
+   const bson_uint8_t *nul;
+   bson_uint32_t start;
+   bson_uint32_t size;
+
+   bson_return_val_if_fail(parser, FALSE);
+   bson_return_val_if_fail(bson, FALSE);
+
+   if (identifier) {
+      *identifier = NULL;
+   }
+
+   if (!parser->data || parser->err_offset) {
+      return FALSE;
+   }
+
+   if (parser->opcode == BSON_MESSAGE_OP_REPLY) {
+      if (parser->offset == parser->end) {
+         if (parser->n_docs != (bson_uint32_t)parser->number_returned) {
+            bson_message_parser_fail(parser, parser->end);
+         }
+         return FALSE;
+      }
+      return bson_message_parser_document(parser, parser->end, bson);
+   }
+
+   for (;;) {
+      if (parser->section_end) {
+         if (parser->offset < parser->section_end) {
+            if (identifier) {
+               *identifier = parser->identifier;
+            }
+            return bson_message_parser_document(parser, parser->section_end,
+                                                bson);
+         }
+         parser->section_end = 0;
+         parser->identifier = NULL;
+      }
+
+      if (parser->offset == parser->end) {
+         if (parser->n_bodies != 1) {
+            bson_message_parser_fail(parser, parser->end);
+         }
+         return FALSE;
+      }
+
+      start = parser->offset;
+
+      switch (parser->data[start]) {
+      case 0:
+         parser->offset++;
+         parser->n_bodies++;
+         return bson_message_parser_document(parser, parser->end, bson);
+      case 1:
+         /*
+          * A document sequence: its size, which counts itself, the
+          * identifier and the documents.
+          */
+         if ((parser->end - start) < 6) {
+            return bson_message_parser_fail(parser, start);
+         }
+         size = bson_message_read_uint32(parser->data + start + 1);
+         if ((size < 5) || (size > (parser->end - start - 1))) {
+            return bson_message_parser_fail(parser, start);
+         }
+         nul = memchr(parser->data + start + 5, '\0', size - 4);
+         if (!nul) {
+            return bson_message_parser_fail(parser, start);
+         }
+         parser->identifier = (const char *)parser->data + start + 5;
+         parser->offset = (bson_uint32_t)(nul + 1 - parser->data);
+         parser->section_end = start + 1 + size;
+         break;
+      default:
+         return bson_message_parser_fail(parser, start);
+      }
+   }
+}
+
+
+size_t
+bson_message_parser_get_error_offset (const bson_message_parser_t *parser)
+{
+   bson_return_val_if_fail(parser, 0);
+
+   return parser->err_offset;
+}
@@ -0,0 +1,358 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_MESSAGE_H
+#define BSON_MESSAGE_H
+
+
+#include "bson-macros.h"
+#include "bson-types.h"
+
+#ifndef BSON_OS_WIN32
+#  include <sys/uio.h>
+#endif
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * BSON_MESSAGE_HEADER_SIZE:
+ *
+ * The size in bytes of the header at the start of every MongoDB wire
+ * protocol message: the message length, request id, response to and
+ * opcode, each a little-endian int32.
+ */
+#define BSON_MESSAGE_HEADER_SIZE 16
+
+
+/**
+ * bson_message_opcode_t:
+ *
+ * The MongoDB wire protocol opcodes known to bson_message_t.
+ *
+ * %BSON_MESSAGE_OP_REPLY: A reply to a legacy query.
+ * %BSON_MESSAGE_OP_INSERT: A legacy insert of one or more documents.
+ * %BSON_MESSAGE_OP_MSG: A command with optional document sequences.
+ */
+typedef enum
+{
+   BSON_MESSAGE_OP_REPLY  = 1,
+   BSON_MESSAGE_OP_INSERT = 2002,
+   BSON_MESSAGE_OP_MSG    = 2013,
+} bson_message_opcode_t;
+
+
+/**
+ * bson_message_msg_flags_t:
+ *
+ * The flag bits of an OP_MSG.
+ *
+ * %BSON_MESSAGE_MSG_CHECKSUM_PRESENT: The message ends in a CRC-32C
+ *    checksum.
+ * %BSON_MESSAGE_MSG_MORE_TO_COME: Another message follows without a
+ *    request.
+ * %BSON_MESSAGE_MSG_EXHAUST_ALLOWED: The client accepts more than one
+ *    reply.
+ */
+typedef enum
+{
+   BSON_MESSAGE_MSG_CHECKSUM_PRESENT = 1 << 0,
+   BSON_MESSAGE_MSG_MORE_TO_COME     = 1 << 1,
+   BSON_MESSAGE_MSG_EXHAUST_ALLOWED  = 1 << 16,
+} bson_message_msg_flags_t;
+
+
+/**
+ * bson_message_t:
+ *
+ * Builds a batch of MongoDB wire protocol messages, or frames, that carry
+ * a stream of documents. Each frame is either an OP_INSERT into a
+ * collection or an OP_MSG whose command body is followed by a document
+ * sequence section such as "documents".
+ *
+ * Documents are packed into the current frame until it would exceed the
+ * maximum message size or hold the maximum number of documents, and then
+ * a new frame is started. The length fields of each frame are patched as
+ * documents are added, so the frames are complete at all times.
+ *
+ * All frames live in one buffer that is written through a bson_writer_t.
+ * Documents may be copied in with bson_message_append() or built in place
+ * with bson_message_begin_document(), which saves the copy entirely. The
+ * frames are then sent with a single writev() of the iovecs from
+ * bson_message_get_iovecs().
+ */
+typedef struct _bson_message_t bson_message_t;
+
+
+/**
+ * bson_message_new:
+ * @opcode: %BSON_MESSAGE_OP_INSERT or %BSON_MESSAGE_OP_MSG.
+ * @flags: The flags of each frame, such as ContinueOnError for OP_INSERT.
+ *    %BSON_MESSAGE_MSG_CHECKSUM_PRESENT is not supported.
+ * @name: The full collection name such as "db.collection" for OP_INSERT or
+ *    the identifier of the document sequence such as "documents" for
+ *    OP_MSG.
+ * @body: (allow-none): The command of each OP_MSG frame, such as
+ *    { "insert": "collection", "$db": "db" }. It is copied. Must be NULL
+ *    for OP_INSERT.
+ * @max_message_size: The maximum size of a frame in bytes, such as the
+ *    maxMessageSizeBytes of the server.
+ * @max_batch_size: The maximum number of documents in a frame, such as the
+ *    maxWriteBatchSize of the server, or 0 for no limit.
+ *
+ * Creates a new bson_message_t. Frames are numbered with consecutive
+ * request ids starting at 0; see bson_message_set_request_id().
+ *
+ * Returns: A newly allocated bson_message_t that should be freed with
+ *    bson_message_destroy(), or NULL if the arguments are invalid or not
+ *    even an empty frame fits in @max_message_size.
+ */
+bson_message_t *
+bson_message_new (bson_message_opcode_t  opcode,
+                  bson_uint32_t          flags,
+                  const char            *name,
+                  const bson_t          *body,
+                  size_t                 max_message_size,
+                  bson_uint32_t          max_batch_size);
+
+
+void
+bson_message_destroy (bson_message_t *message);
+
+
+/**
+ * bson_message_set_request_id:
+ * @message: A bson_message_t.
+ * @request_id: The request id of the first frame.
+ *
+ * Sets the request id of the first frame. Each further frame gets the
+ * next id.
+ */
+void
+bson_message_set_request_id (bson_message_t *message,
+                             bson_int32_t    request_id);
+
+
+/**
+ * bson_message_append:
+ * @message: A bson_message_t.
+ * @bson: A bson_t.
+ *
+ * Copies @bson into the current frame, or into a new frame if it does not
+ * fit.
+ *
+ * Returns: TRUE if successful; FALSE if @bson does not fit in a frame on
+ *    its own, in which case nothing is added.
+ */
+bson_bool_t
+bson_message_append (bson_message_t *message,
+                     const bson_t   *bson);
+
+
+/**
+ * bson_message_begin_document:
+ * @message: A bson_message_t.
+ * @bson: (out): A location for a bson_t*.
+ *
+ * Begins a document that is built directly in the buffer of @message. The
+ * caller appends to *@bson and then calls bson_message_end_document() or
+ * bson_message_rollback_document(). *@bson is not valid after that.
+ */
+void
+bson_message_begin_document (bson_message_t  *message,
+                             bson_t         **bson);
+
+
+/**
+ * bson_message_end_document:
+ * @message: A bson_message_t.
+ *
+ * Adds the document started with bson_message_begin_document() to the
+ * current frame. If it does not fit, a new frame is started in front of
+ * it, which moves the document once.
+ *
+ * Returns: TRUE if successful; FALSE if the document does not fit in a
+ *    frame on its own, in which case it is discarded.
+ */
+bson_bool_t
+bson_message_end_document (bson_message_t *message);
+
+
+/**
+ * bson_message_rollback_document:
+ * @message: A bson_message_t.
+ *
+ * Discards the document started with bson_message_begin_document().
+ */
+void
+bson_message_rollback_document (bson_message_t *message);
+
+
+/**
+ * bson_message_get_n_frames:
+ * @message: A bson_message_t.
+ *
+ * Returns: The number of frames holding at least one document.
+ */
+size_t
+bson_message_get_n_frames (const bson_message_t *message);
+
+
+#ifndef BSON_OS_WIN32
+/**
+ * bson_message_get_iovecs:
+ * @message: A bson_message_t.
+ * @iov: An array of @n_iov struct iovec.
+ * @n_iov: The number of elements in @iov.
+ *
+ * Fills @iov with the first @n_iov frames, one iovec per frame. The
+ * iovecs point into the buffer of @message and are valid until the next
+ * document is added or @message is reset or destroyed.
+ *
+ * Returns: The number of iovecs filled in.
+ */
+size_t
+bson_message_get_iovecs (const bson_message_t *message,
+                         struct iovec         *iov,
+                         size_t                n_iov);
+#endif
+
+
+/**
+ * bson_message_reset:
+ * @message: A bson_message_t.
+ *
+ * Removes all frames so that the next batch can be built in the same
+ * buffer. The request id continues from the last frame.
+ */
+void
+bson_message_reset (bson_message_t *message);
+
+
+/**
+ * bson_message_parser_t:
+ *
+ * Parses a received OP_REPLY or OP_MSG frame in place. The documents are
+ * returned as read-only bson_t views into the receive buffer, so nothing
+ * is copied or allocated. The structure is meant to live on the stack.
+ *
+ * After bson_message_parser_init() the header fields are filled in. For
+ * an OP_REPLY @flags holds the response flags and @cursor_id,
+ * @starting_from and @number_returned are set. For an OP_MSG @flags holds
+ * the flag bits. The fields after @number_returned are internal.
+ */
+typedef struct
+{
+   bson_uint32_t          length;
+   bson_int32_t           request_id;
+   bson_int32_t           response_to;
+   bson_message_opcode_t  opcode;
+   bson_uint32_t          flags;
+   bson_int64_t           cursor_id;
+   bson_int32_t           starting_from;
+   bson_int32_t           number_returned;
+
+   const bson_uint8_t    *data;
+   bson_uint32_t          offset;
+   bson_uint32_t          end;
+   bson_uint32_t          section_end;
+   const char            *identifier;
+   bson_uint32_t          n_docs;
+   bson_uint32_t          n_bodies;
+   bson_uint32_t          err_offset;
+} bson_message_parser_t;
+
+
+/**
+ * bson_message_parser_init:
+ * @parser: A bson_message_parser_t.
+ * @data: The start of a frame in a receive buffer.
+ * @length: The number of bytes received at @data.
+ * @incomplete: (out) (allow-none): A location for whether more bytes are
+ *    needed.
+ *
+ * Validates the header of the frame at @data and prepares @parser to walk
+ * its documents. @data may hold more than one frame; @parser covers the
+ * first one, which is @parser->length bytes long, so the next starts at
+ * @data + @parser->length. @data must outlive @parser and the documents
+ * returned from it.
+ *
+ * If @data ends before the frame does, *@incomplete is set to TRUE. In
+ * that case @parser->length holds the size of the frame once at least
+ * a length field has been received, or 0 before that.
+ *
+ * The checksum of an OP_MSG with %BSON_MESSAGE_MSG_CHECKSUM_PRESENT is
+ * skipped but not verified.
+ *
+ * Returns: TRUE if @data starts with a complete frame with a valid header;
+ *    otherwise FALSE.
+ */
+bson_bool_t
+bson_message_parser_init (bson_message_parser_t *parser,
+                          const bson_uint8_t    *data,
+                          size_t                 length,
+                          bson_bool_t           *incomplete);
+
+
+/**
+ * bson_message_parser_next:
+ * @parser: A bson_message_parser_t.
+ * @bson: (out): A bson_t to initialize as a view of the next document.
+ * @identifier: (out) (allow-none): A location for the identifier of the
+ *    document sequence holding the document.
+ *
+ * Fetches the next document of the frame: the documents of an OP_REPLY,
+ * or the body and the documents of each document sequence of an OP_MSG
+ * in the order they appear. *@identifier is set to NULL for the body and
+ * for the documents of an OP_REPLY, and otherwise points into the frame.
+ *
+ * Each document is checked to lie within its section and frame and to
+ * be NUL terminated, but not validated further; see bson_validate().
+ *
+ * Returns: TRUE if a document was found; FALSE at the end of the frame or
+ *    if it is corrupt. See bson_message_parser_get_error_offset().
+ */
+bson_bool_t
+bson_message_parser_next (bson_message_parser_t  *parser,
+                          bson_t                 *bson,
+                          const char            **identifier);
+
+
+/**
+ * bson_message_parser_get_error_offset:
+ * @parser: A bson_message_parser_t.
+ *
+ * Fetches the offset in the frame at which @parser found it corrupt. An
+ * OP_MSG without exactly one body, or an OP_REPLY whose document count
+ * does not match @number_returned, is reported at the end of the frame.
+ *
+ * Returns: The offset of the corruption, or 0 if none was found.
+ */
+size_t
+bson_message_parser_get_error_offset (const bson_message_parser_t *parser);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_MESSAGE_H */
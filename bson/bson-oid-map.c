@@ -0,0 +1,730 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bson.h"
+#include "bson-oid-map.h"
+
+
+/*
+ * Every slot has a control byte. Full slots store the low 7 bits of the
+ * hash (H2) so the high bit tells full slots apart from empty or deleted
+ * ones. The control bytes of the first GROUP_WIDTH - 1 slots are cloned past
+ * the end of the array so that a group may be loaded at any position.
+ */
+#define CTRL_EMPTY   ((bson_uint8_t)0x80)
+#define CTRL_DELETED ((bson_uint8_t)0xFE)
+#define GROUP_WIDTH  16
+#define BATCH_SIZE   16
+#define MIN_CAPACITY 16
+
+#define H1(h) ((size_t)((h) >> 7))
+#define H2(h) ((bson_uint8_t)((h) & 0x7F))
+
+#if defined(__GNUC__)
+#  define PREFETCH(p) __builtin_prefetch((p))
+#  define CTZ(v)      __builtin_ctz((v))
+#else
+#  define PREFETCH(p)
+#  define CTZ(v)      bson_oid_map_ctz((v))
+#endif
+
+
+struct _bson_oid_map_t
+{
+   bson_uint8_t  *ctrl;
+   bson_oid_t    *keys;
+   bson_uint64_t *values;      /* NULL for sets. */
+   size_t         capacity;    /* Power of two, or zero. */
+   size_t         count;
+   size_t         growth_left; /* Empty slots we may fill before growing. */
+   bson_bool_t    has_values;
+};
+
+
+struct _bson_oid_set_t
+{
+   bson_oid_map_t map;
+};
+
+
+#if !defined(__GNUC__)
+static BSON_INLINE int
+bson_oid_map_ctz (bson_uint32_t v)
+{
+   int i = 0;
+
+   while (!(v & 1)) {
+      v >>= 1;
+      i++;
+   }
+
+   return i;
+}
+#endif
+
+
+#ifdef __SSE2__
+static BSON_INLINE bson_uint32_t
+bson_oid_map_group_match (const bson_uint8_t *ctrl,
+                          bson_uint8_t        h2)
+{
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+   __m128i match = _mm_set1_epi8((char)h2);
+
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(group, match));
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_oid_map_group_match_empty (const bson_uint8_t *ctrl)
+{
+   return bson_oid_map_group_match(ctrl, CTRL_EMPTY);
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_oid_map_group_match_free (const bson_uint8_t *ctrl)
+{
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+
+   return _mm_movemask_epi8(group);
+}
+#else
+/*
+ * Portable fallback processing the 16 control bytes as two 64-bit words.
+ * The resulting masks have the same layout as the SSE2 versions.
+ */
+#define LSBS 0x0101010101010101ULL
+#define MSBS 0x8080808080808080ULL
+
+
+static BSON_INLINE bson_uint64_t
+bson_oid_map_load64 (const bson_uint8_t *ctrl)
+{
+   bson_uint64_t v;
+
+   memcpy(&v, ctrl, 8);
+   return BSON_UINT64_FROM_LE(v);
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_oid_map_swar_mask (bson_uint64_t msbs)
+{
+   return (bson_uint32_t)((((msbs >> 7) * 0x0102040810204080ULL) >> 56) &
+                          0xFF);
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_oid_map_group_match (const bson_uint8_t *ctrl,
+                          bson_uint8_t        h2)
+{
+   bson_uint64_t lo = bson_oid_map_load64(ctrl) ^ (LSBS * h2);
+   bson_uint64_t hi = bson_oid_map_load64(ctrl + 8) ^ (LSBS * h2);
+
+   /*
+    * May report false positives, which are discarded when comparing keys.
+    */
+   lo = (lo - LSBS) & ~lo & MSBS;
+   hi = (hi - LSBS) & ~hi & MSBS;
+
+   return bson_oid_map_swar_mask(lo) | (bson_oid_map_swar_mask(hi) << 8);
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_oid_map_group_match_empty (const bson_uint8_t *ctrl)
+{
+   bson_uint64_t lo = bson_oid_map_load64(ctrl);
+   bson_uint64_t hi = bson_oid_map_load64(ctrl + 8);
+
+   lo = lo & (~lo << 6) & MSBS;
+   hi = hi & (~hi << 6) & MSBS;
+
+   return bson_oid_map_swar_mask(lo) | (bson_oid_map_swar_mask(hi) << 8);
+}
+
+
+static BSON_INLINE bson_uint32_t
+bson_oid_map_group_match_free (const bson_uint8_t *ctrl)
+{
+   bson_uint64_t lo = bson_oid_map_load64(ctrl) & MSBS;
+   bson_uint64_t hi = bson_oid_map_load64(ctrl + 8) & MSBS;
+
+   return bson_oid_map_swar_mask(lo) | (bson_oid_map_swar_mask(hi) << 8);
+}
+#endif
+
+
+static BSON_INLINE bson_uint64_t
+bson_oid_map_hash (const bson_oid_t *oid)
+{
+   bson_uint64_t a;
+   bson_uint32_t b;
+   bson_uint64_t h;
+
+   /*
+    * bson_oid_hash_unsafe() maps ObjectIds from the same process onto a few
+    * thousand distinct values since only the counter bytes differ. Mix the
+    * whole 12 bytes instead so that both the slot index and the control
+    * byte see well distributed bits.
+    */
+   memcpy(&a, oid->bytes, 8);
+   memcpy(&b, oid->bytes + 8, 4);
+
+   h = (a * 0x9E3779B97F4A7C15ULL) ^ ((bson_uint64_t)b * 0xC2B2AE3D27D4EB4FULL);
+   h ^= h >> 29;
+   h *= 0xBF58476D1CE4E5B9ULL;
+   return h ^ (h >> 32);
+}
+
+
+static BSON_INLINE void
+bson_oid_map_set_ctrl (bson_oid_map_t *map,
+                       size_t          slot,
+                       bson_uint8_t    ctrl)
+{
+   map->ctrl[slot] = ctrl;
+   if (slot < (GROUP_WIDTH - 1)) {
+      map->ctrl[map->capacity + slot] = ctrl;
+   }
+}
+
+
+static BSON_INLINE bson_bool_t
+bson_oid_map_find (const bson_oid_map_t *map,
+                   const bson_oid_t     *oid,
+                   bson_uint64_t         hash,
+                   size_t               *slot)
+{
+   bson_uint32_t bits;
+   size_t mask = map->capacity - 1;
+   size_t pos;
+   size_t step = 0;
+   size_t i;
+
+   if (BSON_UNLIKELY(!map->capacity)) {
+      return FALSE;
+   }
+
+   pos = H1(hash) & mask;
+
+   for (;;) {
+      bits = bson_oid_map_group_match(map->ctrl + pos, H2(hash));
+      while (bits) {
+         i = (pos + CTZ(bits)) & mask;
+         if (BSON_LIKELY(bson_oid_equal_unsafe(&map->keys[i], oid))) {
+            *slot = i;
+            return TRUE;
+         }
+         bits &= bits - 1;
+      }
+
+      if (BSON_LIKELY(bson_oid_map_group_match_empty(map->ctrl + pos))) {
+         return FALSE;
+      }
+
+      step += GROUP_WIDTH;
+      pos = (pos + step) & mask;
+   }
+}
+
+
+static BSON_INLINE size_t
+bson_oid_map_find_free (const bson_oid_map_t *map,
+                        bson_uint64_t         hash)
+{
+   bson_uint32_t bits;
+   size_t mask = map->capacity - 1;
+   size_t pos = H1(hash) & mask;
+   size_t step = 0;
+
+   for (;;) {
+      if ((bits = bson_oid_map_group_match_free(map->ctrl + pos))) {
+         return (pos + CTZ(bits)) & mask;
+      }
+      step += GROUP_WIDTH;
+      pos = (pos + step) & mask;
+   }
+}
+
+
+static void
+bson_oid_map_resize (bson_oid_map_t *map,
+                     size_t          capacity)
+{
+   bson_uint64_t *old_values = map->values;
+   bson_uint8_t *old_ctrl = map->ctrl;
+   bson_oid_t *old_keys = map->keys;
+   size_t old_capacity = map->capacity;
+   size_t slot;
+   size_t i;
+
+   map->capacity = capacity;
+   map->ctrl = bson_malloc(capacity + GROUP_WIDTH);
+   map->keys = bson_malloc(capacity * sizeof *map->keys);
+   map->values = NULL;
+   if (map->has_values) {
+      map->values = bson_malloc(capacity * sizeof *map->values);
+   }
+   memset(map->ctrl, CTRL_EMPTY, capacity + GROUP_WIDTH);
+
+   for (i = 0; i < old_capacity; i++) {
+      if (!(old_ctrl[i] & 0x80)) {
+         slot = bson_oid_map_find_free(map,
+                                       bson_oid_map_hash(&old_keys[i]));
+         bson_oid_map_set_ctrl(map, slot, old_ctrl[i]);
+         map->keys[slot] = old_keys[i];
+         if (map->has_values) {
+            map->values[slot] = old_values[i];
+         }
+      }
+   }
+
+   map->growth_left = (capacity - (capacity / 8)) - map->count;
+
+   bson_free(old_ctrl);
+   bson_free(old_keys);
+   bson_free(old_values);
+}
+
+
+static void
+bson_oid_map_rehash (bson_oid_map_t *map)
+{
+   /*
+    * If tombstones rather than live entries filled the table, rebuild it at
+    * the same size to clear them. Otherwise double the capacity.
+    */
+   if (!map->capacity) {
+      bson_oid_map_resize(map, MIN_CAPACITY);
+   } else if ((map->count * 16) <= (map->capacity * 7)) {
+      bson_oid_map_resize(map, map->capacity);
+   } else {
+      bson_oid_map_resize(map, map->capacity * 2);
+   }
+}
+
+
+static void
+bson_oid_map_init (bson_oid_map_t *map,
+                   size_t          n_reserve,
+                   bson_bool_t     has_values)
+{
+   size_t capacity = MIN_CAPACITY;
+
+   memset(map, 0, sizeof *map);
+   map->has_values = has_values;
+
+   if (n_reserve) {
+      while ((capacity - (capacity / 8)) < n_reserve) {
+         capacity *= 2;
+      }
+      bson_oid_map_resize(map, capacity);
+   }
+}
+
+
+static void
+bson_oid_map_fini (bson_oid_map_t *map)
+{
+   bson_free(map->ctrl);
+   bson_free(map->keys);
+   bson_free(map->values);
+}
+
+
+static bson_bool_t
+bson_oid_map_insert_hashed (bson_oid_map_t   *map,
+                            const bson_oid_t *oid,
+                            bson_uint64_t     hash,
+                            bson_uint64_t     value)
+{
+   size_t slot;
+
+   if (bson_oid_map_find(map, oid, hash, &slot)) {
+      if (map->has_values) {
+         map->values[slot] = value;
+      }
+      return FALSE;
+   }
+
+   if (BSON_UNLIKELY(!map->capacity)) {
+      bson_oid_map_rehash(map);
+   }
+
+   slot = bson_oid_map_find_free(map, hash);
+
+   /*
+    * Reusing a tombstone does not consume an empty slot, so only grow when
+    * we are about to fill the last allowed empty slot.
+    */
+   if (BSON_UNLIKELY(!map->growth_left && (map->ctrl[slot] == CTRL_EMPTY))) {
+      bson_oid_map_rehash(map);
+      slot = bson_oid_map_find_free(map, hash);
+   }
+
+   if (map->ctrl[slot] == CTRL_EMPTY) {
+      map->growth_left--;
+   }
+
+   bson_oid_map_set_ctrl(map, slot, H2(hash));
+   map->keys[slot] = *oid;
+   if (map->has_values) {
+      map->values[slot] = value;
+   }
+   map->count++;
+
+   return TRUE;
+}
+
+
+static bson_bool_t
+bson_oid_map_remove_internal (bson_oid_map_t   *map,
+                              const bson_oid_t *oid)
+{
+   size_t slot;
+
+   if (!bson_oid_map_find(map, oid, bson_oid_map_hash(oid), &slot)) {
+      return FALSE;
+   }
+
+   bson_oid_map_set_ctrl(map, slot, CTRL_DELETED);
+   map->count--;
+
+   return TRUE;
+}
+
+
+static BSON_INLINE void
+bson_oid_map_prefetch (const bson_oid_map_t *map,
+                       const bson_oid_t     *oids,
+                       bson_uint64_t        *hashes,
+                       size_t                n)
+{
+   size_t pos;
+   size_t i;
+
+   for (i = 0; i < n; i++) {
+      hashes[i] = bson_oid_map_hash(&oids[i]);
+      if (map->capacity) {
+         pos = H1(hashes[i]) & (map->capacity - 1);
+         PREFETCH(map->ctrl + pos);
+         PREFETCH(map->keys + pos);
+      }
+   }
+}
+
+
+static size_t
+bson_oid_map_insert_many_internal (bson_oid_map_t      *map,
+                                   const bson_oid_t    *oids,
+                                   const bson_uint64_t *values,
+                                   size_t               n_oids)
+{
+   bson_uint64_t hashes[BATCH_SIZE];
+   size_t inserted = 0;
+   size_t n;
+   size_t i;
+   size_t j;
+
+   for (i = 0; i < n_oids; i += n) {
+      n = MIN(BATCH_SIZE, n_oids - i);
+      bson_oid_map_prefetch(map, oids + i, hashes, n);
+      for (j = 0; j < n; j++) {
+         inserted += bson_oid_map_insert_hashed(map, &oids[i + j], hashes[j],
+                                                values ? values[i + j] : 0);
+      }
+   }
+
+   return inserted;
+}
+
+
+static size_t
+bson_oid_map_lookup_many_internal (const bson_oid_map_t *map,
+                                   const bson_oid_t     *oids,
+                                   bson_uint64_t        *values,
+                                   bson_bool_t          *found,
+                                   size_t                n_oids)
+{
+   bson_uint64_t hashes[BATCH_SIZE];
+   bson_bool_t ret;
+   size_t n_found = 0;
+   size_t slot;
+   size_t n;
+   size_t i;
+   size_t j;
+
+   for (i = 0; i < n_oids; i += n) {
+      n = MIN(BATCH_SIZE, n_oids - i);
+      bson_oid_map_prefetch(map, oids + i, hashes, n);
+      for (j = 0; j < n; j++) {
+         ret = bson_oid_map_find(map, &oids[i + j], hashes[j], &slot);
+         if (ret) {
+            if (values) {
+               values[i + j] = map->values[slot];
+            }
+            n_found++;
+         }
+         if (found) {
+            found[i + j] = ret;
+         }
+      }
+   }
+
+   return n_found;
+}
+
+
+static size_t
+bson_oid_map_memory_usage (const bson_oid_map_t *map)
+{
+   size_t per_slot = 1 + sizeof(bson_oid_t);
+
+   if (!map->capacity) {
+      return 0;
+   }
+
+   if (map->has_values) {
+      per_slot += sizeof(bson_uint64_t);
+   }
+
+   return (map->capacity * per_slot) + GROUP_WIDTH;
+}
+
+
+bson_oid_map_t *
+bson_oid_map_new (size_t n_reserve)
+{
+   bson_oid_map_t *map;
+
+   map = bson_malloc(sizeof *map);
+   bson_oid_map_init(map, n_reserve, TRUE);
+
+   return map;
+}
+
+
+void
+bson_oid_map_destroy (bson_oid_map_t *map)
+{
+   if (map) {
+      bson_oid_map_fini(map);
+      bson_free(map);
+   }
+}
+
+
+bson_bool_t
+bson_oid_map_insert (bson_oid_map_t   *map,
+                     const bson_oid_t *oid,
+                     bson_uint64_t     value)
+{
+   bson_return_val_if_fail(map, FALSE);
+   bson_return_val_if_fail(oid, FALSE);
+
+   return bson_oid_map_insert_hashed(map, oid, bson_oid_map_hash(oid), value);
+}
+
+
+bson_bool_t
+bson_oid_map_lookup (const bson_oid_map_t *map,
+                     const bson_oid_t     *oid,
+                     bson_uint64_t        *value)
+{
+   size_t slot;
+
+   bson_return_val_if_fail(map, FALSE);
+   bson_return_val_if_fail(oid, FALSE);
+
+   if (bson_oid_map_find(map, oid, bson_oid_map_hash(oid), &slot)) {
+      if (value) {
+         *value = map->values[slot];
+      }
+      return TRUE;
+   }
+
+   return FALSE;
+}
+
+
+bson_bool_t
+bson_oid_map_remove (bson_oid_map_t   *map,
+                     const bson_oid_t *oid)
+{
+   bson_return_val_if_fail(map, FALSE);
+   bson_return_val_if_fail(oid, FALSE);
+
+   return bson_oid_map_remove_internal(map, oid);
+}
+
+
+size_t
+bson_oid_map_insert_many (bson_oid_map_t      *map,
+                          const bson_oid_t    *oids,
+                          const bson_uint64_t *values,
+                          size_t               n_oids)
+{
+   bson_return_val_if_fail(map, 0);
+   bson_return_val_if_fail(oids || !n_oids, 0);
+   bson_return_val_if_fail(values || !n_oids, 0);
+
+   return bson_oid_map_insert_many_internal(map, oids, values, n_oids);
+}
+
+
+size_t
+bson_oid_map_lookup_many (const bson_oid_map_t *map,
+                          const bson_oid_t     *oids,
+                          bson_uint64_t        *values,
+                          bson_bool_t          *found,
+                          size_t                n_oids)
+{
+   bson_return_val_if_fail(map, 0);
+   bson_return_val_if_fail(oids || !n_oids, 0);
+   bson_return_val_if_fail(values || !n_oids, 0);
+
+   return bson_oid_map_lookup_many_internal(map, oids, values, found, n_oids);
+}
+
+
+size_t
+bson_oid_map_count (const bson_oid_map_t *map)
+{
+   bson_return_val_if_fail(map, 0);
+
+   return map->count;
+}
+
+
+size_t
+bson_oid_map_get_memory_usage (const bson_oid_map_t *map)
+{
+   bson_return_val_if_fail(map, 0);
+
+   return bson_oid_map_memory_usage(map);
+}
+
+
+bson_oid_set_t *
+bson_oid_set_new (size_t n_reserve)
+{
+   bson_oid_set_t *set;
+
+   set = bson_malloc(sizeof *set);
+   bson_oid_map_init(&set->map, n_reserve, FALSE);
+
+   return set;
+}
+
+
+void
+bson_oid_set_destroy (bson_oid_set_t *set)
+{
+   if (set) {
+      bson_oid_map_fini(&set->map);
+      bson_free(set);
+   }
+}
+
+
+bson_bool_t
+bson_oid_set_add (bson_oid_set_t   *set,
+                  const bson_oid_t *oid)
+{
+   bson_return_val_if_fail(set, FALSE);
+   bson_return_val_if_fail(oid, FALSE);
+
+   return bson_oid_map_insert_hashed(&set->map, oid, bson_oid_map_hash(oid),
+                                     0);
+}
+
+
+bson_bool_t
+bson_oid_set_contains (const bson_oid_set_t *set,
+                       const bson_oid_t     *oid)
+{
+   size_t slot;
+
+   bson_return_val_if_fail(set, FALSE);
+   bson_return_val_if_fail(oid, FALSE);
+
+   return bson_oid_map_find(&set->map, oid, bson_oid_map_hash(oid), &slot);
+}
+
+
+bson_bool_t
+bson_oid_set_remove (bson_oid_set_t   *set,
+                     const bson_oid_t *oid)
+{
+   bson_return_val_if_fail(set, FALSE);
+   bson_return_val_if_fail(oid, FALSE);
+
+   return bson_oid_map_remove_internal(&set->map, oid);
+}
+
+
+size_t
+bson_oid_set_add_many (bson_oid_set_t   *set,
+                       const bson_oid_t *oids,
+                       size_t            n_oids)
+{
+   bson_return_val_if_fail(set, 0);
+   bson_return_val_if_fail(oids || !n_oids, 0);
+
+   return bson_oid_map_insert_many_internal(&set->map, oids, NULL, n_oids);
+}
+
+
+size_t
+bson_oid_set_contains_many (const bson_oid_set_t *set,
+                            const bson_oid_t     *oids,
+                            bson_bool_t          *found,
+                            size_t                n_oids)
+{
+   bson_return_val_if_fail(set, 0);
+   bson_return_val_if_fail(oids || !n_oids, 0);
+
+   return bson_oid_map_lookup_many_internal(&set->map, oids, NULL, found,
+                                            n_oids);
+}
+
+
+size_t
+bson_oid_set_count (const bson_oid_set_t *set)
+{
+   bson_return_val_if_fail(set, 0);
+
+   return set->map.count;
+}
+
+
+size_t
+bson_oid_set_get_memory_usage (const bson_oid_set_t *set)
+{
+   bson_return_val_if_fail(set, 0);
+
+   return bson_oid_map_memory_usage(&set->map);
+}
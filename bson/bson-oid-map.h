@@ -0,0 +1,313 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_OID_MAP_H
+#define BSON_OID_MAP_H
+
+
+#include "bson-macros.h"
+#include "bson-oid.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_oid_map_t:
+ *
+ * An open-addressing hash table mapping bson_oid_t keys to 64-bit values.
+ *
+ * Keys are stored inline in a flat array next to a separate array of values
+ * and one control byte per slot. Lookups compare 16 control bytes at a time
+ * (using SSE2 where available) and only touch keys whose control byte
+ * matches 7 bits of the hash, so most lookups read a single key.
+ *
+ * Every slot costs 21 bytes (13 bytes for bson_oid_set_t) and the table is
+ * grown by doubling once it is 7/8 full. bson_oid_map_get_memory_usage()
+ * returns the exact number of bytes allocated.
+ */
+typedef struct _bson_oid_map_t bson_oid_map_t;
+
+
+/**
+ * bson_oid_set_t:
+ *
+ * Like bson_oid_map_t but without values.
+ */
+typedef struct _bson_oid_set_t bson_oid_set_t;
+
+
+/**
+ * bson_oid_map_new:
+ * @n_reserve: The number of entries to reserve room for, or 0.
+ *
+ * Creates a new bson_oid_map_t that can hold at least @n_reserve entries
+ * without growing.
+ *
+ * Returns: A newly allocated bson_oid_map_t that should be freed with
+ *    bson_oid_map_destroy().
+ */
+bson_oid_map_t *
+bson_oid_map_new (size_t n_reserve);
+
+
+/**
+ * bson_oid_map_destroy:
+ * @map: A bson_oid_map_t.
+ *
+ * Frees @map and all of its entries.
+ */
+void
+bson_oid_map_destroy (bson_oid_map_t *map);
+
+
+/**
+ * bson_oid_map_insert:
+ * @map: A bson_oid_map_t.
+ * @oid: The key.
+ * @value: The value for @oid.
+ *
+ * Inserts @oid into @map, replacing the value if @oid is already present.
+ *
+ * Returns: TRUE if @oid was not already present.
+ */
+bson_bool_t
+bson_oid_map_insert (bson_oid_map_t   *map,
+                     const bson_oid_t *oid,
+                     bson_uint64_t     value);
+
+
+/**
+ * bson_oid_map_lookup:
+ * @map: A bson_oid_map_t.
+ * @oid: The key.
+ * @value: A location for the value, or NULL.
+ *
+ * Looks up @oid in @map.
+ *
+ * Returns: TRUE if @oid was found and @value is set.
+ */
+bson_bool_t
+bson_oid_map_lookup (const bson_oid_map_t *map,
+                     const bson_oid_t     *oid,
+                     bson_uint64_t        *value);
+
+
+/**
+ * bson_oid_map_remove:
+ * @map: A bson_oid_map_t.
+ * @oid: The key.
+ *
+ * Removes @oid from @map.
+ *
+ * Returns: TRUE if @oid was found and removed.
+ */
+bson_bool_t
+bson_oid_map_remove (bson_oid_map_t   *map,
+                     const bson_oid_t *oid);
+
+
+/**
+ * bson_oid_map_insert_many:
+ * @map: A bson_oid_map_t.
+ * @oids: An array of @n_oids keys.
+ * @values: An array of @n_oids values.
+ * @n_oids: The number of entries to insert.
+ *
+ * Inserts @n_oids entries like bson_oid_map_insert(). Hashing and memory
+ * prefetching are done a batch at a time, which hides most of the cache
+ * misses of large tables.
+ *
+ * Returns: The number of keys that were not already present.
+ */
+size_t
+bson_oid_map_insert_many (bson_oid_map_t      *map,
+                          const bson_oid_t    *oids,
+                          const bson_uint64_t *values,
+                          size_t               n_oids);
+
+
+/**
+ * bson_oid_map_lookup_many:
+ * @map: A bson_oid_map_t.
+ * @oids: An array of @n_oids keys.
+ * @values: An array of @n_oids locations for values.
+ * @found: An array of @n_oids locations for the results, or NULL.
+ * @n_oids: The number of keys to look up.
+ *
+ * Looks up @n_oids keys like bson_oid_map_lookup(), batching the hashing
+ * and prefetching. @values is left untouched for keys that were not found.
+ *
+ * Returns: The number of keys found.
+ */
+size_t
+bson_oid_map_lookup_many (const bson_oid_map_t *map,
+                          const bson_oid_t     *oids,
+                          bson_uint64_t        *values,
+                          bson_bool_t          *found,
+                          size_t                n_oids);
+
+
+/**
+ * bson_oid_map_count:
+ * @map: A bson_oid_map_t.
+ *
+ * Returns: The number of entries in @map.
+ */
+size_t
+bson_oid_map_count (const bson_oid_map_t *map);
+
+
+/**
+ * bson_oid_map_get_memory_usage:
+ * @map: A bson_oid_map_t.
+ *
+ * Returns: The number of bytes allocated for the entries of @map.
+ */
+size_t
+bson_oid_map_get_memory_usage (const bson_oid_map_t *map);
+
+
+/**
+ * bson_oid_set_new:
+ * @n_reserve: The number of entries to reserve room for, or 0.
+ *
+ * Creates a new bson_oid_set_t.
+ *
+ * Returns: A newly allocated bson_oid_set_t that should be freed with
+ *    bson_oid_set_destroy().
+ */
+bson_oid_set_t *
+bson_oid_set_new (size_t n_reserve);
+
+
+/**
+ * bson_oid_set_destroy:
+ * @set: A bson_oid_set_t.
+ *
+ * Frees @set and all of its entries.
+ */
+void
+bson_oid_set_destroy (bson_oid_set_t *set);
+
+
+/**
+ * bson_oid_set_add:
+ * @set: A bson_oid_set_t.
+ * @oid: A bson_oid_t.
+ *
+ * Adds @oid to @set.
+ *
+ * Returns: TRUE if @oid was not already present.
+ */
+bson_bool_t
+bson_oid_set_add (bson_oid_set_t   *set,
+                  const bson_oid_t *oid);
+
+
+/**
+ * bson_oid_set_contains:
+ * @set: A bson_oid_set_t.
+ * @oid: A bson_oid_t.
+ *
+ * Returns: TRUE if @oid is in @set.
+ */
+bson_bool_t
+bson_oid_set_contains (const bson_oid_set_t *set,
+                       const bson_oid_t     *oid);
+
+
+/**
+ * bson_oid_set_remove:
+ * @set: A bson_oid_set_t.
+ * @oid: A bson_oid_t.
+ *
+ * Removes @oid from @set.
+ *
+ * Returns: TRUE if @oid was found and removed.
+ */
+bson_bool_t
+bson_oid_set_remove (bson_oid_set_t   *set,
+                     const bson_oid_t *oid);
+
+
+/**
+ * bson_oid_set_add_many:
+ * @set: A bson_oid_set_t.
+ * @oids: An array of @n_oids bson_oid_t.
+ * @n_oids: The number of elements in @oids.
+ *
+ * Adds @n_oids entries like bson_oid_set_add(), batching the hashing and
+ * prefetching.
+ *
+ * Returns: The number of oids that were not already present.
+ */
+size_t
+bson_oid_set_add_many (bson_oid_set_t   *set,
+                       const bson_oid_t *oids,
+                       size_t            n_oids);
+
+
+/**
+ * bson_oid_set_contains_many:
+ * @set: A bson_oid_set_t.
+ * @oids: An array of @n_oids bson_oid_t.
+ * @found: An array of @n_oids locations for the results, or NULL.
+ * @n_oids: The number of elements in @oids.
+ *
+ * Checks @n_oids entries like bson_oid_set_contains(), batching the hashing
+ * and prefetching.
+ *
+ * Returns: The number of oids found.
+ */
+size_t
+bson_oid_set_contains_many (const bson_oid_set_t *set,
+                            const bson_oid_t     *oids,
+                            bson_bool_t          *found,
+                            size_t                n_oids);
+
+
+/**
+ * bson_oid_set_count:
+ * @set: A bson_oid_set_t.
+ *
+ * Returns: The number of entries in @set.
+ */
+size_t
+bson_oid_set_count (const bson_oid_set_t *set);
+
+
+/**
+ * bson_oid_set_get_memory_usage:
+ * @set: A bson_oid_set_t.
+ *
+ * Returns: The number of bytes allocated for the entries of @set.
+ */
+size_t
+bson_oid_set_get_memory_usage (const bson_oid_set_t *set);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_OID_MAP_H */
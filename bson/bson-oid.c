@@ -26,6 +26,14 @@
 #include "bson-oid.h"
 
 
+#if defined(__GNUC__) && !defined(__clang__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define WITH_OID_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+
 /*
  * This table contains an array of two character pairs for every possible
  * bson_uint8_t. It is used as a lookup table when encoding a bson_oid_t
@@ -91,6 +99,31 @@ static const bson_uint16_t gHexCharPairs[] = {
 };
 
 
+/*
+ * The value of every hex digit accepted by bson_oid_is_valid(), or 0xFF for
+ * any other character. Used by bson_oid_init_from_string_many() to decode
+ * and validate with one lookup per character.
+ */
+static const bson_uint8_t gHexValues[256] = {
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+   0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+
 void
 bson_oid_init_sequence (bson_oid_t     *oid,
                         bson_context_t *context)
@@ -129,6 +162,44 @@ bson_oid_init (bson_oid_t     *oid,
 }
 
 
+void
+bson_oid_init_many (bson_oid_t     *oids,
+                    size_t          n_oids,
+                    bson_context_t *context)
+{
+   bson_uint32_t now = time(NULL);
+   bson_uint32_t seq;
+   bson_uint32_t be;
+   bson_oid_t oid;
+   size_t i;
+
+   bson_return_if_fail(oids || !n_oids);
+   bson_return_if_fail(n_oids <= 0x1000000);
+
+   if (!n_oids) {
+      return;
+   }
+
+   if (!context) {
+      context = bson_context_get_default();
+   }
+
+   now = BSON_UINT32_TO_BE(now);
+   memcpy(&oid.bytes[0], &now, 4);
+
+   context->oid_get_host(context, &oid);
+   context->oid_get_pid(context, &oid);
+
+   seq = bson_context_reserve_seq32(context, n_oids);
+
+   for (i = 0; i < n_oids; i++, seq++) {
+      be = BSON_UINT32_TO_BE(seq);
+      memcpy(&oids[i].bytes[0], &oid.bytes[0], 9);
+      memcpy(&oids[i].bytes[9], ((bson_uint8_t *)&be) + 1, 3);
+   }
+}
+
+
 void
 bson_oid_init_from_data (bson_oid_t         *oid,
                          const bson_uint8_t *data)
@@ -246,3 +317,467 @@ bson_oid_is_valid (const char *str,
 
    return FALSE;
 }
+
+
+static BSON_INLINE void
+bson_oid_to_string_scalar (const bson_oid_t *oid,
+                           char             *str)
+{
+   bson_uint16_t pairs[12];
+   int i;
+
+   for (i = 0; i < 12; i++) {
+      pairs[i] = gHexCharPairs[oid->bytes[i]];
+   }
+
+   memcpy(str, pairs, 24);
+   str[24] = '\0';
+}
+
+
+/*
+ * Checks that @str is exactly 24 characters long without reading past its
+ * terminating NUL byte, as memchr() stops at the first match.
+ */
+static BSON_INLINE bson_bool_t
+bson_oid_string_has_length (const char *str)
+{
+   return (memchr(str, '\0', 25) == (const void *)(str + 24));
+}
+
+
+static BSON_INLINE bson_bool_t
+bson_oid_init_from_string_scalar (bson_oid_t *oid,
+                                  const char *str)
+{
+   const bson_uint8_t *s = (const bson_uint8_t *)str;
+   bson_uint8_t invalid = 0;
+   bson_uint8_t hi;
+   bson_uint8_t lo;
+   int i;
+
+   for (i = 0; i < 12; i++) {
+      hi = gHexValues[s[2 * i]];
+      lo = gHexValues[s[2 * i + 1]];
+      invalid |= (hi | lo);
+      oid->bytes[i] = (hi << 4) | (lo & 0xF);
+   }
+
+   return !(invalid & 0xF0);
+}
+
+
+#if defined(WITH_OID_SSSE3)
+/*
+ * Each ObjectId is split into its high and low nibbles, which are
+ * interleaved and then mapped to characters with a single shuffle.
+ */
+static void __attribute__((target("ssse3")))
+bson_oid_to_string_many_ssse3 (const bson_oid_t *oids,
+                               size_t            n_oids,
+                               char             *strs)
+{
+   const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6',
+                                        '7', '8', '9', 'a', 'b', 'c', 'd',
+                                        'e', 'f');
+   const __m128i mask = _mm_set1_epi8(0xF);
+   __m128i bytes;
+   __m128i hi;
+   __m128i lo;
+   bson_uint8_t buf[16] = { 0 };
+   size_t i;
+
+   for (i = 0; i < n_oids; i++, strs += 25) {
+      memcpy(buf, &oids[i], 12);
+      bytes = _mm_loadu_si128((const __m128i *)buf);
+      hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+      lo = _mm_and_si128(bytes, mask);
+      _mm_storeu_si128((__m128i *)strs,
+                       _mm_shuffle_epi8(digits, _mm_unpacklo_epi8(hi, lo)));
+      _mm_storel_epi64((__m128i *)(strs + 16),
+                       _mm_shuffle_epi8(digits, _mm_unpackhi_epi8(hi, lo)));
+      strs[24] = '\0';
+   }
+}
+
+
+/*
+ * Converts 16 characters to their nibble values and sets @valid to the
+ * mask of characters that were lowercase hex digits.
+ */
+static BSON_INLINE __m128i __attribute__((target("ssse3")))
+bson_oid_decode_ssse3 (__m128i  chars,
+                       int     *valid)
+{
+   __m128i digit;
+   __m128i alpha;
+
+   digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                         _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), chars));
+   alpha = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('a' - 1)),
+                         _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), chars));
+
+   *valid = _mm_movemask_epi8(_mm_or_si128(digit, alpha));
+
+   return _mm_or_si128(
+      _mm_and_si128(digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+      _mm_and_si128(alpha, _mm_sub_epi8(chars, _mm_set1_epi8('a' - 10))));
+}
+
+
+static size_t __attribute__((target("ssse3")))
+bson_oid_init_from_string_many_ssse3 (bson_oid_t        *oids,
+                                      const char *const *strs,
+                                      size_t             n_strs,
+                                      bson_bool_t       *valid)
+{
+   const __m128i weights = _mm_set1_epi16(0x0110);
+   bson_uint8_t buf[16];
+   __m128i a;
+   __m128i b;
+   size_t n_valid = 0;
+   size_t i;
+   int valid_a;
+   int valid_b;
+   bson_bool_t ok;
+
+   for (i = 0; i < n_strs; i++) {
+      /*
+       * The loads below read 24 bytes, so check the length first.
+       */
+      if (BSON_UNLIKELY(!bson_oid_string_has_length(strs[i]))) {
+         ok = FALSE;
+      } else {
+         a = _mm_loadu_si128((const __m128i *)strs[i]);
+         b = _mm_loadl_epi64((const __m128i *)(strs[i] + 16));
+
+         a = bson_oid_decode_ssse3(a, &valid_a);
+         b = bson_oid_decode_ssse3(b, &valid_b);
+
+         /*
+          * Multiply each pair of nibbles by (16, 1) and sum them, giving
+          * one byte per 16-bit lane which is then packed down.
+          */
+         a = _mm_maddubs_epi16(a, weights);
+         b = _mm_maddubs_epi16(b, weights);
+         _mm_storeu_si128((__m128i *)buf, _mm_packus_epi16(a, b));
+
+         ok = ((valid_a == 0xFFFF) && ((valid_b & 0xFF) == 0xFF));
+      }
+
+      if (BSON_LIKELY(ok)) {
+         memcpy(&oids[i], buf, 12);
+         n_valid++;
+      } else {
+         memset(&oids[i], 0, 12);
+      }
+
+      if (valid) {
+         valid[i] = ok;
+      }
+   }
+
+   return n_valid;
+}
+#endif
+
+
+void
+bson_oid_to_string_many (const bson_oid_t *oids,
+                         size_t            n_oids,
+                         char             *strs)
+{
+   size_t i;
+
+   bson_return_if_fail(oids || !n_oids);
+   bson_return_if_fail(strs || !n_oids);
+
+#if defined(WITH_OID_SSSE3)
+   if (__builtin_cpu_supports("ssse3")) {
+      bson_oid_to_string_many_ssse3(oids, n_oids, strs);
+      return;
+   }
+#endif
+
+   for (i = 0; i < n_oids; i++) {
+      bson_oid_to_string_scalar(&oids[i], strs + (25 * i));
+   }
+}
+
+
+size_t
+bson_oid_init_from_string_many (bson_oid_t        *oids,
+                                const char *const *strs,
+                                size_t             n_strs,
+                                bson_bool_t       *valid)
+{
+   size_t n_valid = 0;
+   size_t i;
+   bson_bool_t ok;
+
+   bson_return_val_if_fail(oids || !n_strs, 0);
+   bson_return_val_if_fail(strs || !n_strs, 0);
+
+#if defined(WITH_OID_SSSE3)
+   if (__builtin_cpu_supports("ssse3")) {
+      return bson_oid_init_from_string_many_ssse3(oids, strs, n_strs, valid);
+   }
+#endif
+
+   for (i = 0; i < n_strs; i++) {
+      ok = (bson_oid_string_has_length(strs[i]) &&
+            bson_oid_init_from_string_scalar(&oids[i], strs[i]));
+
+      if (ok) {
+         n_valid++;
+      } else {
+         memset(&oids[i], 0, 12);
+      }
+
+      if (valid) {
+         valid[i] = ok;
+      }
+   }
+
+   return n_valid;
+}
+
+
+/*
+ * Arrays smaller than this are insertion sorted, as clearing and scanning
+ * the radix histograms would cost more than the sort itself.
+ */
+#define BSON_OID_SORT_THRESHOLD 64
+
+
+static void
+bson_oid_insertion_sort (bson_oid_t *oids,
+                         size_t      n_oids,
+                         size_t     *permutation)
+{
+   bson_oid_t oid;
+   size_t index;
+   size_t i;
+   size_t j;
+
+   for (i = 1; i < n_oids; i++) {
+      oid = oids[i];
+      index = permutation ? permutation[i] : 0;
+
+      for (j = i; j && (bson_oid_compare_unsafe(&oids[j - 1], &oid) > 0); j--) {
+         oids[j] = oids[j - 1];
+         if (permutation) {
+            permutation[j] = permutation[j - 1];
+         }
+      }
+
+      oids[j] = oid;
+      if (permutation) {
+         permutation[j] = index;
+      }
+   }
+}
+
+
+void
+bson_oid_sort (bson_oid_t *oids,
+               size_t      n_oids,
+               size_t     *permutation)
+{
+   bson_oid_t *src;
+   bson_oid_t *dst;
+   bson_oid_t *tmp;
+   bson_oid_t *swap;
+   size_t *psrc;
+   size_t *pdst;
+   size_t *pswap;
+   size_t *ptmp = NULL;
+   size_t *counts;
+   size_t *count;
+   size_t offset;
+   size_t c;
+   size_t i;
+   bson_uint8_t digit;
+   int b;
+
+   bson_return_if_fail(oids || !n_oids);
+
+   if (permutation) {
+      for (i = 0; i < n_oids; i++) {
+         permutation[i] = i;
+      }
+   }
+
+   if (n_oids < BSON_OID_SORT_THRESHOLD) {
+      bson_oid_insertion_sort(oids, n_oids, permutation);
+      return;
+   }
+
+   /*
+    * The histograms for all 12 bytes are independent of the order of the
+    * ObjectIds, so they are all gathered in a single pass up front.
+    */
+   counts = bson_malloc0(12 * 256 * sizeof *counts);
+
+   for (i = 0; i < n_oids; i++) {
+      for (b = 0; b < 12; b++) {
+         counts[(b * 256) + oids[i].bytes[b]]++;
+      }
+   }
+
+   tmp = bson_malloc(n_oids * sizeof *tmp);
+   if (permutation) {
+      ptmp = bson_malloc(n_oids * sizeof *ptmp);
+   }
+
+   src = oids;
+   dst = tmp;
+   psrc = permutation;
+   pdst = ptmp;
+
+   for (b = 11; b >= 0; b--) {
+      count = counts + (b * 256);
+
+      if (count[src[0].bytes[b]] == n_oids) {
+         continue;
+      }
+
+      for (offset = 0, i = 0; i < 256; i++) {
+         c = count[i];
+         count[i] = offset;
+         offset += c;
+      }
+
+      for (i = 0; i < n_oids; i++) {
+         digit = src[i].bytes[b];
+         dst[count[digit]] = src[i];
+         if (psrc) {
+            pdst[count[digit]] = psrc[i];
+         }
+         count[digit]++;
+      }
+
+      swap = src;
+      src = dst;
+      dst = swap;
+
+      pswap = psrc;
+      psrc = pdst;
+      pdst = pswap;
+   }
+
+   if (src != oids) {
+      memcpy(oids, src, n_oids * sizeof *oids);
+      if (permutation) {
+         memcpy(permutation, psrc, n_oids * sizeof *permutation);
+      }
+   }
+
+   bson_free(counts);
+   bson_free(tmp);
+   bson_free(ptmp);
+}
+
+
+bson_bool_t
+bson_oid_bsearch (const bson_oid_t *oids,
+                  size_t            n_oids,
+                  const bson_oid_t *oid,
+                  size_t           *index)
+{
+   size_t lo = 0;
+   size_t hi = n_oids;
+   size_t mid;
+
+   bson_return_val_if_fail(oids || !n_oids, FALSE);
+   bson_return_val_if_fail(oid, FALSE);
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) / 2);
+      if (bson_oid_compare_unsafe(&oids[mid], oid) < 0) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (index) {
+      *index = lo;
+   }
+
+   return ((lo < n_oids) && bson_oid_equal_unsafe(&oids[lo], oid));
+}
+
+
+size_t
+bson_oid_intersect (const bson_oid_t *a,
+                    size_t            n_a,
+                    const bson_oid_t *b,
+                    size_t            n_b,
+                    bson_oid_t       *out)
+{
+   size_t i = 0;
+   size_t j = 0;
+   size_t n = 0;
+   int cmp;
+
+   bson_return_val_if_fail(a || !n_a, 0);
+   bson_return_val_if_fail(b || !n_b, 0);
+   bson_return_val_if_fail(out || !n_a || !n_b, 0);
+
+   while ((i < n_a) && (j < n_b)) {
+      cmp = bson_oid_compare_unsafe(&a[i], &b[j]);
+      if (cmp < 0) {
+         i++;
+      } else if (cmp > 0) {
+         j++;
+      } else {
+         out[n++] = a[i];
+         i++;
+         j++;
+      }
+   }
+
+   return n;
+}
+
+
+size_t
+bson_oid_union (const bson_oid_t *a,
+                size_t            n_a,
+                const bson_oid_t *b,
+                size_t            n_b,
+                bson_oid_t       *out)
+{
+   size_t i = 0;
+   size_t j = 0;
+   size_t n = 0;
+   int cmp;
+
+   bson_return_val_if_fail(a || !n_a, 0);
+   bson_return_val_if_fail(b || !n_b, 0);
+   bson_return_val_if_fail(out || (!n_a && !n_b), 0);
+
+   while ((i < n_a) && (j < n_b)) {
+      cmp = bson_oid_compare_unsafe(&a[i], &b[j]);
+      if (cmp < 0) {
+         out[n++] = a[i++];
+      } else if (cmp > 0) {
+         out[n++] = b[j++];
+      } else {
+         out[n++] = a[i];
+         i++;
+         j++;
+      }
+   }
+
+   for (; i < n_a; i++) {
+      out[n++] = a[i];
+   }
+
+   for (; j < n_b; j++) {
+      out[n++] = b[j];
+   }
+
+   return n;
+}
@@ -27,6 +27,7 @@
 #include <time.h>
 
 #include "bson-context.h"
+#include "bson-endian.h"
 #include "bson-macros.h"
 #include "bson-types.h"
 
@@ -130,6 +131,26 @@ bson_oid_init (bson_oid_t     *oid,
                bson_context_t *context);
 
 
+/**
+ * bson_oid_init_many:
+ * @oids: An array of @n_oids bson_oid_t to initialize.
+ * @n_oids: The number of elements in @oids.
+ * @context: A bson_context_t or NULL.
+ *
+ * Initializes @n_oids ObjectIds like calling bson_oid_init() on each of
+ * them. The timestamp, host and pid are only sampled once and the sequence
+ * numbers are reserved from @context with a single atomic operation, which
+ * makes this much cheaper for bulk inserts.
+ *
+ * The resulting ObjectIds share the same timestamp and have consecutive
+ * sequence numbers, wrapping around after 0xFFFFFF.
+ */
+void
+bson_oid_init_many (bson_oid_t     *oids,
+                    size_t          n_oids,
+                    bson_context_t *context);
+
+
 /**
  * bson_oid_init_from_data:
  * @oid: A bson_oid_t to initialize.
@@ -187,6 +208,137 @@ bson_oid_to_string (const bson_oid_t *oid,
                     char              str[25]);
 
 
+/**
+ * bson_oid_to_string_many:
+ * @oids: An array of @n_oids bson_oid_t.
+ * @n_oids: The number of elements in @oids.
+ * @strs: A buffer of at least 25 * @n_oids bytes.
+ *
+ * Formats @n_oids ObjectIds like bson_oid_to_string(). The string for
+ * @oids[i] is stored NUL-terminated at @strs + (25 * i).
+ *
+ * On x86 processors supporting SSSE3 several characters are converted at
+ * once, which is considerably faster than looping over
+ * bson_oid_to_string().
+ */
+void
+bson_oid_to_string_many (const bson_oid_t *oids,
+                         size_t            n_oids,
+                         char             *strs);
+
+
+/**
+ * bson_oid_init_from_string_many:
+ * @oids: An array of @n_strs bson_oid_t to initialize.
+ * @strs: An array of @n_strs NUL-terminated strings.
+ * @n_strs: The number of elements in @strs.
+ * @valid: An array of @n_strs locations for the results, or NULL.
+ *
+ * Parses @n_strs hex encoded ObjectIds, validating them at the same time.
+ * A string is valid when it passes bson_oid_is_valid() with its length,
+ * so it must be exactly 24 characters long.
+ * Invalid strings result in a zeroed bson_oid_t and, if @valid is not NULL,
+ * FALSE being stored in @valid.
+ *
+ * Like bson_oid_to_string_many(), this uses SSSE3 when available.
+ *
+ * Returns: The number of valid strings.
+ */
+size_t
+bson_oid_init_from_string_many (bson_oid_t        *oids,
+                                const char *const *strs,
+                                size_t             n_strs,
+                                bson_bool_t       *valid);
+
+
+/**
+ * bson_oid_sort:
+ * @oids: An array of @n_oids bson_oid_t.
+ * @n_oids: The number of elements in @oids.
+ * @permutation: An array of @n_oids indexes, or NULL.
+ *
+ * Sorts @oids in place into the order defined by bson_oid_compare(). The
+ * sort is stable.
+ *
+ * If @permutation is not NULL, @permutation[i] is set to the original index
+ * of the ObjectId that ends up at @oids[i], which allows sorting a parallel
+ * array of values afterwards.
+ *
+ * Large arrays are radix sorted a byte at a time, skipping every byte that
+ * is the same in all ObjectIds (such as the host and pid bytes of ids from
+ * a single process).
+ */
+void
+bson_oid_sort (bson_oid_t *oids,
+               size_t      n_oids,
+               size_t     *permutation);
+
+
+/**
+ * bson_oid_bsearch:
+ * @oids: A sorted array of @n_oids bson_oid_t.
+ * @n_oids: The number of elements in @oids.
+ * @oid: The bson_oid_t to find.
+ * @index: A location for the resulting index, or NULL.
+ *
+ * Performs a binary search for @oid in @oids, which must be sorted as by
+ * bson_oid_sort(). If @oid is found, @index is set to the index of its
+ * first occurrence. Otherwise @index is set to the index at which @oid
+ * would have to be inserted to keep @oids sorted.
+ *
+ * Returns: TRUE if @oid was found.
+ */
+bson_bool_t
+bson_oid_bsearch (const bson_oid_t *oids,
+                  size_t            n_oids,
+                  const bson_oid_t *oid,
+                  size_t           *index);
+
+
+/**
+ * bson_oid_intersect:
+ * @a: A sorted array of @n_a bson_oid_t.
+ * @n_a: The number of elements in @a.
+ * @b: A sorted array of @n_b bson_oid_t.
+ * @n_b: The number of elements in @b.
+ * @out: A location for at least MIN(@n_a, @n_b) bson_oid_t.
+ *
+ * Stores the ObjectIds found in both @a and @b into @out, in sorted order.
+ * An ObjectId present m times in @a and n times in @b is stored MIN(m, n)
+ * times.
+ *
+ * Returns: The number of ObjectIds stored in @out.
+ */
+size_t
+bson_oid_intersect (const bson_oid_t *a,
+                    size_t            n_a,
+                    const bson_oid_t *b,
+                    size_t            n_b,
+                    bson_oid_t       *out);
+
+
+/**
+ * bson_oid_union:
+ * @a: A sorted array of @n_a bson_oid_t.
+ * @n_a: The number of elements in @a.
+ * @b: A sorted array of @n_b bson_oid_t.
+ * @n_b: The number of elements in @b.
+ * @out: A location for at least @n_a + @n_b bson_oid_t.
+ *
+ * Stores the ObjectIds found in either @a or @b into @out, in sorted
+ * order. An ObjectId present m times in @a and n times in @b is stored
+ * MAX(m, n) times.
+ *
+ * Returns: The number of ObjectIds stored in @out.
+ */
+size_t
+bson_oid_union (const bson_oid_t *a,
+                size_t            n_a,
+                const bson_oid_t *b,
+                size_t            n_b,
+                bson_oid_t       *out);
+
+
 /**
  * bson_oid_compare_unsafe:
  * @oid1: A bson_oid_t.
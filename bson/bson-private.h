@@ -35,6 +35,9 @@ typedef enum
    BSON_FLAG_CHILD    = 1 << 3,
    BSON_FLAG_IN_CHILD = 1 << 4,
    BSON_FLAG_NO_FREE  = 1 << 5,
+   BSON_FLAG_HASHED   = 1 << 6,
+   BSON_FLAG_VALID    = 1 << 7,
+   BSON_FLAG_BORROWED = 1 << 8,
 } bson_flags_t;
 
 
@@ -64,6 +67,8 @@ typedef struct
    bson_uint8_t       *alloc;    /* buffer that we own. */
    size_t              alloclen; /* length of buffer that we own. */
    bson_realloc_func   realloc;  /* our realloc implementation */
+   bson_uint64_t       hash[4];  /* running hash lanes if HASHED */
+   bson_uint32_t       hash_len; /* bytes of elements in running hash */
 } bson_impl_alloc_t
 BSON_ALIGNED_END(128);
 
@@ -71,6 +76,17 @@ BSON_ALIGNED_END(128);
 BSON_STATIC_ASSERT(sizeof(bson_impl_alloc_t) <= 128);
 
 
+bson_bool_t
+bson_append_raw (bson_t             *bson,
+                 const bson_uint8_t *data,
+                 size_t              len);
+
+
+void
+bson_hash_rewind (bson_t        *bson,
+                  bson_uint32_t  offset);
+
+
 BSON_END_DECLS
 
 
@@ -27,6 +27,7 @@ typedef enum
 {
    BSON_READER_FD = 1,
    BSON_READER_DATA = 2,
+   BSON_READER_IOVEC = 3,
 } bson_reader_type_t;
 
 
@@ -56,6 +57,23 @@ typedef struct
 } bson_reader_data_t;
 
 
+#ifndef BSON_OS_WIN32
+typedef struct
+{
+   bson_reader_type_t  type;
+   struct iovec       *iov;
+   size_t              n_iov;
+   size_t              index;
+   size_t              offset;
+   size_t              consumed;
+   size_t              length;
+   bson_uint8_t       *bounce;
+   size_t              bounce_len;
+   bson_t              inline_bson;
+} bson_reader_iovec_t;
+#endif
+
+
 static void
 bson_reader_fd_fill_buffer (bson_reader_fd_t *reader)
 {
@@ -273,6 +291,169 @@ bson_reader_data_tell (bson_reader_data_t *reader)
 }
 
 
+#ifndef BSON_OS_WIN32
+bson_reader_t *
+bson_reader_new_from_iovec (const struct iovec *iov,
+                            size_t              n_iov)
+{
+   bson_reader_iovec_t *real;
+   size_t i;
+
+   bson_return_val_if_fail(iov || !n_iov, NULL);
+
+   real = bson_malloc0(sizeof *real);
+   real->type = BSON_READER_IOVEC;
+   real->iov = bson_malloc0(MAX(1, n_iov) * sizeof *iov);
+   real->n_iov = n_iov;
+
+   for (i = 0; i < n_iov; i++) {
+      real->iov[i] = iov[i];
+      real->length += iov[i].iov_len;
+   }
+
+   return (bson_reader_t *)real;
+}
+
+
+/*
+ * Copies @len bytes starting at the current position of @reader to @buf,
+ * across as many segments as needed, without moving the position.
+ */
+static bson_bool_t
+bson_reader_iovec_gather (bson_reader_iovec_t *reader,
+                          bson_uint8_t        *buf,
+                          size_t               len)
+{
+   size_t index = reader->index;
+   size_t offset = reader->offset;
+   size_t n;
+
+   while (len) {
+      if (index == reader->n_iov) {
+         return FALSE;
+      }
+      n = MIN(len, reader->iov[index].iov_len - offset);
+      memcpy(buf, (const bson_uint8_t *)reader->iov[index].iov_base + offset,
+             n);
+      buf += n;
+      len -= n;
+      offset += n;
+      if (offset == reader->iov[index].iov_len) {
+         offset = 0;
+         index++;
+      }
+   }
+
+   return TRUE;
+}
+
+
+static void
+bson_reader_iovec_skip (bson_reader_iovec_t *reader,
+                        size_t               len)
+{
+   size_t n;
+
+   while (len) {
+      n = MIN(len, reader->iov[reader->index].iov_len - reader->offset);
+      len -= n;
+      reader->offset += n;
+      if (reader->offset == reader->iov[reader->index].iov_len) {
+         reader->consumed += reader->offset;
+         reader->offset = 0;
+         reader->index++;
+      }
+   }
+}
+
+
+static const bson_t *
+bson_reader_iovec_read (bson_reader_iovec_t *reader,
+                        bson_bool_t         *reached_eof)
+{
+   const bson_uint8_t *data;
+   bson_uint32_t blen;
+   size_t avail;
+
+   bson_return_val_if_fail(reader, NULL);
+
+   if (reached_eof) {
+      *reached_eof = FALSE;
+   }
+
+   /*
+    * Skip past finished and empty segments.
+    */
+   while ((reader->index < reader->n_iov) &&
+          (reader->offset == reader->iov[reader->index].iov_len)) {
+      reader->consumed += reader->offset;
+      reader->offset = 0;
+      reader->index++;
+   }
+
+   if (reader->index == reader->n_iov) {
+      if (reached_eof) {
+         *reached_eof = TRUE;
+      }
+      return NULL;
+   }
+
+   data = (const bson_uint8_t *)reader->iov[reader->index].iov_base +
+          reader->offset;
+   avail = reader->iov[reader->index].iov_len - reader->offset;
+
+   if (avail >= 4) {
+      memcpy(&blen, data, sizeof blen);
+   } else if (!bson_reader_iovec_gather(reader, (bson_uint8_t *)&blen,
+                                        sizeof blen)) {
+      return NULL;
+   }
+
+   blen = BSON_UINT32_FROM_LE(blen);
+
+   if (blen <= avail) {
+      if (!bson_init_static(&reader->inline_bson, data, blen)) {
+         return NULL;
+      }
+      reader->offset += blen;
+   } else {
+      /*
+       * The document straddles segments, so copy it into the bounce
+       * buffer, which only ever grows.
+       */
+      if ((blen < 5) || (blen > (reader->length - reader->consumed -
+                                 reader->offset))) {
+         return NULL;
+      }
+      if (blen > reader->bounce_len) {
+         reader->bounce_len = bson_next_power_of_two(blen);
+         bson_free(reader->bounce);
+         reader->bounce = bson_malloc(reader->bounce_len);
+      }
+      bson_reader_iovec_gather(reader, reader->bounce, blen);
+      if (!bson_init_static(&reader->inline_bson, reader->bounce, blen)) {
+         return NULL;
+      }
+      bson_reader_iovec_skip(reader, blen);
+   }
+
+   if (reached_eof) {
+      *reached_eof = ((reader->consumed + reader->offset) == reader->length);
+   }
+
+   return &reader->inline_bson;
+}
+
+
+static off_t
+bson_reader_iovec_tell (bson_reader_iovec_t *reader)
+{
+   bson_return_val_if_fail(reader, -1);
+   return reader->consumed + reader->offset;
+}
+#endif
+
+
 void
 bson_reader_destroy (bson_reader_t *reader)
 {
@@ -291,6 +472,15 @@ bson_reader_destroy (bson_reader_t *reader)
       break;
    case BSON_READER_DATA:
       break;
+#ifndef BSON_OS_WIN32
+   case BSON_READER_IOVEC:
+      {
+         bson_reader_iovec_t *iovec = (bson_reader_iovec_t *)reader;
+         bson_free(iovec->iov);
+         bson_free(iovec->bounce);
+      }
+      break;
+#endif
    default:
       fprintf(stderr, "No such reader type: %02x\n", reader->type);
       break;
@@ -313,6 +503,11 @@ bson_reader_read (bson_reader_t *reader,
       return bson_reader_fd_read((bson_reader_fd_t *)reader, reached_eof);
    case BSON_READER_DATA:
       return bson_reader_data_read((bson_reader_data_t *)reader, reached_eof);
+#ifndef BSON_OS_WIN32
+   case BSON_READER_IOVEC:
+      return bson_reader_iovec_read((bson_reader_iovec_t *)reader,
+                                    reached_eof);
+#endif
    default:
       fprintf(stderr, "No such reader type: %02x\n", reader->type);
       break;
@@ -332,6 +527,10 @@ bson_reader_tell (bson_reader_t *reader)
       return bson_reader_fd_tell((bson_reader_fd_t *)reader);
    case BSON_READER_DATA:
       return bson_reader_data_tell((bson_reader_data_t *)reader);
+#ifndef BSON_OS_WIN32
+   case BSON_READER_IOVEC:
+      return bson_reader_iovec_tell((bson_reader_iovec_t *)reader);
+#endif
    default:
       fprintf(stderr, "No such reader type: %02x\n", reader->type);
       return -1;
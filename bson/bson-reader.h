@@ -27,6 +27,10 @@
 #include "bson-oid.h"
 #include "bson-types.h"
 
+#ifndef BSON_OS_WIN32
+#  include <sys/uio.h>
+#endif
+
 
 BSON_BEGIN_DECLS
 
@@ -66,6 +70,30 @@ bson_reader_new_from_data (const bson_uint8_t *data,
                            size_t              length);
 
 
+#ifndef BSON_OS_WIN32
+/**
+ * bson_reader_new_from_iovec:
+ * @iov: An array of @n_iov struct iovec.
+ * @n_iov: The number of elements in @iov.
+ *
+ * Allocates and initializes a new bson_reader_t that will read the segments
+ * of @iov, such as a chain of fixed size receive buffers, as one stream of
+ * BSON documents without first copying them together.
+ *
+ * Documents that lie within a single segment are returned in place. Only
+ * documents that straddle segments are copied, into a buffer owned by the
+ * reader that is reused for each of them. The memory described by @iov must
+ * outlive the reader, but @iov itself is copied.
+ *
+ * Returns: (transfer full): A newly allocated bson_reader_t that should be
+ *   freed with bson_reader_destroy().
+ */
+bson_reader_t *
+bson_reader_new_from_iovec (const struct iovec *iov,
+                            size_t              n_iov);
+#endif
+
+
 
 /**
  * bson_reader_destroy:
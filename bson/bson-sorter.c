@@ -0,0 +1,1196 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bson.h"
+#include "bson-sorter.h"
+#include "bson-thread.h"
+
+
+#define BSON_SORTER_MAX_KEYS        16
+#define BSON_SORTER_MAX_DEPTH       100
+#define BSON_SORTER_DEFAULT_RUN     (64 * 1024 * 1024)
+#define BSON_SORTER_SPILL_BUFFER    (256 * 1024)
+#define BSON_SORTER_INSERTION_SORT  16
+
+
+typedef struct
+{
+   bson_uint32_t offset; /* Offset of the value within the document. */
+   bson_uint32_t type;   /* Type of the value, or null if missing. */
+} bson_sorter_key_t;
+
+
+typedef struct
+{
+   char        *dotkey;
+   bson_bool_t  ascending;
+} bson_sorter_field_t;
+
+
+typedef struct
+{
+   const bson_sorter_t *sorter;
+   bson_uint8_t        *buf;
+   size_t               len;
+   size_t               alloc;
+   size_t              *docs;
+   bson_sorter_key_t   *keys;
+   bson_uint32_t       *order;
+   bson_uint32_t       *tmp;
+   bson_uint32_t        n_docs;
+   bson_uint32_t        docs_alloc;
+   int                  fd;
+   bson_int64_t         usec;
+   bson_bool_t          failed;
+   bson_error_t         error;
+} bson_sorter_run_t;
+
+
+typedef struct
+{
+   bson_sorter_run_t *run;
+   bson_thread_t      thread;
+   bson_bool_t        active;
+} bson_sorter_worker_t;
+
+
+typedef struct
+{
+   bson_reader_t     *reader;
+   const bson_t      *doc;
+   bson_uint32_t      index;
+   bson_sorter_key_t  keys[BSON_SORTER_MAX_KEYS];
+} bson_sorter_source_t;
+
+
+struct _bson_sorter_t
+{
+   size_t                    run_size;
+   bson_uint32_t             n_threads;
+   bson_uint32_t             n_keys;
+   bson_sorter_field_t       keys[BSON_SORTER_MAX_KEYS];
+   bson_sorter_compare_func  compare;
+   void                     *compare_data;
+   char                     *tmpdir;
+   bson_sorter_run_t        *runs;
+   bson_sorter_worker_t     *workers;
+   bson_uint32_t             next_worker;
+   int                      *spills;
+   bson_uint32_t             n_spills;
+   bson_sorter_stats_t       stats;
+};
+
+
+bson_sorter_t *
+bson_sorter_new (size_t        run_size,
+                 bson_uint32_t n_threads)
+{
+   bson_sorter_t *sorter;
+
+   sorter = bson_malloc0(sizeof *sorter);
+   sorter->run_size = run_size ? run_size : BSON_SORTER_DEFAULT_RUN;
+   sorter->n_threads = n_threads ? n_threads : 1;
+
+   return sorter;
+}
+
+
+void
+bson_sorter_destroy (bson_sorter_t *sorter)
+{
+   bson_uint32_t i;
+
+   if (sorter) {
+      for (i = 0; i < sorter->n_keys; i++) {
+         bson_free(sorter->keys[i].dotkey);
+      }
+      bson_free(sorter->tmpdir);
+      bson_free(sorter);
+   }
+}
+
+
+bson_bool_t
+bson_sorter_add_key (bson_sorter_t *sorter,
+                     const char    *dotkey,
+                     bson_bool_t    ascending)
+{
+   bson_return_val_if_fail(sorter, FALSE);
+   bson_return_val_if_fail(dotkey, FALSE);
+
+   if (sorter->n_keys == BSON_SORTER_MAX_KEYS) {
+      return FALSE;
+   }
+
+   sorter->keys[sorter->n_keys].dotkey = bson_strdup(dotkey);
+   sorter->keys[sorter->n_keys].ascending = !!ascending;
+   sorter->n_keys++;
+
+   return TRUE;
+}
+
+
+void
+bson_sorter_set_compare_func (bson_sorter_t            *sorter,
+                              bson_sorter_compare_func  compare,
+                              void                     *data)
+{
+   bson_return_if_fail(sorter);
+
+   sorter->compare = compare;
+   sorter->compare_data = data;
+}
+
+
+void
+bson_sorter_set_tmpdir (bson_sorter_t *sorter,
+                        const char    *tmpdir)
+{
+   bson_return_if_fail(sorter);
+
+   bson_free(sorter->tmpdir);
+   sorter->tmpdir = tmpdir ? bson_strdup(tmpdir) : NULL;
+}
+
+
+void
+bson_sorter_get_stats (const bson_sorter_t *sorter,
+                       bson_sorter_stats_t *stats)
+{
+   bson_return_if_fail(sorter);
+   bson_return_if_fail(stats);
+
+   *stats = sorter->stats;
+}
+
+
+static int
+_bson_sorter_type_order (bson_type_t type)
+{
+   /*
+    * Values of different types are ordered the same way MongoDB orders them.
+    * Numbers compare by value regardless of their type.
+    */
+   switch (type) {
+   case BSON_TYPE_MINKEY:
+      return 1;
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_NULL:
+      return 2;
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+      return 3;
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_SYMBOL:
+      return 4;
+   case BSON_TYPE_DOCUMENT:
+      return 5;
+   case BSON_TYPE_ARRAY:
+      return 6;
+   case BSON_TYPE_BINARY:
+      return 7;
+   case BSON_TYPE_OID:
+      return 8;
+   case BSON_TYPE_BOOL:
+      return 9;
+   case BSON_TYPE_DATE_TIME:
+      return 10;
+   case BSON_TYPE_TIMESTAMP:
+      return 11;
+   case BSON_TYPE_REGEX:
+      return 12;
+   case BSON_TYPE_DBPOINTER:
+      return 13;
+   case BSON_TYPE_CODE:
+      return 14;
+   case BSON_TYPE_CODEWSCOPE:
+      return 15;
+   case BSON_TYPE_MAXKEY:
+      return 16;
+   case BSON_TYPE_EOD:
+   default:
+      return 0;
+   }
+}
+
+
+static BSON_INLINE bson_uint32_t
+_bson_sorter_read_uint32 (const bson_uint8_t *data)
+{
+   bson_uint32_t v;
+
+   memcpy(&v, data, 4);
+   return BSON_UINT32_FROM_LE(v);
+}
+
+
+static BSON_INLINE bson_uint64_t
+_bson_sorter_read_uint64 (const bson_uint8_t *data)
+{
+   bson_uint64_t v;
+
+   memcpy(&v, data, 8);
+   return BSON_UINT64_FROM_LE(v);
+}
+
+
+static double
+_bson_sorter_read_double (bson_type_t         type,
+                          const bson_uint8_t *data)
+{
+   double d;
+
+   if (type == BSON_TYPE_DOUBLE) {
+      memcpy(&d, data, 8);
+      return BSON_DOUBLE_FROM_LE(d);
+   } else if (type == BSON_TYPE_INT32) {
+      return (bson_int32_t)_bson_sorter_read_uint32(data);
+   }
+
+   return (double)(bson_int64_t)_bson_sorter_read_uint64(data);
+}
+
+
+static int
+_bson_sorter_compare_number (bson_type_t         atype,
+                             const bson_uint8_t *a,
+                             bson_type_t         btype,
+                             const bson_uint8_t *b)
+{
+   bson_int64_t ai;
+   bson_int64_t bi;
+   double ad;
+   double bd;
+
+   if ((atype == BSON_TYPE_DOUBLE) || (btype == BSON_TYPE_DOUBLE)) {
+      ad = _bson_sorter_read_double(atype, a);
+      bd = _bson_sorter_read_double(btype, b);
+
+      /*
+       * NaN sorts before all other numbers.
+       */
+      if (ad != ad) {
+         return (bd != bd) ? 0 : -1;
+      } else if (bd != bd) {
+         return 1;
+      }
+
+      return (ad < bd) ? -1 : (ad > bd);
+   }
+
+   if (atype == BSON_TYPE_INT32) {
+      ai = (bson_int32_t)_bson_sorter_read_uint32(a);
+   } else {
+      ai = (bson_int64_t)_bson_sorter_read_uint64(a);
+   }
+
+   if (btype == BSON_TYPE_INT32) {
+      bi = (bson_int32_t)_bson_sorter_read_uint32(b);
+   } else {
+      bi = (bson_int64_t)_bson_sorter_read_uint64(b);
+   }
+
+   return (ai < bi) ? -1 : (ai > bi);
+}
+
+
+static int
+_bson_sorter_compare_string (const bson_uint8_t *a,
+                             const bson_uint8_t *b)
+{
+   bson_uint32_t alen;
+   bson_uint32_t blen;
+   int ret;
+
+   alen = _bson_sorter_read_uint32(a);
+   blen = _bson_sorter_read_uint32(b);
+
+   if ((ret = memcmp(a + 4, b + 4, (alen < blen) ? alen : blen))) {
+      return ret;
+   }
+
+   return (alen < blen) ? -1 : (alen > blen);
+}
+
+
+static int
+_bson_sorter_compare_value (bson_type_t         atype,
+                            const bson_uint8_t *a,
+                            bson_type_t         btype,
+                            const bson_uint8_t *b,
+                            int                 depth);
+
+
+static const bson_uint8_t *
+_bson_sorter_iter_value (const bson_iter_t *iter)
+{
+   const char *key;
+
+   key = bson_iter_key(iter);
+   return (const bson_uint8_t *)key + strlen(key) + 1;
+}
+
+
+static int
+_bson_sorter_compare_document (const bson_uint8_t *a,
+                               const bson_uint8_t *b,
+                               int                 depth)
+{
+   bson_iter_t aiter;
+   bson_iter_t biter;
+   bson_bool_t anext;
+   bson_bool_t bnext;
+   bson_t abson;
+   bson_t bbson;
+   int aorder;
+   int border;
+   int ret;
+
+   if (depth > BSON_SORTER_MAX_DEPTH) {
+      return 0;
+   }
+
+   if (!bson_init_static(&abson, a, _bson_sorter_read_uint32(a)) ||
+       !bson_init_static(&bbson, b, _bson_sorter_read_uint32(b)) ||
+       !bson_iter_init(&aiter, &abson) ||
+       !bson_iter_init(&biter, &bbson)) {
+      return 0;
+   }
+
+   for (;;) {
+      anext = bson_iter_next(&aiter);
+      bnext = bson_iter_next(&biter);
+
+      if (!anext || !bnext) {
+         return (int)anext - (int)bnext;
+      }
+
+      aorder = _bson_sorter_type_order(bson_iter_type(&aiter));
+      border = _bson_sorter_type_order(bson_iter_type(&biter));
+      if (aorder != border) {
+         return (aorder < border) ? -1 : 1;
+      }
+
+      if ((ret = strcmp(bson_iter_key(&aiter), bson_iter_key(&biter)))) {
+         return ret;
+      }
+
+      ret = _bson_sorter_compare_value(bson_iter_type(&aiter),
+                                       _bson_sorter_iter_value(&aiter),
+                                       bson_iter_type(&biter),
+                                       _bson_sorter_iter_value(&biter),
+                                       depth + 1);
+      if (ret) {
+         return ret;
+      }
+   }
+}
+
+
+static int
+_bson_sorter_compare_value (bson_type_t         atype,
+                            const bson_uint8_t *a,
+                            bson_type_t         btype,
+                            const bson_uint8_t *b,
+                            int                 depth)
+{
+   bson_uint32_t alen;
+   bson_uint32_t blen;
+   bson_uint64_t au;
+   bson_uint64_t bu;
+   bson_int64_t ai;
+   bson_int64_t bi;
+   size_t len;
+   int aorder;
+   int border;
+   int ret;
+
+   aorder = _bson_sorter_type_order(atype);
+   border = _bson_sorter_type_order(btype);
+
+   if (aorder != border) {
+      return (aorder < border) ? -1 : 1;
+   }
+
+   switch (atype) {
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+      return _bson_sorter_compare_number(atype, a, btype, b);
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_SYMBOL:
+   case BSON_TYPE_CODE:
+      return _bson_sorter_compare_string(a, b);
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+      return _bson_sorter_compare_document(a, b, depth);
+   case BSON_TYPE_BINARY:
+      alen = _bson_sorter_read_uint32(a);
+      blen = _bson_sorter_read_uint32(b);
+      if (alen != blen) {
+         return (alen < blen) ? -1 : 1;
+      }
+      if (a[4] != b[4]) {
+         return (a[4] < b[4]) ? -1 : 1;
+      }
+      return memcmp(a + 5, b + 5, alen);
+   case BSON_TYPE_OID:
+      return memcmp(a, b, 12);
+   case BSON_TYPE_BOOL:
+      return (int)!!a[0] - (int)!!b[0];
+   case BSON_TYPE_DATE_TIME:
+      ai = (bson_int64_t)_bson_sorter_read_uint64(a);
+      bi = (bson_int64_t)_bson_sorter_read_uint64(b);
+      return (ai < bi) ? -1 : (ai > bi);
+   case BSON_TYPE_TIMESTAMP:
+      au = _bson_sorter_read_uint64(a);
+      bu = _bson_sorter_read_uint64(b);
+      return (au < bu) ? -1 : (au > bu);
+   case BSON_TYPE_REGEX:
+      if ((ret = strcmp((const char *)a, (const char *)b))) {
+         return ret;
+      }
+      return strcmp((const char *)a + strlen((const char *)a) + 1,
+                    (const char *)b + strlen((const char *)b) + 1);
+   case BSON_TYPE_DBPOINTER:
+      if ((ret = _bson_sorter_compare_string(a, b))) {
+         return ret;
+      }
+      len = 4 + _bson_sorter_read_uint32(a);
+      return memcmp(a + len, b + len, 12);
+   case BSON_TYPE_CODEWSCOPE:
+      if ((ret = _bson_sorter_compare_string(a + 4, b + 4))) {
+         return ret;
+      }
+      len = 8 + _bson_sorter_read_uint32(a + 4);
+      return _bson_sorter_compare_document(a + len, b + len, depth);
+   case BSON_TYPE_EOD:
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+   default:
+      return 0;
+   }
+}
+
+
+static void
+_bson_sorter_extract (const bson_sorter_t *sorter,
+                      const bson_uint8_t  *data,
+                      const bson_t        *doc,
+                      bson_sorter_key_t   *keys)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_uint32_t i;
+
+   for (i = 0; i < sorter->n_keys; i++) {
+      keys[i].offset = 0;
+      keys[i].type = BSON_TYPE_NULL;
+
+      if (bson_iter_init(&iter, doc) &&
+          bson_iter_find_descendant(&iter, sorter->keys[i].dotkey, &child)) {
+         keys[i].offset = (bson_uint32_t)(_bson_sorter_iter_value(&child) -
+                                          data);
+         keys[i].type = bson_iter_type(&child);
+      }
+   }
+}
+
+
+static int
+_bson_sorter_compare (const bson_sorter_t     *sorter,
+                      const bson_uint8_t      *a,
+                      const bson_sorter_key_t *akeys,
+                      const bson_uint8_t      *b,
+                      const bson_sorter_key_t *bkeys)
+{
+   bson_uint32_t i;
+   bson_t abson;
+   bson_t bbson;
+   int ret;
+
+   if (sorter->compare) {
+      bson_init_static(&abson, a, _bson_sorter_read_uint32(a));
+      bson_init_static(&bbson, b, _bson_sorter_read_uint32(b));
+      return sorter->compare(&abson, &bbson, sorter->compare_data);
+   }
+
+   for (i = 0; i < sorter->n_keys; i++) {
+      ret = _bson_sorter_compare_value(akeys[i].type, a + akeys[i].offset,
+                                       bkeys[i].type, b + bkeys[i].offset,
+                                       0);
+      if (ret) {
+         return sorter->keys[i].ascending ? ret : -ret;
+      }
+   }
+
+   return 0;
+}
+
+
+static void
+_bson_sorter_run_init (bson_sorter_run_t   *run,
+                       const bson_sorter_t *sorter)
+{
+   memset(run, 0, sizeof *run);
+   run->sorter = sorter;
+   run->fd = -1;
+}
+
+
+static void
+_bson_sorter_run_reset (bson_sorter_run_t *run)
+{
+   run->len = 0;
+   run->n_docs = 0;
+   run->fd = -1;
+   run->usec = 0;
+   run->failed = FALSE;
+}
+
+
+static void
+_bson_sorter_run_destroy (bson_sorter_run_t *run)
+{
+   if (run->fd != -1) {
+      close(run->fd);
+   }
+   bson_free(run->buf);
+   bson_free(run->docs);
+   bson_free(run->keys);
+   bson_free(run->order);
+   bson_free(run->tmp);
+}
+
+
+static void
+_bson_sorter_run_append (bson_sorter_run_t *run,
+                         const bson_t      *doc)
+{
+   bson_uint32_t n_keys = run->sorter->n_keys;
+
+   if ((run->len + doc->len) > run->alloc) {
+      run->alloc = run->alloc ? run->alloc : 4096;
+      while ((run->len + doc->len) > run->alloc) {
+         run->alloc *= 2;
+      }
+      run->buf = bson_realloc(run->buf, run->alloc);
+   }
+
+   if (run->n_docs == run->docs_alloc) {
+      run->docs_alloc = run->docs_alloc ? run->docs_alloc * 2 : 256;
+      run->docs = bson_realloc(run->docs,
+                               run->docs_alloc * sizeof *run->docs);
+      run->order = bson_realloc(run->order,
+                                run->docs_alloc * sizeof *run->order);
+      run->tmp = bson_realloc(run->tmp,
+                              run->docs_alloc * sizeof *run->tmp);
+      if (n_keys) {
+         run->keys = bson_realloc(run->keys,
+                                  run->docs_alloc * n_keys *
+                                  sizeof *run->keys);
+      }
+   }
+
+   memcpy(run->buf + run->len, bson_get_data(doc), doc->len);
+   run->docs[run->n_docs] = run->len;
+
+   if (n_keys && !run->sorter->compare) {
+      _bson_sorter_extract(run->sorter, bson_get_data(doc), doc,
+                           run->keys + (run->n_docs * n_keys));
+   }
+
+   run->len += doc->len;
+   run->n_docs++;
+}
+
+
+static BSON_INLINE int
+_bson_sorter_run_compare (const bson_sorter_run_t *run,
+                          bson_uint32_t            a,
+                          bson_uint32_t            b)
+{
+   bson_uint32_t n_keys = run->sorter->n_keys;
+
+   return _bson_sorter_compare(run->sorter,
+                               run->buf + run->docs[a],
+                               run->keys + (a * n_keys),
+                               run->buf + run->docs[b],
+                               run->keys + (b * n_keys));
+}
+
+
+static void
+_bson_sorter_run_msort (const bson_sorter_run_t *run,
+                        bson_uint32_t           *order,
+                        bson_uint32_t           *tmp,
+                        bson_uint32_t            n)
+{
+   bson_uint32_t mid;
+   bson_uint32_t i;
+   bson_uint32_t j;
+   bson_uint32_t k;
+   bson_uint32_t v;
+
+   if (n <= BSON_SORTER_INSERTION_SORT) {
+      for (i = 1; i < n; i++) {
+         v = order[i];
+         for (j = i; j && (_bson_sorter_run_compare(run, order[j - 1], v) > 0);
+              j--) {
+            order[j] = order[j - 1];
+         }
+         order[j] = v;
+      }
+      return;
+   }
+
+   mid = n / 2;
+   _bson_sorter_run_msort(run, order, tmp, mid);
+   _bson_sorter_run_msort(run, order + mid, tmp + mid, n - mid);
+
+   if (_bson_sorter_run_compare(run, order[mid - 1], order[mid]) <= 0) {
+      return;
+   }
+
+   /*
+    * Merge the left half, moved out of the way into tmp, with the right half
+    * which is already in place. Ties take from the left to stay stable.
+    */
+   memcpy(tmp, order, mid * sizeof *order);
+
+   for (i = 0, j = mid, k = 0; i < mid; k++) {
+      if ((j < n) && (_bson_sorter_run_compare(run, order[j], tmp[i]) < 0)) {
+         order[k] = order[j++];
+      } else {
+         order[k] = tmp[i++];
+      }
+   }
+}
+
+
+static void
+_bson_sorter_run_sort (bson_sorter_run_t *run)
+{
+   bson_uint32_t i;
+
+   for (i = 0; i < run->n_docs; i++) {
+      run->order[i] = i;
+   }
+
+   _bson_sorter_run_msort(run, run->order, run->tmp, run->n_docs);
+}
+
+
+static bson_bool_t
+_bson_sorter_write_all (int                 fd,
+                        const bson_uint8_t *data,
+                        size_t              len)
+{
+   ssize_t ret;
+
+   while (len) {
+      ret = write(fd, data, len);
+      if (ret < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return FALSE;
+      }
+      data += ret;
+      len -= ret;
+   }
+
+   return TRUE;
+}
+
+
+static bson_bool_t
+_bson_sorter_run_spill (bson_sorter_run_t *run)
+{
+   const bson_uint8_t *doc;
+   const char *tmpdir;
+   bson_uint8_t *buf;
+   bson_uint32_t doclen;
+   bson_uint32_t i;
+   size_t len = 0;
+   char *path;
+
+   if (!(tmpdir = run->sorter->tmpdir) && !(tmpdir = getenv("TMPDIR"))) {
+      tmpdir = "/tmp";
+   }
+
+   path = bson_strdup_printf("%s/bson-sorter-XXXXXX", tmpdir);
+   run->fd = mkstemp(path);
+   if (run->fd == -1) {
+      bson_set_error(&run->error,
+                     BSON_ERROR_SORTER,
+                     BSON_SORTER_ERROR_SPILL,
+                     "Failed to create spill file in \"%s\": %s",
+                     tmpdir, strerror(errno));
+      bson_free(path);
+      return FALSE;
+   }
+   unlink(path);
+   bson_free(path);
+
+   /*
+    * Documents are copied into the spill file exactly as they were read so
+    * the merge can hand them to a bson_reader_t without re-encoding them.
+    */
+   buf = bson_malloc(BSON_SORTER_SPILL_BUFFER);
+
+   for (i = 0; i < run->n_docs; i++) {
+      doc = run->buf + run->docs[run->order[i]];
+      doclen = _bson_sorter_read_uint32(doc);
+
+      if ((len + doclen) > BSON_SORTER_SPILL_BUFFER) {
+         if (!_bson_sorter_write_all(run->fd, buf, len)) {
+            goto failure;
+         }
+         len = 0;
+      }
+
+      if (doclen > BSON_SORTER_SPILL_BUFFER) {
+         if (!_bson_sorter_write_all(run->fd, doc, doclen)) {
+            goto failure;
+         }
+      } else {
+         memcpy(buf + len, doc, doclen);
+         len += doclen;
+      }
+   }
+
+   if (!_bson_sorter_write_all(run->fd, buf, len) ||
+       (lseek(run->fd, 0, SEEK_SET) != 0)) {
+      goto failure;
+   }
+
+   bson_free(buf);
+
+   return TRUE;
+
+failure:
+   bson_set_error(&run->error,
+                  BSON_ERROR_SORTER,
+                  BSON_SORTER_ERROR_SPILL,
+                  "Failed to write spill file: %s",
+                  strerror(errno));
+   bson_free(buf);
+
+   return FALSE;
+}
+
+
+static void *
+_bson_sorter_run_worker (void *data)
+{
+   bson_sorter_run_t *run = data;
+   bson_int64_t begin;
+
+   begin = bson_get_monotonic_time();
+
+   _bson_sorter_run_sort(run);
+   run->failed = !_bson_sorter_run_spill(run);
+
+   run->usec = bson_get_monotonic_time() - begin;
+
+   return NULL;
+}
+
+
+static bson_bool_t
+_bson_sorter_join (bson_sorter_t        *sorter,
+                   bson_sorter_worker_t *worker,
+                   bson_error_t         *error)
+{
+   bson_sorter_run_t *run = worker->run;
+
+   bson_thread_join(worker->thread, NULL);
+   worker->active = FALSE;
+
+   sorter->stats.sort_usec += run->usec;
+
+   if (run->failed) {
+      if (error) {
+         *error = run->error;
+      }
+      return FALSE;
+   }
+
+   sorter->spills = bson_realloc(sorter->spills,
+                                 (sorter->n_spills + 1) *
+                                 sizeof *sorter->spills);
+   sorter->spills[sorter->n_spills++] = run->fd;
+   sorter->stats.n_runs++;
+   run->fd = -1;
+
+   return TRUE;
+}
+
+
+static bson_bool_t
+_bson_sorter_dispatch (bson_sorter_t      *sorter,
+                       bson_sorter_run_t **cur,
+                       bson_error_t       *error)
+{
+   bson_sorter_worker_t *worker;
+   bson_sorter_run_t *run;
+
+   /*
+    * Workers are used round-robin, so the worker we hand the run to always
+    * holds the oldest run in flight. Joining it keeps the spill files in
+    * input order, which the merge relies on for stability.
+    */
+   worker = &sorter->workers[sorter->next_worker % sorter->n_threads];
+
+   if (worker->active && !_bson_sorter_join(sorter, worker, error)) {
+      return FALSE;
+   }
+
+   run = worker->run;
+   worker->run = *cur;
+   _bson_sorter_run_reset(run);
+   *cur = run;
+
+   if (bson_thread_create(&worker->thread, NULL, _bson_sorter_run_worker,
+                          worker->run) != 0) {
+      bson_set_error(error,
+                     BSON_ERROR_SORTER,
+                     BSON_SORTER_ERROR_SPILL,
+                     "Failed to start sort worker.");
+      return FALSE;
+   }
+
+   worker->active = TRUE;
+   sorter->next_worker++;
+
+   return TRUE;
+}
+
+
+static bson_bool_t
+_bson_sorter_join_all (bson_sorter_t *sorter,
+                       bson_error_t  *error)
+{
+   bson_sorter_worker_t *worker;
+   bson_bool_t ret = TRUE;
+   bson_uint32_t i;
+
+   for (i = 0; i < sorter->n_threads; i++) {
+      worker = &sorter->workers[(sorter->next_worker + i) % sorter->n_threads];
+      if (worker->active && !_bson_sorter_join(sorter, worker, error)) {
+         /*
+          * Keep joining so no worker outlives the sort.
+          */
+         ret = FALSE;
+         error = NULL;
+      }
+   }
+
+   return ret;
+}
+
+
+static int
+_bson_sorter_source_compare (const bson_sorter_t        *sorter,
+                             const bson_sorter_source_t *a,
+                             const bson_sorter_source_t *b)
+{
+   int ret;
+
+   ret = _bson_sorter_compare(sorter,
+                              bson_get_data(a->doc), a->keys,
+                              bson_get_data(b->doc), b->keys);
+   if (ret) {
+      return ret;
+   }
+
+   return (a->index < b->index) ? -1 : (a->index > b->index);
+}
+
+
+static bson_bool_t
+_bson_sorter_source_next (const bson_sorter_t  *sorter,
+                          bson_sorter_source_t *source,
+                          bson_error_t         *error)
+{
+   bson_bool_t eof = FALSE;
+
+   if (!(source->doc = bson_reader_read(source->reader, &eof))) {
+      if (!eof) {
+         bson_set_error(error,
+                        BSON_ERROR_SORTER,
+                        BSON_SORTER_ERROR_MERGE,
+                        "Failed to read document from spill file %u.",
+                        source->index);
+         return FALSE;
+      }
+      return TRUE;
+   }
+
+   if (sorter->n_keys && !sorter->compare) {
+      _bson_sorter_extract(sorter, bson_get_data(source->doc), source->doc,
+                           source->keys);
+   }
+
+   return TRUE;
+}
+
+
+static void
+_bson_sorter_heap_down (const bson_sorter_t   *sorter,
+                        bson_sorter_source_t **heap,
+                        bson_uint32_t          n,
+                        bson_uint32_t          i)
+{
+   bson_sorter_source_t *v = heap[i];
+   bson_uint32_t child;
+
+   while ((child = (2 * i) + 1) < n) {
+      if (((child + 1) < n) &&
+          (_bson_sorter_source_compare(sorter, heap[child + 1],
+                                       heap[child]) < 0)) {
+         child++;
+      }
+      if (_bson_sorter_source_compare(sorter, heap[child], v) >= 0) {
+         break;
+      }
+      heap[i] = heap[child];
+      i = child;
+   }
+
+   heap[i] = v;
+}
+
+
+static bson_bool_t
+_bson_sorter_merge (bson_sorter_t         *sorter,
+                    bson_sorter_emit_func  emit,
+                    void                  *data,
+                    bson_error_t          *error)
+{
+   bson_sorter_source_t *sources;
+   bson_sorter_source_t **heap;
+   bson_sorter_source_t *top;
+   bson_bool_t ret = FALSE;
+   bson_uint32_t n_heap = 0;
+   bson_uint32_t i;
+
+   sources = bson_malloc0(sorter->n_spills * sizeof *sources);
+   heap = bson_malloc0(sorter->n_spills * sizeof *heap);
+
+   for (i = 0; i < sorter->n_spills; i++) {
+      sources[i].reader = bson_reader_new_from_fd(sorter->spills[i], TRUE);
+      sources[i].index = i;
+      sorter->spills[i] = -1;
+   }
+
+   for (i = 0; i < sorter->n_spills; i++) {
+      if (!_bson_sorter_source_next(sorter, &sources[i], error)) {
+         goto cleanup;
+      }
+      if (sources[i].doc) {
+         heap[n_heap++] = &sources[i];
+      }
+   }
+
+   for (i = n_heap / 2; i > 0; i--) {
+      _bson_sorter_heap_down(sorter, heap, n_heap, i - 1);
+   }
+
+   while (n_heap) {
+      top = heap[0];
+
+      if (!emit(top->doc, data)) {
+         bson_set_error(error,
+                        BSON_ERROR_SORTER,
+                        BSON_SORTER_ERROR_ABORTED,
+                        "Sort aborted by emit function.");
+         goto cleanup;
+      }
+
+      if (!_bson_sorter_source_next(sorter, top, error)) {
+         goto cleanup;
+      }
+
+      if (!top->doc) {
+         heap[0] = heap[--n_heap];
+      }
+
+      if (n_heap) {
+         _bson_sorter_heap_down(sorter, heap, n_heap, 0);
+      }
+   }
+
+   ret = TRUE;
+
+cleanup:
+   for (i = 0; i < sorter->n_spills; i++) {
+      bson_reader_destroy(sources[i].reader);
+   }
+   bson_free(sources);
+   bson_free(heap);
+
+   return ret;
+}
+
+
+static bson_bool_t
+_bson_sorter_emit_run (bson_sorter_run_t     *run,
+                       bson_sorter_emit_func  emit,
+                       void                  *data,
+                       bson_error_t          *error)
+{
+   const bson_uint8_t *doc;
+   bson_uint32_t i;
+   bson_t b;
+
+   for (i = 0; i < run->n_docs; i++) {
+      doc = run->buf + run->docs[run->order[i]];
+      bson_init_static(&b, doc, _bson_sorter_read_uint32(doc));
+      if (!emit(&b, data)) {
+         bson_set_error(error,
+                        BSON_ERROR_SORTER,
+                        BSON_SORTER_ERROR_ABORTED,
+                        "Sort aborted by emit function.");
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_sorter_sort (bson_sorter_t         *sorter,
+                  bson_reader_t         *reader,
+                  bson_sorter_emit_func  emit,
+                  void                  *data,
+                  bson_error_t          *error)
+{
+   bson_sorter_run_t *cur;
+   const bson_t *b;
+   bson_int64_t begin;
+   bson_int64_t now;
+   bson_bool_t eof = FALSE;
+   bson_bool_t ret = FALSE;
+   bson_uint32_t i;
+
+   bson_return_val_if_fail(sorter, FALSE);
+   bson_return_val_if_fail(reader, FALSE);
+   bson_return_val_if_fail(emit, FALSE);
+
+   memset(&sorter->stats, 0, sizeof sorter->stats);
+   begin = bson_get_monotonic_time();
+
+   sorter->runs = bson_malloc0((sorter->n_threads + 1) * sizeof *sorter->runs);
+   sorter->workers = bson_malloc0(sorter->n_threads * sizeof *sorter->workers);
+   sorter->next_worker = 0;
+   sorter->spills = NULL;
+   sorter->n_spills = 0;
+
+   for (i = 0; i <= sorter->n_threads; i++) {
+      _bson_sorter_run_init(&sorter->runs[i], sorter);
+      if (i < sorter->n_threads) {
+         sorter->workers[i].run = &sorter->runs[i];
+      }
+   }
+
+   cur = &sorter->runs[sorter->n_threads];
+
+   while ((b = bson_reader_read(reader, &eof))) {
+      if (cur->n_docs && ((cur->len + b->len) > sorter->run_size)) {
+         if (!_bson_sorter_dispatch(sorter, &cur, error)) {
+            goto cleanup;
+         }
+      }
+      _bson_sorter_run_append(cur, b);
+      sorter->stats.n_docs++;
+      sorter->stats.n_bytes += b->len;
+   }
+
+   if (!eof) {
+      bson_set_error(error,
+                     BSON_ERROR_SORTER,
+                     BSON_SORTER_ERROR_READ,
+                     "Failed to read document %llu.",
+                     (unsigned long long)sorter->stats.n_docs);
+      goto cleanup;
+   }
+
+   if (!sorter->next_worker) {
+      /*
+       * Everything fit within a single run, sort it in memory.
+       */
+      now = bson_get_monotonic_time();
+      sorter->stats.read_usec = now - begin;
+      _bson_sorter_run_sort(cur);
+      sorter->stats.n_runs = cur->n_docs ? 1 : 0;
+      sorter->stats.sort_usec = bson_get_monotonic_time() - now;
+
+      now = bson_get_monotonic_time();
+      ret = _bson_sorter_emit_run(cur, emit, data, error);
+      sorter->stats.merge_usec = bson_get_monotonic_time() - now;
+      goto cleanup;
+   }
+
+   if (cur->n_docs && !_bson_sorter_dispatch(sorter, &cur, error)) {
+      goto cleanup;
+   }
+
+   if (!_bson_sorter_join_all(sorter, error)) {
+      goto cleanup;
+   }
+
+   now = bson_get_monotonic_time();
+   sorter->stats.read_usec = now - begin;
+   ret = _bson_sorter_merge(sorter, emit, data, error);
+   sorter->stats.merge_usec = bson_get_monotonic_time() - now;
+
+cleanup:
+   _bson_sorter_join_all(sorter, NULL);
+
+   for (i = 0; i < sorter->n_spills; i++) {
+      if (sorter->spills[i] != -1) {
+         close(sorter->spills[i]);
+      }
+   }
+
+   for (i = 0; i <= sorter->n_threads; i++) {
+      _bson_sorter_run_destroy(&sorter->runs[i]);
+   }
+
+   bson_free(sorter->spills);
+   bson_free(sorter->runs);
+   bson_free(sorter->workers);
+   sorter->spills = NULL;
+   sorter->n_spills = 0;
+   sorter->runs = NULL;
+   sorter->workers = NULL;
+
+   sorter->stats.total_usec = bson_get_monotonic_time() - begin;
+
+   return ret;
+}
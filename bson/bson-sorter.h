@@ -0,0 +1,234 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_SORTER_H
+#define BSON_SORTER_H
+
+
+#include "bson-macros.h"
+#include "bson-reader.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_sorter_t:
+ *
+ * The bson_sorter_t structure performs an external merge sort over a stream
+ * of BSON documents read from a bson_reader_t. Documents are collected into
+ * bounded in-memory runs which are sorted in parallel by worker threads and
+ * spilled to temporary files. The runs are then merged with a k-way heap
+ * merge.
+ *
+ * Spill files contain the original BSON documents back to back, so no
+ * re-encoding takes place between the input and the output.
+ */
+typedef struct _bson_sorter_t bson_sorter_t;
+
+
+/**
+ * bson_sorter_compare_func:
+ * @a: A bson_t.
+ * @b: A bson_t.
+ * @data: User data provided to bson_sorter_set_compare_func().
+ *
+ * A qsort() style comparison function for two documents.
+ *
+ * Returns: Less than zero, zero, or greater than zero.
+ */
+typedef int (*bson_sorter_compare_func) (const bson_t *a,
+                                         const bson_t *b,
+                                         void         *data);
+
+
+/**
+ * bson_sorter_emit_func:
+ * @bson: The next document in sorted order.
+ * @data: User data provided to bson_sorter_sort().
+ *
+ * Called for every document in sorted order. @bson is only valid for the
+ * duration of the callback.
+ *
+ * Returns: TRUE to continue; FALSE to abort the sort.
+ */
+typedef bson_bool_t (*bson_sorter_emit_func) (const bson_t *bson,
+                                              void         *data);
+
+
+/**
+ * bson_sorter_error_t:
+ *
+ * Error codes within the %BSON_ERROR_SORTER domain.
+ */
+typedef enum
+{
+   BSON_SORTER_ERROR_READ    = 1,
+   BSON_SORTER_ERROR_SPILL   = 2,
+   BSON_SORTER_ERROR_MERGE   = 3,
+   BSON_SORTER_ERROR_ABORTED = 4,
+} bson_sorter_error_t;
+
+
+/**
+ * bson_sorter_stats_t:
+ *
+ * Statistics about the last call to bson_sorter_sort(). All times are in
+ * microseconds of wall clock time.
+ *
+ * @read_usec includes the time spent waiting for a worker to become free,
+ * and @sort_usec is the sum of the time spent by the workers sorting and
+ * spilling runs. As the workers run in parallel, @sort_usec may exceed the
+ * total elapsed time.
+ */
+typedef struct
+{
+   bson_uint64_t n_docs;
+   bson_uint64_t n_bytes;
+   bson_uint32_t n_runs;
+   bson_int64_t  read_usec;
+   bson_int64_t  sort_usec;
+   bson_int64_t  merge_usec;
+   bson_int64_t  total_usec;
+} bson_sorter_stats_t;
+
+
+/**
+ * bson_sorter_new:
+ * @run_size: The maximum number of bytes of documents in a run, or 0.
+ * @n_threads: The number of worker threads sorting runs, or 0.
+ *
+ * Creates a new bson_sorter_t. At most @n_threads + 1 runs of @run_size bytes
+ * will be held in memory at once. A single document larger than @run_size
+ * forms a run by itself.
+ *
+ * If @run_size is 0, a default of 64 MiB is used. If @n_threads is 0, a
+ * single worker thread is used.
+ *
+ * Returns: A newly allocated bson_sorter_t that should be freed with
+ *    bson_sorter_destroy().
+ */
+bson_sorter_t *
+bson_sorter_new (size_t        run_size,
+                 bson_uint32_t n_threads);
+
+
+/**
+ * bson_sorter_destroy:
+ * @sorter: A bson_sorter_t.
+ *
+ * Releases all resources associated with @sorter.
+ */
+void
+bson_sorter_destroy (bson_sorter_t *sorter);
+
+
+/**
+ * bson_sorter_add_key:
+ * @sorter: A bson_sorter_t.
+ * @dotkey: A dotted path to the field, such as "a.b".
+ * @ascending: TRUE to sort ascending, FALSE for descending.
+ *
+ * Adds a sort key to the built-in key extractor. Documents are ordered by
+ * each key in the order they were added. The position of every key within a
+ * document is extracted once when the document is read, so comparisons do
+ * not search the document.
+ *
+ * Values of different types are ordered like MongoDB orders them. A missing
+ * field sorts like null.
+ *
+ * Returns: TRUE if successful; FALSE if too many keys were added.
+ */
+bson_bool_t
+bson_sorter_add_key (bson_sorter_t *sorter,
+                     const char    *dotkey,
+                     bson_bool_t    ascending);
+
+
+/**
+ * bson_sorter_set_compare_func:
+ * @sorter: A bson_sorter_t.
+ * @compare: A bson_sorter_compare_func.
+ * @data: User data for @compare.
+ *
+ * Replaces the built-in key extractor with a custom comparison function.
+ * Keys added with bson_sorter_add_key() are ignored afterwards.
+ */
+void
+bson_sorter_set_compare_func (bson_sorter_t            *sorter,
+                              bson_sorter_compare_func  compare,
+                              void                     *data);
+
+
+/**
+ * bson_sorter_set_tmpdir:
+ * @sorter: A bson_sorter_t.
+ * @tmpdir: The directory for spill files.
+ *
+ * Sets the directory in which spill files are created. By default $TMPDIR
+ * is used, or /tmp if it is not set. Spill files are unlinked as soon as they
+ * are created.
+ */
+void
+bson_sorter_set_tmpdir (bson_sorter_t *sorter,
+                        const char    *tmpdir);
+
+
+/**
+ * bson_sorter_sort:
+ * @sorter: A bson_sorter_t.
+ * @reader: A bson_reader_t to read documents from.
+ * @emit: A function to call with every document in sorted order.
+ * @data: User data for @emit.
+ * @error: A location for a bson_error_t, or NULL.
+ *
+ * Reads all documents from @reader and calls @emit for each of them in
+ * sorted order. The sort is stable. If all documents fit within a single run,
+ * nothing is spilled to disk.
+ *
+ * Returns: TRUE if successful; otherwise FALSE and @error is set.
+ */
+bson_bool_t
+bson_sorter_sort (bson_sorter_t         *sorter,
+                  bson_reader_t         *reader,
+                  bson_sorter_emit_func  emit,
+                  void                  *data,
+                  bson_error_t          *error);
+
+
+/**
+ * bson_sorter_get_stats:
+ * @sorter: A bson_sorter_t.
+ * @stats: A location for a bson_sorter_stats_t.
+ *
+ * Fetches the statistics of the last call to bson_sorter_sort().
+ */
+void
+bson_sorter_get_stats (const bson_sorter_t *sorter,
+                       bson_sorter_stats_t *stats);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_SORTER_H */
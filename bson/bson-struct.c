@@ -0,0 +1,585 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "bson.h"
+#include "bson-struct.h"
+
+
+#define MEMBER(s, offset, type) ((type *)((bson_uint8_t *)(s) + (offset)))
+#define CONST_MEMBER(s, offset, type) \
+   ((const type *)((const bson_uint8_t *)(s) + (offset)))
+
+
+static bson_bool_t
+bson_struct_decode_iter (const bson_struct_desc_t *desc,
+                         bson_iter_t              *iter,
+                         void                     *s);
+
+
+/*
+ * The size of a value of @type, which is the stride of arrays of them.
+ */
+static size_t
+bson_struct_type_size (const bson_struct_field_t *field,
+                       bson_struct_type_t         type)
+{
+   switch (type) {
+   case BSON_STRUCT_INT32:
+      return sizeof(bson_int32_t);
+   case BSON_STRUCT_INT64:
+   case BSON_STRUCT_DATE_TIME:
+      return sizeof(bson_int64_t);
+   case BSON_STRUCT_DOUBLE:
+      return sizeof(double);
+   case BSON_STRUCT_BOOL:
+      return sizeof(bson_bool_t);
+   case BSON_STRUCT_OID:
+      return sizeof(bson_oid_t);
+   case BSON_STRUCT_STRING:
+      return sizeof(char *);
+   case BSON_STRUCT_CHARS:
+      return field->size;
+   case BSON_STRUCT_DOCUMENT:
+      return field->desc ? field->desc->size : 0;
+   case BSON_STRUCT_ARRAY:
+   default:
+      return 0;
+   }
+}
+
+
+static bson_bool_t
+bson_struct_append_value (bson_t                    *bson,
+                          const char                *key,
+                          int                        key_length,
+                          const bson_struct_field_t *field,
+                          bson_struct_type_t         type,
+                          const void                *value)
+{
+   const char *str;
+   const char *end;
+   bson_t child;
+
+   switch (type) {
+   case BSON_STRUCT_INT32:
+      return bson_append_int32(bson, key, key_length,
+                               *(const bson_int32_t *)value);
+   case BSON_STRUCT_INT64:
+      return bson_append_int64(bson, key, key_length,
+                               *(const bson_int64_t *)value);
+   case BSON_STRUCT_DOUBLE:
+      return bson_append_double(bson, key, key_length,
+                                *(const double *)value);
+   case BSON_STRUCT_BOOL:
+      return bson_append_bool(bson, key, key_length,
+                              *(const bson_bool_t *)value);
+   case BSON_STRUCT_DATE_TIME:
+      return bson_append_date_time(bson, key, key_length,
+                                   *(const bson_int64_t *)value);
+   case BSON_STRUCT_OID:
+      return bson_append_oid(bson, key, key_length,
+                             (const bson_oid_t *)value);
+   case BSON_STRUCT_STRING:
+      str = *(const char * const *)value;
+      if (!str) {
+         return bson_append_null(bson, key, key_length);
+      }
+      return bson_append_utf8(bson, key, key_length, str, -1);
+   case BSON_STRUCT_CHARS:
+      str = value;
+      end = memchr(str, '\0', field->size);
+      return bson_append_utf8(bson, key, key_length, str,
+                              (int)(end ? (end - str) : field->size));
+   case BSON_STRUCT_DOCUMENT:
+      bson_return_val_if_fail(field->desc, FALSE);
+      return (bson_append_document_begin(bson, key, key_length, &child) &&
+              bson_struct_encode(field->desc, value, &child) &&
+              bson_append_document_end(bson, &child));
+   case BSON_STRUCT_ARRAY:
+   default:
+      return FALSE;
+   }
+}
+
+
+/*
+ * Encodes an array member. Arrays of fixed size numbers go through the
+ * bulk appenders, everything else through an array builder.
+ */
+static bson_bool_t
+bson_struct_append_array (bson_t                    *bson,
+                          const bson_struct_field_t *field,
+                          const void                *s)
+{
+   bson_array_builder_t builder;
+   const bson_uint8_t *elems;
+   const char *key;
+   size_t n_elems;
+   size_t size;
+   size_t i;
+   int key_length;
+
+   elems = *CONST_MEMBER(s, field->offset, bson_uint8_t *);
+   n_elems = *CONST_MEMBER(s, field->count_offset, size_t);
+
+   bson_return_val_if_fail(elems || !n_elems, FALSE);
+
+   switch (field->elem_type) {
+   case BSON_STRUCT_INT32:
+      return bson_append_array_int32(bson, field->name, -1,
+                                     (const bson_int32_t *)elems, n_elems);
+   case BSON_STRUCT_INT64:
+      return bson_append_array_int64(bson, field->name, -1,
+                                     (const bson_int64_t *)elems, n_elems);
+   case BSON_STRUCT_DOUBLE:
+      return bson_append_array_double(bson, field->name, -1,
+                                      (const double *)elems, n_elems);
+   case BSON_STRUCT_OID:
+      return bson_append_array_oid(bson, field->name, -1,
+                                   (const bson_oid_t *)elems, n_elems);
+   case BSON_STRUCT_BOOL:
+   case BSON_STRUCT_DATE_TIME:
+   case BSON_STRUCT_STRING:
+   case BSON_STRUCT_CHARS:
+   case BSON_STRUCT_DOCUMENT:
+   case BSON_STRUCT_ARRAY:
+   default:
+      break;
+   }
+
+   size = bson_struct_type_size(field, field->elem_type);
+   bson_return_val_if_fail(size, FALSE);
+
+   if (!bson_append_array_builder_begin(bson, field->name, -1, &builder)) {
+      return FALSE;
+   }
+
+   for (i = 0; i < n_elems; i++) {
+      key = bson_array_builder_next_key(&builder, &key_length);
+      if (!bson_struct_append_value(&builder.array, key, key_length, field,
+                                    field->elem_type, elems + (i * size))) {
+         bson_append_array_builder_end(bson, &builder);
+         return FALSE;
+      }
+   }
+
+   return bson_append_array_builder_end(bson, &builder);
+}
+
+
+bson_bool_t
+bson_struct_encode (const bson_struct_desc_t *desc,
+                    const void               *s,
+                    bson_t                   *bson)
+{
+   const bson_struct_field_t *field;
+   size_t i;
+
+   bson_return_val_if_fail(desc, FALSE);
+   bson_return_val_if_fail(s, FALSE);
+   bson_return_val_if_fail(bson, FALSE);
+
+   for (i = 0; i < desc->n_fields; i++) {
+      field = &desc->fields[i];
+
+      if (field->type == BSON_STRUCT_ARRAY) {
+         if (!bson_struct_append_array(bson, field, s)) {
+            return FALSE;
+         }
+      } else if (!bson_struct_append_value(bson, field->name, -1, field,
+                                           field->type,
+                                           CONST_MEMBER(s, field->offset,
+                                                        bson_uint8_t))) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_struct_encode_array (const bson_struct_desc_t *desc,
+                          const void               *structs,
+                          size_t                    n_structs,
+                          bson_t                   *bson,
+                          const char               *key,
+                          int                       key_length)
+{
+   bson_array_builder_t builder;
+   bson_struct_field_t field;
+   const char *elem_key;
+   size_t i;
+   int elem_key_length;
+
+   bson_return_val_if_fail(desc, FALSE);
+   bson_return_val_if_fail(structs || !n_structs, FALSE);
+
+   memset(&field, 0, sizeof field);
+   field.desc = desc;
+
+   if (!bson_append_array_builder_begin(bson, key, key_length, &builder)) {
+      return FALSE;
+   }
+
+   for (i = 0; i < n_structs; i++) {
+      elem_key = bson_array_builder_next_key(&builder, &elem_key_length);
+      if (!bson_struct_append_value(&builder.array, elem_key,
+                                    elem_key_length, &field,
+                                    BSON_STRUCT_DOCUMENT,
+                                    CONST_MEMBER(structs, i * desc->size,
+                                                 bson_uint8_t))) {
+         bson_append_array_builder_end(bson, &builder);
+         return FALSE;
+      }
+   }
+
+   return bson_append_array_builder_end(bson, &builder);
+}
+
+
+static bson_bool_t
+bson_struct_read_value (const bson_iter_t         *iter,
+                        const bson_struct_field_t *field,
+                        bson_struct_type_t         type,
+                        void                      *value)
+{
+   bson_iter_t child;
+   const char *str;
+   bson_uint32_t len;
+   char *copy;
+
+   switch (type) {
+   case BSON_STRUCT_INT32:
+      if (!BSON_ITER_HOLDS_INT32(iter)) {
+         return FALSE;
+      }
+      *(bson_int32_t *)value = bson_iter_int32(iter);
+      return TRUE;
+   case BSON_STRUCT_INT64:
+      if (BSON_ITER_HOLDS_INT32(iter)) {
+         *(bson_int64_t *)value = bson_iter_int32(iter);
+         return TRUE;
+      } else if (!BSON_ITER_HOLDS_INT64(iter)) {
+         return FALSE;
+      }
+      *(bson_int64_t *)value = bson_iter_int64(iter);
+      return TRUE;
+   case BSON_STRUCT_DOUBLE:
+      if (!BSON_ITER_HOLDS_DOUBLE(iter)) {
+         return FALSE;
+      }
+      *(double *)value = bson_iter_double(iter);
+      return TRUE;
+   case BSON_STRUCT_BOOL:
+      if (!BSON_ITER_HOLDS_BOOL(iter)) {
+         return FALSE;
+      }
+      *(bson_bool_t *)value = bson_iter_bool(iter);
+      return TRUE;
+   case BSON_STRUCT_DATE_TIME:
+      if (!BSON_ITER_HOLDS_DATE_TIME(iter)) {
+         return FALSE;
+      }
+      *(bson_int64_t *)value = bson_iter_date_time(iter);
+      return TRUE;
+   case BSON_STRUCT_OID:
+      if (!BSON_ITER_HOLDS_OID(iter)) {
+         return FALSE;
+      }
+      bson_oid_copy(bson_iter_oid(iter), value);
+      return TRUE;
+   case BSON_STRUCT_STRING:
+      if (BSON_ITER_HOLDS_NULL(iter)) {
+         *(char **)value = NULL;
+         return TRUE;
+      } else if (!BSON_ITER_HOLDS_UTF8(iter)) {
+         return FALSE;
+      }
+      str = bson_iter_utf8(iter, &len);
+      copy = bson_malloc(len + 1);
+      memcpy(copy, str, len);
+      copy[len] = '\0';
+      *(char **)value = copy;
+      return TRUE;
+   case BSON_STRUCT_CHARS:
+      if (!BSON_ITER_HOLDS_UTF8(iter)) {
+         return FALSE;
+      }
+      str = bson_iter_utf8(iter, &len);
+      len = MIN(len, field->size);
+      memcpy(value, str, len);
+      if (len < field->size) {
+         ((char *)value)[len] = '\0';
+      }
+      return TRUE;
+   case BSON_STRUCT_DOCUMENT:
+      if (!BSON_ITER_HOLDS_DOCUMENT(iter) ||
+          !bson_iter_recurse(iter, &child)) {
+         return FALSE;
+      }
+      return bson_struct_decode_iter(field->desc, &child, value);
+   case BSON_STRUCT_ARRAY:
+   default:
+      return FALSE;
+   }
+}
+
+
+/*
+ * Decodes the array @iter is located on into a newly allocated array of
+ * @type values, storing the array and its length in @elems and @n_elems
+ * before decoding so that they are freed by bson_struct_clear() on failure.
+ */
+static bson_bool_t
+bson_struct_read_array (const bson_iter_t         *iter,
+                        const bson_struct_field_t *field,
+                        bson_struct_type_t         type,
+                        void                     **elems,
+                        size_t                    *n_elems)
+{
+   bson_uint8_t *data;
+   bson_iter_t child;
+   size_t size;
+   size_t n = 0;
+
+   *elems = NULL;
+   *n_elems = 0;
+
+   size = bson_struct_type_size(field, type);
+
+   if (!size ||
+       !BSON_ITER_HOLDS_ARRAY(iter) ||
+       !bson_iter_recurse(iter, &child)) {
+      return FALSE;
+   }
+
+   while (bson_iter_next(&child)) {
+      n++;
+   }
+
+   if (!n) {
+      return TRUE;
+   }
+
+   *elems = data = bson_malloc0(n * size);
+   *n_elems = n;
+
+   bson_iter_recurse(iter, &child);
+
+   for (n = 0; bson_iter_next(&child); n++) {
+      if (!bson_struct_read_value(&child, field, type, data + (n * size))) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+static bson_bool_t
+bson_struct_read_field (const bson_iter_t         *iter,
+                        const bson_struct_field_t *field,
+                        void                      *s)
+{
+   if (field->type == BSON_STRUCT_ARRAY) {
+      return bson_struct_read_array(iter, field, field->elem_type,
+                                    MEMBER(s, field->offset, void *),
+                                    MEMBER(s, field->count_offset, size_t));
+   }
+
+   return bson_struct_read_value(iter, field, field->type,
+                                 MEMBER(s, field->offset, bson_uint8_t));
+}
+
+
+static bson_bool_t
+bson_struct_decode_iter (const bson_struct_desc_t *desc,
+                         bson_iter_t              *iter,
+                         void                     *s)
+{
+   const bson_struct_field_t *field;
+   const char *key;
+   size_t next = 0;
+   size_t i;
+
+   bson_return_val_if_fail(desc, FALSE);
+
+   while (bson_iter_next(iter)) {
+      key = bson_iter_key(iter);
+
+      /*
+       * Documents usually come back in the order we encoded them in, so
+       * the field after the last match is nearly always the right one.
+       */
+      if ((next < desc->n_fields) && !strcmp(key, desc->fields[next].name)) {
+         field = &desc->fields[next];
+      } else {
+         field = NULL;
+         for (i = 0; i < desc->n_fields; i++) {
+            if (!strcmp(key, desc->fields[i].name)) {
+               field = &desc->fields[i];
+               break;
+            }
+         }
+         if (!field) {
+            continue;
+         }
+      }
+
+      next = (field - desc->fields) + 1;
+
+      if (!bson_struct_read_field(iter, field, s)) {
+         return FALSE;
+      }
+   }
+
+   return !iter->err_offset;
+}
+
+
+bson_bool_t
+bson_struct_decode (const bson_struct_desc_t *desc,
+                    const bson_t             *bson,
+                    void                     *s)
+{
+   bson_iter_t iter;
+
+   bson_return_val_if_fail(desc, FALSE);
+   bson_return_val_if_fail(bson, FALSE);
+   bson_return_val_if_fail(s, FALSE);
+
+   if (!bson_iter_init(&iter, bson)) {
+      return FALSE;
+   }
+
+   return bson_struct_decode_iter(desc, &iter, s);
+}
+
+
+bson_bool_t
+bson_struct_decode_array (const bson_struct_desc_t  *desc,
+                          const bson_iter_t         *iter,
+                          void                     **structs,
+                          size_t                    *n_structs)
+{
+   bson_struct_field_t field;
+
+   bson_return_val_if_fail(desc, FALSE);
+   bson_return_val_if_fail(iter, FALSE);
+   bson_return_val_if_fail(structs, FALSE);
+   bson_return_val_if_fail(n_structs, FALSE);
+
+   memset(&field, 0, sizeof field);
+   field.desc = desc;
+
+   return bson_struct_read_array(iter, &field, BSON_STRUCT_DOCUMENT,
+                                 structs, n_structs);
+}
+
+
+/*
+ * Frees what a single value of @type owns.
+ */
+static void
+bson_struct_clear_value (const bson_struct_field_t *field,
+                         bson_struct_type_t         type,
+                         void                      *value)
+{
+   switch (type) {
+   case BSON_STRUCT_STRING:
+      bson_free(*(char **)value);
+      *(char **)value = NULL;
+      break;
+   case BSON_STRUCT_DOCUMENT:
+      bson_struct_clear(field->desc, value);
+      break;
+   case BSON_STRUCT_INT32:
+   case BSON_STRUCT_INT64:
+   case BSON_STRUCT_DOUBLE:
+   case BSON_STRUCT_BOOL:
+   case BSON_STRUCT_DATE_TIME:
+   case BSON_STRUCT_OID:
+   case BSON_STRUCT_CHARS:
+   case BSON_STRUCT_ARRAY:
+   default:
+      break;
+   }
+}
+
+
+void
+bson_struct_clear (const bson_struct_desc_t *desc,
+                   void                     *s)
+{
+   const bson_struct_field_t *field;
+   bson_uint8_t **elems;
+   size_t *n_elems;
+   size_t size;
+   size_t i;
+   size_t j;
+
+   bson_return_if_fail(desc);
+   bson_return_if_fail(s);
+
+   for (i = 0; i < desc->n_fields; i++) {
+      field = &desc->fields[i];
+
+      if (field->type != BSON_STRUCT_ARRAY) {
+         bson_struct_clear_value(field, field->type,
+                                 MEMBER(s, field->offset, bson_uint8_t));
+         continue;
+      }
+
+      elems = MEMBER(s, field->offset, bson_uint8_t *);
+      n_elems = MEMBER(s, field->count_offset, size_t);
+      size = bson_struct_type_size(field, field->elem_type);
+
+      if (*elems) {
+         for (j = 0; j < *n_elems; j++) {
+            bson_struct_clear_value(field, field->elem_type,
+                                    *elems + (j * size));
+         }
+      }
+
+      bson_free(*elems);
+      *elems = NULL;
+      *n_elems = 0;
+   }
+}
+
+
+void
+bson_struct_free_array (const bson_struct_desc_t *desc,
+                        void                     *structs,
+                        size_t                    n_structs)
+{
+   size_t i;
+
+   bson_return_if_fail(desc);
+
+   if (structs) {
+      for (i = 0; i < n_structs; i++) {
+         bson_struct_clear(desc, MEMBER(structs, i * desc->size,
+                                        bson_uint8_t));
+      }
+
+      bson_free(structs);
+   }
+}
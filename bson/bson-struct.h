@@ -0,0 +1,242 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_STRUCT_H
+#define BSON_STRUCT_H
+
+
+#include <stddef.h>
+
+#include "bson-iter.h"
+#include "bson-macros.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_struct_type_t:
+ *
+ * The C type of a struct member described by a bson_struct_field_t.
+ *
+ * %BSON_STRUCT_INT32: A bson_int32_t, encoded as BSON_TYPE_INT32.
+ * %BSON_STRUCT_INT64: A bson_int64_t, encoded as BSON_TYPE_INT64.
+ * %BSON_STRUCT_DOUBLE: A double, encoded as BSON_TYPE_DOUBLE.
+ * %BSON_STRUCT_BOOL: A bson_bool_t, encoded as BSON_TYPE_BOOL.
+ * %BSON_STRUCT_DATE_TIME: A bson_int64_t of milliseconds since the UNIX
+ *    epoch, encoded as BSON_TYPE_DATE_TIME.
+ * %BSON_STRUCT_OID: A bson_oid_t, encoded as BSON_TYPE_OID.
+ * %BSON_STRUCT_STRING: A char * allocated with bson_malloc(), encoded as
+ *    BSON_TYPE_UTF8 or BSON_TYPE_NULL if it is NULL.
+ * %BSON_STRUCT_CHARS: A char array of the field's size, holding a string
+ *    that is NUL terminated unless it fills the array. Encoded as
+ *    BSON_TYPE_UTF8; longer strings are truncated when decoding.
+ * %BSON_STRUCT_DOCUMENT: An embedded struct described by the field's
+ *    descriptor, encoded as BSON_TYPE_DOCUMENT.
+ * %BSON_STRUCT_ARRAY: A pointer to elements of the field's element type
+ *    allocated with bson_malloc(), along with a size_t count. Encoded as
+ *    BSON_TYPE_ARRAY.
+ */
+typedef enum
+{
+   BSON_STRUCT_INT32 = 1,
+   BSON_STRUCT_INT64,
+   BSON_STRUCT_DOUBLE,
+   BSON_STRUCT_BOOL,
+   BSON_STRUCT_DATE_TIME,
+   BSON_STRUCT_OID,
+   BSON_STRUCT_STRING,
+   BSON_STRUCT_CHARS,
+   BSON_STRUCT_DOCUMENT,
+   BSON_STRUCT_ARRAY
+} bson_struct_type_t;
+
+
+typedef struct _bson_struct_desc_t bson_struct_desc_t;
+
+
+/**
+ * bson_struct_field_t:
+ *
+ * Describes how a single struct member maps to a field of a document.
+ * @elem_type and @count_offset are only used by %BSON_STRUCT_ARRAY, @size
+ * by %BSON_STRUCT_CHARS (also as an array element) and @desc by
+ * %BSON_STRUCT_DOCUMENT (also as an array element).
+ *
+ * The BSON_STRUCT_FIELD() family of macros fills these in using the name
+ * of the member as the key.
+ */
+typedef struct
+{
+   const char                *name;         /* The key of the field. */
+   size_t                     offset;       /* offsetof() the member. */
+   bson_struct_type_t         type;         /* The C type of the member. */
+   bson_struct_type_t         elem_type;    /* The type of array elements. */
+   size_t                     size;         /* The size of a char array. */
+   size_t                     count_offset; /* offsetof() the array count. */
+   const bson_struct_desc_t  *desc;         /* Embedded struct descriptor. */
+} bson_struct_field_t;
+
+
+/**
+ * bson_struct_desc_t:
+ *
+ * Describes a C struct as a list of fields, in the order they are encoded.
+ * Decoding expects documents to be in the same order and falls back to a
+ * search over @fields for keys that are not.
+ */
+struct _bson_struct_desc_t
+{
+   size_t                     size;     /* sizeof the struct. */
+   const bson_struct_field_t *fields;
+   size_t                     n_fields;
+};
+
+
+#define BSON_STRUCT_FIELD(s, m, t) \
+   { #m, offsetof(s, m), (t), (bson_struct_type_t)0, 0, 0, NULL }
+#define BSON_STRUCT_FIELD_CHARS(s, m) \
+   { #m, offsetof(s, m), BSON_STRUCT_CHARS, (bson_struct_type_t)0, \
+     sizeof(((s *)0)->m), 0, NULL }
+#define BSON_STRUCT_FIELD_DOCUMENT(s, m, d) \
+   { #m, offsetof(s, m), BSON_STRUCT_DOCUMENT, (bson_struct_type_t)0, 0, 0, \
+     (d) }
+#define BSON_STRUCT_FIELD_ARRAY(s, m, count, t, d) \
+   { #m, offsetof(s, m), BSON_STRUCT_ARRAY, (t), 0, offsetof(s, count), (d) }
+
+
+/**
+ * bson_struct_encode:
+ * @desc: A bson_struct_desc_t.
+ * @s: A struct described by @desc.
+ * @bson: A bson_t.
+ *
+ * Appends the members of @s to @bson as described by @desc.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_struct_encode (const bson_struct_desc_t *desc,
+                    const void               *s,
+                    bson_t                   *bson);
+
+
+/**
+ * bson_struct_encode_array:
+ * @desc: A bson_struct_desc_t.
+ * @structs: An array of @n_structs structs described by @desc.
+ * @n_structs: The number of structs in @structs.
+ * @bson: A bson_t.
+ * @key: The key for the field.
+ * @key_length: The length of @key in bytes not including NUL or -1
+ *    if @key_length is NUL terminated.
+ *
+ * Appends @structs to @bson as an array of documents.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_struct_encode_array (const bson_struct_desc_t *desc,
+                          const void               *structs,
+                          size_t                    n_structs,
+                          bson_t                   *bson,
+                          const char               *key,
+                          int                       key_length);
+
+
+/**
+ * bson_struct_decode:
+ * @desc: A bson_struct_desc_t.
+ * @bson: A bson_t.
+ * @s: (out): A struct described by @desc.
+ *
+ * Decodes @bson into @s. Each key is first compared against the field
+ * following the previous one in @desc, so documents in the encoded order
+ * cost one comparison per field. Keys that are not in @desc are skipped
+ * and members without a field in @bson are left alone.
+ *
+ * Strings and arrays are allocated with bson_malloc() and overwrite the
+ * member without freeing it, so @s should be zeroed or cleared with
+ * bson_struct_clear(). Call bson_struct_clear() on @s even if decoding
+ * fails.
+ *
+ * Returns: TRUE if successful; FALSE if a field has a type that does not
+ *    match its member.
+ */
+bson_bool_t
+bson_struct_decode (const bson_struct_desc_t *desc,
+                    const bson_t             *bson,
+                    void                     *s);
+
+
+/**
+ * bson_struct_decode_array:
+ * @desc: A bson_struct_desc_t.
+ * @iter: A bson_iter_t located on an array of documents.
+ * @structs: (out): A location for the decoded structs.
+ * @n_structs: (out): A location for the number of decoded structs.
+ *
+ * Decodes the documents of the array @iter is located on into a newly
+ * allocated array of structs, as bson_struct_decode() would. The result
+ * should be freed with bson_struct_free_array(), even if decoding fails.
+ *
+ * Returns: TRUE if successful; otherwise FALSE.
+ */
+bson_bool_t
+bson_struct_decode_array (const bson_struct_desc_t  *desc,
+                          const bson_iter_t         *iter,
+                          void                     **structs,
+                          size_t                    *n_structs);
+
+
+/**
+ * bson_struct_clear:
+ * @desc: A bson_struct_desc_t.
+ * @s: A struct described by @desc.
+ *
+ * Frees the strings and arrays owned by @s, including those of embedded
+ * structs, and sets them to NULL.
+ */
+void
+bson_struct_clear (const bson_struct_desc_t *desc,
+                   void                     *s);
+
+
+/**
+ * bson_struct_free_array:
+ * @desc: A bson_struct_desc_t.
+ * @structs: An array of structs described by @desc.
+ * @n_structs: The number of structs in @structs.
+ *
+ * Clears each of @structs with bson_struct_clear() and frees @structs.
+ */
+void
+bson_struct_free_array (const bson_struct_desc_t *desc,
+                        void                     *structs,
+                        size_t                    n_structs);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_STRUCT_H */
@@ -0,0 +1,489 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "bson.h"
+#include "bson-private.h"
+#include "bson-template.h"
+
+
+typedef struct
+{
+   bson_type_t    type;
+   bson_uint32_t  key_offset;  /* Offset of the key in the image. */
+   bson_uint32_t  offset;      /* Offset of the value in the image. */
+   bson_uint32_t  length;      /* Length of the value in the image. */
+   bson_bool_t    fixed;       /* Written in place within the image. */
+   bson_bool_t    set;         /* @value replaces the value in the image. */
+   bson_uint8_t  *value;
+   bson_uint32_t  value_len;
+   size_t         value_alloc;
+} bson_template_slot_t;
+
+
+struct _bson_template_t
+{
+   bson_uint8_t         *prototype; /* The encoded prototype. */
+   bson_uint8_t         *image;     /* The prototype with fixed slots set. */
+   bson_uint32_t         len;
+   bson_template_slot_t *slots;
+   int                   n_slots;
+   int                   n_set;     /* Variable slots with a value set. */
+};
+
+
+static bson_bool_t
+bson_template_is_fixed (bson_type_t type)
+{
+   switch (type) {
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_OID:
+   case BSON_TYPE_BOOL:
+   case BSON_TYPE_DATE_TIME:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_TIMESTAMP:
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+   case BSON_TYPE_UNDEFINED:
+      return TRUE;
+   case BSON_TYPE_EOD:
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+   case BSON_TYPE_BINARY:
+   case BSON_TYPE_REGEX:
+   case BSON_TYPE_DBPOINTER:
+   case BSON_TYPE_CODE:
+   case BSON_TYPE_SYMBOL:
+   case BSON_TYPE_CODEWSCOPE:
+   default:
+      return FALSE;
+   }
+}
+
+
+bson_template_t *
+bson_template_new (const bson_t *prototype)
+{
+   bson_template_slot_t *slot;
+   const bson_uint8_t *data;
+   bson_template_t *tmpl;
+   bson_iter_t iter;
+   int n_slots = 0;
+
+   bson_return_val_if_fail(prototype, NULL);
+
+   if (!bson_iter_init(&iter, prototype)) {
+      return NULL;
+   }
+
+   while (bson_iter_next(&iter)) {
+      n_slots++;
+   }
+
+   if (iter.err_offset) {
+      return NULL;
+   }
+
+   data = bson_get_data(prototype);
+
+   tmpl = bson_malloc0(sizeof *tmpl);
+   tmpl->len = prototype->len;
+   tmpl->prototype = bson_malloc(prototype->len);
+   tmpl->image = bson_malloc(prototype->len);
+   tmpl->slots = bson_malloc0((n_slots + 1) * sizeof *tmpl->slots);
+   tmpl->n_slots = n_slots;
+
+   memcpy(tmpl->prototype, data, prototype->len);
+   memcpy(tmpl->image, data, prototype->len);
+
+   bson_iter_init(&iter, prototype);
+
+   for (slot = tmpl->slots; bson_iter_next(&iter); slot++) {
+      slot->type = bson_iter_type(&iter);
+      slot->key_offset = iter.offset + 1;
+      slot->offset = slot->key_offset + strlen(bson_iter_key(&iter)) + 1;
+      slot->length = iter.next_offset - slot->offset;
+      slot->fixed = bson_template_is_fixed(slot->type);
+   }
+
+   return tmpl;
+}
+
+
+void
+bson_template_destroy (bson_template_t *tmpl)
+{
+   int i;
+
+   if (tmpl) {
+      for (i = 0; i < tmpl->n_slots; i++) {
+         bson_free(tmpl->slots[i].value);
+      }
+
+      bson_free(tmpl->slots);
+      bson_free(tmpl->image);
+      bson_free(tmpl->prototype);
+      bson_free(tmpl);
+   }
+}
+
+
+int
+bson_template_slot (const bson_template_t *tmpl,
+                    const char            *key)
+{
+   int i;
+
+   bson_return_val_if_fail(tmpl, -1);
+   bson_return_val_if_fail(key, -1);
+
+   for (i = 0; i < tmpl->n_slots; i++) {
+      if (!strcmp((const char *)tmpl->image + tmpl->slots[i].key_offset,
+                  key)) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+
+void
+bson_template_reset (bson_template_t *tmpl)
+{
+   int i;
+
+   bson_return_if_fail(tmpl);
+
+   memcpy(tmpl->image, tmpl->prototype, tmpl->len);
+
+   for (i = 0; i < tmpl->n_slots; i++) {
+      tmpl->slots[i].set = FALSE;
+   }
+
+   tmpl->n_set = 0;
+}
+
+
+/*
+ * Fetches the location to write a value of @type and @length to within
+ * @slot, or NULL if @slot is out of range or holds another type. Variable
+ * slots get a buffer of @length bytes that replaces the prototype value.
+ */
+static bson_uint8_t *
+bson_template_slot_data (bson_template_t *tmpl,
+                         int              slot,
+                         bson_type_t      type,
+                         size_t           length)
+{
+   bson_template_slot_t *s;
+
+   bson_return_val_if_fail(tmpl, NULL);
+   bson_return_val_if_fail((slot >= 0) && (slot < tmpl->n_slots), NULL);
+
+   s = &tmpl->slots[slot];
+
+   bson_return_val_if_fail(s->type == type, NULL);
+
+   if (s->fixed) {
+      bson_return_val_if_fail(s->length == length, NULL);
+      return tmpl->image + s->offset;
+   }
+
+   if (length > BSON_MAX_SIZE) {
+      return NULL;
+   }
+
+   if (length > s->value_alloc) {
+      s->value_alloc = bson_next_power_of_two(length);
+      s->value = bson_realloc(s->value, s->value_alloc);
+   }
+
+   if (!s->set) {
+      s->set = TRUE;
+      tmpl->n_set++;
+   }
+
+   s->value_len = (bson_uint32_t)length;
+
+   return s->value;
+}
+
+
+bson_bool_t
+bson_template_set_int32 (bson_template_t *tmpl,
+                         int              slot,
+                         bson_int32_t     value)
+{
+   bson_uint8_t *data;
+
+   if (!(data = bson_template_slot_data(tmpl, slot, BSON_TYPE_INT32, 4))) {
+      return FALSE;
+   }
+
+   value = BSON_UINT32_TO_LE(value);
+   memcpy(data, &value, 4);
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_template_set_int64 (bson_template_t *tmpl,
+                         int              slot,
+                         bson_int64_t     value)
+{
+   bson_uint8_t *data;
+
+   if (!(data = bson_template_slot_data(tmpl, slot, BSON_TYPE_INT64, 8))) {
+      return FALSE;
+   }
+
+   value = BSON_UINT64_TO_LE(value);
+   memcpy(data, &value, 8);
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_template_set_double (bson_template_t *tmpl,
+                          int              slot,
+                          double           value)
+{
+   bson_uint8_t *data;
+
+   if (!(data = bson_template_slot_data(tmpl, slot, BSON_TYPE_DOUBLE, 8))) {
+      return FALSE;
+   }
+
+   value = BSON_DOUBLE_TO_LE(value);
+   memcpy(data, &value, 8);
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_template_set_date_time (bson_template_t *tmpl,
+                             int              slot,
+                             bson_int64_t     value)
+{
+   bson_uint8_t *data;
+
+   if (!(data = bson_template_slot_data(tmpl, slot, BSON_TYPE_DATE_TIME,
+                                        8))) {
+      return FALSE;
+   }
+
+   value = BSON_UINT64_TO_LE(value);
+   memcpy(data, &value, 8);
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_template_set_oid (bson_template_t  *tmpl,
+                       int               slot,
+                       const bson_oid_t *value)
+{
+   bson_uint8_t *data;
+
+   bson_return_val_if_fail(value, FALSE);
+
+   if (!(data = bson_template_slot_data(tmpl, slot, BSON_TYPE_OID, 12))) {
+      return FALSE;
+   }
+
+   memcpy(data, value, 12);
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_template_set_bool (bson_template_t *tmpl,
+                        int              slot,
+                        bson_bool_t      value)
+{
+   bson_uint8_t *data;
+
+   if (!(data = bson_template_slot_data(tmpl, slot, BSON_TYPE_BOOL, 1))) {
+      return FALSE;
+   }
+
+   *data = !!value;
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_template_set_utf8 (bson_template_t *tmpl,
+                        int              slot,
+                        const char      *value,
+                        int              length)
+{
+   bson_uint32_t length_le;
+   bson_uint8_t *data;
+
+   bson_return_val_if_fail(value, FALSE);
+
+   if (length < 0) {
+      length = (int)strlen(value);
+   }
+
+   if (!(data = bson_template_slot_data(tmpl, slot, BSON_TYPE_UTF8,
+                                        4 + (size_t)length + 1))) {
+      return FALSE;
+   }
+
+   length_le = BSON_UINT32_TO_LE(length + 1);
+   memcpy(data, &length_le, 4);
+   memcpy(data + 4, value, length);
+   data[4 + length] = '\0';
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_template_set_document (bson_template_t *tmpl,
+                            int              slot,
+                            const bson_t    *value)
+{
+   bson_uint8_t *data;
+   bson_type_t type;
+
+   bson_return_val_if_fail(tmpl, FALSE);
+   bson_return_val_if_fail(value, FALSE);
+   bson_return_val_if_fail((slot >= 0) && (slot < tmpl->n_slots), FALSE);
+
+   type = tmpl->slots[slot].type;
+
+   bson_return_val_if_fail((type == BSON_TYPE_DOCUMENT) ||
+                           (type == BSON_TYPE_ARRAY), FALSE);
+
+   if (!(data = bson_template_slot_data(tmpl, slot, type, value->len))) {
+      return FALSE;
+   }
+
+   memcpy(data, bson_get_data(value), value->len);
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_template_set_iter (bson_template_t   *tmpl,
+                        int                slot,
+                        const bson_iter_t *iter)
+{
+   const bson_uint8_t *value;
+   const bson_uint8_t *end;
+   bson_uint8_t *data;
+
+   bson_return_val_if_fail(iter, FALSE);
+   bson_return_val_if_fail(iter->bson, FALSE);
+   bson_return_val_if_fail(iter->key, FALSE);
+
+   /*
+    * data1 is NULL for null-like values, so find the value after the key.
+    */
+   value = iter->key + strlen((const char *)iter->key) + 1;
+   end = bson_get_data(iter->bson) + iter->next_offset;
+
+   if (!(data = bson_template_slot_data(tmpl, slot, bson_iter_type(iter),
+                                        end - value))) {
+      return FALSE;
+   }
+
+   memcpy(data, value, end - value);
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_template_append (const bson_template_t *tmpl,
+                      bson_t                *bson)
+{
+   const bson_template_slot_t *s;
+   size_t n_bytes;
+   size_t pos;
+   int i;
+
+   bson_return_val_if_fail(tmpl, FALSE);
+   bson_return_val_if_fail(bson, FALSE);
+
+   if (!tmpl->n_set) {
+      return bson_append_raw(bson, tmpl->image + 4, tmpl->len - 5);
+   }
+
+   /*
+    * Reserve the final size up front so that we never leave half of the
+    * fields behind, including in a buffer that cannot grow.
+    */
+   n_bytes = tmpl->len - 5;
+   for (i = 0; i < tmpl->n_slots; i++) {
+      s = &tmpl->slots[i];
+      if (s->set) {
+         n_bytes = n_bytes - s->length + s->value_len;
+      }
+   }
+
+   if ((n_bytes > (BSON_MAX_SIZE - bson->len)) ||
+       !bson_reserve(bson, bson->len + n_bytes)) {
+      return FALSE;
+   }
+
+   /*
+    * Copy the runs of the image between the variable slots that were set,
+    * splicing in their values. Every run holds at least the type and key
+    * of the next slot.
+    */
+   pos = 4;
+   for (i = 0; i < tmpl->n_slots; i++) {
+      s = &tmpl->slots[i];
+      if (s->set) {
+         if (!bson_append_raw(bson, tmpl->image + pos, s->offset - pos) ||
+             !bson_append_raw(bson, s->value, s->value_len)) {
+            return FALSE;
+         }
+         pos = s->offset + s->length;
+      }
+   }
+
+   return bson_append_raw(bson, tmpl->image + pos, tmpl->len - 1 - pos);
+}
+
+
+bson_bool_t
+bson_template_build (const bson_template_t *tmpl,
+                     bson_t                *bson)
+{
+   bson_return_val_if_fail(bson, FALSE);
+
+   bson_init(bson);
+
+   return bson_template_append(tmpl, bson);
+}
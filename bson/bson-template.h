@@ -0,0 +1,241 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_TEMPLATE_H
+#define BSON_TEMPLATE_H
+
+
+#include "bson-iter.h"
+#include "bson-macros.h"
+#include "bson-oid.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_template_t:
+ *
+ * A bson_template_t produces many documents of the same shape. It is
+ * compiled from a prototype document whose top-level fields become the
+ * slots of the template. The encoded type and key of every field is kept,
+ * so producing a document is a single copy of the encoded bytes.
+ *
+ * Slots of type BSON_TYPE_INT32, BSON_TYPE_INT64, BSON_TYPE_DOUBLE,
+ * BSON_TYPE_DATE_TIME, BSON_TYPE_OID and BSON_TYPE_BOOL have a fixed size
+ * and are written in place. Other slots may change size and are spliced in
+ * when the document is produced, which costs a copy per slot that was set.
+ *
+ * Values set on a template are kept until they are set again or the
+ * template is reset, so a bson_template_t must only be used by one thread
+ * at a time.
+ */
+typedef struct _bson_template_t bson_template_t;
+
+
+/**
+ * bson_template_new:
+ * @prototype: A bson_t.
+ *
+ * Compiles @prototype into a new template. The values of @prototype are
+ * the initial values of the slots.
+ *
+ * Returns: A newly allocated bson_template_t that should be freed with
+ *    bson_template_destroy(), or NULL if @prototype is invalid.
+ */
+bson_template_t *
+bson_template_new (const bson_t *prototype);
+
+
+/**
+ * bson_template_destroy:
+ * @tmpl: A bson_template_t.
+ *
+ * Frees @tmpl and all of its slot values.
+ */
+void
+bson_template_destroy (bson_template_t *tmpl);
+
+
+/**
+ * bson_template_slot:
+ * @tmpl: A bson_template_t.
+ * @key: The key of a top-level field of the prototype.
+ *
+ * Looks up the slot for @key. This is a linear search, so look slots up
+ * once and keep the result.
+ *
+ * Returns: The slot of @key, or -1 if the prototype has no such field.
+ */
+int
+bson_template_slot (const bson_template_t *tmpl,
+                    const char            *key);
+
+
+/**
+ * bson_template_reset:
+ * @tmpl: A bson_template_t.
+ *
+ * Restores all slots of @tmpl to the values of the prototype.
+ */
+void
+bson_template_reset (bson_template_t *tmpl);
+
+
+/**
+ * bson_template_set_int32:
+ * @tmpl: A bson_template_t.
+ * @slot: A slot of type BSON_TYPE_INT32.
+ * @value: The new value.
+ *
+ * Writes @value into @slot. The bson_template_set_*() functions below do
+ * the same for the other fixed size types, and fail if @slot does not have
+ * the matching type.
+ *
+ * Returns: TRUE if successful; otherwise FALSE.
+ */
+bson_bool_t
+bson_template_set_int32 (bson_template_t *tmpl,
+                         int              slot,
+                         bson_int32_t     value);
+
+
+bson_bool_t
+bson_template_set_int64 (bson_template_t *tmpl,
+                         int              slot,
+                         bson_int64_t     value);
+
+
+bson_bool_t
+bson_template_set_double (bson_template_t *tmpl,
+                          int              slot,
+                          double           value);
+
+
+bson_bool_t
+bson_template_set_date_time (bson_template_t *tmpl,
+                             int              slot,
+                             bson_int64_t     value);
+
+
+bson_bool_t
+bson_template_set_oid (bson_template_t  *tmpl,
+                       int               slot,
+                       const bson_oid_t *value);
+
+
+bson_bool_t
+bson_template_set_bool (bson_template_t *tmpl,
+                        int              slot,
+                        bson_bool_t      value);
+
+
+/**
+ * bson_template_set_utf8:
+ * @tmpl: A bson_template_t.
+ * @slot: A slot of type BSON_TYPE_UTF8.
+ * @value: A UTF-8 encoded string.
+ * @length: The length of @value or -1 if it is NUL terminated.
+ *
+ * Copies @value into @slot. The string may have a different length than
+ * the one in the prototype.
+ *
+ * Returns: TRUE if successful; otherwise FALSE.
+ */
+bson_bool_t
+bson_template_set_utf8 (bson_template_t *tmpl,
+                        int              slot,
+                        const char      *value,
+                        int              length);
+
+
+/**
+ * bson_template_set_document:
+ * @tmpl: A bson_template_t.
+ * @slot: A slot of type BSON_TYPE_DOCUMENT or BSON_TYPE_ARRAY.
+ * @value: A bson_t.
+ *
+ * Copies @value into @slot.
+ *
+ * Returns: TRUE if successful; otherwise FALSE.
+ */
+bson_bool_t
+bson_template_set_document (bson_template_t *tmpl,
+                            int              slot,
+                            const bson_t    *value);
+
+
+/**
+ * bson_template_set_iter:
+ * @tmpl: A bson_template_t.
+ * @slot: A slot.
+ * @iter: A bson_iter_t located on a value of the same type as @slot.
+ *
+ * Copies the value @iter is located on into @slot. This works for slots
+ * of any type.
+ *
+ * Returns: TRUE if successful; otherwise FALSE.
+ */
+bson_bool_t
+bson_template_set_iter (bson_template_t   *tmpl,
+                        int                slot,
+                        const bson_iter_t *iter);
+
+
+/**
+ * bson_template_append:
+ * @tmpl: A bson_template_t.
+ * @bson: A bson_t.
+ *
+ * Appends the fields of @tmpl, with the current slot values, to @bson.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_template_append (const bson_template_t *tmpl,
+                      bson_t                *bson);
+
+
+/**
+ * bson_template_build:
+ * @tmpl: A bson_template_t.
+ * @bson: (out): A location for the new document.
+ *
+ * Initializes @bson with the fields of @tmpl, as bson_init() followed by
+ * bson_template_append() would.
+ *
+ * @bson is initialized in either case and should be freed with
+ * bson_destroy().
+ *
+ * Returns: TRUE if successful; FALSE if the document would overflow max
+ *    size.
+ */
+bson_bool_t
+bson_template_build (const bson_template_t *tmpl,
+                     bson_t                *bson);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_TEMPLATE_H */
@@ -73,6 +73,9 @@ typedef ssize_t (*bson_read_func_t) (int     fd,
  *   result of getpid() when initializing the context.
  * %BSON_CONTEXT_DISABLE_HOST_CACHE: Call gethostname() instead of caching the
  *   result of gethostname() when initializing the context.
+ * %BSON_CONTEXT_SEQ_PER_THREAD: Context will be called from multiple threads,
+ *   each of which takes blocks of sequence numbers from the context instead
+ *   of synchronizing for every ObjectId.
  */
 typedef enum
 {
@@ -83,6 +86,7 @@ typedef enum
 #if defined(__linux__)
    BSON_CONTEXT_USE_TASK_ID        = (1 << 3),
 #endif
+   BSON_CONTEXT_SEQ_PER_THREAD     = (1 << 4),
 } bson_context_flags_t;
 
 
@@ -145,6 +149,23 @@ BSON_ALIGNED_END(128);
 BSON_STATIC_ASSERT(sizeof(bson_t) == 128);
 
 
+/**
+ * bson_array_builder_t:
+ *
+ * This structure is used to append the elements of an array without having
+ * to format the "0", "1", "2", ... keys yourself. The next index is tracked
+ * and its key is written two digits at a time into @key.
+ *
+ * See bson_append_array_builder_begin().
+ */
+typedef struct
+{
+   bson_t        array;   /* The array being built. */
+   bson_uint32_t index;   /* Index of the next element. */
+   char          key[16]; /* Key of the next element. */
+} bson_array_builder_t;
+
+
 /**
  * bson_oid_t:
  *
@@ -257,7 +278,8 @@ typedef struct
    size_t              next_offset; /* Offset of next element. */
    size_t              err_offset;  /* Location of decoding error. */
    bson_t              inl_bson;    /* Used for recursing into children. */
-   void               *padding[6];  /* For future use. */
+   const bson_t       *root;        /* Top-level bson_t being iterated. */
+   void               *padding[5];  /* For future use. */
 } bson_iter_t;
 
 
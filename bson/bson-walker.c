@@ -0,0 +1,249 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include <string.h>
+
+#include "bson.h"
+#include "bson-walker.h"
+
+
+/*
+ * Each frame is the end offset of an open document or array, with the top
+ * bit set for arrays. BSON_MAX_SIZE keeps offsets below it.
+ */
+#define FRAME_ARRAY 0x80000000U
+#define FRAME_END(f) ((f) & ~FRAME_ARRAY)
+
+
+bson_bool_t
+bson_walker_init (bson_walker_t *walker,
+                  const bson_t  *bson)
+{
+   bson_return_val_if_fail(walker, FALSE);
+   bson_return_val_if_fail(bson, FALSE);
+
+   memset(walker, 0, sizeof *walker);
+   walker->frames = walker->inline_frames;
+   walker->n_alloc = BSON_WALKER_INLINE_FRAMES;
+
+   if (!bson_iter_init(&walker->iter, bson)) {
+      return FALSE;
+   }
+
+   walker->bson = bson;
+   walker->offset = 4;
+
+   return TRUE;
+}
+
+
+void
+bson_walker_destroy (bson_walker_t *walker)
+{
+   if (walker && (walker->frames != walker->inline_frames)) {
+      bson_free(walker->frames);
+      walker->frames = walker->inline_frames;
+   }
+}
+
+
+static BSON_INLINE bson_bool_t
+bson_walker_fail (bson_walker_t *walker,
+                  size_t         offset)
+{
+   walker->err_offset = offset;
+   walker->bson = NULL;
+
+   return FALSE;
+}
+
+
+static void
+bson_walker_push (bson_walker_t *walker,
+                  bson_uint32_t  frame)
+{
+   if (walker->n_frames == walker->n_alloc) {
+      walker->n_alloc *= 2;
+      if (walker->frames == walker->inline_frames) {
+         walker->frames = bson_malloc(walker->n_alloc *
+                                      sizeof *walker->frames);
+         memcpy(walker->frames, walker->inline_frames,
+                sizeof walker->inline_frames);
+      } else {
+         walker->frames = bson_realloc(walker->frames,
+                                       walker->n_alloc *
+                                       sizeof *walker->frames);
+      }
+   }
+
+   walker->frames[walker->n_frames++] = frame;
+}
+
+
+bson_bool_t
+bson_walker_next (bson_walker_t       *walker,
+                  bson_walker_event_t *event)
+{
+   bson_iter_t *iter;
+   const bson_uint8_t *data;
+   bson_uint32_t start;
+   bson_uint32_t end;
+
+   bson_return_val_if_fail(walker, FALSE);
+   bson_return_val_if_fail(event, FALSE);
+
+   if (!walker->bson) {
+      return FALSE;
+   }
+
+   iter = &walker->iter;
+   end = walker->n_frames ? FRAME_END(walker->frames[walker->n_frames - 1])
+                          : walker->bson->len;
+
+   /*
+    * The terminating byte of the innermost open document. Its presence
+    * was checked when the document was entered.
+    */
+   if ((walker->offset + 1) == end) {
+      if (!walker->n_frames) {
+         walker->bson = NULL;
+         return FALSE;
+      }
+      walker->n_frames--;
+      walker->offset = end;
+      walker->depth = walker->n_frames;
+      walker->event = *event = BSON_WALKER_LEAVE;
+      return TRUE;
+   }
+
+   /*
+    * Every element is decoded relative to the top-level document, which
+    * keeps the iterator in bounds. The innermost document's end is checked
+    * here.
+    */
+   iter->bson = walker->bson;
+   iter->root = walker->bson;
+   iter->next_offset = walker->offset;
+
+   if (!bson_iter_next(iter)) {
+      return bson_walker_fail(walker, iter->err_offset ? iter->err_offset
+                                                       : walker->offset);
+   }
+
+   if (iter->next_offset >= end) {
+      return bson_walker_fail(walker, walker->offset);
+   }
+
+   walker->depth = walker->n_frames;
+
+   switch (bson_iter_type_unsafe(iter)) {
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+      data = bson_get_data(walker->bson);
+      start = (bson_uint32_t)(iter->data1 - data);
+      if (((iter->next_offset - start) < 5) ||
+          data[iter->next_offset - 1]) {
+         return bson_walker_fail(walker, start);
+      }
+      if (BSON_ITER_HOLDS_ARRAY(iter)) {
+         bson_walker_push(walker, iter->next_offset | FRAME_ARRAY);
+         walker->event = *event = BSON_WALKER_ENTER_ARRAY;
+      } else {
+         bson_walker_push(walker, iter->next_offset);
+         walker->event = *event = BSON_WALKER_ENTER_DOCUMENT;
+      }
+      walker->offset = start + 4;
+      break;
+   case BSON_TYPE_EOD:
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_BINARY:
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_OID:
+   case BSON_TYPE_BOOL:
+   case BSON_TYPE_DATE_TIME:
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_REGEX:
+   case BSON_TYPE_DBPOINTER:
+   case BSON_TYPE_CODE:
+   case BSON_TYPE_SYMBOL:
+   case BSON_TYPE_CODEWSCOPE:
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_TIMESTAMP:
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_MAXKEY:
+   case BSON_TYPE_MINKEY:
+   default:
+      walker->offset = (bson_uint32_t)iter->next_offset;
+      walker->event = *event = BSON_WALKER_VALUE;
+      break;
+   }
+
+   return TRUE;
+}
+
+
+void
+bson_walker_skip (bson_walker_t *walker)
+{
+   bson_return_if_fail(walker);
+
+   if (walker->bson &&
+       ((walker->event == BSON_WALKER_ENTER_DOCUMENT) ||
+        (walker->event == BSON_WALKER_ENTER_ARRAY))) {
+      walker->offset = FRAME_END(walker->frames[--walker->n_frames]);
+      walker->event = BSON_WALKER_VALUE;
+   }
+}
+
+
+const bson_iter_t *
+bson_walker_iter (const bson_walker_t *walker)
+{
+   bson_return_val_if_fail(walker, NULL);
+
+   return &walker->iter;
+}
+
+
+bson_uint32_t
+bson_walker_depth (const bson_walker_t *walker)
+{
+   bson_return_val_if_fail(walker, 0);
+
+   return walker->depth;
+}
+
+
+bson_bool_t
+bson_walker_in_array (const bson_walker_t *walker)
+{
+   bson_return_val_if_fail(walker, FALSE);
+
+   return walker->depth &&
+          !!(walker->frames[walker->depth - 1] & FRAME_ARRAY);
+}
+
+
+size_t
+bson_walker_get_error_offset (const bson_walker_t *walker)
+{
+   bson_return_val_if_fail(walker, 0);
+
+   return walker->err_offset;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#if !defined (BSON_INSIDE) && !defined (BSON_COMPILATION)
+#error "Only <bson.h> can be included directly."
+#endif
+
+
+#ifndef BSON_WALKER_H
+#define BSON_WALKER_H
+
+
+#include "bson-iter.h"
+#include "bson-macros.h"
+#include "bson-types.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/**
+ * bson_walker_event_t:
+ *
+ * The events produced by bson_walker_next().
+ *
+ * %BSON_WALKER_ENTER_DOCUMENT: An embedded document starts. The events for
+ *    its fields follow, then %BSON_WALKER_LEAVE.
+ * %BSON_WALKER_ENTER_ARRAY: The same for an array.
+ * %BSON_WALKER_VALUE: Any other field.
+ * %BSON_WALKER_LEAVE: The innermost open document or array ends.
+ */
+typedef enum
+{
+   BSON_WALKER_ENTER_DOCUMENT = 1,
+   BSON_WALKER_ENTER_ARRAY,
+   BSON_WALKER_VALUE,
+   BSON_WALKER_LEAVE
+} bson_walker_event_t;
+
+
+#define BSON_WALKER_INLINE_FRAMES 16
+
+
+/**
+ * bson_walker_t:
+ *
+ * Walks a document and all of the documents embedded in it depth first,
+ * in a single pass over the buffer and without recursion. Each open
+ * document or array takes four bytes of stack; the first
+ * BSON_WALKER_INLINE_FRAMES levels are kept inside the structure so it can
+ * live on the stack. Documents marked with bson_mark_validated() are
+ * walked without bounds checks.
+ *
+ * The fields are private.
+ */
+typedef struct
+{
+   const bson_t        *bson;
+   bson_iter_t          iter;
+   bson_walker_event_t  event;
+   bson_uint32_t        offset;
+   bson_uint32_t        depth;
+   bson_uint32_t        n_frames;
+   bson_uint32_t        n_alloc;
+   bson_uint32_t       *frames;
+   bson_uint32_t        inline_frames[BSON_WALKER_INLINE_FRAMES];
+   size_t               err_offset;
+} bson_walker_t;
+
+
+/**
+ * bson_walker_init:
+ * @walker: A bson_walker_t.
+ * @bson: A bson_t that must outlive @walker.
+ *
+ * Initializes @walker to walk @bson. The top-level document itself does
+ * not produce an enter or leave event. Call bson_walker_destroy() when
+ * done, even if this fails.
+ *
+ * Returns: TRUE if successful; FALSE if @bson is too short to be a
+ *    document.
+ */
+bson_bool_t
+bson_walker_init (bson_walker_t *walker,
+                  const bson_t  *bson);
+
+
+/**
+ * bson_walker_next:
+ * @walker: A bson_walker_t.
+ * @event: (out): A location for the event.
+ *
+ * Advances @walker to the next event. For every event but
+ * %BSON_WALKER_LEAVE, bson_walker_iter() is located on the field the event
+ * is about, so its key and value can be read with the bson_iter_t
+ * accessors.
+ *
+ * Returns: TRUE if an event was produced; FALSE at the end of the document
+ *    or if it is corrupt. See bson_walker_get_error_offset().
+ */
+bson_bool_t
+bson_walker_next (bson_walker_t       *walker,
+                  bson_walker_event_t *event);
+
+
+/**
+ * bson_walker_skip:
+ * @walker: A bson_walker_t.
+ *
+ * Skips the contents of the document or array just entered, along with its
+ * %BSON_WALKER_LEAVE event. Does nothing after other events.
+ */
+void
+bson_walker_skip (bson_walker_t *walker);
+
+
+/**
+ * bson_walker_iter:
+ * @walker: A bson_walker_t.
+ *
+ * Fetches the iterator located on the current field. It must not be
+ * advanced with bson_iter_next(); use bson_iter_recurse() to get an
+ * independent iterator over an embedded document.
+ *
+ * Returns: A bson_iter_t owned by @walker.
+ */
+const bson_iter_t *
+bson_walker_iter (const bson_walker_t *walker);
+
+
+/**
+ * bson_walker_depth:
+ * @walker: A bson_walker_t.
+ *
+ * Fetches the depth of the current event. Fields of the top-level document
+ * are at depth 0, fields of a document embedded in it at depth 1, and so
+ * on. The enter and leave events of a document are at the depth of the
+ * field that holds it.
+ *
+ * Returns: The depth of the current event.
+ */
+bson_uint32_t
+bson_walker_depth (const bson_walker_t *walker);
+
+
+/**
+ * bson_walker_in_array:
+ * @walker: A bson_walker_t.
+ *
+ * Checks if the current field is an element of an array, in which case its
+ * key is just its index.
+ *
+ * Returns: TRUE if the current field is in an array.
+ */
+bson_bool_t
+bson_walker_in_array (const bson_walker_t *walker);
+
+
+/**
+ * bson_walker_get_error_offset:
+ * @walker: A bson_walker_t.
+ *
+ * Fetches the offset of the corruption that stopped @walker.
+ *
+ * Returns: The offset into the top-level document, or 0 if @walker has not
+ *    run into corruption.
+ */
+size_t
+bson_walker_get_error_offset (const bson_walker_t *walker);
+
+
+void
+bson_walker_destroy (bson_walker_t *walker);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_WALKER_H */
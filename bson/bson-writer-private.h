@@ -0,0 +1,43 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#ifndef BSON_WRITER_PRIVATE_H
+#define BSON_WRITER_PRIVATE_H
+
+
+#include "bson-writer.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * Grows the buffer of @writer so @size more bytes fit after the documents
+ * written so far and advances past them. Returns where the caller should
+ * write those bytes, or NULL if a document is in progress or they do not
+ * fit in a fixed buffer.
+ */
+bson_uint8_t *
+bson_writer_append_raw (bson_writer_t *writer,
+                        size_t         size);
+
+
+BSON_END_DECLS
+
+
+#endif /* BSON_WRITER_PRIVATE_H */
@@ -15,8 +15,11 @@
  */
 
 
+#include <string.h>
+
 #include "bson-private.h"
 #include "bson-writer.h"
+#include "bson-writer-private.h"
 
 
 struct _bson_writer_t
@@ -63,16 +66,34 @@ bson_writer_get_length (bson_writer_t *writer)
 }
 
 
-void
+size_t
+bson_writer_get_remaining (bson_writer_t *writer)
+{
+   size_t used;
+
+   bson_return_val_if_fail(writer, 0);
+
+   used = writer->offset + writer->b.len;
+
+   return (*writer->buflen > used) ? (*writer->buflen - used) : 0;
+}
+
+
+bson_bool_t
 bson_writer_begin (bson_writer_t  *writer,
                    bson_t        **bson)
 {
    bson_impl_alloc_t *b;
    bson_bool_t grown = FALSE;
+   size_t buflen;
 
-   bson_return_if_fail(writer);
-   bson_return_if_fail(writer->ready);
-   bson_return_if_fail(bson);
+   bson_return_val_if_fail(writer, FALSE);
+   bson_return_val_if_fail(writer->ready, FALSE);
+   bson_return_val_if_fail(bson, FALSE);
+
+   if (!writer->realloc_func && ((writer->offset + 5) > *writer->buflen)) {
+      return FALSE;
+   }
 
    writer->ready = FALSE;
 
@@ -89,23 +110,53 @@ bson_writer_begin (bson_writer_t  *writer,
    b->alloclen = 0;
    b->realloc = writer->realloc_func;
 
-   while ((writer->offset + writer->b.len) > *writer->buflen) {
+   buflen = *writer->buflen;
+
+   while ((writer->offset + writer->b.len) > buflen) {
       grown = TRUE;
-      if (!*writer->buflen) {
-         *writer->buflen = 64;
-      } else {
-         (*writer->buflen) *= 2;
-      }
+      buflen = buflen ? (buflen * 2) : 64;
    }
 
    if (grown) {
-      *writer->buf = writer->realloc_func(*writer->buf, *writer->buflen);
+      *writer->buf = writer->realloc_func(*writer->buf, buflen);
+      *writer->buflen = buflen;
    }
 
-   memset((*writer->buf) + writer->offset + 1, 0, 5);
+   memset((*writer->buf) + writer->offset + 1, 0, 4);
    (*writer->buf)[writer->offset] = 5;
 
    *bson = &writer->b;
+
+   return TRUE;
+}
+
+
+bson_uint8_t *
+bson_writer_append_raw (bson_writer_t *writer,
+                        size_t         size)
+{
+   bson_uint8_t *data;
+   size_t buflen;
+
+   bson_return_val_if_fail(writer, NULL);
+   bson_return_val_if_fail(writer->ready, NULL);
+
+   if ((writer->offset + size) > *writer->buflen) {
+      if (!writer->realloc_func) {
+         return NULL;
+      }
+      buflen = *writer->buflen ? *writer->buflen : 64;
+      while ((writer->offset + size) > buflen) {
+         buflen *= 2;
+      }
+      *writer->buf = writer->realloc_func(*writer->buf, buflen);
+      *writer->buflen = buflen;
+   }
+
+   data = *writer->buf + writer->offset;
+   writer->offset += size;
+
+   return data;
 }
 
 
@@ -19,7 +19,9 @@
 #define BSON_WRITER_H
 
 
-#include "bson.h"
+#include "bson-macros.h"
+#include "bson-memory.h"
+#include "bson-types.h"
 
 
 BSON_BEGIN_DECLS
@@ -35,6 +37,11 @@ BSON_BEGIN_DECLS
  * This is useful if you want to build a series of BSON documents right into
  * the target buffer for an outgoing packet. The offset parameter allows you to
  * start at an offset of the target buffer.
+ *
+ * Without a realloc() function the buffer has a fixed capacity, such as a
+ * pre-registered send buffer. Appends that would overflow it fail and leave
+ * the current document as it was, so the caller can call
+ * bson_writer_rollback(), flush the finished documents and start over.
  */
 typedef struct _bson_writer_t bson_writer_t;
 
@@ -47,7 +54,8 @@ typedef struct _bson_writer_t bson_writer_t;
  * @realloc_func: A realloc() style function or NULL.
  *
  * Creates a new instance of bson_writer_t using the buffer, length, offset,
- * and realloc() function supplied.
+ * and realloc() function supplied. If @realloc_func is NULL, the buffer is
+ * never grown and must already hold *@buflen bytes.
  *
  * The caller is expected to clean up the structure when finished using
  * bson_writer_destroy().
@@ -91,6 +99,24 @@ size_t
 bson_writer_get_length (bson_writer_t *writer);
 
 
+/**
+ * bson_writer_get_remaining:
+ * @writer: A bson_writer_t.
+ *
+ * Fetches the number of bytes that can still be written before the buffer
+ * of @writer is full. Like bson_writer_get_length(), this includes the
+ * document currently being written, but not an open child document of it.
+ *
+ * For a writer without a realloc() function this is the room left in the
+ * fixed buffer, which helps to end a batch before an append fails. Other
+ * writers grow the buffer when it runs out.
+ *
+ * Returns: The number of bytes left in the buffer.
+ */
+size_t
+bson_writer_get_remaining (bson_writer_t *writer);
+
+
 /**
  * bson_writer_begin:
  * @writer: A bson_writer_t.
@@ -99,8 +125,11 @@ bson_writer_get_length (bson_writer_t *writer);
  * Begins writing a new document. The caller may use the bson structure to
  * write out a new BSON document. When completed, the caller must call either
  * bson_writer_end() or bson_writer_rollback().
+ *
+ * Returns: TRUE if successful; FALSE if @writer has a fixed capacity and
+ *    not even an empty document fits.
  */
-void
+bson_bool_t
 bson_writer_begin (bson_writer_t  *writer,
                    bson_t        **bson);
 
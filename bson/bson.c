@@ -20,6 +20,9 @@
 
 #include "b64_ntop.h"
 #include "bson.h"
+#include "bson-hash-private.h"
+#include "bson-keys-private.h"
+#include "bson-keyset-private.h"
 #include "bson-private.h"
 
 
@@ -100,6 +103,8 @@ static bson_bool_t
 bson_impl_alloc_grow (bson_impl_alloc_t *impl,
                       bson_uint32_t      size)
 {
+   bson_impl_alloc_t *root;
+   bson_uint8_t *data;
    size_t req;
 
    BSON_ASSERT(impl);
@@ -114,15 +119,39 @@ bson_impl_alloc_grow (bson_impl_alloc_t *impl,
       return TRUE;
    }
 
+   /*
+    * Caller supplied buffers that may not grow have no realloc function.
+    */
+   if (!impl->realloc) {
+      return FALSE;
+   }
+
    req = bson_next_power_of_two(req);
 
-   if (req <= INT32_MAX) {
+   if (req > INT32_MAX) {
+      return FALSE;
+   }
+
+   for (root = impl; root->parent; root = (bson_impl_alloc_t *)root->parent) {
+   }
+
+   if ((root->flags & BSON_FLAG_BORROWED)) {
+      /*
+       * The buffer still belongs to the caller of bson_init_with_buffer(),
+       * so copy it to the heap rather than realloc it. Open children share
+       * the buffer pointer of the root and follow along.
+       */
+      data = bson_malloc(req);
+      memcpy(data, *impl->buf, *impl->buflen);
+      *impl->buf = data;
+      root->flags &= ~(BSON_FLAG_BORROWED | BSON_FLAG_NO_FREE);
+   } else {
       *impl->buf = impl->realloc(*impl->buf, req);
-      *impl->buflen = req;
-      return TRUE;
    }
 
-   return FALSE;
+   *impl->buflen = req;
+
+   return TRUE;
 }
 
 
@@ -130,14 +159,27 @@ static bson_bool_t
 bson_grow (bson_t        *bson,
            bson_uint32_t  size)
 {
+   bson_bool_t ret;
+
    BSON_ASSERT(bson);
    BSON_ASSERT(!(bson->flags & BSON_FLAG_RDONLY));
 
    if ((bson->flags & BSON_FLAG_INLINE)) {
-      return bson_impl_inline_grow((bson_impl_inline_t *)bson, size);
+      ret = bson_impl_inline_grow((bson_impl_inline_t *)bson, size);
    } else {
-      return bson_impl_alloc_grow((bson_impl_alloc_t *)bson, size);
+      ret = bson_impl_alloc_grow((bson_impl_alloc_t *)bson, size);
    }
+
+   /*
+    * Everything that adds to a document grows it first, which makes this
+    * the place to drop the mark of bson_mark_validated(). A failed append
+    * leaves the document unchanged, mark included.
+    */
+   if (ret) {
+      bson->flags &= ~BSON_FLAG_VALID;
+   }
+
+   return ret;
 }
 
 
@@ -165,6 +207,53 @@ bson_encode_length (bson_t *bson)
 }
 
 
+/**
+ * bson_hash_fold:
+ * @bson: A bson_t initialized with bson_init_hashed().
+ *
+ * Folds all complete stripes of newly appended elements into the running
+ * hash of @bson. The remaining tail is hashed by bson_hash().
+ */
+static BSON_INLINE void
+bson_hash_fold (bson_t *bson)
+{
+   bson_impl_alloc_t *impl = (bson_impl_alloc_t *)bson;
+   bson_uint32_t avail;
+
+   avail = (bson->len - 5) - impl->hash_len;
+
+   if (avail >= BSON_HASH_STRIPE) {
+      avail -= (avail % BSON_HASH_STRIPE);
+      bson_hash_lanes_update(impl->hash,
+                             bson_data(bson) + 4 + impl->hash_len,
+                             avail);
+      impl->hash_len += avail;
+   }
+}
+
+
+/**
+ * bson_hash_rewind:
+ * @bson: A bson_t.
+ * @offset: Offset of modified bytes, relative to the first element.
+ *
+ * The running hash cannot be rewound, so start over if bytes at @offset
+ * were already folded into it. Does nothing unless @bson is hashed.
+ */
+void
+bson_hash_rewind (bson_t        *bson,
+                  bson_uint32_t  offset)
+{
+   bson_impl_alloc_t *impl = (bson_impl_alloc_t *)bson;
+
+   if ((bson->flags & BSON_FLAG_HASHED) && (offset < impl->hash_len)) {
+      bson_hash_lanes_init(impl->hash, 0);
+      impl->hash_len = 0;
+      bson_hash_fold(bson);
+   }
+}
+
+
 /**
  * bson_append_va:
  * @bson: A bson_t
@@ -196,8 +285,6 @@ bson_append_va (bson_t             *bson,
    BSON_ASSERT(first_len);
    BSON_ASSERT(first_data);
 
-   bson_grow(bson, n_bytes);
-
    data = first_data;
    data_len = first_len;
 
@@ -257,10 +344,18 @@ bson_append (bson_t             *bson,
       return FALSE;
    }
 
+   if (BSON_UNLIKELY(!bson_grow(bson, n_bytes))) {
+      return FALSE;
+   }
+
    va_start(args, first_data);
    bson_append_va(bson, n_bytes, n_pairs, first_len, first_data, args);
    va_end(args);
 
+   if ((bson->flags & BSON_FLAG_HASHED)) {
+      bson_hash_fold(bson);
+   }
+
    return TRUE;
 }
 
@@ -276,6 +371,7 @@ bson_append_bson_begin (bson_t      *bson,
    const bson_uint8_t empty[5] = { 5 };
    bson_impl_alloc_t *aparent = (bson_impl_alloc_t *)bson;
    bson_impl_alloc_t *achild = (bson_impl_alloc_t *)child;
+   bson_flags_t hashed;
 
    bson_return_val_if_fail(bson, FALSE);
    bson_return_val_if_fail(!(bson->flags & BSON_FLAG_RDONLY), FALSE);
@@ -300,17 +396,25 @@ bson_append_bson_begin (bson_t      *bson,
    }
 
    /*
-    * Append the type and key for the field.
+    * Append the type and key for the field. The empty child document is
+    * about to be rewritten, so keep it out of the running hash until
+    * bson_append_bson_end().
     */
+   hashed = (bson->flags & BSON_FLAG_HASHED);
+   bson->flags &= ~BSON_FLAG_HASHED;
+
    if (!bson_append(bson, 4,
                     (1 + key_length + 1 + 5),
                     1, &type,
                     key_length, key,
                     1, &gZero,
                     5, empty)) {
+      bson->flags |= hashed;
       return FALSE;
    }
 
+   bson->flags |= hashed;
+
    /*
     * Mark the document as working on a child document so that no
     * further modifications can happen until the caller has called
@@ -370,6 +474,10 @@ bson_append_bson_end (bson_t *bson,
    bson_data(bson)[bson->len - 1] = '\0';
    bson_encode_length(bson);
 
+   if ((bson->flags & BSON_FLAG_HASHED)) {
+      bson_hash_fold(bson);
+   }
+
    return TRUE;
 }
 
@@ -400,6 +508,404 @@ bson_append_array_end (bson_t *bson,
 }
 
 
+bson_bool_t
+bson_append_array_builder_begin (bson_t               *bson,
+                                 const char           *key,
+                                 int                   key_length,
+                                 bson_array_builder_t *builder)
+{
+   bson_return_val_if_fail(builder, FALSE);
+
+   builder->index = 0;
+
+   return bson_append_array_begin(bson, key, key_length, &builder->array);
+}
+
+
+bson_bool_t
+bson_append_array_builder_end (bson_t               *bson,
+                               bson_array_builder_t *builder)
+{
+   bson_return_val_if_fail(builder, FALSE);
+
+   return bson_append_array_end(bson, &builder->array);
+}
+
+
+/*
+ * Formats the key of the next element into @builder->key without advancing
+ * the index, so that a failed append can be retried with the same key.
+ */
+static BSON_INLINE int
+bson_array_builder_key (bson_array_builder_t *builder)
+{
+   return (int)bson_uint32_to_digits(builder->index, builder->key);
+}
+
+
+const char *
+bson_array_builder_next_key (bson_array_builder_t *builder,
+                             int                  *key_length)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, NULL);
+
+   len = bson_array_builder_key(builder);
+   builder->index++;
+
+   if (key_length) {
+      *key_length = len;
+   }
+
+   return builder->key;
+}
+
+
+/*
+ * Advances the index of @builder if @appended. Used as the tail of the
+ * typed bson_array_builder_append_*() functions.
+ */
+static BSON_INLINE bson_bool_t
+bson_array_builder_advance (bson_array_builder_t *builder,
+                            bson_bool_t           appended)
+{
+   if (appended) {
+      builder->index++;
+   }
+
+   return appended;
+}
+
+
+bson_bool_t
+bson_array_builder_append_iter (bson_array_builder_t *builder,
+                                const bson_iter_t    *iter)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder, bson_append_iter(&builder->array, builder->key, len, iter));
+}
+
+
+bson_bool_t
+bson_array_builder_append_bool (bson_array_builder_t *builder,
+                                bson_bool_t           value)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder, bson_append_bool(&builder->array, builder->key, len, value));
+}
+
+
+bson_bool_t
+bson_array_builder_append_date_time (bson_array_builder_t *builder,
+                                     bson_int64_t          value)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder,
+      bson_append_date_time(&builder->array, builder->key, len, value));
+}
+
+
+bson_bool_t
+bson_array_builder_append_document (bson_array_builder_t *builder,
+                                    const bson_t         *value)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder,
+      bson_append_document(&builder->array, builder->key, len, value));
+}
+
+
+bson_bool_t
+bson_array_builder_append_double (bson_array_builder_t *builder,
+                                  double                value)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder, bson_append_double(&builder->array, builder->key, len, value));
+}
+
+
+bson_bool_t
+bson_array_builder_append_int32 (bson_array_builder_t *builder,
+                                 bson_int32_t          value)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder, bson_append_int32(&builder->array, builder->key, len, value));
+}
+
+
+bson_bool_t
+bson_array_builder_append_int64 (bson_array_builder_t *builder,
+                                 bson_int64_t          value)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder, bson_append_int64(&builder->array, builder->key, len, value));
+}
+
+
+bson_bool_t
+bson_array_builder_append_null (bson_array_builder_t *builder)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder, bson_append_null(&builder->array, builder->key, len));
+}
+
+
+bson_bool_t
+bson_array_builder_append_oid (bson_array_builder_t *builder,
+                               const bson_oid_t     *value)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder, bson_append_oid(&builder->array, builder->key, len, value));
+}
+
+
+bson_bool_t
+bson_array_builder_append_utf8 (bson_array_builder_t *builder,
+                                const char           *value,
+                                int                   length)
+{
+   int len;
+
+   bson_return_val_if_fail(builder, FALSE);
+
+   len = bson_array_builder_key(builder);
+
+   return bson_array_builder_advance(
+      builder,
+      bson_append_utf8(&builder->array, builder->key, len, value, length));
+}
+
+
+/**
+ * bson_append_array_fixed:
+ * @bson: A bson_t.
+ * @key: The key for the field.
+ * @key_length: The length of @key or -1.
+ * @type: The BSON type of the elements.
+ * @values: An array of @n_values elements of @value_size bytes each.
+ * @value_size: 4, 8 or 12 (bson_oid_t).
+ * @n_values: The number of elements.
+ *
+ * Appends @values as a BSON array in a single growth of @bson. The index
+ * keys are written with bson_uint32_to_digits() and 4 and 8 byte values are
+ * converted to little-endian on the way.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+static bson_bool_t
+bson_append_array_fixed (bson_t      *bson,
+                         const char  *key,
+                         int          key_length,
+                         bson_type_t  type,
+                         const void  *values,
+                         size_t       value_size,
+                         size_t       n_values)
+{
+   const bson_uint8_t *src = values;
+   bson_uint32_t array_len;
+   bson_uint32_t u32;
+   bson_uint64_t u64;
+   bson_uint8_t *buf;
+   size_t n_digits = 0;
+   size_t n_bytes;
+   size_t lo;
+   size_t hi;
+   size_t width;
+   size_t i;
+
+   bson_return_val_if_fail(bson, FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_RDONLY), FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_IN_CHILD), FALSE);
+   bson_return_val_if_fail(key, FALSE);
+   bson_return_val_if_fail(values || !n_values, FALSE);
+
+   if (key_length < 0) {
+      key_length = strlen(key);
+   }
+
+   /*
+    * Each element takes at least 6 bytes, so anything beyond this can never
+    * fit and would overflow the size computation below.
+    */
+   if (n_values > (BSON_MAX_SIZE / 6)) {
+      return FALSE;
+   }
+
+   /*
+    * Sum the lengths of the keys "0" through "n_values - 1" one decimal
+    * width at a time.
+    */
+   for (lo = 0, hi = 10, width = 1; lo < n_values; lo = hi, hi *= 10, width++) {
+      n_digits += (MIN(hi, n_values) - lo) * width;
+   }
+
+   n_bytes = 4 + (n_values * (2 + value_size)) + n_digits + 1;
+   array_len = (bson_uint32_t)n_bytes;
+   n_bytes += 1 + key_length + 1;
+
+   if (BSON_UNLIKELY(n_bytes > (BSON_MAX_SIZE - bson->len))) {
+      return FALSE;
+   }
+
+   if (BSON_UNLIKELY(!bson_grow(bson, n_bytes))) {
+      return FALSE;
+   }
+
+   buf = bson_data(bson) + bson->len - 1;
+
+   *buf++ = BSON_TYPE_ARRAY;
+   memcpy(buf, key, key_length);
+   buf += key_length;
+   *buf++ = '\0';
+
+   array_len = BSON_UINT32_TO_LE(array_len);
+   memcpy(buf, &array_len, 4);
+   buf += 4;
+
+   for (i = 0; i < n_values; i++, src += value_size) {
+      *buf++ = type;
+      buf += bson_uint32_to_digits((bson_uint32_t)i, (char *)buf) + 1;
+
+      switch (value_size) {
+      case 4:
+         memcpy(&u32, src, 4);
+         u32 = BSON_UINT32_TO_LE(u32);
+         memcpy(buf, &u32, 4);
+         break;
+      case 8:
+         memcpy(&u64, src, 8);
+         u64 = BSON_UINT64_TO_LE(u64);
+         memcpy(buf, &u64, 8);
+         break;
+      default:
+         memcpy(buf, src, value_size);
+         break;
+      }
+
+      buf += value_size;
+   }
+
+   *buf++ = '\0';
+
+   bson->len += n_bytes;
+   bson_encode_length(bson);
+   *buf = '\0';
+
+   if ((bson->flags & BSON_FLAG_HASHED)) {
+      bson_hash_fold(bson);
+   }
+
+   return TRUE;
+}
+
+
+bson_bool_t
+bson_append_array_int32 (bson_t             *bson,
+                         const char         *key,
+                         int                 key_length,
+                         const bson_int32_t *values,
+                         size_t              n_values)
+{
+   return bson_append_array_fixed(bson, key, key_length, BSON_TYPE_INT32,
+                                  values, 4, n_values);
+}
+
+
+bson_bool_t
+bson_append_array_int64 (bson_t             *bson,
+                         const char         *key,
+                         int                 key_length,
+                         const bson_int64_t *values,
+                         size_t              n_values)
+{
+   return bson_append_array_fixed(bson, key, key_length, BSON_TYPE_INT64,
+                                  values, 8, n_values);
+}
+
+
+/*
+ * Doubles are swapped like 64-bit integers, which is what
+ * BSON_DOUBLE_TO_LE() does as well.
+ */
+bson_bool_t
+bson_append_array_double (bson_t       *bson,
+                          const char   *key,
+                          int           key_length,
+                          const double *values,
+                          size_t        n_values)
+{
+   return bson_append_array_fixed(bson, key, key_length, BSON_TYPE_DOUBLE,
+                                  values, 8, n_values);
+}
+
+
+bson_bool_t
+bson_append_array_oid (bson_t           *bson,
+                       const char       *key,
+                       int               key_length,
+                       const bson_oid_t *values,
+                       size_t            n_values)
+{
+   return bson_append_array_fixed(bson, key, key_length, BSON_TYPE_OID,
+                                  values, sizeof *values, n_values);
+}
+
+
 bson_bool_t
 bson_append_document_begin (bson_t     *bson,
                             const char *key,
@@ -822,7 +1328,7 @@ bson_append_iter (bson_t            *bson,
                                   bson_iter_date_time(iter));
       break;
    case BSON_TYPE_NULL:
-      ret = bson_append_undefined(bson, key, key_length);
+      ret = bson_append_null(bson, key, key_length);
       break;
    case BSON_TYPE_REGEX:
       {
@@ -906,6 +1412,79 @@ bson_append_iter (bson_t            *bson,
 }
 
 
+/**
+ * bson_append_raw:
+ * @bson: A bson_t to append to.
+ * @data: The encoded elements.
+ * @len: The length of @data.
+ *
+ * Appends already encoded elements that do not live within @bson.
+ */
+bson_bool_t
+bson_append_raw (bson_t             *bson,
+                 const bson_uint8_t *data,
+                 size_t              len)
+{
+   const bson_uint8_t *buf;
+
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_RDONLY), FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_IN_CHILD), FALSE);
+
+   if (!len) {
+      return TRUE;
+   }
+
+   /*
+    * Growing @bson could move the bytes we are copying from.
+    */
+   buf = bson_data(bson);
+   bson_return_val_if_fail((data + len <= buf) || (data >= buf + bson->len),
+                           FALSE);
+
+   return bson_append(bson, 1, len, (bson_uint32_t)len, data);
+}
+
+
+bson_bool_t
+bson_append_iter_range (bson_t            *bson,
+                        const bson_iter_t *first,
+                        const bson_iter_t *last)
+{
+   const bson_uint8_t *data;
+   size_t end;
+
+   bson_return_val_if_fail(bson, FALSE);
+   bson_return_val_if_fail(first, FALSE);
+   bson_return_val_if_fail(first->bson, FALSE);
+   bson_return_val_if_fail(first->type, FALSE);
+
+   data = bson_get_data(first->bson);
+
+   if (last) {
+      bson_return_val_if_fail(last->bson, FALSE);
+      bson_return_val_if_fail(bson_get_data(last->bson) == data, FALSE);
+      end = last->offset;
+   } else {
+      end = first->bson->len - 1;
+   }
+
+   bson_return_val_if_fail(end >= first->offset, FALSE);
+
+   return bson_append_raw(bson, data + first->offset, end - first->offset);
+}
+
+
+bson_bool_t
+bson_concat (bson_t       *dst,
+             const bson_t *src)
+{
+   bson_return_val_if_fail(dst, FALSE);
+   bson_return_val_if_fail(src, FALSE);
+
+   return bson_append_raw(dst, bson_get_data(src) + 4, src->len - 5);
+}
+
+
 bson_bool_t
 bson_append_maxkey (bson_t     *bson,
                     const char *key,
@@ -1169,6 +1748,20 @@ bson_append_now_utc (bson_t     *bson,
 }
 
 
+bson_bool_t
+bson_append_now_utc_coarse (bson_t     *bson,
+                            const char *key,
+                            int         key_length)
+{
+   bson_return_val_if_fail(bson, FALSE);
+   bson_return_val_if_fail(key, FALSE);
+   bson_return_val_if_fail(key_length >= -1, FALSE);
+
+   return bson_append_date_time(bson, key, key_length,
+                                bson_get_coarse_real_time() / 1000);
+}
+
+
 bson_bool_t
 bson_append_date_time (bson_t       *bson,
                        const char   *key,
@@ -1179,7 +1772,6 @@ bson_append_date_time (bson_t       *bson,
 
    bson_return_val_if_fail(bson, FALSE);
    bson_return_val_if_fail(key, FALSE);
-   bson_return_val_if_fail(value, FALSE);
 
    if (key_length < 0) {
       key_length = strlen(key);
@@ -1206,56 +1798,153 @@ bson_append_timeval (bson_t         *bson,
    bson_return_val_if_fail(key, FALSE);
    bson_return_val_if_fail(value, FALSE);
 
-   unix_msec = BSON_UINT64_TO_LE((((bson_uint64_t)value->tv_sec) * 1000UL) +
-                                 (value->tv_usec / 1000UL));
-   return bson_append_date_time(bson, key, key_length, unix_msec);
+   unix_msec = BSON_UINT64_TO_LE((((bson_uint64_t)value->tv_sec) * 1000UL) +
+                                 (value->tv_usec / 1000UL));
+   return bson_append_date_time(bson, key, key_length, unix_msec);
+}
+
+
+bson_bool_t
+bson_append_undefined (bson_t     *bson,
+                       const char *key,
+                       int         key_length)
+{
+   static const bson_uint8_t type = BSON_TYPE_UNDEFINED;
+
+   bson_return_val_if_fail(bson, FALSE);
+   bson_return_val_if_fail(key, FALSE);
+
+   if (key_length < 0) {
+      key_length = strlen(key);
+   }
+
+   return bson_append(bson, 3,
+                      (1 + key_length + 1),
+                      1, &type,
+                      key_length, key,
+                      1, &gZero);
+}
+
+
+void
+bson_init (bson_t *bson)
+{
+   bson_impl_inline_t *impl = (bson_impl_inline_t *)bson;
+
+   bson_return_if_fail(bson);
+
+   impl->flags = BSON_FLAG_INLINE | BSON_FLAG_STATIC;
+   impl->len = 5;
+   impl->data[0] = 5;
+   impl->data[1] = 0;
+   impl->data[2] = 0;
+   impl->data[3] = 0;
+   impl->data[4] = 0;
+}
+
+
+void
+bson_reinit (bson_t *bson)
+{
+   bson_destroy(bson);
+   bson_init(bson);
+}
+
+
+bson_bool_t
+bson_init_with_buffer (bson_t       *bson,
+                       bson_uint8_t *buf,
+                       size_t        buflen,
+                       bson_bool_t   allow_grow)
+{
+   bson_impl_alloc_t *impl = (bson_impl_alloc_t *)bson;
+
+   bson_return_val_if_fail(bson, FALSE);
+   bson_return_val_if_fail(buf, FALSE);
+
+   if ((buflen < 5) || (buflen > INT32_MAX)) {
+      return FALSE;
+   }
+
+   impl->flags = BSON_FLAG_STATIC | BSON_FLAG_NO_FREE | BSON_FLAG_BORROWED;
+   impl->len = 5;
+   impl->parent = NULL;
+   impl->depth = 0;
+   impl->buf = &impl->alloc;
+   impl->buflen = &impl->alloclen;
+   impl->offset = 0;
+   impl->alloc = buf;
+   impl->alloclen = buflen;
+   impl->alloc[0] = 5;
+   impl->alloc[1] = 0;
+   impl->alloc[2] = 0;
+   impl->alloc[3] = 0;
+   impl->alloc[4] = 0;
+   impl->realloc = allow_grow ? bson_realloc : NULL;
+
+   return TRUE;
 }
 
 
 bson_bool_t
-bson_append_undefined (bson_t     *bson,
-                       const char *key,
-                       int         key_length)
+bson_reserve (bson_t *bson,
+              size_t  size)
 {
-   static const bson_uint8_t type = BSON_TYPE_UNDEFINED;
+   bson_flags_t valid;
 
    bson_return_val_if_fail(bson, FALSE);
-   bson_return_val_if_fail(key, FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_RDONLY), FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_IN_CHILD), FALSE);
 
-   if (key_length < 0) {
-      key_length = strlen(key);
+   if (size > BSON_MAX_SIZE) {
+      return FALSE;
    }
 
-   return bson_append(bson, 3,
-                      (1 + key_length + 1),
-                      1, &type,
-                      key_length, key,
-                      1, &gZero);
+   if (size <= bson->len) {
+      return TRUE;
+   }
+
+   /*
+    * Growing does not change the contents, so keep the mark of
+    * bson_mark_validated().
+    */
+   valid = (bson->flags & BSON_FLAG_VALID);
+
+   if (!bson_grow(bson, (bson_uint32_t)(size - bson->len))) {
+      return FALSE;
+   }
+
+   bson->flags |= valid;
+
+   return TRUE;
 }
 
 
 void
-bson_init (bson_t *bson)
+bson_reset (bson_t *bson)
 {
-   bson_impl_inline_t *impl = (bson_impl_inline_t *)bson;
+   bson_impl_alloc_t *impl = (bson_impl_alloc_t *)bson;
+   bson_uint8_t *data;
 
    bson_return_if_fail(bson);
+   bson_return_if_fail(!(bson->flags & BSON_FLAG_RDONLY));
+   bson_return_if_fail(!(bson->flags & BSON_FLAG_CHILD));
+   bson_return_if_fail(!(bson->flags & BSON_FLAG_IN_CHILD));
 
-   impl->flags = BSON_FLAG_INLINE | BSON_FLAG_STATIC;
-   impl->len = 5;
-   impl->data[0] = 5;
-   impl->data[1] = 0;
-   impl->data[2] = 0;
-   impl->data[3] = 0;
-   impl->data[4] = 0;
-}
+   bson->flags &= ~BSON_FLAG_VALID;
+   bson->len = 5;
 
+   data = bson_data(bson);
+   data[0] = 5;
+   data[1] = 0;
+   data[2] = 0;
+   data[3] = 0;
+   data[4] = 0;
 
-void
-bson_reinit (bson_t *bson)
-{
-   bson_destroy(bson);
-   bson_init(bson);
+   if ((bson->flags & BSON_FLAG_HASHED)) {
+      bson_hash_lanes_init(impl->hash, 0);
+      impl->hash_len = 0;
+   }
 }
 
 
@@ -1434,25 +2123,76 @@ bson_copy_to (const bson_t *src,
 }
 
 
-static bson_bool_t
-should_ignore (const char *first_exclude,
-               va_list     args,
-               const char *name)
+/**
+ * bson_copy_run:
+ * @dst: The bson_t to append to.
+ * @data: The data of the source document.
+ * @run_start: The offset of the first element of the run.
+ * @run_end: The offset following the last element of the run.
+ *
+ * Appends a run of whole elements taken from another document.
+ */
+static void
+bson_copy_run (bson_t             *dst,
+               const bson_uint8_t *data,
+               size_t              run_start,
+               size_t              run_end)
 {
-   bson_bool_t ret = FALSE;
-   const char *exclude = first_exclude;
-   va_list args_copy;
+   if (!bson_append_raw(dst, data + run_start, run_end - run_start)) {
+      /*
+       * This should not be able to happen since we are copying from within
+       * a valid bson_t.
+       */
+      BSON_ASSERT(FALSE);
+   }
+}
 
-   va_copy(args_copy, args);
-   do {
-      if (!strcmp(name, exclude)) {
-         ret = TRUE;
-         break;
+
+/**
+ * bson_copy_to_keyset:
+ * @src: A bson_t.
+ * @dst: A bson_t to initialize and copy into.
+ * @keyset: A bson_keyset_t.
+ * @include: If the fields in @keyset are to be kept or dropped.
+ *
+ * Copies the fields of @src that are in @keyset if @include is TRUE, or the
+ * ones that are not if it is FALSE. Fields that are kept and adjacent in
+ * @src are copied with a single memcpy().
+ */
+static void
+bson_copy_to_keyset (const bson_t        *src,
+                     bson_t              *dst,
+                     const bson_keyset_t *keyset,
+                     bson_bool_t          include)
+{
+   const bson_uint8_t *data;
+   bson_iter_t iter;
+   size_t run_start = 0;
+   size_t run_end = 0;
+   int key_length;
+
+   bson_init(dst);
+
+   if (!bson_iter_init(&iter, src)) {
+      return;
+   }
+
+   data = bson_get_data(src);
+
+   while (bson_iter_next(&iter)) {
+      key_length = (int)strlen((const char *)iter.key);
+
+      if (!bson_keyset_contains(keyset, (const char *)iter.key, key_length) ==
+          !include) {
+         if (iter.offset != run_end) {
+            bson_copy_run(dst, data, run_start, run_end);
+            run_start = iter.offset;
+         }
+         run_end = iter.next_offset;
       }
-   } while ((exclude = va_arg(args_copy, const char *)));
-   va_end(args_copy);
+   }
 
-   return ret;
+   bson_copy_run(dst, data, run_start, run_end);
 }
 
 
@@ -1462,24 +2202,11 @@ bson_copy_to_excluding_va (const bson_t *src,
                            const char   *first_exclude,
                            va_list       args)
 {
-   bson_iter_t iter;
+   bson_keyset_t *keyset;
 
-   bson_init(dst);
-
-   if (bson_iter_init(&iter, src)) {
-      while (bson_iter_next(&iter)) {
-         if (!should_ignore(first_exclude, args, bson_iter_key(&iter))) {
-            if (!bson_append_iter(dst, NULL, 0, &iter)) {
-               /*
-                * This should not be able to happen since we are copying
-                * from within a valid bson_t.
-                */
-               BSON_ASSERT(FALSE);
-               return;
-            }
-         }
-      }
-   }
+   keyset = bson_keyset_new_va(first_exclude, args);
+   bson_copy_to_keyset(src, dst, keyset, FALSE);
+   bson_keyset_destroy(keyset);
 }
 
 
@@ -1501,6 +2228,368 @@ bson_copy_to_excluding (const bson_t *src,
 }
 
 
+void
+bson_copy_to_including (const bson_t *src,
+                        bson_t       *dst,
+                        const char   *first_include,
+                        ...)
+{
+   bson_keyset_t *keyset;
+   va_list args;
+
+   bson_return_if_fail(src);
+   bson_return_if_fail(dst);
+   bson_return_if_fail(first_include);
+
+   va_start(args, first_include);
+   keyset = bson_keyset_new_va(first_include, args);
+   va_end(args);
+
+   bson_copy_to_keyset(src, dst, keyset, TRUE);
+   bson_keyset_destroy(keyset);
+}
+
+
+void
+bson_copy_to_excluding_keyset (const bson_t        *src,
+                               bson_t              *dst,
+                               const bson_keyset_t *keyset)
+{
+   bson_return_if_fail(src);
+   bson_return_if_fail(dst);
+   bson_return_if_fail(keyset);
+
+   bson_copy_to_keyset(src, dst, keyset, FALSE);
+}
+
+
+void
+bson_copy_to_including_keyset (const bson_t        *src,
+                               bson_t              *dst,
+                               const bson_keyset_t *keyset)
+{
+   bson_return_if_fail(src);
+   bson_return_if_fail(dst);
+   bson_return_if_fail(keyset);
+
+   bson_copy_to_keyset(src, dst, keyset, TRUE);
+}
+
+
+/**
+ * bson_edit_find:
+ * @iters: Two bson_iter_t to alternate between while descending.
+ * @dotkey: The dotted path to the element.
+ * @parents: A location for the offsets of the enclosing subdocuments.
+ * @n_parents: A location for the number of offsets in @parents.
+ *
+ * Locates the element at @dotkey, recording the offset of each subdocument
+ * that was descended into so their lengths can be fixed up after an edit.
+ * Unlike bson_iter_find_descendant(), path components must match whole
+ * keys.
+ *
+ * Returns: The iter positioned on the element, or NULL if not found.
+ */
+static bson_iter_t *
+bson_edit_find (const bson_t  *bson,
+                bson_iter_t    iters[2],
+                const char    *dotkey,
+                bson_uint32_t *parents,
+                size_t        *n_parents)
+{
+   const bson_uint8_t *base = bson_data(bson);
+   bson_iter_t *iter = &iters[0];
+   const char *dot;
+   size_t len;
+   int k = 0;
+
+   *n_parents = 0;
+
+   if (!bson_iter_init(iter, bson)) {
+      return NULL;
+   }
+
+   for (;;) {
+      if ((dot = strchr(dotkey, '.'))) {
+         len = dot - dotkey;
+      } else {
+         len = strlen(dotkey);
+      }
+
+      do {
+         if (!bson_iter_next(iter)) {
+            return NULL;
+         }
+      } while (strncmp(bson_iter_key(iter), dotkey, len) ||
+               bson_iter_key(iter)[len]);
+
+      if (!dot) {
+         return iter;
+      }
+
+      if (!BSON_ITER_HOLDS_DOCUMENT(iter) && !BSON_ITER_HOLDS_ARRAY(iter)) {
+         return NULL;
+      }
+
+      parents[(*n_parents)++] = iter->data1 - base;
+
+      k ^= 1;
+      if (!bson_iter_recurse(iter, &iters[k])) {
+         return NULL;
+      }
+
+      iter = &iters[k];
+      dotkey = dot + 1;
+   }
+}
+
+
+/**
+ * bson_edit_splice:
+ * @bson: A top-level bson_t.
+ * @pos: The offset of the bytes to replace.
+ * @remove_len: The number of bytes to remove at @pos.
+ * @insert: The bytes to insert at @pos.
+ * @insert_len: The number of bytes in @insert.
+ * @parents: Offsets of the subdocuments containing @pos.
+ * @n_parents: The number of elements in @parents.
+ *
+ * Replaces @remove_len bytes at @pos with @insert, moving the rest of the
+ * document and adjusting the length prefix of @bson and every subdocument
+ * in @parents. All of those prefixes lie before @pos and are therefore not
+ * moved themselves.
+ *
+ * Returns: FALSE if the document would exceed BSON_MAX_SIZE.
+ */
+static bson_bool_t
+bson_edit_splice (bson_t              *bson,
+                  bson_uint32_t        pos,
+                  bson_uint32_t        remove_len,
+                  const bson_uint8_t  *insert,
+                  bson_uint32_t        insert_len,
+                  const bson_uint32_t *parents,
+                  size_t               n_parents)
+{
+   bson_uint8_t *data;
+   bson_uint32_t doclen;
+   bson_int32_t delta;
+   size_t i;
+
+   if (insert_len > remove_len) {
+      if ((insert_len - remove_len) > (BSON_MAX_SIZE - bson->len)) {
+         return FALSE;
+      }
+
+      /*
+       * bson_grow() rounds the buffer up to a power of two, leaving slack
+       * for further growth without reallocating.
+       */
+      if (!bson_grow(bson, insert_len - remove_len)) {
+         return FALSE;
+      }
+   }
+
+   bson->flags &= ~BSON_FLAG_VALID;
+
+   delta = (bson_int32_t)insert_len - (bson_int32_t)remove_len;
+   data = bson_data(bson);
+
+   memmove(data + pos + insert_len,
+           data + pos + remove_len,
+           bson->len - pos - remove_len);
+   if (insert_len) {
+      memcpy(data + pos, insert, insert_len);
+   }
+
+   bson->len += delta;
+   bson_encode_length(bson);
+
+   for (i = 0; i < n_parents; i++) {
+      memcpy(&doclen, data + parents[i], 4);
+      doclen = BSON_UINT32_TO_LE(BSON_UINT32_FROM_LE(doclen) + delta);
+      memcpy(data + parents[i], &doclen, 4);
+   }
+
+   /*
+    * Parents are listed outermost first, and their length prefixes change
+    * ahead of @pos.
+    */
+   bson_hash_rewind(bson, (n_parents ? parents[0] : pos) - 4);
+
+   return TRUE;
+}
+
+
+/**
+ * bson_edit:
+ *
+ * Common implementation of bson_remove(), bson_replace_iter() and
+ * bson_insert_iter(). If @value is NULL the element at @dotkey is removed.
+ * Otherwise, the element at @dotkey is replaced by one with @key and the
+ * value of @value, or the element is appended to the subdocument at @dotkey
+ * if @append is TRUE.
+ */
+static bson_bool_t
+bson_edit (bson_t            *bson,
+           const char        *dotkey,
+           bson_bool_t        append,
+           const char        *key,
+           int                key_length,
+           const bson_iter_t *value)
+{
+   bson_iter_t iters[2];
+   bson_iter_t *iter = NULL;
+   bson_uint32_t stack_parents[8];
+   bson_uint32_t *parents = stack_parents;
+   bson_uint8_t stack_element[256];
+   bson_uint8_t *element = NULL;
+   const bson_uint8_t *value_data;
+   bson_uint32_t element_len = 0;
+   bson_uint32_t value_len = 0;
+   bson_uint32_t doclen;
+   bson_uint32_t pos;
+   bson_uint32_t remove_len;
+   size_t n_parents = 0;
+   size_t n_dots = 0;
+   const char *c;
+   bson_bool_t ret = FALSE;
+
+   for (c = dotkey; c && *c; c++) {
+      n_dots += (*c == '.');
+   }
+
+   if ((n_dots + 1) > (sizeof stack_parents / sizeof stack_parents[0])) {
+      parents = bson_malloc((n_dots + 1) * sizeof *parents);
+   }
+
+   if (dotkey) {
+      if (!(iter = bson_edit_find(bson, iters, dotkey, parents, &n_parents))) {
+         goto cleanup;
+      }
+   }
+
+   /*
+    * Build the new element up front as @value may point into @bson, which
+    * is about to be modified.
+    */
+   if (value) {
+      if (key_length < 0) {
+         key_length = strlen(key);
+      }
+
+      /*
+       * data1 is NULL for null-like values, so find the value after the key.
+       */
+      value_data = value->key + strlen((const char *)value->key) + 1;
+      value_len = value->next_offset -
+                  (value_data - bson_get_data(value->bson));
+      element_len = 1 + key_length + 1 + value_len;
+
+      if (element_len > sizeof stack_element) {
+         element = bson_malloc(element_len);
+      } else {
+         element = stack_element;
+      }
+
+      element[0] = *value->type;
+      memcpy(element + 1, key, key_length);
+      element[1 + key_length] = '\0';
+      memcpy(element + 2 + key_length, value_data, value_len);
+   }
+
+   if (append) {
+      if (iter) {
+         if (!BSON_ITER_HOLDS_DOCUMENT(iter) && !BSON_ITER_HOLDS_ARRAY(iter)) {
+            goto cleanup;
+         }
+         pos = iter->data1 - bson_data(bson);
+         parents[n_parents++] = pos;
+         memcpy(&doclen, iter->data1, 4);
+         pos += BSON_UINT32_FROM_LE(doclen) - 1;
+      } else {
+         pos = bson->len - 1;
+      }
+      remove_len = 0;
+   } else {
+      pos = iter->type - bson_data(bson);
+      remove_len = iter->next_offset - iter->offset;
+   }
+
+   ret = bson_edit_splice(bson, pos, remove_len, element, element_len,
+                          parents, n_parents);
+
+cleanup:
+   if (parents != stack_parents) {
+      bson_free(parents);
+   }
+
+   if (element != stack_element) {
+      bson_free(element);
+   }
+
+   return ret;
+}
+
+
+bson_bool_t
+bson_remove (bson_t     *bson,
+             const char *dotkey)
+{
+   bson_return_val_if_fail(bson, FALSE);
+   bson_return_val_if_fail(dotkey, FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_RDONLY), FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_CHILD), FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_IN_CHILD), FALSE);
+
+   return bson_edit(bson, dotkey, FALSE, NULL, 0, NULL);
+}
+
+
+bson_bool_t
+bson_replace_iter (bson_t            *bson,
+                   const char        *dotkey,
+                   const bson_iter_t *value)
+{
+   const char *key;
+
+   bson_return_val_if_fail(bson, FALSE);
+   bson_return_val_if_fail(dotkey, FALSE);
+   bson_return_val_if_fail(value, FALSE);
+   bson_return_val_if_fail(value->type && value->key, FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_RDONLY), FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_CHILD), FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_IN_CHILD), FALSE);
+
+   /*
+    * The element keeps its own key, which is the last path component.
+    */
+   key = strrchr(dotkey, '.');
+   key = key ? key + 1 : dotkey;
+
+   return bson_edit(bson, dotkey, FALSE, key, -1, value);
+}
+
+
+bson_bool_t
+bson_insert_iter (bson_t            *bson,
+                  const char        *dotkey,
+                  const char        *key,
+                  int                key_length,
+                  const bson_iter_t *value)
+{
+   bson_return_val_if_fail(bson, FALSE);
+   bson_return_val_if_fail(key, FALSE);
+   bson_return_val_if_fail(key_length >= -1, FALSE);
+   bson_return_val_if_fail(value, FALSE);
+   bson_return_val_if_fail(value->type && value->key, FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_RDONLY), FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_CHILD), FALSE);
+   bson_return_val_if_fail(!(bson->flags & BSON_FLAG_IN_CHILD), FALSE);
+
+   return bson_edit(bson, dotkey, TRUE, key, key_length, value);
+}
+
+
 void
 bson_destroy (bson_t *bson)
 {
@@ -2161,13 +3250,19 @@ bson_validate (const bson_t          *bson,
 {
    bson_validate_state_t state = { flags, -1 };
    bson_iter_t iter;
+   bson_t view;
 
-   if (!bson_iter_init(&iter, bson)) {
+   /*
+    * Check through an unmarked view so a document that was already marked
+    * is still checked in full.
+    */
+   if (!bson_init_static(&view, bson_get_data(bson), bson->len) ||
+       !bson_iter_init(&iter, &view)) {
       state.err_offset = 0;
       goto failure;
    }
 
-   bson_iter_validate_document(&iter, NULL, bson, &state);
+   bson_iter_validate_document(&iter, NULL, &view, &state);
 
 failure:
    if (offset) {
@@ -2176,3 +3271,21 @@ failure:
 
    return (state.err_offset < 0);
 }
+
+
+void
+bson_mark_validated (bson_t *bson)
+{
+   bson_return_if_fail(bson);
+
+   bson->flags |= BSON_FLAG_VALID;
+}
+
+
+bson_bool_t
+bson_is_validated (const bson_t *bson)
+{
+   bson_return_val_if_fail(bson, FALSE);
+
+   return !!(bson->flags & BSON_FLAG_VALID);
+}
@@ -26,22 +26,32 @@
 
 #define BSON_INSIDE
 
+#include "bson-column.h"
 #include "bson-config.h"
 #include "bson-context.h"
 #include "bson-clock.h"
+#include "bson-diff.h"
 #include "bson-error.h"
+#include "bson-hash.h"
 #include "bson-iter.h"
 #include "bson-keys.h"
+#include "bson-keyset.h"
 #include "bson-macros.h"
 #include "bson-md5.h"
 #include "bson-memory.h"
+#include "bson-message.h"
 #include "bson-oid.h"
+#include "bson-oid-map.h"
 #include "bson-reader.h"
+#include "bson-sorter.h"
 #include "bson-string.h"
+#include "bson-struct.h"
+#include "bson-template.h"
 #include "bson-thread.h"
 #include "bson-types.h"
 #include "bson-utf8.h"
 #include "bson-version.h"
+#include "bson-walker.h"
 #include "bson-writer.h"
 
 #undef BSON_INSIDE
@@ -130,12 +140,66 @@ bson_init (bson_t *b);
  * @b: (inout): A bson_t.
  *
  * Calls bson_destroy() on @b followed by bson_init(). This is useful as a
- * short helper to rebuild documents.
+ * short helper to rebuild documents. See bson_reset() to keep the buffer
+ * instead.
  */
 void
 bson_reinit (bson_t *b);
 
 
+/**
+ * bson_init_with_buffer:
+ * @b: A pointer to a bson_t.
+ * @buf: A buffer of at least @buflen bytes.
+ * @buflen: The capacity of @buf, at least 5.
+ * @allow_grow: If @b may outgrow @buf.
+ *
+ * Initializes an empty bson_t that is built in @buf, such as a buffer on
+ * the stack or in thread local scratch space. @buf must be valid for the
+ * life of @b and is never freed.
+ *
+ * If @allow_grow is TRUE, a document that outgrows @buf is copied to a heap
+ * buffer that bson_destroy() frees. Otherwise appends that do not fit in
+ * @buf fail and leave @b unchanged.
+ *
+ * Returns: TRUE if initialized successfully; otherwise FALSE.
+ */
+bson_bool_t
+bson_init_with_buffer (bson_t       *b,
+                       bson_uint8_t *buf,
+                       size_t        buflen,
+                       bson_bool_t   allow_grow);
+
+
+/**
+ * bson_reserve:
+ * @b: A bson_t.
+ * @size: The size in bytes @b should be able to grow to.
+ *
+ * Grows the buffer of @b so that it can hold a @size byte document without
+ * further allocation. This saves the intermediate growths of a series of
+ * appends whose total size is known up front.
+ *
+ * Returns: TRUE if successful; FALSE if @size exceeds %BSON_MAX_SIZE or the
+ *    buffer of @b cannot grow.
+ */
+bson_bool_t
+bson_reserve (bson_t *b,
+              size_t  size);
+
+
+/**
+ * bson_reset:
+ * @b: A bson_t.
+ *
+ * Removes all fields from @b but keeps its buffer, so that a loop can
+ * build a document per iteration in one allocation. @b must not be a
+ * child document or read-only.
+ */
+void
+bson_reset (bson_t *b);
+
+
 /**
  * bson_new_from_data:
  * @data: A buffer containing a serialized bson document.
@@ -208,6 +272,69 @@ bson_copy_to_excluding (const bson_t *src,
                         ...) BSON_GNUC_NULL_TERMINATED;
 
 
+/**
+ * bson_copy_to_including:
+ * @src: A bson_t.
+ * @dst: A bson_t to initialize and copy into.
+ * @first_include: First field name to include.
+ *
+ * Copies only the fields of @src that are provided into @dst, keeping the
+ * order of @src.
+ */
+void
+bson_copy_to_including (const bson_t *src,
+                        bson_t       *dst,
+                        const char   *first_include,
+                        ...) BSON_GNUC_NULL_TERMINATED;
+
+
+/**
+ * bson_copy_to_excluding_keyset:
+ * @src: A bson_t.
+ * @dst: A bson_t to initialize and copy into.
+ * @keyset: The fields to exclude.
+ *
+ * Like bson_copy_to_excluding() but takes a bson_keyset_t that can be
+ * reused for many documents. Runs of fields that are kept are copied with
+ * a single memcpy().
+ */
+void
+bson_copy_to_excluding_keyset (const bson_t        *src,
+                               bson_t              *dst,
+                               const bson_keyset_t *keyset);
+
+
+/**
+ * bson_copy_to_including_keyset:
+ * @src: A bson_t.
+ * @dst: A bson_t to initialize and copy into.
+ * @keyset: The fields to include.
+ *
+ * Like bson_copy_to_including() but takes a bson_keyset_t that can be
+ * reused for many documents.
+ */
+void
+bson_copy_to_including_keyset (const bson_t        *src,
+                               bson_t              *dst,
+                               const bson_keyset_t *keyset);
+
+
+/**
+ * bson_concat:
+ * @dst: A bson_t to append to.
+ * @src: A bson_t.
+ *
+ * Appends all of the elements of @src to @dst with a single memcpy(). Keys
+ * are copied as they are, so concatenating two documents with a common key
+ * produces a document with a duplicate key. @src must not be @dst.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_concat (bson_t       *dst,
+             const bson_t *src);
+
+
 /**
  * bson_destroy:
  * @bson: A bson_t.
@@ -292,6 +419,9 @@ bson_equal (const bson_t *bson,
  * Validates a BSON document by walking through the document and inspecting
  * the fields for valid content.
  *
+ * @bson is not modified. To skip the checks of later iterations, pass a
+ * document that is valid to bson_mark_validated().
+ *
  * Returns: TRUE if @bson is valid; otherwise FALSE and @offset is set.
  */
 bson_bool_t
@@ -300,6 +430,36 @@ bson_validate (const bson_t          *bson,
                size_t                *offset);
 
 
+/**
+ * bson_mark_validated:
+ * @bson: A bson_t.
+ *
+ * Tells libbson that the structure of @bson is known to be valid, for
+ * example because it was built by this process or checked on the way in.
+ * Iterators over a marked document, and over the documents embedded in it,
+ * skip the bounds and length checks that bson_iter_next() otherwise does
+ * for every element.
+ *
+ * Iterating a marked document that is not in fact valid reads out of
+ * bounds. The mark is dropped when @bson is appended to or edited.
+ */
+void
+bson_mark_validated (bson_t *bson);
+
+
+/**
+ * bson_is_validated:
+ * @bson: A bson_t.
+ *
+ * Checks if @bson was marked with bson_mark_validated() and has not been
+ * modified since.
+ *
+ * Returns: TRUE if @bson is marked as valid.
+ */
+bson_bool_t
+bson_is_validated (const bson_t *bson);
+
+
 /**
  * bson_as_json:
  * @bson: A bson_t.
@@ -549,6 +709,173 @@ bson_append_array_end (bson_t *bson,
                        bson_t *child);
 
 
+/**
+ * bson_append_array_builder_begin:
+ * @bson: A bson_t.
+ * @key: The key for the field.
+ * @key_length: The length of @key in bytes not including NUL or -1
+ *    if @key_length is NUL terminated.
+ * @builder: A location to an uninitialized bson_array_builder_t.
+ *
+ * Like bson_append_array_begin(), but initializes @builder to generate the
+ * index keys of the array elements. Append elements with
+ * bson_array_builder_append_int32() and friends, or use
+ * bson_array_builder_next_key() with the regular append functions on
+ * @builder->array.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_append_array_builder_begin (bson_t               *bson,
+                                 const char           *key,
+                                 int                   key_length,
+                                 bson_array_builder_t *builder);
+
+
+/**
+ * bson_append_array_builder_end:
+ * @bson: A bson_t.
+ * @builder: A bson_array_builder_t supplied to
+ *    bson_append_array_builder_begin().
+ *
+ * Finishes the appending of the array built with @builder to @bson.
+ * @builder is considered disposed after this call and should not be used
+ * any further.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_append_array_builder_end (bson_t               *bson,
+                               bson_array_builder_t *builder);
+
+
+/**
+ * bson_array_builder_next_key:
+ * @builder: A bson_array_builder_t.
+ * @key_length: (out) (allow-none): A location for the length of the key.
+ *
+ * Fetches the key for the next element of the array and advances the index
+ * of @builder. The key is only valid until the next call using @builder.
+ *
+ * Returns: The key for the next element.
+ */
+const char *
+bson_array_builder_next_key (bson_array_builder_t *builder,
+                             int                  *key_length);
+
+
+/**
+ * bson_array_builder_append_iter:
+ * @builder: A bson_array_builder_t.
+ * @iter: A bson_iter_t located on the value to append.
+ *
+ * Appends the value @iter is located on as the next element of the array.
+ * The bson_array_builder_append_*() functions below are the typed
+ * counterparts of bson_append_*(), using the next index as the key. The
+ * index is only advanced if the append succeeds.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_array_builder_append_iter (bson_array_builder_t *builder,
+                                const bson_iter_t    *iter);
+
+
+bson_bool_t
+bson_array_builder_append_bool (bson_array_builder_t *builder,
+                                bson_bool_t           value);
+
+
+bson_bool_t
+bson_array_builder_append_date_time (bson_array_builder_t *builder,
+                                     bson_int64_t          value);
+
+
+bson_bool_t
+bson_array_builder_append_document (bson_array_builder_t *builder,
+                                    const bson_t         *value);
+
+
+bson_bool_t
+bson_array_builder_append_double (bson_array_builder_t *builder,
+                                  double                value);
+
+
+bson_bool_t
+bson_array_builder_append_int32 (bson_array_builder_t *builder,
+                                 bson_int32_t          value);
+
+
+bson_bool_t
+bson_array_builder_append_int64 (bson_array_builder_t *builder,
+                                 bson_int64_t          value);
+
+
+bson_bool_t
+bson_array_builder_append_null (bson_array_builder_t *builder);
+
+
+bson_bool_t
+bson_array_builder_append_oid (bson_array_builder_t *builder,
+                               const bson_oid_t     *value);
+
+
+bson_bool_t
+bson_array_builder_append_utf8 (bson_array_builder_t *builder,
+                                const char           *value,
+                                int                   length);
+
+
+/**
+ * bson_append_array_int32:
+ * @bson: A bson_t.
+ * @key: The key for the field.
+ * @key_length: The length of @key in bytes not including NUL or -1
+ *    if @key_length is NUL terminated.
+ * @values: An array of @n_values bson_int32_t.
+ * @n_values: The number of elements in @values.
+ *
+ * Appends @values as a BSON array of 32-bit integers. The size of the array
+ * is computed up front so that the buffer of @bson grows at most once, and
+ * the elements are written straight into it.
+ *
+ * bson_append_array_int64(), bson_append_array_double() and
+ * bson_append_array_oid() do the same for the other fixed size types.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_append_array_int32 (bson_t             *bson,
+                         const char         *key,
+                         int                 key_length,
+                         const bson_int32_t *values,
+                         size_t              n_values);
+
+
+bson_bool_t
+bson_append_array_int64 (bson_t             *bson,
+                         const char         *key,
+                         int                 key_length,
+                         const bson_int64_t *values,
+                         size_t              n_values);
+
+
+bson_bool_t
+bson_append_array_double (bson_t       *bson,
+                          const char   *key,
+                          int           key_length,
+                          const double *values,
+                          size_t        n_values);
+
+
+bson_bool_t
+bson_append_array_oid (bson_t           *bson,
+                       const char       *key,
+                       int               key_length,
+                       const bson_oid_t *values,
+                       size_t            n_values);
+
+
 /**
  * bson_append_int32:
  * @bson: A bson_t.
@@ -602,6 +929,25 @@ bson_append_iter (bson_t            *bson,
                   const bson_iter_t *iter);
 
 
+/**
+ * bson_append_iter_range:
+ * @bson: A bson_t to append to.
+ * @first: An iter positioned on the first element to append.
+ * @last: An iter on the same document positioned on the element to stop
+ *    before, or %NULL to append through the end of the document.
+ *
+ * Appends the elements from @first up to @last, keys included, by copying
+ * their encoded bytes with a single memcpy(). The elements must not come
+ * from @bson itself.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_append_iter_range (bson_t            *bson,
+                        const bson_iter_t *first,
+                        const bson_iter_t *last);
+
+
 /**
  * bson_append_minkey:
  * @bson: A bson_t.
@@ -817,6 +1163,26 @@ bson_append_now_utc (bson_t     *bson,
                      const char *key,
                      int         key_length);
 
+
+/**
+ * bson_append_now_utc_coarse:
+ * @bson: A bson_t.
+ * @key: The key for the field.
+ * @key_length: The length of @key or -1 if it is NULL terminated.
+ *
+ * Appends the current time as a UTC date time read from
+ * bson_get_coarse_real_time(). This is a cheaper alternative to
+ * millisecond timestamps taken with gettimeofday(), such as with
+ * bson_append_timeval(), though it may lag the wall clock by a few
+ * milliseconds.
+ *
+ * Returns: TRUE if successful; FALSE if append would overflow max size.
+ */
+bson_bool_t
+bson_append_now_utc_coarse (bson_t     *bson,
+                            const char *key,
+                            int         key_length);
+
 /**
  * bson_append_timestamp:
  * @bson: A bson_t.
@@ -858,6 +1224,69 @@ bson_append_undefined (bson_t     *bson,
                        int         key_length);
 
 
+/**
+ * bson_remove:
+ * @bson: A bson_t.
+ * @dotkey: The dotted path of the field to remove, such as "a.b.c".
+ *
+ * Removes a field from @bson in place, moving the following bytes down and
+ * adjusting the length of every enclosing document. This avoids rebuilding
+ * the document with bson_copy_to_excluding().
+ *
+ * Removing an element from an array does not renumber the keys of the
+ * elements that follow it.
+ *
+ * Returns: TRUE if the field was found and removed.
+ */
+bson_bool_t
+bson_remove (bson_t     *bson,
+             const char *dotkey);
+
+
+/**
+ * bson_replace_iter:
+ * @bson: A bson_t.
+ * @dotkey: The dotted path of the field to replace.
+ * @value: A bson_iter_t positioned on the new value.
+ *
+ * Replaces the value of a field in @bson in place, keeping its key and
+ * position. The new value may have a different type and size than the old
+ * one, unlike bson_iter_overwrite_int32() and friends. @value may point
+ * into @bson itself.
+ *
+ * Returns: TRUE if the field was found and replaced; FALSE if it was not
+ *    found or the result would overflow max size.
+ */
+bson_bool_t
+bson_replace_iter (bson_t            *bson,
+                   const char        *dotkey,
+                   const bson_iter_t *value);
+
+
+/**
+ * bson_insert_iter:
+ * @bson: A bson_t.
+ * @dotkey: The dotted path of a document or array field, or NULL.
+ * @key: The key for the new field.
+ * @key_length: The length of @key or -1 if it is NULL terminated.
+ * @value: A bson_iter_t positioned on the value for the new field.
+ *
+ * Adds a field at the end of the document or array at @dotkey, or at the
+ * end of @bson itself if @dotkey is NULL, adjusting the length of every
+ * enclosing document. This allows growing a nested document without
+ * rebuilding @bson.
+ *
+ * Returns: TRUE if successful; FALSE if @dotkey was not found or is not a
+ *    document or array, or the result would overflow max size.
+ */
+bson_bool_t
+bson_insert_iter (bson_t            *bson,
+                  const char        *dotkey,
+                  const char        *key,
+                  int                key_length,
+                  const bson_iter_t *value);
+
+
 BSON_END_DECLS
 
 
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * This program sorts the BSON documents contained in the provided file, or
+ * stdin, and writes them to stdout. Inputs larger than memory are sorted
+ * using temporary files.
+ *
+ *   bson-sort -k name -k age:-1 -m 256 -j 4 input.bson > sorted.bson
+ */
+
+
+#include <bson.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+static void
+usage (const char *prog)
+{
+   fprintf(stderr,
+           "usage: %s [-k KEY[:-1]]... [-m MB] [-j THREADS] [-T DIR] [-v] "
+           "[FILE]\n"
+           "\n"
+           "  -k KEY[:-1]  Sort by the dotted KEY, descending with :-1.\n"
+           "  -m MB        Size of each in-memory run in megabytes.\n"
+           "  -j THREADS   Number of threads sorting runs.\n"
+           "  -T DIR       Directory for temporary files.\n"
+           "  -v           Print timings to stderr.\n",
+           prog);
+}
+
+
+static bson_bool_t
+emit (const bson_t *b,
+      void         *data)
+{
+   FILE *stream = data;
+
+   return (fwrite(bson_get_data(b), 1, b->len, stream) == b->len);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bson_sorter_stats_t stats;
+   bson_sorter_t *sorter;
+   bson_reader_t *reader;
+   bson_error_t error;
+   bson_bool_t verbose = FALSE;
+   const char *tmpdir = NULL;
+   size_t run_size = 0;
+   char **keys;
+   char *sep;
+   int n_keys = 0;
+   int threads = 0;
+   int ret = 0;
+   int fd = STDIN_FILENO;
+   int c;
+   int i;
+
+   keys = bson_malloc0(argc * sizeof *keys);
+
+   while ((c = getopt(argc, argv, "hk:m:j:T:v")) != -1) {
+      switch (c) {
+      case 'k':
+         keys[n_keys++] = optarg;
+         break;
+      case 'm':
+         run_size = (size_t)atoi(optarg) * 1024 * 1024;
+         break;
+      case 'j':
+         threads = atoi(optarg);
+         break;
+      case 'T':
+         tmpdir = optarg;
+         break;
+      case 'v':
+         verbose = TRUE;
+         break;
+      case 'h':
+      default:
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   /*
+    * Without any keys all documents compare equal and are written in the
+    * order they were read.
+    */
+   sorter = bson_sorter_new(run_size, threads);
+   bson_sorter_set_tmpdir(sorter, tmpdir);
+
+   for (i = 0; i < n_keys; i++) {
+      if ((sep = strrchr(keys[i], ':'))) {
+         *sep = '\0';
+      }
+      if (!bson_sorter_add_key(sorter, keys[i],
+                               !sep || (atoi(sep + 1) >= 0))) {
+         fprintf(stderr, "Too many sort keys.\n");
+         return 1;
+      }
+   }
+
+   if (optind < argc) {
+      errno = 0;
+      fd = open(argv[optind], O_RDONLY);
+      if (fd == -1) {
+         fprintf(stderr, "Failed to open %s: %s\n",
+                 argv[optind], strerror(errno));
+         return 1;
+      }
+   }
+
+   reader = bson_reader_new_from_fd(fd, (fd != STDIN_FILENO));
+
+   if (!bson_sorter_sort(sorter, reader, emit, stdout, &error)) {
+      fprintf(stderr, "%s\n", error.message);
+      ret = 1;
+   }
+
+   if (verbose) {
+      bson_sorter_get_stats(sorter, &stats);
+      fprintf(stderr,
+              "%llu documents, %llu bytes, %u runs\n"
+              "read:  %8.3lf ms\n"
+              "sort:  %8.3lf ms\n"
+              "merge: %8.3lf ms\n"
+              "total: %8.3lf ms\n",
+              (unsigned long long)stats.n_docs,
+              (unsigned long long)stats.n_bytes,
+              stats.n_runs,
+              stats.read_usec / 1000.0,
+              stats.sort_usec / 1000.0,
+              stats.merge_usec / 1000.0,
+              stats.total_usec / 1000.0);
+   }
+
+   bson_reader_destroy(reader);
+   bson_sorter_destroy(sorter);
+   bson_free(keys);
+
+   return ret;
+}
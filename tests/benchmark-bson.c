@@ -0,0 +1,2339 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Timing runs that are too slow for "make test". Build and run them with
+ * "make benchmark"; run_test() prints the wall time of each one.
+ */
+
+
+#include <assert.h>
+#include <bson/bson-thread.h>
+#include <stdlib.h>
+
+#include "bson-tests.h"
+
+
+#define N_OIDS 1000000
+
+
+/*
+ * A straightforward chained hash table to compare bson_oid_map_t against.
+ */
+typedef struct _chained_node_t chained_node_t;
+
+
+struct _chained_node_t
+{
+   chained_node_t *next;
+   bson_oid_t      oid;
+   bson_uint64_t   value;
+};
+
+
+typedef struct
+{
+   chained_node_t **buckets;
+   size_t           n_buckets;
+   size_t           count;
+} chained_t;
+
+
+static void
+chained_init (chained_t *c)
+{
+   c->n_buckets = 16;
+   c->count = 0;
+   c->buckets = bson_malloc0(c->n_buckets * sizeof *c->buckets);
+}
+
+
+static void
+chained_grow (chained_t *c)
+{
+   chained_node_t **buckets;
+   chained_node_t *node;
+   chained_node_t *next;
+   size_t n_buckets = c->n_buckets * 2;
+   size_t b;
+   size_t i;
+
+   buckets = bson_malloc0(n_buckets * sizeof *buckets);
+
+   for (i = 0; i < c->n_buckets; i++) {
+      for (node = c->buckets[i]; node; node = next) {
+         next = node->next;
+         b = bson_oid_hash_unsafe(&node->oid) & (n_buckets - 1);
+         node->next = buckets[b];
+         buckets[b] = node;
+      }
+   }
+
+   bson_free(c->buckets);
+   c->buckets = buckets;
+   c->n_buckets = n_buckets;
+}
+
+
+static void
+chained_insert (chained_t        *c,
+                const bson_oid_t *oid,
+                bson_uint64_t     value)
+{
+   chained_node_t *node;
+   size_t b;
+
+   b = bson_oid_hash_unsafe(oid) & (c->n_buckets - 1);
+
+   for (node = c->buckets[b]; node; node = node->next) {
+      if (bson_oid_equal_unsafe(&node->oid, oid)) {
+         node->value = value;
+         return;
+      }
+   }
+
+   node = bson_malloc(sizeof *node);
+   node->oid = *oid;
+   node->value = value;
+   node->next = c->buckets[b];
+   c->buckets[b] = node;
+
+   if (++c->count > c->n_buckets) {
+      chained_grow(c);
+   }
+}
+
+
+static bson_bool_t
+chained_lookup (const chained_t  *c,
+                const bson_oid_t *oid,
+                bson_uint64_t    *value)
+{
+   chained_node_t *node;
+   size_t b;
+
+   b = bson_oid_hash_unsafe(oid) & (c->n_buckets - 1);
+
+   for (node = c->buckets[b]; node; node = node->next) {
+      if (bson_oid_equal_unsafe(&node->oid, oid)) {
+         *value = node->value;
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+
+static void
+chained_destroy (chained_t *c)
+{
+   chained_node_t *node;
+   chained_node_t *next;
+   size_t i;
+
+   for (i = 0; i < c->n_buckets; i++) {
+      for (node = c->buckets[i]; node; node = next) {
+         next = node->next;
+         bson_free(node);
+      }
+   }
+
+   bson_free(c->buckets);
+}
+
+
+static bson_oid_t *
+make_oids (size_t n)
+{
+   bson_context_t *context;
+   bson_oid_t *oids;
+   size_t i;
+
+   context = bson_context_new(BSON_CONTEXT_NONE);
+   oids = bson_malloc(n * sizeof *oids);
+
+   for (i = 0; i < n; i++) {
+      bson_oid_init(&oids[i], context);
+   }
+
+   bson_context_destroy(context);
+
+   return oids;
+}
+
+
+static bson_oid_t *gOids;
+
+
+static bson_uint8_t *
+build_sorter_input (bson_uint32_t  n_docs,
+                    bson_int32_t   n_distinct,
+                    size_t        *len)
+{
+   bson_uint8_t *buf = NULL;
+   size_t alloc = 0;
+   bson_uint32_t i;
+   bson_t b;
+
+   *len = 0;
+   srand(1234);
+
+   for (i = 0; i < n_docs; i++) {
+      bson_init(&b);
+      bson_append_utf8(&b, "name", -1, "some padding for the run", -1);
+      bson_append_int32(&b, "a", -1, rand() % n_distinct);
+      bson_append_int32(&b, "seq", -1, i);
+      if ((*len + b.len) > alloc) {
+         alloc = alloc ? alloc * 2 : 4096;
+         buf = bson_realloc(buf, alloc);
+      }
+      memcpy(buf + *len, bson_get_data(&b), b.len);
+      *len += b.len;
+      bson_destroy(&b);
+   }
+
+   return buf;
+}
+
+
+static bson_bool_t
+count_emit (const bson_t *b,
+            void         *data)
+{
+   (*(bson_uint32_t *)data)++;
+   return TRUE;
+}
+
+
+static void
+benchmark_sorter_spill_1mm (void)
+{
+   bson_sorter_stats_t stats;
+   bson_sorter_t *sorter;
+   bson_reader_t *reader;
+   bson_error_t error;
+   bson_uint32_t n_docs = 0;
+   bson_uint8_t *buf;
+   size_t len;
+
+   buf = build_sorter_input(1000000, 100000, &len);
+
+   sorter = bson_sorter_new(4 * 1024 * 1024, 4);
+   assert(bson_sorter_add_key(sorter, "a", TRUE));
+
+   reader = bson_reader_new_from_data(buf, len);
+   assert(bson_sorter_sort(sorter, reader, count_emit, &n_docs, &error));
+   assert_cmpint(n_docs, ==, 1000000);
+
+   bson_sorter_get_stats(sorter, &stats);
+   assert_cmpint(stats.n_runs, >, 1);
+
+   bson_reader_destroy(reader);
+   bson_sorter_destroy(sorter);
+   bson_free(buf);
+}
+
+
+static void
+benchmark_hash_1mm (void)
+{
+   bson_uint64_t h = 0;
+   bson_t b;
+   int i;
+
+   bson_init(&b);
+   bson_append_utf8(&b, "name", -1, "a typical document name", -1);
+   bson_append_int32(&b, "age", -1, 42);
+   bson_append_int64(&b, "created", -1, 1234567890123LL);
+   bson_append_utf8(&b, "email", -1, "someone@example.com", -1);
+
+   for (i = 0; i < 1000000; i++) {
+      h ^= bson_hash(&b);
+   }
+
+   assert(h == 0);
+
+   bson_destroy(&b);
+}
+
+
+static void
+benchmark_oid_map_insert_lookup_1mm (void)
+{
+   bson_oid_map_t *map;
+   bson_uint64_t value;
+   size_t i;
+
+   map = bson_oid_map_new(0);
+
+   for (i = 0; i < N_OIDS; i++) {
+      bson_oid_map_insert(map, &gOids[i], i);
+   }
+
+   for (i = 0; i < N_OIDS; i++) {
+      assert(bson_oid_map_lookup(map, &gOids[i], &value));
+   }
+
+   bson_oid_map_destroy(map);
+}
+
+
+static void
+benchmark_oid_map_insert_lookup_many_1mm (void)
+{
+   bson_oid_map_t *map;
+   bson_uint64_t *values;
+
+   values = bson_malloc(N_OIDS * sizeof *values);
+   memset(values, 0, N_OIDS * sizeof *values);
+
+   map = bson_oid_map_new(0);
+   bson_oid_map_insert_many(map, gOids, values, N_OIDS);
+   assert_cmpint(bson_oid_map_lookup_many(map, gOids, values, NULL,
+                                          N_OIDS), ==, N_OIDS);
+   bson_oid_map_destroy(map);
+
+   bson_free(values);
+}
+
+
+static void
+benchmark_chained_insert_lookup_1mm (void)
+{
+   bson_uint64_t value;
+   chained_t c;
+   size_t i;
+
+   chained_init(&c);
+
+   for (i = 0; i < N_OIDS; i++) {
+      chained_insert(&c, &gOids[i], i);
+   }
+
+   for (i = 0; i < N_OIDS; i++) {
+      assert(chained_lookup(&c, &gOids[i], &value));
+   }
+
+   chained_destroy(&c);
+}
+
+
+static void
+benchmark_oid_init_many_100k (void)
+{
+   bson_oid_t *oids;
+   int i;
+
+   oids = bson_malloc(100000 * sizeof *oids);
+
+   for (i = 0; i < 10; i++) {
+      bson_oid_init_many(oids, 100000, NULL);
+   }
+
+   bson_free(oids);
+}
+
+
+static void
+benchmark_oid_init_100k (void)
+{
+   bson_oid_t *oids;
+   int i;
+   int j;
+
+   oids = bson_malloc(100000 * sizeof *oids);
+
+   for (i = 0; i < 10; i++) {
+      for (j = 0; j < 100000; j++) {
+         bson_oid_init(&oids[j], NULL);
+      }
+   }
+
+   bson_free(oids);
+}
+
+
+#define N_PER_THREAD_OIDS 100000
+
+
+typedef struct
+{
+   bson_context_t *context;
+   bson_oid_t     *oids;
+   int             n_oids;
+} oid_worker_t;
+
+
+static void *
+oid_fill_worker (void *data)
+{
+   oid_worker_t *worker = data;
+   int i;
+
+   for (i = 0; i < worker->n_oids; i++) {
+      bson_oid_init(&worker->oids[i], worker->context);
+   }
+
+   return NULL;
+}
+
+
+static int gContentionThreads;
+
+
+static void
+oid_contention (bson_context_flags_t flags)
+{
+   bson_context_t *context;
+   bson_thread_t *threads;
+   oid_worker_t *workers;
+   int i;
+
+   context = bson_context_new(flags);
+   threads = bson_malloc(gContentionThreads * sizeof *threads);
+   workers = bson_malloc(gContentionThreads * sizeof *workers);
+
+   for (i = 0; i < gContentionThreads; i++) {
+      workers[i].context = context;
+      workers[i].oids = bson_malloc(N_PER_THREAD_OIDS * sizeof(bson_oid_t));
+      workers[i].n_oids = N_PER_THREAD_OIDS;
+      bson_thread_create(&threads[i], NULL, oid_fill_worker, &workers[i]);
+   }
+
+   for (i = 0; i < gContentionThreads; i++) {
+      bson_thread_join(threads[i], NULL);
+      bson_free(workers[i].oids);
+   }
+
+   bson_free(threads);
+   bson_free(workers);
+   bson_context_destroy(context);
+}
+
+
+static void
+benchmark_oid_contention_thread_safe (void)
+{
+   oid_contention(BSON_CONTEXT_THREAD_SAFE);
+}
+
+
+static void
+benchmark_oid_contention_per_thread (void)
+{
+   oid_contention(BSON_CONTEXT_SEQ_PER_THREAD);
+}
+
+
+#define N_HEX_OIDS 1000000
+
+
+static bson_oid_t *gHexOids;
+static char *gHexStrs;
+static const char **gHexStrPtrs;
+
+
+static void
+benchmark_oid_to_string_1mm (void)
+{
+   size_t i;
+
+   for (i = 0; i < N_HEX_OIDS; i++) {
+      bson_oid_to_string(&gHexOids[i], gHexStrs + (25 * i));
+   }
+}
+
+
+static void
+benchmark_oid_to_string_many_1mm (void)
+{
+   bson_oid_to_string_many(gHexOids, N_HEX_OIDS, gHexStrs);
+}
+
+
+static void
+benchmark_oid_init_from_string_1mm (void)
+{
+   size_t i;
+
+   for (i = 0; i < N_HEX_OIDS; i++) {
+      if (bson_oid_is_valid(gHexStrPtrs[i], 24)) {
+         bson_oid_init_from_string(&gHexOids[i], gHexStrPtrs[i]);
+      }
+   }
+}
+
+
+static void
+benchmark_oid_init_from_string_many_1mm (void)
+{
+   assert_cmpint(bson_oid_init_from_string_many(gHexOids, gHexStrPtrs,
+                                                N_HEX_OIDS, NULL), ==,
+                 N_HEX_OIDS);
+}
+
+
+static int
+oid_qsort_compare (const void *a,
+                   const void *b)
+{
+   return bson_oid_compare(a, b);
+}
+
+
+static void
+oid_fill_random (bson_oid_t *oids,
+                 size_t      n_oids,
+                 int         n_random_bytes)
+{
+   size_t i;
+   int j;
+
+   bson_oid_init_many(oids, n_oids, NULL);
+
+   for (i = 0; i < n_oids; i++) {
+      for (j = 12 - n_random_bytes; j < 12; j++) {
+         oids[i].bytes[j] = rand();
+      }
+   }
+}
+
+
+static void
+benchmark_oid_qsort_1mm (void)
+{
+   oid_fill_random(gHexOids, N_HEX_OIDS, 3);
+   qsort(gHexOids, N_HEX_OIDS, sizeof *gHexOids, oid_qsort_compare);
+}
+
+
+static void
+benchmark_oid_sort_1mm (void)
+{
+   oid_fill_random(gHexOids, N_HEX_OIDS, 3);
+   bson_oid_sort(gHexOids, N_HEX_OIDS, NULL);
+}
+
+
+static bson_t *
+build_wide_doc (void)
+{
+   bson_t *b;
+   char key[12];
+   int i;
+
+   b = bson_new();
+   for (i = 0; i < 1000; i++) {
+      snprintf(key, sizeof key, "key%d", i);
+      bson_append_utf8(b, key, -1, "some value", -1);
+   }
+
+   return b;
+}
+
+
+static void
+benchmark_replace_iter_10k (void)
+{
+   bson_iter_t iter;
+   bson_t values;
+   bson_t *b;
+   int i;
+
+   bson_init(&values);
+   bson_append_utf8(&values, "short", -1, "v", -1);
+   bson_append_utf8(&values, "long", -1, "a longer value", -1);
+
+   b = build_wide_doc();
+
+   for (i = 0; i < 10000; i++) {
+      assert(bson_iter_init_find(&iter, &values, (i % 2) ? "short" : "long"));
+      assert(bson_replace_iter(b, "key500", &iter));
+   }
+
+   bson_destroy(b);
+   bson_destroy(&values);
+}
+
+
+static void
+benchmark_rebuild_10k (void)
+{
+   bson_iter_t iter;
+   bson_t values;
+   bson_t *b;
+   bson_t c;
+   int i;
+
+   bson_init(&values);
+   bson_append_utf8(&values, "short", -1, "v", -1);
+   bson_append_utf8(&values, "long", -1, "a longer value", -1);
+
+   b = build_wide_doc();
+
+   for (i = 0; i < 10000; i++) {
+      assert(bson_iter_init_find(&iter, &values, (i % 2) ? "short" : "long"));
+      bson_copy_to_excluding(b, &c, "key500", NULL);
+      bson_append_iter(&c, "key500", -1, &iter);
+      bson_destroy(b);
+      b = bson_copy(&c);
+      bson_destroy(&c);
+   }
+
+   bson_destroy(b);
+   bson_destroy(&values);
+}
+
+
+static const char *
+key_for (int i)
+{
+   static char str[16];
+   const char *key;
+
+   bson_uint32_to_string(i, &key, str, sizeof str);
+
+   return key;
+}
+
+
+static void
+build_record (bson_t *b,
+              int     version)
+{
+   bson_t child;
+   bson_t child2;
+   int i;
+
+   bson_init(b);
+   bson_append_int32(b, "_id", -1, 12345);
+   bson_append_int32(b, "version", -1, version);
+
+   for (i = 0; i < 40; i++) {
+      bson_append_utf8(b, key_for(i), -1, "a typical string field", -1);
+   }
+
+   bson_append_document_begin(b, "stats", -1, &child);
+   for (i = 0; i < 20; i++) {
+      bson_append_int64(&child, key_for(i), -1, (i == 3) ? version : i);
+   }
+   bson_append_document_end(b, &child);
+
+   bson_append_array_begin(b, "history", -1, &child);
+   for (i = 0; i < (100 + (version % 4)); i++) {
+      bson_append_document_begin(&child, key_for(i), -1, &child2);
+      bson_append_int32(&child2, "v", -1, i);
+      bson_append_document_end(&child, &child2);
+   }
+   bson_append_array_end(b, &child);
+}
+
+
+static bson_uint64_t gPatchBytes;
+static bson_uint64_t gDocBytes;
+static bson_uint64_t gNPatches;
+
+
+static void
+benchmark_diff_apply_100k (void)
+{
+   bson_t docs[2];
+   bson_t result;
+   bson_t patch;
+   bson_t *from;
+   bson_t *to;
+   int i;
+
+   build_record(&docs[0], 0);
+
+   for (i = 1; i <= 100000; i++) {
+      from = &docs[(i - 1) & 1];
+      to = &docs[i & 1];
+      build_record(to, i);
+      bson_diff(from, to, &patch);
+      assert(bson_patch_apply(from, &patch, &result));
+      assert(bson_equal(&result, to));
+      gPatchBytes += patch.len;
+      gDocBytes += to->len;
+      gNPatches++;
+      bson_destroy(&result);
+      bson_destroy(&patch);
+      bson_destroy(from);
+   }
+
+   bson_destroy(&docs[i & 1 ? 0 : 1]);
+}
+
+
+static const char *gExcludes[] = {
+   "field3", "field17", "field18", "field31", "field49", "missing",
+};
+
+
+static bson_t *
+build_keyset_doc (void)
+{
+   bson_t *b;
+   bson_t child;
+   char key[16];
+   int i;
+
+   b = bson_new();
+
+   for (i = 0; i < 50; i++) {
+      snprintf(key, sizeof key, "field%d", i);
+
+      switch (i % 6) {
+      case 0:
+         bson_append_int32(b, key, -1, i);
+         break;
+      case 1:
+         bson_append_utf8(b, key, -1, "a typical string value", -1);
+         break;
+      case 2:
+         bson_append_document_begin(b, key, -1, &child);
+         bson_append_int32(&child, "field3", -1, i);
+         bson_append_document_end(b, &child);
+         break;
+      case 3:
+         bson_append_null(b, key, -1);
+         break;
+      case 4:
+         bson_append_minkey(b, key, -1);
+         break;
+      case 5:
+      default:
+         bson_append_maxkey(b, key, -1);
+         break;
+      }
+   }
+
+   return b;
+}
+
+
+/*
+ * The element by element copy that the keyset copiers replace.
+ */
+static void
+copy_naive (const bson_t *src,
+            bson_t       *dst,
+            const char  **keys,
+            size_t        n_keys,
+            bson_bool_t   include)
+{
+   bson_iter_t iter;
+   bson_bool_t found;
+   size_t i;
+
+   bson_init(dst);
+
+   assert(bson_iter_init(&iter, src));
+
+   while (bson_iter_next(&iter)) {
+      found = FALSE;
+
+      for (i = 0; i < n_keys; i++) {
+         if (!strcmp(keys[i], bson_iter_key(&iter))) {
+            found = TRUE;
+            break;
+         }
+      }
+
+      if (found == include) {
+         assert(bson_append_iter(dst, NULL, 0, &iter));
+      }
+   }
+}
+
+
+static void
+benchmark_copy_to_excluding_keyset_100k (void)
+{
+   bson_keyset_t *keyset;
+   bson_t *b;
+   bson_t c;
+   int i;
+
+   b = build_keyset_doc();
+   keyset = bson_keyset_new_from_array(gExcludes, 6);
+
+   for (i = 0; i < 100000; i++) {
+      bson_copy_to_excluding_keyset(b, &c, keyset);
+      bson_destroy(&c);
+   }
+
+   bson_keyset_destroy(keyset);
+   bson_destroy(b);
+}
+
+
+static void
+benchmark_copy_to_including_keyset_100k (void)
+{
+   bson_keyset_t *keyset;
+   bson_t *b;
+   bson_t c;
+   int i;
+
+   b = build_keyset_doc();
+   keyset = bson_keyset_new_from_array(gExcludes, 6);
+
+   for (i = 0; i < 100000; i++) {
+      bson_copy_to_including_keyset(b, &c, keyset);
+      bson_destroy(&c);
+   }
+
+   bson_keyset_destroy(keyset);
+   bson_destroy(b);
+}
+
+
+static void
+benchmark_copy_naive_excluding_100k (void)
+{
+   bson_t *b;
+   bson_t c;
+   int i;
+
+   b = build_keyset_doc();
+
+   for (i = 0; i < 100000; i++) {
+      copy_naive(b, &c, gExcludes, 6, FALSE);
+      bson_destroy(&c);
+   }
+
+   bson_destroy(b);
+}
+
+
+static void
+benchmark_concat_10k (void)
+{
+   bson_t *b;
+   bson_t c;
+   int i;
+
+   b = build_wide_doc();
+
+   for (i = 0; i < 10000; i++) {
+      bson_init(&c);
+      bson_append_int32(&c, "ok", 2, 1);
+      assert(bson_concat(&c, b));
+      bson_destroy(&c);
+   }
+
+   bson_destroy(b);
+}
+
+
+static void
+benchmark_concat_append_iter_10k (void)
+{
+   bson_iter_t iter;
+   bson_t *b;
+   bson_t c;
+   int i;
+
+   b = build_wide_doc();
+
+   for (i = 0; i < 10000; i++) {
+      bson_init(&c);
+      bson_append_int32(&c, "ok", 2, 1);
+      assert(bson_iter_init(&iter, b));
+      while (bson_iter_next(&iter)) {
+         assert(bson_append_iter(&c, NULL, 0, &iter));
+      }
+      bson_destroy(&c);
+   }
+
+   bson_destroy(b);
+}
+
+
+#define N_ARRAY 10000
+
+
+static void
+benchmark_append_array_snprintf_10k (void)
+{
+   bson_t child;
+   bson_t b;
+   char key[16];
+   int i;
+   int j;
+
+   for (j = 0; j < 100; j++) {
+      bson_init(&b);
+      bson_append_array_begin(&b, "values", -1, &child);
+      for (i = 0; i < N_ARRAY; i++) {
+         snprintf(key, sizeof key, "%d", i);
+         bson_append_int32(&child, key, -1, i);
+      }
+      bson_append_array_end(&b, &child);
+      bson_destroy(&b);
+   }
+}
+
+
+static void
+benchmark_append_array_builder_10k (void)
+{
+   bson_array_builder_t builder;
+   bson_t b;
+   int i;
+   int j;
+
+   for (j = 0; j < 100; j++) {
+      bson_init(&b);
+      bson_append_array_builder_begin(&b, "values", -1, &builder);
+      for (i = 0; i < N_ARRAY; i++) {
+         bson_array_builder_append_int32(&builder, i);
+      }
+      bson_append_array_builder_end(&b, &builder);
+      bson_destroy(&b);
+   }
+}
+
+
+static void
+benchmark_append_array_int32_10k (void)
+{
+   bson_int32_t *values;
+   bson_t b;
+   int i;
+   int j;
+
+   values = bson_malloc(N_ARRAY * sizeof *values);
+   for (i = 0; i < N_ARRAY; i++) {
+      values[i] = i;
+   }
+
+   for (j = 0; j < 100; j++) {
+      bson_init(&b);
+      assert(bson_append_array_int32(&b, "values", -1, values, N_ARRAY));
+      bson_destroy(&b);
+   }
+
+   bson_free(values);
+}
+
+
+static bson_oid_t gEventOid;
+
+
+/*
+ * Builds an event document the way an emitter would without a template.
+ */
+static void
+build_event (bson_t       *b,
+             bson_int32_t  seq,
+             bson_int64_t  ts,
+             const char   *name,
+             const bson_t *tags)
+{
+   bson_init(b);
+   bson_append_oid(b, "_id", -1, &gEventOid);
+   bson_append_int32(b, "seq", -1, seq);
+   bson_append_date_time(b, "ts", -1, ts);
+   bson_append_utf8(b, "name", -1, name, -1);
+   bson_append_double(b, "value", -1, seq / 2.0);
+   bson_append_int64(b, "bytes", -1, ts * 3);
+   bson_append_document(b, "tags", -1, tags);
+   bson_append_bool(b, "ok", -1, seq & 1);
+}
+
+
+static void
+benchmark_template_build_1m (void)
+{
+   bson_template_t *tmpl;
+   bson_t prototype;
+   bson_t tags;
+   bson_t b;
+   int i;
+
+   bson_init(&tags);
+   build_event(&prototype, 0, 1, "event", &tags);
+   tmpl = bson_template_new(&prototype);
+
+   for (i = 0; i < 1000000; i++) {
+      bson_template_set_int32(tmpl, 1, i);
+      bson_template_set_date_time(tmpl, 2, (i + 1) * 1000LL);
+      bson_template_set_double(tmpl, 4, i / 2.0);
+      bson_template_set_int64(tmpl, 5, (i + 1) * 3000LL);
+      bson_template_set_bool(tmpl, 7, i & 1);
+      bson_template_build(tmpl, &b);
+      bson_destroy(&b);
+   }
+
+   bson_template_destroy(tmpl);
+   bson_destroy(&prototype);
+   bson_destroy(&tags);
+}
+
+
+static void
+benchmark_template_build_utf8_1m (void)
+{
+   static const char *names[] = { "connect", "query", "disconnect" };
+   bson_template_t *tmpl;
+   bson_t prototype;
+   bson_t tags;
+   bson_t b;
+   int i;
+
+   bson_init(&tags);
+   build_event(&prototype, 0, 1, "event", &tags);
+   tmpl = bson_template_new(&prototype);
+
+   for (i = 0; i < 1000000; i++) {
+      bson_template_set_int32(tmpl, 1, i);
+      bson_template_set_date_time(tmpl, 2, (i + 1) * 1000LL);
+      bson_template_set_utf8(tmpl, 3, names[i % 3], -1);
+      bson_template_set_double(tmpl, 4, i / 2.0);
+      bson_template_set_int64(tmpl, 5, (i + 1) * 3000LL);
+      bson_template_set_bool(tmpl, 7, i & 1);
+      bson_template_build(tmpl, &b);
+      bson_destroy(&b);
+   }
+
+   bson_template_destroy(tmpl);
+   bson_destroy(&prototype);
+   bson_destroy(&tags);
+}
+
+
+static void
+benchmark_append_1m (void)
+{
+   static const char *names[] = { "connect", "query", "disconnect" };
+   bson_t tags;
+   bson_t b;
+   int i;
+
+   bson_init(&tags);
+
+   for (i = 0; i < 1000000; i++) {
+      build_event(&b, i, (i + 1) * 1000LL, names[i % 3], &tags);
+      bson_destroy(&b);
+   }
+
+   bson_destroy(&tags);
+}
+
+
+#define N_EVENTS 10000
+
+
+typedef struct
+{
+   char          host[16];
+   bson_int32_t  port;
+} endpoint_t;
+
+
+typedef struct
+{
+   bson_oid_t    id;
+   bson_int32_t  seq;
+   bson_int64_t  bytes;
+   double        latency;
+   bson_bool_t   ok;
+   bson_int64_t  ts;
+   char         *name;
+   endpoint_t    peer;
+   bson_int32_t *samples;
+   size_t        n_samples;
+   char        **tags;
+   size_t        n_tags;
+   endpoint_t   *hops;
+   size_t        n_hops;
+} event_t;
+
+
+static const bson_struct_field_t gEndpointFields[] = {
+   BSON_STRUCT_FIELD_CHARS(endpoint_t, host),
+   BSON_STRUCT_FIELD(endpoint_t, port, BSON_STRUCT_INT32),
+};
+
+
+static const bson_struct_desc_t gEndpointDesc = {
+   sizeof(endpoint_t), gEndpointFields, 2
+};
+
+
+static const bson_struct_field_t gEventFields[] = {
+   { "_id", offsetof(event_t, id), BSON_STRUCT_OID, (bson_struct_type_t)0, 0, 0,
+     NULL },
+   BSON_STRUCT_FIELD(event_t, seq, BSON_STRUCT_INT32),
+   BSON_STRUCT_FIELD(event_t, bytes, BSON_STRUCT_INT64),
+   BSON_STRUCT_FIELD(event_t, latency, BSON_STRUCT_DOUBLE),
+   BSON_STRUCT_FIELD(event_t, ok, BSON_STRUCT_BOOL),
+   BSON_STRUCT_FIELD(event_t, ts, BSON_STRUCT_DATE_TIME),
+   BSON_STRUCT_FIELD(event_t, name, BSON_STRUCT_STRING),
+   BSON_STRUCT_FIELD_DOCUMENT(event_t, peer, &gEndpointDesc),
+   BSON_STRUCT_FIELD_ARRAY(event_t, samples, n_samples, BSON_STRUCT_INT32,
+                           NULL),
+   BSON_STRUCT_FIELD_ARRAY(event_t, tags, n_tags, BSON_STRUCT_STRING, NULL),
+   BSON_STRUCT_FIELD_ARRAY(event_t, hops, n_hops, BSON_STRUCT_DOCUMENT,
+                           &gEndpointDesc),
+};
+
+
+static const bson_struct_desc_t gEventDesc = {
+   sizeof(event_t), gEventFields, 11
+};
+
+
+static char *gTags[] = { (char *)"a", (char *)"bb", (char *)"ccc" };
+static bson_int32_t gSamples[] = { 5, 4, 3, 2, 1 };
+static endpoint_t gHops[] = { { "10.0.0.1", 1 }, { "10.0.0.2", 2 } };
+
+
+static void
+init_event (event_t *e,
+            int      i)
+{
+   memset(e, 0, sizeof *e);
+   bson_oid_init_sequence(&e->id, NULL);
+   e->seq = i;
+   e->bytes = i * 1000000000LL;
+   e->latency = i / 4.0;
+   e->ok = i & 1;
+   e->ts = 1000LL * i;
+   e->name = (i % 3) ? (char *)"query" : NULL;
+   strcpy(e->peer.host, "db.example.com");
+   e->peer.port = 27017 + i;
+   e->samples = gSamples;
+   e->n_samples = i % 6;
+   e->tags = gTags;
+   e->n_tags = i % 4;
+   e->hops = gHops;
+   e->n_hops = i % 3;
+}
+
+
+/*
+ * The hand-written mapping the descriptor replaces.
+ */
+static void
+encode_event (const event_t *e,
+              bson_t        *b)
+{
+   bson_t child;
+   char key[16];
+   size_t i;
+
+   bson_append_oid(b, "_id", -1, &e->id);
+   bson_append_int32(b, "seq", -1, e->seq);
+   bson_append_int64(b, "bytes", -1, e->bytes);
+   bson_append_double(b, "latency", -1, e->latency);
+   bson_append_bool(b, "ok", -1, e->ok);
+   bson_append_date_time(b, "ts", -1, e->ts);
+   if (e->name) {
+      bson_append_utf8(b, "name", -1, e->name, -1);
+   } else {
+      bson_append_null(b, "name", -1);
+   }
+   bson_append_document_begin(b, "peer", -1, &child);
+   bson_append_utf8(&child, "host", -1, e->peer.host, -1);
+   bson_append_int32(&child, "port", -1, e->peer.port);
+   bson_append_document_end(b, &child);
+   bson_append_array_begin(b, "samples", -1, &child);
+   for (i = 0; i < e->n_samples; i++) {
+      snprintf(key, sizeof key, "%u", (unsigned)i);
+      bson_append_int32(&child, key, -1, e->samples[i]);
+   }
+   bson_append_array_end(b, &child);
+   bson_append_array_begin(b, "tags", -1, &child);
+   for (i = 0; i < e->n_tags; i++) {
+      snprintf(key, sizeof key, "%u", (unsigned)i);
+      bson_append_utf8(&child, key, -1, e->tags[i], -1);
+   }
+   bson_append_array_end(b, &child);
+   bson_append_array_begin(b, "hops", -1, &child);
+   for (i = 0; i < e->n_hops; i++) {
+      bson_t hop;
+
+      snprintf(key, sizeof key, "%u", (unsigned)i);
+      bson_append_document_begin(&child, key, -1, &hop);
+      bson_append_utf8(&hop, "host", -1, e->hops[i].host, -1);
+      bson_append_int32(&hop, "port", -1, e->hops[i].port);
+      bson_append_document_end(&child, &hop);
+   }
+   bson_append_array_end(b, &child);
+}
+
+
+static void
+decode_event (const bson_t *b,
+              event_t      *e)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_uint32_t len;
+
+   memset(e, 0, sizeof *e);
+
+   if (bson_iter_init_find(&iter, b, "_id")) {
+      bson_oid_copy(bson_iter_oid(&iter), &e->id);
+   }
+   if (bson_iter_init_find(&iter, b, "seq")) {
+      e->seq = bson_iter_int32(&iter);
+   }
+   if (bson_iter_init_find(&iter, b, "bytes")) {
+      e->bytes = bson_iter_int64(&iter);
+   }
+   if (bson_iter_init_find(&iter, b, "latency")) {
+      e->latency = bson_iter_double(&iter);
+   }
+   if (bson_iter_init_find(&iter, b, "ok")) {
+      e->ok = bson_iter_bool(&iter);
+   }
+   if (bson_iter_init_find(&iter, b, "ts")) {
+      e->ts = bson_iter_date_time(&iter);
+   }
+   if (bson_iter_init_find(&iter, b, "name") && BSON_ITER_HOLDS_UTF8(&iter)) {
+      e->name = bson_strdup(bson_iter_utf8(&iter, &len));
+   }
+   if (bson_iter_init_find(&iter, b, "peer") &&
+       bson_iter_recurse(&iter, &child)) {
+      if (bson_iter_find(&child, "host")) {
+         strncpy(e->peer.host, bson_iter_utf8(&child, &len),
+                 sizeof e->peer.host - 1);
+         e->peer.host[sizeof e->peer.host - 1] = '\0';
+      }
+      if (bson_iter_find(&child, "port")) {
+         e->peer.port = bson_iter_int32(&child);
+      }
+   }
+   if (bson_iter_init_find(&iter, b, "samples") &&
+       bson_iter_recurse(&iter, &child)) {
+      e->samples = bson_malloc(16 * sizeof *e->samples);
+      while (bson_iter_next(&child) && e->n_samples < 16) {
+         e->samples[e->n_samples++] = bson_iter_int32(&child);
+      }
+   }
+}
+
+
+static event_t *gEvents;
+static bson_t *gDocs;
+
+
+static void
+benchmark_struct_encode_10k (void)
+{
+   int i;
+
+   for (i = 0; i < N_EVENTS; i++) {
+      bson_init(&gDocs[i]);
+      bson_struct_encode(&gEventDesc, &gEvents[i], &gDocs[i]);
+   }
+}
+
+
+static void
+benchmark_hand_encode_10k (void)
+{
+   bson_t b;
+   int i;
+
+   for (i = 0; i < N_EVENTS; i++) {
+      bson_init(&b);
+      encode_event(&gEvents[i], &b);
+      bson_destroy(&b);
+   }
+}
+
+
+static void
+benchmark_struct_decode_10k (void)
+{
+   event_t e;
+   int i;
+
+   for (i = 0; i < N_EVENTS; i++) {
+      memset(&e, 0, sizeof e);
+      bson_struct_decode(&gEventDesc, &gDocs[i], &e);
+      bson_struct_clear(&gEventDesc, &e);
+   }
+}
+
+
+/*
+ * Only decodes the scalar fields, samples and peer, which is already
+ * slower than decoding everything through the descriptor.
+ */
+static void
+benchmark_hand_decode_10k (void)
+{
+   event_t e;
+   int i;
+
+   for (i = 0; i < N_EVENTS; i++) {
+      decode_event(&gDocs[i], &e);
+      bson_free(e.name);
+      bson_free(e.samples);
+   }
+}
+
+
+#define N_COLUMN_DOCS 100000
+
+
+static const char *gHosts[] = { "alpha", "beta", "gamma" };
+static bson_uint8_t *gColumnStream;
+static size_t gColumnStreamLen;
+
+
+/*
+ * { "seq": i, "host": gHosts[i % 3], "stats": { "bytes": i * 10,
+ *   "latency": i / 4.0 }, "tags": [ "x", i % 2 == 0 ], "ok": i % 5 != 0 }
+ *
+ * Every seventh document lacks stats.latency and every eleventh has a
+ * string for seq.
+ */
+static void
+build_column_doc (bson_t *b,
+                  int     i)
+{
+   bson_t child;
+
+   bson_init(b);
+   if ((i % 11) == 0) {
+      bson_append_utf8(b, "seq", -1, "eleven", -1);
+   } else {
+      bson_append_int32(b, "seq", -1, i);
+   }
+   bson_append_utf8(b, "host", -1, gHosts[i % 3], -1);
+   bson_append_document_begin(b, "stats", -1, &child);
+   bson_append_int64(&child, "bytes", -1, (bson_int64_t)i * 10);
+   if ((i % 7) != 0) {
+      bson_append_double(&child, "latency", -1, i / 4.0);
+   }
+   bson_append_document_end(b, &child);
+   bson_append_array_begin(b, "tags", -1, &child);
+   bson_append_utf8(&child, "0", -1, "x", -1);
+   bson_append_bool(&child, "1", -1, (i % 2) == 0);
+   bson_append_array_end(b, &child);
+   bson_append_bool(b, "ok", -1, (i % 5) != 0);
+}
+
+
+static void
+benchmark_extractor_100k (void)
+{
+   const bson_column_t *col;
+   bson_extractor_t *ex;
+   bson_reader_t *reader;
+   bson_int64_t sum;
+   double dsum;
+
+   ex = bson_extractor_new();
+   bson_extractor_add_column(ex, "seq", BSON_COLUMN_INT32);
+   bson_extractor_add_column(ex, "host", BSON_COLUMN_STRING);
+   bson_extractor_add_column(ex, "stats.bytes", BSON_COLUMN_INT64);
+   bson_extractor_add_column(ex, "stats.latency", BSON_COLUMN_DOUBLE);
+   bson_extractor_add_column(ex, "ok", BSON_COLUMN_BOOL);
+
+   reader = bson_reader_new_from_data(gColumnStream, gColumnStreamLen);
+   assert(bson_extractor_read(ex, reader, 0, NULL) == N_COLUMN_DOCS);
+   bson_reader_destroy(reader);
+
+   col = bson_extractor_get_column(ex, 2);
+   assert(bson_column_sum_int64(col, &sum));
+   assert(sum == (bson_int64_t)N_COLUMN_DOCS * (N_COLUMN_DOCS - 1) * 5);
+   col = bson_extractor_get_column(ex, 3);
+   assert(bson_column_sum_double(col, &dsum));
+   assert(dsum > 0.0);
+
+   bson_extractor_destroy(ex);
+}
+
+
+/*
+ * The same work as benchmark_extractor_100k(), looking up each path on its own.
+ */
+static void
+benchmark_find_descendant_100k (void)
+{
+   static const char *paths[] = {
+      "seq", "host", "stats.bytes", "stats.latency", "ok"
+   };
+   bson_reader_t *reader;
+   const bson_t *b;
+   bson_iter_t iter;
+   bson_iter_t found;
+   bson_int64_t sum = 0;
+   bson_bool_t eof = FALSE;
+   size_t n = 0;
+   int i;
+
+   reader = bson_reader_new_from_data(gColumnStream, gColumnStreamLen);
+   while ((b = bson_reader_read(reader, &eof))) {
+      for (i = 0; i < 5; i++) {
+         assert(bson_iter_init(&iter, b));
+         if (bson_iter_find_descendant(&iter, paths[i], &found) &&
+             BSON_ITER_HOLDS_INT64(&found)) {
+            sum += bson_iter_int64(&found);
+         }
+      }
+      n++;
+   }
+   bson_reader_destroy(reader);
+
+   assert(n == N_COLUMN_DOCS);
+   assert(sum == (bson_int64_t)N_COLUMN_DOCS * (N_COLUMN_DOCS - 1) * 5);
+}
+
+
+static bson_extractor_t *gColumnExtractor;
+
+
+static void
+benchmark_encoder_100k (void)
+{
+   bson_column_encoder_t *enc;
+   bson_writer_t *writer;
+   bson_uint8_t *buf = NULL;
+   size_t buflen = 0;
+   size_t n_docs = 0;
+
+   enc = bson_column_encoder_new();
+   bson_column_encoder_add_column(
+      enc, "seq", -1, bson_extractor_get_column(gColumnExtractor, 0));
+   bson_column_encoder_add_column(
+      enc, "host", -1, bson_extractor_get_column(gColumnExtractor, 1));
+   bson_column_encoder_add_column(
+      enc, "bytes", -1, bson_extractor_get_column(gColumnExtractor, 2));
+   bson_column_encoder_add_column(
+      enc, "latency", -1, bson_extractor_get_column(gColumnExtractor, 3));
+   bson_column_encoder_add_column(
+      enc, "ok", -1, bson_extractor_get_column(gColumnExtractor, 4));
+
+   writer = bson_writer_new(&buf, &buflen, 0, bson_realloc);
+   assert(bson_column_encoder_write(enc, writer, &n_docs));
+   assert(n_docs == N_COLUMN_DOCS);
+   bson_writer_destroy(writer);
+
+   bson_free(buf);
+   bson_column_encoder_destroy(enc);
+}
+
+
+/*
+ * The same documents as benchmark_encoder_100k(), appended a field at a time.
+ */
+static void
+benchmark_writer_append_100k (void)
+{
+   const bson_column_t *cols[5];
+   bson_writer_t *writer;
+   bson_uint8_t *buf = NULL;
+   size_t buflen = 0;
+   bson_uint32_t code;
+   bson_t *b;
+   size_t row;
+   int i;
+
+   for (i = 0; i < 5; i++) {
+      cols[i] = bson_extractor_get_column(gColumnExtractor, i);
+   }
+
+   writer = bson_writer_new(&buf, &buflen, 0, bson_realloc);
+   for (row = 0; row < N_COLUMN_DOCS; row++) {
+      bson_writer_begin(writer, &b);
+      if (BSON_COLUMN_IS_VALID(cols[0], row)) {
+         bson_append_int32(b, "seq", -1,
+                           ((bson_int32_t *)cols[0]->values)[row]);
+      } else {
+         bson_append_null(b, "seq", -1);
+      }
+      code = ((bson_uint32_t *)cols[1]->values)[row];
+      bson_append_utf8(b, "host", -1, cols[1]->dict[code],
+                       cols[1]->dict_lengths[code]);
+      bson_append_int64(b, "bytes", -1,
+                        ((bson_int64_t *)cols[2]->values)[row]);
+      if (BSON_COLUMN_IS_VALID(cols[3], row)) {
+         bson_append_double(b, "latency", -1,
+                            ((double *)cols[3]->values)[row]);
+      } else {
+         bson_append_null(b, "latency", -1);
+      }
+      bson_append_bool(b, "ok", -1, ((bson_uint8_t *)cols[4]->values)[row]);
+      bson_writer_end(writer);
+   }
+   bson_writer_destroy(writer);
+
+   bson_free(buf);
+}
+
+
+/*
+ * A document of 100 numbers and strings spread over nested documents and
+ * arrays, converted 10000 times with and without bson_mark_validated().
+ */
+static bson_t *
+build_json_nested (void)
+{
+   bson_t *b;
+   bson_t doc;
+   bson_t arr;
+   char key[16];
+   int i;
+   int j;
+
+   b = bson_new();
+   for (i = 0; i < 10; i++) {
+      snprintf(key, sizeof key, "doc%d", i);
+      assert(bson_append_document_begin(b, key, -1, &doc));
+      assert(bson_append_int32(&doc, "int32", -1, i));
+      assert(bson_append_double(&doc, "double", -1, i * 0.5));
+      assert(bson_append_utf8(&doc, "utf8", -1, "value", -1));
+      assert(bson_append_array_begin(&doc, "array", -1, &arr));
+      for (j = 0; j < 7; j++) {
+         snprintf(key, sizeof key, "%d", j);
+         assert(bson_append_int64(&arr, key, -1, j));
+      }
+      assert(bson_append_array_end(&doc, &arr));
+      assert(bson_append_document_end(b, &doc));
+   }
+
+   return b;
+}
+
+
+static void
+as_json_nested (bson_bool_t validated)
+{
+   char *expected;
+   char *str;
+   bson_t *b;
+   int i;
+
+   b = build_json_nested();
+   expected = bson_as_json(b, NULL);
+
+   if (validated) {
+      bson_mark_validated(b);
+   }
+
+   for (i = 0; i < 10000; i++) {
+      str = bson_as_json(b, NULL);
+      assert(!strcmp(str, expected));
+      bson_free(str);
+   }
+
+   bson_free(expected);
+   bson_destroy(b);
+}
+
+
+static void
+benchmark_as_json_nested (void)
+{
+   as_json_nested(FALSE);
+}
+
+
+static void
+benchmark_as_json_nested_validated (void)
+{
+   as_json_nested(TRUE);
+}
+
+
+static bson_bool_t
+visit_sum_int32 (const bson_iter_t *iter,
+                 const char        *key,
+                 bson_int32_t       v_int32,
+                 void              *data)
+{
+   *(bson_int64_t *)data += v_int32;
+   return FALSE;
+}
+
+
+static bson_bool_t
+visit_sum_document (const bson_iter_t *iter,
+                    const char        *key,
+                    const bson_t      *v_document,
+                    void              *data);
+
+
+static const bson_visitor_t gSumVisitor = {
+   .visit_int32 = visit_sum_int32,
+   .visit_document = visit_sum_document,
+   .visit_array = visit_sum_document,
+};
+
+
+static bson_bool_t
+visit_sum_document (const bson_iter_t *iter,
+                    const char        *key,
+                    const bson_t      *v_document,
+                    void              *data)
+{
+   bson_iter_t child;
+
+   if (bson_iter_init(&child, v_document)) {
+      bson_iter_visit_all(&child, &gSumVisitor, data);
+   }
+
+   return FALSE;
+}
+
+
+/*
+ * Sums the int32 fields of ten documents of ten ints and ten strings each
+ * with bson_iter_visit_all(), with and without bson_mark_validated().
+ */
+static void
+visit_all_nested (bson_bool_t validated)
+{
+   bson_int64_t sum = 0;
+   bson_iter_t iter;
+   bson_t child;
+   bson_t *b;
+   char key[16];
+   int i;
+   int j;
+
+   b = bson_new();
+   for (i = 0; i < 10; i++) {
+      snprintf(key, sizeof key, "doc%d", i);
+      assert(bson_append_document_begin(b, key, -1, &child));
+      for (j = 0; j < 10; j++) {
+         snprintf(key, sizeof key, "field_%d", j);
+         assert(bson_append_int32(&child, key, -1, j));
+         assert(bson_append_utf8(&child, "str", -1, "value", -1));
+      }
+      assert(bson_append_document_end(b, &child));
+   }
+
+   if (validated) {
+      bson_mark_validated(b);
+   }
+
+   for (i = 0; i < 100000; i++) {
+      assert(bson_iter_init(&iter, b));
+      bson_iter_visit_all(&iter, &gSumVisitor, &sum);
+   }
+
+   assert(sum == 100000LL * 10 * 45);
+
+   bson_destroy(b);
+}
+
+
+static void
+benchmark_visit_all_100k (void)
+{
+   visit_all_nested(FALSE);
+}
+
+
+static void
+benchmark_visit_all_validated_100k (void)
+{
+   visit_all_nested(TRUE);
+}
+
+
+/*
+ * Ten documents, each holding an array of four documents of ten ints.
+ */
+static bson_t *
+build_walker_doc (void)
+{
+   bson_t doc;
+   bson_t arr;
+   bson_t *b;
+   char key[16];
+   int i;
+   int j;
+
+   b = bson_new();
+   for (i = 0; i < 10; i++) {
+      snprintf(key, sizeof key, "doc%d", i);
+      assert(bson_append_document_begin(b, key, -1, &doc));
+      assert(bson_append_utf8(&doc, "name", -1, "value", -1));
+      assert(bson_append_array_begin(&doc, "items", -1, &arr));
+      for (j = 0; j < 4; j++) {
+         bson_t item;
+         int k;
+
+         snprintf(key, sizeof key, "%d", j);
+         assert(bson_append_document_begin(&arr, key, -1, &item));
+         for (k = 0; k < 10; k++) {
+            snprintf(key, sizeof key, "f%d", k);
+            assert(bson_append_int32(&item, key, -1, 10));
+         }
+         assert(bson_append_document_end(&arr, &item));
+      }
+      assert(bson_append_array_end(&doc, &arr));
+      assert(bson_append_document_end(b, &doc));
+   }
+
+   return b;
+}
+
+
+static bson_t *gWalkerDoc;
+
+
+/*
+ * Sums the int32 values of gWalkerDoc 100k times with a recursive visitor, the
+ * way bson_as_json() walks documents.
+ */
+static void
+benchmark_walker_visit_all_100k (void)
+{
+   bson_int64_t sum = 0;
+   bson_iter_t iter;
+   int i;
+
+   for (i = 0; i < 100000; i++) {
+      assert(bson_iter_init(&iter, gWalkerDoc));
+      bson_iter_visit_all(&iter, &gSumVisitor, &sum);
+   }
+
+   assert(sum == 100000LL * 10 * 4 * 10 * 10);
+}
+
+
+static void
+benchmark_walker_100k (void)
+{
+   bson_walker_event_t event;
+   bson_walker_t walker;
+   const bson_iter_t *iter;
+   bson_int64_t sum = 0;
+   int i;
+
+   for (i = 0; i < 100000; i++) {
+      assert(bson_walker_init(&walker, gWalkerDoc));
+      iter = bson_walker_iter(&walker);
+      while (bson_walker_next(&walker, &event)) {
+         if ((event == BSON_WALKER_VALUE) && BSON_ITER_HOLDS_INT32(iter)) {
+            sum += bson_iter_int32_unsafe(iter);
+         }
+      }
+      bson_walker_destroy(&walker);
+   }
+
+   assert(sum == 100000LL * 10 * 4 * 10 * 10);
+}
+
+
+static void
+benchmark_walker_validated_100k (void)
+{
+   bson_mark_validated(gWalkerDoc);
+   benchmark_walker_100k();
+}
+
+
+/*
+ * Appends the same medium sized document to @b each time, with a child
+ * document so that growth also happens from inside a child.
+ */
+static bson_bool_t
+append_medium_doc (bson_t *b)
+{
+   static const char *keys[] = {
+      "key0", "key1", "key2", "key3", "key4", "key5", "key6", "key7",
+   };
+   bson_t child;
+   int i;
+
+   for (i = 0; i < 8; i++) {
+      if (!bson_append_int32(b, keys[i], 4, i)) {
+         return FALSE;
+      }
+   }
+
+   if (!bson_append_document_begin(b, "child", 5, &child)) {
+      return FALSE;
+   }
+   for (i = 0; i < 8; i++) {
+      if (!bson_append_utf8(&child, keys[i], 4, "a string value", 14)) {
+         bson_append_document_end(b, &child);
+         return FALSE;
+      }
+   }
+
+   return bson_append_document_end(b, &child);
+}
+
+
+/*
+ * Builds a medium document 1mm times, starting over with bson_reinit() as
+ * callers had to before bson_reset().
+ */
+static void
+benchmark_reinit_1mm (void)
+{
+   bson_t b;
+   int i;
+
+   bson_init(&b);
+   for (i = 0; i < 1000000; i++) {
+      bson_reinit(&b);
+      assert(append_medium_doc(&b));
+   }
+   bson_destroy(&b);
+}
+
+
+static void
+benchmark_reset_1mm (void)
+{
+   bson_uint8_t buf[512];
+   bson_t b;
+   int i;
+
+   assert(bson_init_with_buffer(&b, buf, sizeof buf, TRUE));
+   for (i = 0; i < 1000000; i++) {
+      bson_reset(&b);
+      assert(append_medium_doc(&b));
+   }
+   assert(bson_get_data(&b) == buf);
+   bson_destroy(&b);
+}
+
+
+static void
+append_message_doc (bson_t *b,
+                    int     i)
+{
+   static const char str[] = "0123456789012345678901234567890123456789";
+
+   assert(bson_append_int32(b, "i", -1, i));
+   assert(bson_append_utf8(b, "s", -1, str, i % 40));
+}
+
+
+static void
+benchmark_message_copy_100k (void)
+{
+   bson_message_t *message;
+   bson_t b;
+   int i;
+
+   message = bson_message_new(BSON_MESSAGE_OP_INSERT, 0, "db.collection",
+                              NULL, 48000000, 1000);
+
+   for (i = 0; i < 100000; i++) {
+      bson_init(&b);
+      append_message_doc(&b, i);
+      assert(bson_message_append(message, &b));
+      bson_destroy(&b);
+   }
+
+   assert(bson_message_get_n_frames(message) == 100);
+   bson_message_destroy(message);
+}
+
+
+static void
+benchmark_message_in_place_100k (void)
+{
+   bson_message_t *message;
+   bson_t *b;
+   int i;
+
+   message = bson_message_new(BSON_MESSAGE_OP_INSERT, 0, "db.collection",
+                              NULL, 48000000, 1000);
+
+   for (i = 0; i < 100000; i++) {
+      bson_message_begin_document(message, &b);
+      append_message_doc(b, i);
+      assert(bson_message_end_document(message));
+   }
+
+   assert(bson_message_get_n_frames(message) == 100);
+   bson_message_destroy(message);
+}
+
+
+static bson_int32_t
+get_int32 (const bson_uint8_t *p)
+{
+   bson_uint32_t v;
+
+   memcpy(&v, p, 4);
+   return (bson_int32_t)BSON_UINT32_FROM_LE(v);
+}
+
+
+static int
+get_i (const bson_t *b)
+{
+   bson_iter_t iter;
+
+   assert(bson_iter_init_find(&iter, b, "i"));
+   return bson_iter_int32(&iter);
+}
+
+
+/*
+ * Concatenates the frames of @message as they would arrive in a receive
+ * buffer.
+ */
+static bson_uint8_t *
+receive_frames (bson_message_t *message,
+                size_t         *len)
+{
+   struct iovec iov[128];
+   bson_uint8_t *buf;
+   size_t n;
+   size_t i;
+
+   n = bson_message_get_iovecs(message, iov, 128);
+   assert(n < 128);
+
+   for (*len = 0, i = 0; i < n; i++) {
+      *len += iov[i].iov_len;
+   }
+
+   buf = bson_malloc(*len);
+   for (*len = 0, i = 0; i < n; i++) {
+      memcpy(buf + *len, iov[i].iov_base, iov[i].iov_len);
+      *len += iov[i].iov_len;
+   }
+
+   return buf;
+}
+
+
+static bson_uint8_t *gMessageFrames;
+static size_t gMessageFramesLen;
+
+
+static void
+build_message_frames (void)
+{
+   bson_message_t *message;
+   bson_t body;
+   bson_t *b;
+   int i;
+
+   bson_init(&body);
+   assert(bson_append_utf8(&body, "insert", -1, "collection", -1));
+
+   message = bson_message_new(BSON_MESSAGE_OP_MSG, 0, "documents", &body,
+                              48000000, 1000);
+   for (i = 0; i < 100000; i++) {
+      bson_message_begin_document(message, &b);
+      append_message_doc(b, i);
+      assert(bson_message_end_document(message));
+   }
+
+   gMessageFrames = receive_frames(message, &gMessageFramesLen);
+
+   bson_message_destroy(message);
+   bson_destroy(&body);
+}
+
+
+/*
+ * Reads the same frames the way callers had to before
+ * bson_message_parser_t: parse the frame by hand and then allocate a
+ * bson_reader_t for its document sequence.
+ */
+static void
+benchmark_message_reader_100k (void)
+{
+   bson_reader_t *reader;
+   const bson_uint8_t *p;
+   const bson_t *b;
+   bson_uint32_t len;
+   bson_uint32_t body_len;
+   bson_uint32_t seq_len;
+   bson_int64_t sum = 0;
+   bson_bool_t eof;
+   size_t offset;
+   int i;
+
+   for (i = 0; i < 10; i++) {
+      for (offset = 0; offset < gMessageFramesLen; offset += len) {
+         p = gMessageFrames + offset;
+         len = get_int32(p);
+         body_len = get_int32(p + 21);
+         seq_len = get_int32(p + 22 + body_len);
+         reader = bson_reader_new_from_data(p + 26 + body_len + 10,
+                                            seq_len - 4 - 10);
+         while ((b = bson_reader_read(reader, &eof))) {
+            sum += get_i(b);
+         }
+         bson_reader_destroy(reader);
+      }
+   }
+
+   assert(sum == 10 * (100000LL * 99999 / 2));
+}
+
+
+static void
+benchmark_message_parser_100k (void)
+{
+   bson_message_parser_t parser;
+   const bson_uint8_t *p;
+   const char *identifier;
+   bson_int64_t sum = 0;
+   size_t left;
+   bson_t b;
+   int i;
+
+   for (i = 0; i < 10; i++) {
+      for (p = gMessageFrames, left = gMessageFramesLen; left; ) {
+         assert(bson_message_parser_init(&parser, p, left, NULL));
+         while (bson_message_parser_next(&parser, &b, &identifier)) {
+            if (identifier) {
+               sum += get_i(&b);
+            }
+         }
+         p += parser.length;
+         left -= parser.length;
+      }
+   }
+
+   assert(sum == 10 * (100000LL * 99999 / 2));
+}
+
+
+/*
+ * Builds a stream of @n documents of varying size for the iovec tests.
+ */
+static bson_uint8_t *
+build_stream (bson_uint32_t  n,
+              size_t        *len)
+{
+   bson_writer_t *writer;
+   bson_uint8_t *buf = NULL;
+   size_t buflen = 0;
+   bson_uint32_t i;
+   bson_uint32_t j;
+   bson_t *b;
+
+   writer = bson_writer_new(&buf, &buflen, 0, bson_realloc);
+
+   for (i = 0; i < n; i++) {
+      bson_writer_begin(writer, &b);
+      assert(bson_append_int32(b, "i", -1, i));
+      for (j = 0; j < (i % 7); j++) {
+         assert(bson_append_utf8(b, "s", -1, "some string data", -1));
+      }
+      bson_writer_end(writer);
+   }
+
+   *len = bson_writer_get_length(writer);
+   bson_writer_destroy(writer);
+
+   return buf;
+}
+
+
+/*
+ * Splits @len bytes at @data into segments of @seg bytes, with an empty
+ * segment after every third one.
+ */
+static struct iovec *
+split_stream (bson_uint8_t *data,
+              size_t        len,
+              size_t        seg,
+              size_t       *n_iov)
+{
+   struct iovec *iov;
+   size_t offset;
+   size_t n = 0;
+
+   iov = bson_malloc0(((len / seg) + 1) * 2 * sizeof *iov);
+
+   for (offset = 0; offset < len; offset += seg) {
+      iov[n].iov_base = data + offset;
+      iov[n].iov_len = MIN(seg, len - offset);
+      n++;
+      if ((n % 3) == 2) {
+         iov[n].iov_base = data;
+         iov[n].iov_len = 0;
+         n++;
+      }
+   }
+
+   *n_iov = n;
+
+   return iov;
+}
+
+
+/*
+ * A stream of 100k documents received into a chain of 64 KiB buffers,
+ * read in place versus copied together and read with the data reader.
+ */
+static bson_uint8_t *gReaderStream;
+static size_t gReaderStreamLen;
+
+
+static void
+benchmark_reader_iovec_100k (void)
+{
+   bson_reader_t *reader;
+   struct iovec *iov;
+   const bson_t *b;
+   bson_bool_t eof;
+   size_t n_iov;
+   size_t n = 0;
+   int i;
+
+   for (i = 0; i < 10; i++) {
+      iov = split_stream(gReaderStream, gReaderStreamLen, 65536, &n_iov);
+      reader = bson_reader_new_from_iovec(iov, n_iov);
+      while ((b = bson_reader_read(reader, &eof))) {
+         n++;
+      }
+      assert(eof);
+      bson_reader_destroy(reader);
+      bson_free(iov);
+   }
+
+   assert(n == 1000000);
+}
+
+
+static void
+benchmark_reader_coalesce_100k (void)
+{
+   bson_reader_t *reader;
+   struct iovec *iov;
+   bson_uint8_t *buf;
+   const bson_t *b;
+   bson_bool_t eof;
+   size_t offset;
+   size_t n_iov;
+   size_t n = 0;
+   size_t j;
+   int i;
+
+   for (i = 0; i < 10; i++) {
+      iov = split_stream(gReaderStream, gReaderStreamLen, 65536, &n_iov);
+      buf = bson_malloc(gReaderStreamLen);
+      for (j = 0, offset = 0; j < n_iov; j++) {
+         memcpy(buf + offset, iov[j].iov_base, iov[j].iov_len);
+         offset += iov[j].iov_len;
+      }
+      reader = bson_reader_new_from_data(buf, offset);
+      while ((b = bson_reader_read(reader, &eof))) {
+         n++;
+      }
+      assert(eof);
+      bson_reader_destroy(reader);
+      bson_free(buf);
+      bson_free(iov);
+   }
+
+   assert(n == 1000000);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bson_reader_t *reader;
+   size_t alloc = 0;
+   bson_t b;
+   size_t i;
+
+   gOids = make_oids(N_OIDS);
+
+   gHexOids = bson_malloc(N_HEX_OIDS * sizeof *gHexOids);
+   gHexStrs = bson_malloc(N_HEX_OIDS * 25);
+   gHexStrPtrs = bson_malloc(N_HEX_OIDS * sizeof *gHexStrPtrs);
+   bson_oid_init_many(gHexOids, N_HEX_OIDS, NULL);
+   for (i = 0; i < N_HEX_OIDS; i++) {
+      gHexStrPtrs[i] = gHexStrs + (25 * i);
+   }
+
+   bson_oid_init_sequence(&gEventOid, NULL);
+
+   gWalkerDoc = build_walker_doc();
+
+   build_message_frames();
+   gReaderStream = build_stream(100000, &gReaderStreamLen);
+
+   gEvents = bson_malloc(N_EVENTS * sizeof *gEvents);
+   gDocs = bson_malloc(N_EVENTS * sizeof *gDocs);
+   for (i = 0; i < N_EVENTS; i++) {
+      init_event(&gEvents[i], i);
+   }
+
+   for (i = 0; i < N_COLUMN_DOCS; i++) {
+      build_column_doc(&b, i);
+      if (gColumnStreamLen + b.len > alloc) {
+         alloc = MAX(4096, alloc * 2);
+         gColumnStream = bson_realloc(gColumnStream, alloc);
+      }
+      memcpy(gColumnStream + gColumnStreamLen, bson_get_data(&b), b.len);
+      gColumnStreamLen += b.len;
+      bson_destroy(&b);
+   }
+
+   gColumnExtractor = bson_extractor_new();
+   bson_extractor_add_column(gColumnExtractor, "seq", BSON_COLUMN_INT32);
+   bson_extractor_add_column(gColumnExtractor, "host", BSON_COLUMN_STRING);
+   bson_extractor_add_column(gColumnExtractor, "stats.bytes",
+                             BSON_COLUMN_INT64);
+   bson_extractor_add_column(gColumnExtractor, "stats.latency",
+                             BSON_COLUMN_DOUBLE);
+   bson_extractor_add_column(gColumnExtractor, "ok", BSON_COLUMN_BOOL);
+   reader = bson_reader_new_from_data(gColumnStream, gColumnStreamLen);
+   bson_extractor_read(gColumnExtractor, reader, 0, NULL);
+   bson_reader_destroy(reader);
+
+   run_test("/bson/sorter/spill_1mm", benchmark_sorter_spill_1mm);
+   run_test("/bson/hash/1mm", benchmark_hash_1mm);
+
+   run_test("/bson/oid_map/insert_lookup_1mm",
+            benchmark_oid_map_insert_lookup_1mm);
+   run_test("/bson/oid_map/insert_lookup_many_1mm",
+            benchmark_oid_map_insert_lookup_many_1mm);
+   run_test("/bson/oid_map/chained_insert_lookup_1mm",
+            benchmark_chained_insert_lookup_1mm);
+
+   run_test("/bson/oid/init_many_100k", benchmark_oid_init_many_100k);
+   run_test("/bson/oid/init_100k", benchmark_oid_init_100k);
+
+   /*
+    * Each thread generates N_PER_THREAD_OIDS ids from one shared context, so
+    * with enough cores the time should stay flat as threads are added.
+    */
+   for (gContentionThreads = 1; gContentionThreads <= 32;
+        gContentionThreads *= 2) {
+      char name[64];
+
+      snprintf(name, sizeof name, "/bson/oid/contention/thread_safe/%d",
+               gContentionThreads);
+      run_test(name, benchmark_oid_contention_thread_safe);
+      snprintf(name, sizeof name, "/bson/oid/contention/per_thread/%d",
+               gContentionThreads);
+      run_test(name, benchmark_oid_contention_per_thread);
+   }
+
+   run_test("/bson/oid/to_string_1mm", benchmark_oid_to_string_1mm);
+   run_test("/bson/oid/to_string_many_1mm", benchmark_oid_to_string_many_1mm);
+   run_test("/bson/oid/init_from_string_1mm",
+            benchmark_oid_init_from_string_1mm);
+   run_test("/bson/oid/init_from_string_many_1mm",
+            benchmark_oid_init_from_string_many_1mm);
+   run_test("/bson/oid/qsort_1mm", benchmark_oid_qsort_1mm);
+   run_test("/bson/oid/sort_1mm", benchmark_oid_sort_1mm);
+
+   run_test("/bson/replace_iter_10k", benchmark_replace_iter_10k);
+   run_test("/bson/rebuild_10k", benchmark_rebuild_10k);
+
+   run_test("/bson/diff/apply_100k", benchmark_diff_apply_100k);
+   fprintf(stdout, "%-42s : %.1lf of %.1lf bytes (%.2lf%%)\n",
+           "/bson/diff/apply_100k patch size",
+           (double)gPatchBytes / gNPatches,
+           (double)gDocBytes / gNPatches,
+           100.0 * gPatchBytes / gDocBytes);
+
+   run_test("/bson/keyset/copy_to_excluding_keyset_100k",
+            benchmark_copy_to_excluding_keyset_100k);
+   run_test("/bson/keyset/copy_to_including_keyset_100k",
+            benchmark_copy_to_including_keyset_100k);
+   run_test("/bson/keyset/copy_naive_excluding_100k",
+            benchmark_copy_naive_excluding_100k);
+
+   run_test("/bson/concat_10k", benchmark_concat_10k);
+   run_test("/bson/concat_append_iter_10k",
+            benchmark_concat_append_iter_10k);
+
+   run_test("/bson/append_array_snprintf_10k",
+            benchmark_append_array_snprintf_10k);
+   run_test("/bson/append_array_builder_10k",
+            benchmark_append_array_builder_10k);
+   run_test("/bson/append_array_int32_10k",
+            benchmark_append_array_int32_10k);
+
+   run_test("/bson/template/build_1m", benchmark_template_build_1m);
+   run_test("/bson/template/build_utf8_1m", benchmark_template_build_utf8_1m);
+   run_test("/bson/template/append_1m", benchmark_append_1m);
+
+   run_test("/bson/struct/encode_10k", benchmark_struct_encode_10k);
+   run_test("/bson/struct/hand_encode_10k", benchmark_hand_encode_10k);
+   run_test("/bson/struct/decode_10k", benchmark_struct_decode_10k);
+   run_test("/bson/struct/hand_decode_10k", benchmark_hand_decode_10k);
+
+   run_test("/bson/extractor/100k", benchmark_extractor_100k);
+   run_test("/bson/extractor/find_descendant_100k",
+            benchmark_find_descendant_100k);
+
+   run_test("/bson/column_encoder/100k", benchmark_encoder_100k);
+   run_test("/bson/column_encoder/writer_append_100k",
+            benchmark_writer_append_100k);
+
+   run_test("/bson/as_json/nested_x10000", benchmark_as_json_nested);
+   run_test("/bson/as_json/nested_validated_x10000",
+            benchmark_as_json_nested_validated);
+
+   run_test("/bson/visit_all_100k", benchmark_visit_all_100k);
+   run_test("/bson/visit_all_validated_100k",
+            benchmark_visit_all_validated_100k);
+
+   run_test("/bson/walker/visit_all_100k",
+            benchmark_walker_visit_all_100k);
+   run_test("/bson/walker/walker_100k", benchmark_walker_100k);
+   run_test("/bson/walker/walker_validated_100k",
+            benchmark_walker_validated_100k);
+
+   run_test("/bson/reinit_1mm", benchmark_reinit_1mm);
+   run_test("/bson/reset_1mm", benchmark_reset_1mm);
+
+   run_test("/bson/message/copy_100k", benchmark_message_copy_100k);
+   run_test("/bson/message/in_place_100k", benchmark_message_in_place_100k);
+   run_test("/bson/message/reader_100k", benchmark_message_reader_100k);
+   run_test("/bson/message/parser_100k", benchmark_message_parser_100k);
+
+   run_test("/bson/reader/iovec_100k", benchmark_reader_iovec_100k);
+   run_test("/bson/reader/coalesce_100k", benchmark_reader_coalesce_100k);
+
+   bson_extractor_destroy(gColumnExtractor);
+   bson_free(gColumnStream);
+
+   for (i = 0; i < N_EVENTS; i++) {
+      bson_destroy(&gDocs[i]);
+   }
+   bson_free(gDocs);
+   bson_free(gEvents);
+
+   bson_destroy(gWalkerDoc);
+   bson_free(gMessageFrames);
+   bson_free(gReaderStream);
+
+   bson_free(gHexOids);
+   bson_free(gHexStrs);
+   bson_free(gHexStrPtrs);
+   bson_free(gOids);
+
+   return 0;
+}
@@ -0,0 +1,670 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bson-tests.h"
+
+
+#define N_DOCS 10000
+
+
+static const char *gHosts[] = { "alpha", "beta", "gamma" };
+static bson_uint8_t *gStream;
+static size_t gStreamLen;
+
+
+/*
+ * { "seq": i, "host": gHosts[i % 3], "stats": { "bytes": i * 10,
+ *   "latency": i / 4.0 }, "tags": [ "x", i % 2 == 0 ], "ok": i % 5 != 0 }
+ *
+ * Every seventh document lacks stats.latency and every eleventh has a
+ * string for seq.
+ */
+static void
+build_doc (bson_t *b,
+           int     i)
+{
+   bson_t child;
+
+   bson_init(b);
+   if ((i % 11) == 0) {
+      bson_append_utf8(b, "seq", -1, "eleven", -1);
+   } else {
+      bson_append_int32(b, "seq", -1, i);
+   }
+   bson_append_utf8(b, "host", -1, gHosts[i % 3], -1);
+   bson_append_document_begin(b, "stats", -1, &child);
+   bson_append_int64(&child, "bytes", -1, (bson_int64_t)i * 10);
+   if ((i % 7) != 0) {
+      bson_append_double(&child, "latency", -1, i / 4.0);
+   }
+   bson_append_document_end(b, &child);
+   bson_append_array_begin(b, "tags", -1, &child);
+   bson_append_utf8(&child, "0", -1, "x", -1);
+   bson_append_bool(&child, "1", -1, (i % 2) == 0);
+   bson_append_array_end(b, &child);
+   bson_append_bool(b, "ok", -1, (i % 5) != 0);
+}
+
+
+static void
+test_extractor_paths (void)
+{
+   const bson_column_t *col;
+   bson_extractor_t *ex;
+   bson_t b;
+   int seq, host, bytes, latency, tag, ok, missing;
+   int i;
+
+   ex = bson_extractor_new();
+   seq = bson_extractor_add_column(ex, "seq", BSON_COLUMN_INT64);
+   latency = bson_extractor_add_column(ex, "stats.latency",
+                                       BSON_COLUMN_DOUBLE);
+   host = bson_extractor_add_column(ex, "host", BSON_COLUMN_STRING);
+   bytes = bson_extractor_add_column(ex, "stats.bytes", BSON_COLUMN_INT64);
+   tag = bson_extractor_add_column(ex, "tags.1", BSON_COLUMN_BOOL);
+   ok = bson_extractor_add_column(ex, "ok", BSON_COLUMN_BOOL);
+   missing = bson_extractor_add_column(ex, "stats.nope", BSON_COLUMN_INT32);
+   assert(seq == 0 && latency == 1 && host == 2 && bytes == 3);
+   assert(tag == 4 && ok == 5 && missing == 6);
+   assert(bson_extractor_add_column(ex, "stats.bytes",
+                                    BSON_COLUMN_INT32) == -1);
+
+   for (i = 0; i < 100; i++) {
+      build_doc(&b, i);
+      assert(bson_extractor_add_document(ex, &b));
+      bson_destroy(&b);
+   }
+
+   col = bson_extractor_get_column(ex, seq);
+   assert(col->type == BSON_COLUMN_INT64);
+   assert(col->n_rows == 100);
+   for (i = 0; i < 100; i++) {
+      assert(!BSON_COLUMN_IS_VALID(col, i) == ((i % 11) == 0));
+      assert(((bson_int64_t *)col->values)[i] == (((i % 11) == 0) ? 0 : i));
+   }
+
+   col = bson_extractor_get_column(ex, latency);
+   for (i = 0; i < 100; i++) {
+      assert(!BSON_COLUMN_IS_VALID(col, i) == ((i % 7) == 0));
+      if ((i % 7) != 0) {
+         assert(((double *)col->values)[i] == i / 4.0);
+      }
+   }
+
+   col = bson_extractor_get_column(ex, host);
+   assert(col->n_dict == 3);
+   for (i = 0; i < 3; i++) {
+      assert(!strcmp(col->dict[i], gHosts[i]));
+      assert(col->dict_lengths[i] == strlen(gHosts[i]));
+   }
+   for (i = 0; i < 100; i++) {
+      assert(BSON_COLUMN_IS_VALID(col, i));
+      assert(((bson_uint32_t *)col->values)[i] == (bson_uint32_t)(i % 3));
+   }
+
+   col = bson_extractor_get_column(ex, bytes);
+   for (i = 0; i < 100; i++) {
+      assert(((bson_int64_t *)col->values)[i] == (bson_int64_t)i * 10);
+   }
+
+   col = bson_extractor_get_column(ex, tag);
+   for (i = 0; i < 100; i++) {
+      assert(BSON_COLUMN_IS_VALID(col, i));
+      assert(((bson_uint8_t *)col->values)[i] == ((i % 2) == 0));
+   }
+
+   col = bson_extractor_get_column(ex, ok);
+   for (i = 0; i < 100; i++) {
+      assert(((bson_uint8_t *)col->values)[i] == ((i % 5) != 0));
+   }
+
+   col = bson_extractor_get_column(ex, missing);
+   assert(col->n_rows == 100);
+   assert(bson_column_count(col) == 0);
+
+   assert(!bson_extractor_get_column(ex, 7));
+
+   bson_extractor_destroy(ex);
+}
+
+
+static void
+test_extractor_first_match (void)
+{
+   const bson_column_t *col;
+   bson_extractor_t *ex;
+   bson_t b;
+
+   ex = bson_extractor_new();
+   bson_extractor_add_column(ex, "a", BSON_COLUMN_INT32);
+
+   /* Duplicate keys keep the first value that converts. */
+   bson_init(&b);
+   bson_append_utf8(&b, "a", -1, "no", -1);
+   bson_append_int32(&b, "a", -1, 1);
+   bson_append_int32(&b, "a", -1, 2);
+   assert(bson_extractor_add_document(ex, &b));
+   bson_destroy(&b);
+
+   col = bson_extractor_get_column(ex, 0);
+   assert(col->n_rows == 1);
+   assert(BSON_COLUMN_IS_VALID(col, 0));
+   assert(((bson_int32_t *)col->values)[0] == 1);
+
+   bson_extractor_destroy(ex);
+}
+
+
+static void
+add_to_both (bson_extractor_t *ex32,
+             bson_extractor_t *ex64,
+             bson_t           *b)
+{
+   assert(bson_extractor_add_document(ex32, b));
+   assert(bson_extractor_add_document(ex64, b));
+   bson_destroy(b);
+}
+
+
+static void
+test_extractor_out_of_range (void)
+{
+   static const double doubles[] = { 1e20, -1e20, 2147483648.0, 1e300 };
+   const bson_column_t *col32;
+   const bson_column_t *col64;
+   bson_extractor_t *ex32;
+   bson_extractor_t *ex64;
+   bson_t b;
+   size_t i;
+
+   ex32 = bson_extractor_new();
+   bson_extractor_add_column(ex32, "a", BSON_COLUMN_INT32);
+   ex64 = bson_extractor_new();
+   bson_extractor_add_column(ex64, "a", BSON_COLUMN_INT64);
+
+   /* Values that do not fit leave the row null. */
+   for (i = 0; i < sizeof doubles / sizeof doubles[0]; i++) {
+      bson_init(&b);
+      bson_append_double(&b, "a", -1, doubles[i]);
+      add_to_both(ex32, ex64, &b);
+   }
+
+   bson_init(&b);
+   bson_append_double(&b, "a", -1, NAN);
+   add_to_both(ex32, ex64, &b);
+
+   bson_init(&b);
+   bson_append_int64(&b, "a", -1, 1LL << 40);
+   add_to_both(ex32, ex64, &b);
+
+   /* A later duplicate that fits still matches. */
+   bson_init(&b);
+   bson_append_double(&b, "a", -1, -2147483649.5);
+   bson_append_int32(&b, "a", -1, 7);
+   add_to_both(ex32, ex64, &b);
+
+   col32 = bson_extractor_get_column(ex32, 0);
+   assert(col32->n_rows == 7);
+   assert(bson_column_count(col32) == 1);
+   assert(BSON_COLUMN_IS_VALID(col32, 6));
+   assert(((bson_int32_t *)col32->values)[6] == 7);
+
+   col64 = bson_extractor_get_column(ex64, 0);
+   assert(col64->n_rows == 7);
+   assert(bson_column_count(col64) == 3);
+   assert(BSON_COLUMN_IS_VALID(col64, 2));
+   assert(BSON_COLUMN_IS_VALID(col64, 5));
+   assert(BSON_COLUMN_IS_VALID(col64, 6));
+   assert(((bson_int64_t *)col64->values)[2] == 2147483648LL);
+   assert(((bson_int64_t *)col64->values)[5] == (1LL << 40));
+   assert(((bson_int64_t *)col64->values)[6] == -2147483649LL);
+
+   bson_extractor_destroy(ex32);
+   bson_extractor_destroy(ex64);
+}
+
+
+static void
+test_extractor_reset (void)
+{
+   const bson_column_t *col;
+   bson_extractor_t *ex;
+   bson_t b;
+   int i;
+
+   ex = bson_extractor_new();
+   bson_extractor_add_column(ex, "host", BSON_COLUMN_STRING);
+
+   for (i = 0; i < 10; i++) {
+      build_doc(&b, i);
+      bson_extractor_add_document(ex, &b);
+      bson_destroy(&b);
+   }
+
+   bson_extractor_reset(ex);
+   col = bson_extractor_get_column(ex, 0);
+   assert(col->n_rows == 0);
+   assert(bson_column_count(col) == 0);
+   assert(col->n_dict == 3);
+
+   for (i = 2; i < 5; i++) {
+      build_doc(&b, i);
+      bson_extractor_add_document(ex, &b);
+      bson_destroy(&b);
+   }
+
+   col = bson_extractor_get_column(ex, 0);
+   assert(col->n_rows == 3);
+   assert(bson_column_count(col) == 3);
+   assert(col->n_dict == 3);
+   assert(((bson_uint32_t *)col->values)[0] == 2);
+   assert(((bson_uint32_t *)col->values)[1] == 0);
+   assert(((bson_uint32_t *)col->values)[2] == 1);
+
+   bson_extractor_destroy(ex);
+}
+
+
+static void
+test_extractor_dict_grow (void)
+{
+   const bson_column_t *col;
+   bson_extractor_t *ex;
+   char str[32];
+   bson_t b;
+   int i;
+
+   ex = bson_extractor_new();
+   bson_extractor_add_column(ex, "s", BSON_COLUMN_STRING);
+
+   for (i = 0; i < 3000; i++) {
+      snprintf(str, sizeof str, "value-%d", i % 1000);
+      bson_init(&b);
+      bson_append_utf8(&b, "s", -1, str, -1);
+      bson_extractor_add_document(ex, &b);
+      bson_destroy(&b);
+   }
+
+   col = bson_extractor_get_column(ex, 0);
+   assert(col->n_dict == 1000);
+   for (i = 0; i < 3000; i++) {
+      snprintf(str, sizeof str, "value-%d", i % 1000);
+      assert(!strcmp(col->dict[((bson_uint32_t *)col->values)[i]], str));
+   }
+
+   bson_extractor_destroy(ex);
+}
+
+
+static void
+test_extractor_read (void)
+{
+   const bson_column_t *col;
+   bson_extractor_t *ex;
+   bson_reader_t *reader;
+   bson_bool_t eof = FALSE;
+   bson_int64_t sum;
+   size_t n;
+
+   ex = bson_extractor_new();
+   bson_extractor_add_column(ex, "stats.bytes", BSON_COLUMN_INT64);
+
+   reader = bson_reader_new_from_data(gStream, gStreamLen);
+
+   n = bson_extractor_read(ex, reader, 1000, &eof);
+   assert(n == 1000);
+   assert(!eof);
+
+   n = bson_extractor_read(ex, reader, 0, &eof);
+   assert(n == N_DOCS - 1000);
+   assert(eof);
+
+   col = bson_extractor_get_column(ex, 0);
+   assert(col->n_rows == N_DOCS);
+   assert(bson_column_sum_int64(col, &sum));
+   assert(sum == (bson_int64_t)N_DOCS * (N_DOCS - 1) * 5);
+
+   bson_reader_destroy(reader);
+   bson_extractor_destroy(ex);
+}
+
+
+/*
+ * Builds columns by hand with a partial bitmap and checks the kernels
+ * against a row at a time reference.
+ */
+static void
+test_column_kernels (void)
+{
+   bson_column_t col;
+   bson_int32_t i32[203];
+   bson_int64_t i64[203];
+   double dbl[203];
+   bson_uint8_t valid[26];
+   bson_int64_t isum, imin, imax, rmin, rmax, rsum;
+   double dsum, dmin, dmax, rdmin, rdmax, rdsum;
+   size_t count;
+   size_t n;
+   size_t i;
+
+   for (i = 0; i < 203; i++) {
+      i32[i] = (bson_int32_t)((i * 7919) % 2001) - 1000;
+      i64[i] = (bson_int64_t)i32[i] * 3000000000LL;
+      dbl[i] = i32[i] / 8.0;
+   }
+
+   /* Every size exercises a different tail. */
+   for (n = 0; n <= 203; n += 29) {
+      memset(valid, 0, sizeof valid);
+      for (i = 0; i < n; i++) {
+         /* All valid for the first 64 rows, then sparse. */
+         if ((i < 64) || ((i % 3) != 0)) {
+            valid[i >> 3] |= (1 << (i & 7));
+         }
+      }
+
+      count = 0;
+      rsum = 0;
+      rdsum = 0.0;
+      rmin = INT64_MAX;
+      rmax = INT64_MIN;
+      rdmin = 1e300;
+      rdmax = -1e300;
+      for (i = 0; i < n; i++) {
+         if ((valid[i >> 3] & (1 << (i & 7)))) {
+            count++;
+            rsum += i32[i];
+            rdsum += dbl[i];
+            rmin = MIN(rmin, i32[i]);
+            rmax = MAX(rmax, i32[i]);
+            rdmin = MIN(rdmin, dbl[i]);
+            rdmax = MAX(rdmax, dbl[i]);
+         }
+      }
+
+      memset(&col, 0, sizeof col);
+      col.n_rows = n;
+      col.valid = valid;
+
+      col.type = BSON_COLUMN_INT32;
+      col.values = i32;
+      assert(bson_column_count(&col) == count);
+      assert(bson_column_sum_int64(&col, &isum));
+      assert(isum == rsum);
+      assert(bson_column_min_int64(&col, &imin) == (count > 0));
+      assert(bson_column_max_int64(&col, &imax) == (count > 0));
+      if (count) {
+         assert(imin == rmin);
+         assert(imax == rmax);
+      }
+      assert(!bson_column_sum_double(&col, &dsum));
+
+      col.type = BSON_COLUMN_INT64;
+      col.values = i64;
+      assert(bson_column_sum_int64(&col, &isum));
+      assert(isum == rsum * 3000000000LL);
+      if (count) {
+         assert(bson_column_min_int64(&col, &imin));
+         assert(bson_column_max_int64(&col, &imax));
+         assert(imin == rmin * 3000000000LL);
+         assert(imax == rmax * 3000000000LL);
+      }
+
+      /* Eighths are exact, so lane order does not matter. */
+      col.type = BSON_COLUMN_DOUBLE;
+      col.values = dbl;
+      assert(bson_column_sum_double(&col, &dsum));
+      assert(dsum == rdsum);
+      if (count) {
+         assert(bson_column_min_double(&col, &dmin));
+         assert(bson_column_max_double(&col, &dmax));
+         assert(dmin == rdmin);
+         assert(dmax == rdmax);
+      }
+      assert(!bson_column_min_int64(&col, &imin));
+
+      /* Without a bitmap every row counts. */
+      col.valid = NULL;
+      assert(bson_column_count(&col) == n);
+      col.type = BSON_COLUMN_INT32;
+      col.values = i32;
+      assert(bson_column_sum_int64(&col, &isum));
+      rsum = 0;
+      for (i = 0; i < n; i++) {
+         rsum += i32[i];
+      }
+      assert(isum == rsum);
+   }
+}
+
+
+static void
+test_column_sum_wraps (void)
+{
+   bson_column_t col;
+   bson_int64_t values[16];
+   bson_int64_t sum;
+   int i;
+
+   for (i = 0; i < 16; i++) {
+      values[i] = INT64_MAX;
+   }
+
+   memset(&col, 0, sizeof col);
+   col.type = BSON_COLUMN_INT64;
+   col.n_rows = 16;
+   col.values = values;
+
+   /* 16 * (2^63 - 1) wraps to -16. */
+   assert(bson_column_sum_int64(&col, &sum));
+   assert(sum == -16);
+}
+
+
+static void
+test_encoder_roundtrip (void)
+{
+   const bson_column_t *cols[5];
+   bson_column_encoder_t *enc;
+   bson_extractor_t *ex;
+   bson_reader_t *reader;
+   bson_writer_t *writer;
+   const bson_t *b;
+   bson_uint8_t *buf = NULL;
+   size_t buflen = 0;
+   size_t n_docs = 0;
+   size_t size;
+   bson_iter_t iter;
+   bson_bool_t eof = FALSE;
+   int i;
+
+   ex = bson_extractor_new();
+   bson_extractor_add_column(ex, "seq", BSON_COLUMN_INT32);
+   bson_extractor_add_column(ex, "host", BSON_COLUMN_STRING);
+   bson_extractor_add_column(ex, "stats.bytes", BSON_COLUMN_INT64);
+   bson_extractor_add_column(ex, "stats.latency", BSON_COLUMN_DOUBLE);
+   bson_extractor_add_column(ex, "ok", BSON_COLUMN_BOOL);
+
+   reader = bson_reader_new_from_data(gStream, gStreamLen);
+   assert(bson_extractor_read(ex, reader, 1000, NULL) == 1000);
+   bson_reader_destroy(reader);
+
+   enc = bson_column_encoder_new();
+   for (i = 0; i < 5; i++) {
+      cols[i] = bson_extractor_get_column(ex, i);
+   }
+   assert(bson_column_encoder_add_column(enc, "seq", -1, cols[0]));
+   assert(bson_column_encoder_add_column(enc, "hostname", 4, cols[1]));
+   assert(bson_column_encoder_add_column(enc, "bytes", -1, cols[2]));
+   assert(bson_column_encoder_add_column(enc, "latency", -1, cols[3]));
+   assert(bson_column_encoder_add_column(enc, "ok", -1, cols[4]));
+
+   size = bson_column_encoder_get_size(enc);
+   assert(size > 0);
+
+   writer = bson_writer_new(&buf, &buflen, 0, bson_realloc);
+   assert(bson_column_encoder_write(enc, writer, &n_docs));
+   assert(n_docs == 1000);
+   assert(bson_writer_get_length(writer) == size);
+   bson_writer_destroy(writer);
+
+   reader = bson_reader_new_from_data(buf, size);
+   for (i = 0; (b = bson_reader_read(reader, &eof)); i++) {
+      assert(bson_iter_init(&iter, b));
+      assert(bson_iter_next(&iter));
+      assert(!strcmp(bson_iter_key(&iter), "seq"));
+      if ((i % 11) == 0) {
+         assert(BSON_ITER_HOLDS_NULL(&iter));
+      } else {
+         assert(BSON_ITER_HOLDS_INT32(&iter));
+         assert(bson_iter_int32(&iter) == i);
+      }
+      assert(bson_iter_next(&iter));
+      assert(!strcmp(bson_iter_key(&iter), "host"));
+      assert(!strcmp(bson_iter_utf8(&iter, NULL), gHosts[i % 3]));
+      assert(bson_iter_next(&iter));
+      assert(bson_iter_int64(&iter) == (bson_int64_t)i * 10);
+      assert(bson_iter_next(&iter));
+      assert(!strcmp(bson_iter_key(&iter), "latency"));
+      if ((i % 7) == 0) {
+         assert(BSON_ITER_HOLDS_NULL(&iter));
+      } else {
+         assert(bson_iter_double(&iter) == i / 4.0);
+      }
+      assert(bson_iter_next(&iter));
+      assert(bson_iter_bool(&iter) == ((i % 5) != 0));
+      assert(!bson_iter_next(&iter));
+   }
+   assert(i == 1000);
+   assert(eof);
+   bson_reader_destroy(reader);
+
+   bson_free(buf);
+   bson_column_encoder_destroy(enc);
+   bson_extractor_destroy(ex);
+}
+
+
+static void
+test_encoder_errors (void)
+{
+   bson_column_encoder_t *enc;
+   bson_writer_t *writer;
+   bson_column_t a;
+   bson_column_t s;
+   bson_int32_t values[4] = { 1, 2, 3, 4 };
+   bson_uint32_t codes[4] = { 0, 1, 0, 2 };
+   char *dict[2] = { "x", "yy" };
+   bson_uint32_t dict_lengths[2] = { 1, 2 };
+   bson_uint8_t *buf = NULL;
+   size_t buflen = 0;
+
+   memset(&a, 0, sizeof a);
+   a.type = BSON_COLUMN_INT32;
+   a.n_rows = 4;
+   a.values = values;
+
+   memset(&s, 0, sizeof s);
+   s.type = BSON_COLUMN_STRING;
+   s.n_rows = 3;
+   s.values = codes;
+   s.dict = dict;
+   s.dict_lengths = dict_lengths;
+   s.n_dict = 2;
+
+   enc = bson_column_encoder_new();
+   assert(bson_column_encoder_add_column(enc, "a", -1, &a));
+   assert(bson_column_encoder_add_column(enc, "s", -1, &s));
+
+   writer = bson_writer_new(&buf, &buflen, 0, bson_realloc);
+
+   /* Row counts differ. */
+   assert(!bson_column_encoder_get_size(enc));
+   assert(!bson_column_encoder_write(enc, writer, NULL));
+
+   /* Code 2 is not in the dictionary. */
+   s.n_rows = 4;
+   assert(!bson_column_encoder_write(enc, writer, NULL));
+   assert(bson_writer_get_length(writer) == 0);
+
+   s.n_rows = 3;
+   a.n_rows = 3;
+   assert(bson_column_encoder_get_size(enc) == 3 * (5 + 3 + 4 + 3 + 5) + 4);
+   assert(bson_column_encoder_write(enc, writer, NULL));
+   assert(bson_writer_get_length(writer) == 3 * (5 + 3 + 4 + 3 + 5) + 4);
+   bson_writer_destroy(writer);
+
+   /* The batch does not fit in a fixed buffer one byte too small. */
+   buflen = bson_column_encoder_get_size(enc) - 1;
+   writer = bson_writer_new(&buf, &buflen, 0, NULL);
+   assert(!bson_column_encoder_write(enc, writer, NULL));
+   assert(bson_writer_get_length(writer) == 0);
+   bson_writer_destroy(writer);
+
+   buflen++;
+   writer = bson_writer_new(&buf, &buflen, 0, NULL);
+   assert(bson_column_encoder_write(enc, writer, NULL));
+   assert(bson_writer_get_remaining(writer) == 0);
+
+   a.type = (bson_column_type_t)0;
+   assert(!bson_column_encoder_add_column(enc, "b", -1, &a));
+
+   bson_writer_destroy(writer);
+   bson_free(buf);
+   bson_column_encoder_destroy(enc);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   size_t alloc = 0;
+   bson_t b;
+   int i;
+
+   for (i = 0; i < N_DOCS; i++) {
+      build_doc(&b, i);
+      if (gStreamLen + b.len > alloc) {
+         alloc = MAX(4096, alloc * 2);
+         gStream = bson_realloc(gStream, alloc);
+      }
+      memcpy(gStream + gStreamLen, bson_get_data(&b), b.len);
+      gStreamLen += b.len;
+      bson_destroy(&b);
+   }
+
+   run_test("/bson/extractor/paths", test_extractor_paths);
+   run_test("/bson/extractor/first_match", test_extractor_first_match);
+   run_test("/bson/extractor/out_of_range", test_extractor_out_of_range);
+   run_test("/bson/extractor/reset", test_extractor_reset);
+   run_test("/bson/extractor/dict_grow", test_extractor_dict_grow);
+   run_test("/bson/extractor/read", test_extractor_read);
+   run_test("/bson/column/kernels", test_column_kernels);
+   run_test("/bson/column/sum_wraps", test_column_sum_wraps);
+   run_test("/bson/column_encoder/roundtrip", test_encoder_roundtrip);
+   run_test("/bson/column_encoder/errors", test_encoder_errors);
+
+   bson_free(gStream);
+
+   return 0;
+}
@@ -0,0 +1,510 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+
+#include "bson-tests.h"
+
+
+static const char *
+key_for (int i)
+{
+   static char str[16];
+   const char *key;
+
+   bson_uint32_to_string(i, &key, str, sizeof str);
+
+   return key;
+}
+
+
+static void
+assert_round_trip (const bson_t *from,
+                   const bson_t *to,
+                   bson_t       *patch)
+{
+   bson_t result;
+
+   bson_diff(from, to, patch);
+   assert(bson_patch_apply(from, patch, &result));
+   assert_cmpint(result.len, ==, to->len);
+   assert(bson_equal(&result, to));
+   bson_destroy(&result);
+}
+
+
+static bson_bool_t
+has_entry (const bson_t *patch,
+           const char   *section,
+           const char   *key)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+
+   if (!bson_iter_init(&iter, patch)) {
+      return FALSE;
+   }
+
+   while (bson_iter_next(&iter)) {
+      if (!strcmp(bson_iter_key(&iter), section) &&
+          bson_iter_recurse(&iter, &child)) {
+         while (bson_iter_next(&child)) {
+            if (!strcmp(bson_iter_key(&child), key)) {
+               return TRUE;
+            }
+         }
+      }
+   }
+
+   return FALSE;
+}
+
+
+static void
+test_diff_identical (void)
+{
+   bson_t a;
+   bson_t b;
+   bson_t patch;
+
+   bson_init(&a);
+   bson_append_int32(&a, "a", -1, 1);
+   bson_append_utf8(&a, "b", -1, "hello", -1);
+   bson_append_null(&a, "c", -1);
+   bson_append_minkey(&a, "d", -1);
+   bson_append_maxkey(&a, "e", -1);
+
+   assert_round_trip(&a, &a, &patch);
+   assert(bson_empty(&patch));
+   bson_destroy(&patch);
+
+   bson_copy_to(&a, &b);
+   assert_round_trip(&a, &b, &patch);
+   assert(bson_empty(&patch));
+   bson_destroy(&patch);
+
+   bson_destroy(&b);
+   bson_destroy(&a);
+}
+
+
+static void
+test_diff_set_unset (void)
+{
+   bson_t a;
+   bson_t b;
+   bson_t patch;
+
+   bson_init(&a);
+   bson_append_int32(&a, "a", -1, 1);
+   bson_append_null(&a, "f", -1);
+   bson_append_minkey(&a, "g", -1);
+   bson_append_int32(&a, "b", -1, 2);
+   bson_append_int32(&a, "c", -1, 3);
+   bson_append_int32(&a, "d", -1, 4);
+
+   bson_init(&b);
+   bson_append_int32(&b, "a", -1, 1);
+   bson_append_null(&b, "f", -1);
+   bson_append_maxkey(&b, "g", -1);
+   bson_append_utf8(&b, "b", -1, "two", -1);
+   bson_append_int32(&b, "d", -1, 4);
+   bson_append_int32(&b, "e", -1, 5);
+
+   assert_round_trip(&a, &b, &patch);
+   assert(has_entry(&patch, "$set", "b"));
+   assert(has_entry(&patch, "$set", "e"));
+   assert(has_entry(&patch, "$unset", "c"));
+   assert(!has_entry(&patch, "$set", "a"));
+   assert(!has_entry(&patch, "$set", "d"));
+   assert(!has_entry(&patch, "$set", "f"));
+   assert(has_entry(&patch, "$set", "g"));
+   bson_destroy(&patch);
+
+   assert_round_trip(&b, &a, &patch);
+   bson_destroy(&patch);
+
+   bson_destroy(&a);
+   bson_destroy(&b);
+}
+
+
+static void
+test_diff_moved (void)
+{
+   bson_t a;
+   bson_t b;
+   bson_t patch;
+
+   bson_init(&a);
+   bson_append_int32(&a, "a", -1, 1);
+   bson_append_int32(&a, "b", -1, 2);
+   bson_append_int32(&a, "c", -1, 3);
+
+   /*
+    * "x" is new and ahead of "c", so "c" has to move to the end.
+    */
+   bson_init(&b);
+   bson_append_int32(&b, "a", -1, 1);
+   bson_append_int32(&b, "b", -1, 2);
+   bson_append_int32(&b, "x", -1, 0);
+   bson_append_int32(&b, "c", -1, 3);
+
+   assert_round_trip(&a, &b, &patch);
+   assert(has_entry(&patch, "$unset", "c"));
+   assert(has_entry(&patch, "$set", "c"));
+   assert(!has_entry(&patch, "$set", "a"));
+   bson_destroy(&patch);
+
+   bson_reinit(&b);
+   bson_append_int32(&b, "c", -1, 3);
+   bson_append_int32(&b, "b", -1, 2);
+   bson_append_int32(&b, "a", -1, 1);
+
+   assert_round_trip(&a, &b, &patch);
+   bson_destroy(&patch);
+
+   bson_destroy(&a);
+   bson_destroy(&b);
+}
+
+
+static void
+test_diff_nested (void)
+{
+   bson_t a;
+   bson_t b;
+   bson_t child;
+   bson_t patch;
+   int i;
+
+   bson_init(&a);
+   bson_init(&b);
+   bson_append_int32(&a, "a", -1, 1);
+   bson_append_int32(&b, "a", -1, 1);
+
+   bson_append_document_begin(&a, "sub", -1, &child);
+   for (i = 0; i < 20; i++) {
+      bson_append_utf8(&child, key_for(i), -1, "some long string value", -1);
+   }
+   bson_append_document_end(&a, &child);
+
+   bson_append_document_begin(&b, "sub", -1, &child);
+   for (i = 0; i < 20; i++) {
+      if (i == 7) {
+         bson_append_int32(&child, key_for(i), -1, i);
+      } else {
+         bson_append_utf8(&child, key_for(i), -1,
+                          "some long string value", -1);
+      }
+   }
+   bson_append_document_end(&b, &child);
+
+   assert_round_trip(&a, &b, &patch);
+   assert(has_entry(&patch, "$diff", "sub"));
+   assert(!has_entry(&patch, "$set", "sub"));
+   assert_cmpint(patch.len, <, 64);
+   bson_destroy(&patch);
+
+   bson_destroy(&a);
+   bson_destroy(&b);
+}
+
+
+static void
+test_diff_array (void)
+{
+   bson_iter_t iter;
+   bson_iter_t found;
+   bson_t a;
+   bson_t b;
+   bson_t child;
+   bson_t patch;
+   int i;
+
+   bson_init(&a);
+   bson_init(&b);
+
+   bson_append_array_begin(&a, "arr", -1, &child);
+   for (i = 0; i < 100; i++) {
+      bson_append_int32(&child, key_for(i), -1, i);
+   }
+   bson_append_array_end(&a, &child);
+
+   /*
+    * Remove 40 and 41, insert a string in their place.
+    */
+   bson_append_array_begin(&b, "arr", -1, &child);
+   for (i = 0; i < 40; i++) {
+      bson_append_int32(&child, key_for(i), -1, i);
+   }
+   bson_append_utf8(&child, key_for(40), -1, "forty", -1);
+   for (i = 42; i < 100; i++) {
+      bson_append_int32(&child, key_for(i - 1), -1, i);
+   }
+   bson_append_array_end(&b, &child);
+
+   assert_round_trip(&a, &b, &patch);
+   assert(has_entry(&patch, "$splice", "arr"));
+   assert(bson_iter_init(&iter, &patch));
+   assert(bson_iter_find_descendant(&iter, "$splice.arr.p", &found));
+   assert_cmpint(bson_iter_int32(&found), ==, 40);
+   assert(bson_iter_init(&iter, &patch));
+   assert(bson_iter_find_descendant(&iter, "$splice.arr.d", &found));
+   assert_cmpint(bson_iter_int32(&found), ==, 2);
+   bson_destroy(&patch);
+
+   /*
+    * Appending and truncating.
+    */
+   assert_round_trip(&b, &a, &patch);
+   bson_destroy(&patch);
+
+   bson_reinit(&b);
+   bson_append_array_begin(&b, "arr", -1, &child);
+   for (i = 0; i < 103; i++) {
+      bson_append_int32(&child, key_for(i), -1, i);
+   }
+   bson_append_array_end(&b, &child);
+
+   assert_round_trip(&a, &b, &patch);
+   assert(has_entry(&patch, "$splice", "arr"));
+   bson_destroy(&patch);
+
+   assert_round_trip(&b, &a, &patch);
+   assert(has_entry(&patch, "$splice", "arr"));
+   bson_destroy(&patch);
+
+   bson_destroy(&a);
+   bson_destroy(&b);
+}
+
+
+static void
+test_diff_duplicate_keys (void)
+{
+   bson_iter_t iter;
+   bson_t a;
+   bson_t b;
+   bson_t patch;
+
+   bson_init(&a);
+   bson_append_int32(&a, "a", -1, 1);
+   bson_append_int32(&a, "a", -1, 2);
+
+   bson_init(&b);
+   bson_append_int32(&b, "a", -1, 1);
+   bson_append_int32(&b, "a", -1, 3);
+
+   assert_round_trip(&a, &b, &patch);
+   assert(bson_iter_init_find(&iter, &patch, "$replace"));
+   bson_destroy(&patch);
+
+   /*
+    * Unchanged duplicates need no patch at all.
+    */
+   assert_round_trip(&a, &a, &patch);
+   assert(bson_empty(&patch));
+   bson_destroy(&patch);
+
+   bson_destroy(&a);
+   bson_destroy(&b);
+}
+
+
+static void
+test_patch_malformed (void)
+{
+   bson_t doc;
+   bson_t patch;
+   bson_t child;
+   bson_t child2;
+   bson_t result;
+
+   bson_init(&doc);
+   bson_append_int32(&doc, "a", -1, 1);
+   bson_append_array_begin(&doc, "arr", -1, &child);
+   bson_append_int32(&child, "0", -1, 0);
+   bson_append_array_end(&doc, &child);
+
+   bson_init(&patch);
+   bson_append_document_begin(&patch, "$bogus", -1, &child);
+   bson_append_document_end(&patch, &child);
+   assert(!bson_patch_apply(&doc, &patch, &result));
+   bson_destroy(&result);
+
+   bson_reinit(&patch);
+   bson_append_int32(&patch, "$set", -1, 1);
+   assert(!bson_patch_apply(&doc, &patch, &result));
+   bson_destroy(&result);
+
+   bson_reinit(&patch);
+   bson_append_document_begin(&patch, "$unset", -1, &child);
+   bson_append_bool(&child, "missing", -1, TRUE);
+   bson_append_document_end(&patch, &child);
+   assert(!bson_patch_apply(&doc, &patch, &result));
+   bson_destroy(&result);
+
+   bson_reinit(&patch);
+   bson_append_document_begin(&patch, "$diff", -1, &child);
+   bson_append_document_begin(&child, "a", -1, &child2);
+   bson_append_document_end(&child, &child2);
+   bson_append_document_end(&patch, &child);
+   assert(!bson_patch_apply(&doc, &patch, &result));
+   bson_destroy(&result);
+
+   bson_reinit(&patch);
+   bson_append_document_begin(&patch, "$splice", -1, &child);
+   bson_append_document_begin(&child, "arr", -1, &child2);
+   bson_append_int32(&child2, "p", -1, 1);
+   bson_append_int32(&child2, "d", -1, 1);
+   bson_append_array(&child2, "i", -1, &doc);
+   bson_append_document_end(&child, &child2);
+   bson_append_document_end(&patch, &child);
+   assert(!bson_patch_apply(&doc, &patch, &result));
+   bson_destroy(&result);
+
+   bson_destroy(&patch);
+   bson_destroy(&doc);
+}
+
+
+static bson_uint32_t gSeed = 1;
+
+
+static bson_uint32_t
+rand_next (void)
+{
+   gSeed = (gSeed * 1103515245U) + 12345U;
+   return gSeed >> 8;
+}
+
+
+static void
+append_random_value (bson_t     *b,
+                     const char *key,
+                     int         depth)
+{
+   bson_t child;
+   int n;
+   int i;
+
+   switch (rand_next() % (depth ? 3 : 5)) {
+   case 0:
+      bson_append_int32(b, key, -1, rand_next() % 4);
+      break;
+   case 1:
+      bson_append_utf8(b, key, -1, "value", 1 + (rand_next() % 5));
+      break;
+   case 2:
+      bson_append_null(b, key, -1);
+      break;
+   case 3:
+      bson_append_document_begin(b, key, -1, &child);
+      n = rand_next() % 12;
+      for (i = 0; i < n; i++) {
+         append_random_value(&child, key_for(rand_next() % 16), depth + 1);
+      }
+      bson_append_document_end(b, &child);
+      break;
+   case 4:
+   default:
+      bson_append_array_begin(b, key, -1, &child);
+      n = rand_next() % 20;
+      for (i = 0; i < n; i++) {
+         bson_append_int32(&child, key_for(i), -1, rand_next() % 3);
+      }
+      bson_append_array_end(b, &child);
+      break;
+   }
+}
+
+
+static void
+mutate (const bson_t *from,
+        bson_t       *to)
+{
+   bson_iter_t iter;
+
+   bson_init(to);
+
+   assert(bson_iter_init(&iter, from));
+   while (bson_iter_next(&iter)) {
+      switch (rand_next() % 8) {
+      case 0:
+         break;
+      case 1:
+         append_random_value(to, bson_iter_key(&iter), 0);
+         break;
+      case 2:
+         append_random_value(to, key_for(100 + (rand_next() % 10)), 0);
+         bson_append_iter(to, NULL, 0, &iter);
+         break;
+      default:
+         bson_append_iter(to, NULL, 0, &iter);
+         break;
+      }
+   }
+
+   if (!(rand_next() % 4)) {
+      append_random_value(to, key_for(200), 0);
+   }
+}
+
+
+static void
+test_diff_random (void)
+{
+   bson_t from;
+   bson_t to;
+   bson_t patch;
+   int n;
+   int i;
+   int j;
+
+   for (i = 0; i < 10000; i++) {
+      bson_init(&from);
+      n = rand_next() % 16;
+      for (j = 0; j < n; j++) {
+         append_random_value(&from, key_for(j), 0);
+      }
+
+      mutate(&from, &to);
+      assert_round_trip(&from, &to, &patch);
+
+      bson_destroy(&patch);
+      bson_destroy(&from);
+      bson_destroy(&to);
+   }
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   run_test("/bson/diff/identical", test_diff_identical);
+   run_test("/bson/diff/set_unset", test_diff_set_unset);
+   run_test("/bson/diff/moved", test_diff_moved);
+   run_test("/bson/diff/nested", test_diff_nested);
+   run_test("/bson/diff/array", test_diff_array);
+   run_test("/bson/diff/duplicate_keys", test_diff_duplicate_keys);
+   run_test("/bson/patch/malformed", test_patch_malformed);
+   run_test("/bson/diff/random", test_diff_random);
+
+   return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+
+#include "bson-tests.h"
+
+
+static void
+test_hash_data (void)
+{
+   bson_uint8_t buf[100];
+   int i;
+
+   for (i = 0; i < 100; i++) {
+      buf[i] = i;
+   }
+
+   /*
+    * Known XXH64 values.
+    */
+   assert(bson_hash_data("", 0, 0) == 0xEF46DB3751D8E999ULL);
+   assert(bson_hash_data("", 0, 1) == 0xD5AFBA1336A3BE4BULL);
+   assert(bson_hash_data("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+   assert(bson_hash_data("abc", 3, 1) == 0xBEA9CA8199328908ULL);
+   assert(bson_hash_data(buf, 100, 0) == 0x6AC1E58032166597ULL);
+   assert(bson_hash_data(buf, 100, 1) == 0x3D19A3A2098A7023ULL);
+}
+
+
+static void
+assert_hash (const bson_t *b)
+{
+   assert(bson_hash(b) ==
+          bson_hash_data(bson_get_data(b) + 4, b->len - 5, 0));
+}
+
+
+static void
+test_hash_running (void)
+{
+   bson_t hashed;
+   bson_t plain;
+   bson_t child;
+   bson_t child2;
+   bson_t small;
+   bson_oid_t oid;
+   char key[12];
+   int i;
+
+   bson_init_hashed(&hashed);
+   bson_init(&plain);
+
+   assert_hash(&hashed);
+   assert(bson_hash(&hashed) == bson_hash(&plain));
+
+   bson_oid_init_from_string(&oid, "1234567890abcdef12345678");
+
+   bson_init(&small);
+   bson_append_utf8(&small, "hello", -1, "world", -1);
+
+   for (i = 0; i < 200; i++) {
+      snprintf(key, sizeof key, "%d", i);
+
+      switch (i % 5) {
+      case 0:
+         assert(bson_append_int32(&hashed, key, -1, i));
+         assert(bson_append_int32(&plain, key, -1, i));
+         break;
+      case 1:
+         assert(bson_append_utf8(&hashed, key, -1, "some string", i % 11));
+         assert(bson_append_utf8(&plain, key, -1, "some string", i % 11));
+         break;
+      case 2:
+         assert(bson_append_document_begin(&hashed, key, -1, &child));
+         assert(bson_append_oid(&child, "_id", -1, &oid));
+         assert(bson_append_array_begin(&child, "a", -1, &child2));
+         assert(bson_append_double(&child2, "0", -1, 1.5));
+         assert(bson_append_array_end(&child, &child2));
+         assert(bson_append_document_end(&hashed, &child));
+
+         assert(bson_append_document_begin(&plain, key, -1, &child));
+         assert(bson_append_oid(&child, "_id", -1, &oid));
+         assert(bson_append_array_begin(&child, "a", -1, &child2));
+         assert(bson_append_double(&child2, "0", -1, 1.5));
+         assert(bson_append_array_end(&child, &child2));
+         assert(bson_append_document_end(&plain, &child));
+         break;
+      case 3:
+         assert(bson_append_document(&hashed, key, -1, &small));
+         assert(bson_append_document(&plain, key, -1, &small));
+         break;
+      case 4:
+      default:
+         assert(bson_append_null(&hashed, key, -1));
+         assert(bson_append_null(&plain, key, -1));
+         break;
+      }
+
+      assert_cmpint(hashed.len, ==, plain.len);
+      assert_hash(&hashed);
+      assert(bson_hash(&hashed) == bson_hash(&plain));
+   }
+
+   bson_destroy(&hashed);
+   bson_destroy(&plain);
+   bson_destroy(&small);
+}
+
+
+static void
+test_hash_differs (void)
+{
+   bson_t a;
+   bson_t b;
+
+   bson_init(&a);
+   bson_append_int32(&a, "a", -1, 1);
+   bson_append_int32(&a, "b", -1, 2);
+
+   bson_init(&b);
+   bson_append_int32(&b, "b", -1, 2);
+   bson_append_int32(&b, "a", -1, 1);
+
+   assert(bson_hash(&a) != bson_hash(&b));
+
+   bson_destroy(&a);
+   bson_destroy(&b);
+}
+
+
+static void
+build_overwrite (bson_t       *b,
+                 bson_int64_t  x,
+                 bson_int32_t  i32,
+                 double        d,
+                 bson_bool_t   v)
+{
+   bson_t child;
+
+   bson_append_int32(b, "b", -1, i32);
+   bson_append_double(b, "c", -1, d);
+   bson_append_bool(b, "d", -1, v);
+   bson_append_utf8(b, "e", -1, "a string to push \"a\" further along", -1);
+   bson_append_document_begin(b, "a", -1, &child);
+   bson_append_int64(&child, "x", -1, x);
+   bson_append_utf8(&child, "s", -1, "so that \"a\" straddles a stripe", -1);
+   bson_append_document_end(b, &child);
+}
+
+
+static void
+test_hash_overwrite (void)
+{
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_t hashed;
+   bson_t plain;
+   bson_t value;
+
+   bson_init_hashed(&hashed);
+   build_overwrite(&hashed, 1, 2, 3.0, TRUE);
+   bson_hash(&hashed);
+
+   assert(bson_iter_init(&iter, &hashed));
+   assert(bson_iter_find(&iter, "b"));
+   bson_iter_overwrite_int32(&iter, 20);
+   assert(bson_iter_find(&iter, "c"));
+   bson_iter_overwrite_double(&iter, 30.0);
+   assert(bson_iter_find(&iter, "d"));
+   bson_iter_overwrite_bool(&iter, FALSE);
+   assert(bson_iter_find_descendant(&iter, "a.x", &child));
+   bson_iter_overwrite_int64(&child, 10);
+
+   bson_init(&plain);
+   build_overwrite(&plain, 10, 20, 30.0, FALSE);
+
+   assert(bson_equal(&hashed, &plain));
+   assert(bson_hash(&hashed) == bson_hash(&plain));
+   assert_hash(&hashed);
+
+   /*
+    * Appending to "a" writes past the folded prefix, but the length of "a"
+    * lies within it.
+    */
+   bson_init(&value);
+   bson_append_int32(&value, "y", -1, 1);
+   assert(bson_iter_init_find(&iter, &value, "y"));
+   assert(bson_insert_iter(&hashed, "a", "y", -1, &iter));
+   assert(bson_insert_iter(&plain, "a", "y", -1, &iter));
+
+   assert(bson_equal(&hashed, &plain));
+   assert(bson_hash(&hashed) == bson_hash(&plain));
+   assert_hash(&hashed);
+
+   bson_destroy(&hashed);
+   bson_destroy(&plain);
+   bson_destroy(&value);
+}
+
+
+static void
+test_iter_hash (void)
+{
+   bson_iter_t iter;
+   bson_uint64_t h[10];
+   bson_t b;
+   int i = 0;
+
+   bson_init(&b);
+   bson_append_int32(&b, "a", -1, 1);
+   bson_append_int32(&b, "b", -1, 1);
+   bson_append_int64(&b, "c", -1, 1);
+   bson_append_utf8(&b, "d", -1, "hello", -1);
+   bson_append_utf8(&b, "e", -1, "hello", -1);
+   bson_append_null(&b, "f", -1);
+   bson_append_null(&b, "g", -1);
+   bson_append_undefined(&b, "h", -1);
+   bson_append_minkey(&b, "i", -1);
+   bson_append_maxkey(&b, "j", -1);
+
+   assert(bson_iter_init(&iter, &b));
+   while (bson_iter_next(&iter)) {
+      h[i++] = bson_iter_hash(&iter);
+   }
+
+   assert_cmpint(i, ==, 10);
+   assert(h[0] == h[1]);
+   assert(h[1] != h[2]);
+   assert(h[2] != h[3]);
+   assert(h[3] == h[4]);
+
+   /*
+    * Values without data differ by their type only.
+    */
+   assert(h[5] == h[6]);
+   assert(h[6] != h[7]);
+   assert(h[7] != h[8]);
+   assert(h[8] != h[9]);
+   assert(h[9] != h[5]);
+   assert(h[5] != 0);
+
+   bson_destroy(&b);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   run_test("/bson/hash/data", test_hash_data);
+   run_test("/bson/hash/running", test_hash_running);
+   run_test("/bson/hash/differs", test_hash_differs);
+   run_test("/bson/hash/overwrite", test_hash_overwrite);
+   run_test("/bson/hash/iter", test_iter_hash);
+
+   return 0;
+}
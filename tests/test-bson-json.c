@@ -3,6 +3,7 @@
 #include <bson/bson-string.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "bson-tests.h"
@@ -177,6 +178,60 @@ test_bson_as_json_stack_overflow (void)
 }
 
 
+/*
+ * A document of 100 numbers and strings spread over nested documents and
+ * arrays.
+ */
+static bson_t *
+build_nested (void)
+{
+   bson_t *b;
+   bson_t doc;
+   bson_t arr;
+   char key[16];
+   int i;
+   int j;
+
+   b = bson_new();
+   for (i = 0; i < 10; i++) {
+      snprintf(key, sizeof key, "doc%d", i);
+      assert(bson_append_document_begin(b, key, -1, &doc));
+      assert(bson_append_int32(&doc, "int32", -1, i));
+      assert(bson_append_double(&doc, "double", -1, i * 0.5));
+      assert(bson_append_utf8(&doc, "utf8", -1, "value", -1));
+      assert(bson_append_array_begin(&doc, "array", -1, &arr));
+      for (j = 0; j < 7; j++) {
+         snprintf(key, sizeof key, "%d", j);
+         assert(bson_append_int64(&arr, key, -1, j));
+      }
+      assert(bson_append_array_end(&doc, &arr));
+      assert(bson_append_document_end(b, &doc));
+   }
+
+   return b;
+}
+
+
+static void
+test_bson_as_json_nested_validated (void)
+{
+   char *expected;
+   char *str;
+   bson_t *b;
+
+   b = build_nested();
+   expected = bson_as_json(b, NULL);
+
+   bson_mark_validated(b);
+   str = bson_as_json(b, NULL);
+   assert_cmpstr(str, expected);
+
+   bson_free(str);
+   bson_free(expected);
+   bson_destroy(b);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -187,6 +242,8 @@ main (int   argc,
    run_test("/bson/as_json/int64", test_bson_as_json_int64);
    run_test("/bson/as_json/double", test_bson_as_json_double);
    run_test("/bson/as_json/utf8", test_bson_as_json_utf8);
+   run_test("/bson/as_json/nested_validated",
+            test_bson_as_json_nested_validated);
    run_test("/bson/as_json/stack_overflow", test_bson_as_json_stack_overflow);
 
    return 0;
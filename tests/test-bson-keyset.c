@@ -0,0 +1,275 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+
+#include "bson-tests.h"
+
+
+static const char *gExcludes[] = {
+   "field3", "field17", "field18", "field31", "field49", "missing",
+};
+
+
+static void
+test_keyset_basic (void)
+{
+   static const char *keys[] = { "a", "bb", "", "a", "bb" };
+   static const char *long1 =
+      "a key that is much longer than sixty-three bytes, to share a bit";
+   static const char *long2 =
+      "a key that is much longer than sixty-three bytes, to share a bot";
+   bson_keyset_t *keyset;
+
+   keyset = bson_keyset_new_from_array(keys, 5);
+   assert_cmpint(bson_keyset_count(keyset), ==, 3);
+   assert(bson_keyset_contains(keyset, "a", -1));
+   assert(bson_keyset_contains(keyset, "bb", 2));
+   assert(bson_keyset_contains(keyset, "bbc", 2));
+   assert(bson_keyset_contains(keyset, "", -1));
+   assert(!bson_keyset_contains(keyset, "b", -1));
+   assert(!bson_keyset_contains(keyset, "bb", 1));
+   assert(!bson_keyset_contains(keyset, "ab", -1));
+   bson_keyset_destroy(keyset);
+
+   keyset = bson_keyset_new(long1, "x", NULL);
+   assert_cmpint(bson_keyset_count(keyset), ==, 2);
+   assert(bson_keyset_contains(keyset, long1, -1));
+   assert(!bson_keyset_contains(keyset, long2, -1));
+   assert(!bson_keyset_contains(keyset, "y", -1));
+   bson_keyset_destroy(keyset);
+
+   keyset = bson_keyset_new_from_array(NULL, 0);
+   assert_cmpint(bson_keyset_count(keyset), ==, 0);
+   assert(!bson_keyset_contains(keyset, "", -1));
+   bson_keyset_destroy(keyset);
+}
+
+
+static void
+test_keyset_many (void)
+{
+   bson_keyset_t *keyset;
+   const char **keys;
+   char **strs;
+   char str[32];
+   int i;
+
+   strs = bson_malloc(1000 * sizeof *strs);
+   keys = bson_malloc(1000 * sizeof *keys);
+
+   for (i = 0; i < 1000; i++) {
+      snprintf(str, sizeof str, "key%d", i * 2);
+      keys[i] = strs[i] = bson_strdup(str);
+   }
+
+   keyset = bson_keyset_new_from_array(keys, 1000);
+   assert_cmpint(bson_keyset_count(keyset), ==, 1000);
+
+   for (i = 0; i < 2000; i++) {
+      snprintf(str, sizeof str, "key%d", i);
+      assert(bson_keyset_contains(keyset, str, -1) == !(i % 2));
+   }
+
+   bson_keyset_destroy(keyset);
+
+   for (i = 0; i < 1000; i++) {
+      bson_free(strs[i]);
+   }
+
+   bson_free(strs);
+   bson_free(keys);
+}
+
+
+static bson_t *
+build_doc (void)
+{
+   bson_t *b;
+   bson_t child;
+   char key[16];
+   int i;
+
+   b = bson_new();
+
+   for (i = 0; i < 50; i++) {
+      snprintf(key, sizeof key, "field%d", i);
+
+      switch (i % 6) {
+      case 0:
+         bson_append_int32(b, key, -1, i);
+         break;
+      case 1:
+         bson_append_utf8(b, key, -1, "a typical string value", -1);
+         break;
+      case 2:
+         bson_append_document_begin(b, key, -1, &child);
+         bson_append_int32(&child, "field3", -1, i);
+         bson_append_document_end(b, &child);
+         break;
+      case 3:
+         bson_append_null(b, key, -1);
+         break;
+      case 4:
+         bson_append_minkey(b, key, -1);
+         break;
+      case 5:
+      default:
+         bson_append_maxkey(b, key, -1);
+         break;
+      }
+   }
+
+   return b;
+}
+
+
+/*
+ * The element by element copy that the keyset copiers replace.
+ */
+static void
+copy_naive (const bson_t *src,
+            bson_t       *dst,
+            const char  **keys,
+            size_t        n_keys,
+            bson_bool_t   include)
+{
+   bson_iter_t iter;
+   bson_bool_t found;
+   size_t i;
+
+   bson_init(dst);
+
+   assert(bson_iter_init(&iter, src));
+
+   while (bson_iter_next(&iter)) {
+      found = FALSE;
+
+      for (i = 0; i < n_keys; i++) {
+         if (!strcmp(keys[i], bson_iter_key(&iter))) {
+            found = TRUE;
+            break;
+         }
+      }
+
+      if (found == include) {
+         assert(bson_append_iter(dst, NULL, 0, &iter));
+      }
+   }
+}
+
+
+static void
+test_copy_to_keyset (void)
+{
+   static const char *none[] = { "nothing" };
+   static const char *all[] = {
+      "field0", "field1", "field2", "field3", "field4", "field5", "field6",
+      "field7", "field8", "field9", "field10", "field11", "field12",
+      "field13", "field14", "field15", "field16", "field17", "field18",
+      "field19", "field20", "field21", "field22", "field23", "field24",
+      "field25", "field26", "field27", "field28", "field29", "field30",
+      "field31", "field32", "field33", "field34", "field35", "field36",
+      "field37", "field38", "field39", "field40", "field41", "field42",
+      "field43", "field44", "field45", "field46", "field47", "field48",
+      "field49",
+   };
+   struct {
+      const char **keys;
+      size_t       n_keys;
+   } cases[] = {
+      { gExcludes, 6 },
+      { none, 1 },
+      { all, 50 },
+      { all + 1, 1 },
+      { all + 10, 20 },
+   };
+   bson_keyset_t *keyset;
+   bson_t expected;
+   bson_t *b;
+   bson_t c;
+   int i;
+
+   b = build_doc();
+
+   for (i = 0; i < (int)(sizeof cases / sizeof cases[0]); i++) {
+      keyset = bson_keyset_new_from_array(cases[i].keys, cases[i].n_keys);
+
+      copy_naive(b, &expected, cases[i].keys, cases[i].n_keys, FALSE);
+      bson_copy_to_excluding_keyset(b, &c, keyset);
+      assert_cmpint(c.len, ==, expected.len);
+      assert(bson_equal(&c, &expected));
+      bson_destroy(&c);
+      bson_destroy(&expected);
+
+      copy_naive(b, &expected, cases[i].keys, cases[i].n_keys, TRUE);
+      bson_copy_to_including_keyset(b, &c, keyset);
+      assert_cmpint(c.len, ==, expected.len);
+      assert(bson_equal(&c, &expected));
+      bson_destroy(&c);
+      bson_destroy(&expected);
+
+      bson_keyset_destroy(keyset);
+   }
+
+   bson_destroy(b);
+}
+
+
+static void
+test_copy_to_including (void)
+{
+   bson_iter_t iter;
+   bson_t *b;
+   bson_t c;
+
+   b = build_doc();
+
+   bson_copy_to_including(b, &c, "field5", "field1", "missing", NULL);
+   assert_cmpint(bson_count_keys(&c), ==, 2);
+   assert(bson_iter_init(&iter, &c));
+   assert(bson_iter_next(&iter));
+   assert_cmpstr(bson_iter_key(&iter), "field1");
+   assert(bson_iter_next(&iter));
+   assert_cmpstr(bson_iter_key(&iter), "field5");
+   assert(!bson_iter_next(&iter));
+   bson_destroy(&c);
+
+   bson_copy_to_excluding(b, &c, "field5", "field1", "missing", NULL);
+   assert_cmpint(bson_count_keys(&c), ==, 48);
+   assert(bson_iter_init(&iter, &c));
+   while (bson_iter_next(&iter)) {
+      assert(strcmp(bson_iter_key(&iter), "field1"));
+      assert(strcmp(bson_iter_key(&iter), "field5"));
+   }
+   bson_destroy(&c);
+
+   bson_destroy(b);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   run_test("/bson/keyset/basic", test_keyset_basic);
+   run_test("/bson/keyset/many", test_keyset_many);
+   run_test("/bson/keyset/copy_to", test_copy_to_keyset);
+   run_test("/bson/keyset/copy_to_including", test_copy_to_including);
+
+   return 0;
+}
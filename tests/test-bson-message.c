@@ -0,0 +1,835 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <bson/bson-thread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bson-tests.h"
+
+
+/*
+ * A stand-in for the server: reads frames from a socket until EOF and
+ * checks them.
+ */
+typedef struct
+{
+   int                    fd;
+   bson_message_opcode_t  opcode;
+   const char            *name;
+   size_t                 max_message_size;
+   bson_uint32_t          max_batch_size;
+   bson_int32_t           request_id;
+   size_t                 n_frames;
+   int                    n_docs;
+} server_t;
+
+
+static bson_bool_t
+read_all (int           fd,
+          bson_uint8_t *buf,
+          size_t        len)
+{
+   ssize_t r;
+
+   while (len) {
+      r = read(fd, buf, len);
+      if (r <= 0) {
+         return FALSE;
+      }
+      buf += r;
+      len -= r;
+   }
+
+   return TRUE;
+}
+
+
+static bson_int32_t
+get_int32 (const bson_uint8_t *p)
+{
+   bson_uint32_t v;
+
+   memcpy(&v, p, 4);
+   return (bson_int32_t)BSON_UINT32_FROM_LE(v);
+}
+
+
+/*
+ * Checks a run of documents whose "i" fields continue from server->n_docs.
+ */
+static bson_uint32_t
+check_docs (server_t           *server,
+            const bson_uint8_t *data,
+            size_t              len)
+{
+   bson_reader_t *reader;
+   const bson_t *b;
+   bson_bool_t eof = FALSE;
+   bson_uint32_t n = 0;
+   bson_iter_t iter;
+
+   reader = bson_reader_new_from_data(data, len);
+   while ((b = bson_reader_read(reader, &eof))) {
+      assert(bson_iter_init_find(&iter, b, "i"));
+      assert(bson_iter_int32(&iter) == server->n_docs);
+      server->n_docs++;
+      n++;
+   }
+   assert(eof);
+   bson_reader_destroy(reader);
+
+   return n;
+}
+
+
+static void *
+server_thread (void *data)
+{
+   server_t *server = data;
+   bson_uint8_t header[16];
+   bson_uint8_t *frame;
+   bson_uint8_t *p;
+   bson_uint32_t n;
+   bson_int32_t len;
+   bson_int32_t seq_len;
+   bson_int32_t body_len;
+
+   while (read_all(server->fd, header, sizeof header)) {
+      len = get_int32(header);
+      assert(len > 16);
+      assert((size_t)len <= server->max_message_size);
+      assert((bson_uint32_t)get_int32(header + 4) ==
+             (bson_uint32_t)(server->request_id + server->n_frames));
+      assert(get_int32(header + 8) == 0);
+      assert(get_int32(header + 12) == (bson_int32_t)server->opcode);
+
+      frame = bson_malloc(len);
+      memcpy(frame, header, 16);
+      assert(read_all(server->fd, frame + 16, len - 16));
+      p = frame + 20;
+
+      if (server->opcode == BSON_MESSAGE_OP_INSERT) {
+         assert(!strcmp((const char *)p, server->name));
+         p += strlen(server->name) + 1;
+         n = check_docs(server, p, len - (p - frame));
+      } else {
+         assert(*p++ == 0);
+         body_len = get_int32(p);
+         p += body_len;
+         assert(*p++ == 1);
+         seq_len = get_int32(p);
+         assert((p - frame) + seq_len == len);
+         p += 4;
+         assert(!strcmp((const char *)p, server->name));
+         p += strlen(server->name) + 1;
+         n = check_docs(server, p, len - (p - frame));
+      }
+
+      assert(n);
+      assert(!server->max_batch_size || (n <= server->max_batch_size));
+      server->n_frames++;
+      bson_free(frame);
+   }
+
+   return NULL;
+}
+
+
+static void
+send_all (int           fd,
+          struct iovec *iov,
+          size_t        n_iov)
+{
+   ssize_t r;
+
+   while (n_iov) {
+      r = writev(fd, iov, (int)MIN(n_iov, 64));
+      assert(r > 0);
+      while (n_iov && ((size_t)r >= iov->iov_len)) {
+         r -= iov->iov_len;
+         iov++;
+         n_iov--;
+      }
+      if (n_iov) {
+         iov->iov_base = (char *)iov->iov_base + r;
+         iov->iov_len -= r;
+      }
+   }
+}
+
+
+/*
+ * Sends the frames of @message to a stand-in server and checks that it
+ * receives @n_docs documents in @n_frames frames.
+ */
+static void
+send_to_server (bson_message_t        *message,
+                bson_message_opcode_t  opcode,
+                const char            *name,
+                size_t                 max_message_size,
+                bson_uint32_t          max_batch_size,
+                bson_int32_t           request_id,
+                int                    n_docs)
+{
+   bson_thread_t thread;
+   struct iovec *iov;
+   server_t server;
+   size_t n_frames;
+   int fds[2];
+
+   assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+   memset(&server, 0, sizeof server);
+   server.fd = fds[1];
+   server.opcode = opcode;
+   server.name = name;
+   server.max_message_size = max_message_size;
+   server.max_batch_size = max_batch_size;
+   server.request_id = request_id;
+   bson_thread_create(&thread, NULL, server_thread, &server);
+
+   n_frames = bson_message_get_n_frames(message);
+   iov = bson_malloc(n_frames * sizeof *iov);
+   assert(bson_message_get_iovecs(message, iov, n_frames) == n_frames);
+   send_all(fds[0], iov, n_frames);
+   bson_free(iov);
+   shutdown(fds[0], SHUT_WR);
+
+   bson_thread_join(thread, NULL);
+   close(fds[0]);
+   close(fds[1]);
+
+   assert(server.n_frames == n_frames);
+   assert(server.n_docs == n_docs);
+}
+
+
+static void
+append_doc (bson_t *b,
+            int     i)
+{
+   static const char str[] = "0123456789012345678901234567890123456789";
+
+   assert(bson_append_int32(b, "i", -1, i));
+   assert(bson_append_utf8(b, "s", -1, str, i % 40));
+}
+
+
+static void
+test_message_insert (void)
+{
+   bson_message_t *message;
+   bson_t b;
+   int i;
+
+   message = bson_message_new(BSON_MESSAGE_OP_INSERT, 0, "db.collection",
+                              NULL, 4096, 0);
+   assert(message);
+   bson_message_set_request_id(message, 100);
+   assert(!bson_message_get_n_frames(message));
+
+   for (i = 0; i < 1000; i++) {
+      bson_init(&b);
+      append_doc(&b, i);
+      assert(bson_message_append(message, &b));
+      bson_destroy(&b);
+   }
+
+   assert(bson_message_get_n_frames(message) > 5);
+   send_to_server(message, BSON_MESSAGE_OP_INSERT, "db.collection", 4096, 0,
+                  100, 1000);
+
+   bson_message_destroy(message);
+}
+
+
+static void
+test_message_msg (void)
+{
+   bson_message_t *message;
+   bson_t *b;
+   bson_t body;
+   int i;
+
+   bson_init(&body);
+   assert(bson_append_utf8(&body, "insert", -1, "collection", -1));
+   assert(bson_append_utf8(&body, "$db", -1, "db", -1));
+
+   message = bson_message_new(BSON_MESSAGE_OP_MSG, 0, "documents", &body,
+                              1024 * 1024, 100);
+   assert(message);
+
+   for (i = 0; i < 1000; i++) {
+      bson_message_begin_document(message, &b);
+      append_doc(b, i);
+      assert(bson_message_end_document(message));
+   }
+
+   assert(bson_message_get_n_frames(message) == 10);
+   send_to_server(message, BSON_MESSAGE_OP_MSG, "documents", 1024 * 1024,
+                  100, 0, 1000);
+
+   bson_message_destroy(message);
+   bson_destroy(&body);
+}
+
+
+static void
+test_message_in_place (void)
+{
+   bson_message_t *message;
+   bson_t body;
+   bson_t *b;
+   char big[600];
+   int i;
+
+   bson_init(&body);
+   assert(bson_append_int32(&body, "insert", -1, 1));
+
+   memset(big, 'x', sizeof big - 1);
+   big[sizeof big - 1] = '\0';
+
+   message = bson_message_new(BSON_MESSAGE_OP_MSG, 0, "documents", &body,
+                              512, 0);
+   assert(message);
+
+   /*
+    * Mixes copied and in-place documents with rollbacks and documents too
+    * large for any frame, which are dropped without a trace.
+    */
+   for (i = 0; i < 300; i++) {
+      bson_message_begin_document(message, &b);
+      assert(bson_append_utf8(b, "big", -1, big, -1));
+      assert(!bson_message_end_document(message));
+
+      bson_message_begin_document(message, &b);
+      append_doc(b, -1);
+      bson_message_rollback_document(message);
+
+      if ((i % 2)) {
+         bson_message_begin_document(message, &b);
+         append_doc(b, i);
+         assert(bson_message_end_document(message));
+      } else {
+         bson_t doc;
+
+         bson_init(&doc);
+         append_doc(&doc, i);
+         assert(bson_message_append(message, &doc));
+         bson_destroy(&doc);
+      }
+   }
+
+   send_to_server(message, BSON_MESSAGE_OP_MSG, "documents", 512, 0, 0, 300);
+
+   bson_message_destroy(message);
+   bson_destroy(&body);
+}
+
+
+static void
+test_message_reset (void)
+{
+   bson_message_t *message;
+   bson_t b;
+   int i;
+
+   message = bson_message_new(BSON_MESSAGE_OP_INSERT, 0, "db.c", NULL, 1024,
+                               10);
+
+   for (i = 0; i < 25; i++) {
+      bson_init(&b);
+      append_doc(&b, i);
+      assert(bson_message_append(message, &b));
+      bson_destroy(&b);
+   }
+   assert(bson_message_get_n_frames(message) == 3);
+   send_to_server(message, BSON_MESSAGE_OP_INSERT, "db.c", 1024, 10, 0, 25);
+
+   /* The next batch continues with request id 3. */
+   bson_message_reset(message);
+   assert(!bson_message_get_n_frames(message));
+   for (i = 0; i < 15; i++) {
+      bson_init(&b);
+      append_doc(&b, i);
+      assert(bson_message_append(message, &b));
+      bson_destroy(&b);
+   }
+   assert(bson_message_get_n_frames(message) == 2);
+   send_to_server(message, BSON_MESSAGE_OP_INSERT, "db.c", 1024, 10, 3, 15);
+
+   /* Request ids wrap around. */
+   bson_message_reset(message);
+   bson_message_set_request_id(message, INT32_MAX - 1);
+   for (i = 0; i < 25; i++) {
+      bson_init(&b);
+      append_doc(&b, i);
+      assert(bson_message_append(message, &b));
+      bson_destroy(&b);
+   }
+   send_to_server(message, BSON_MESSAGE_OP_INSERT, "db.c", 1024, 10,
+                  INT32_MAX - 1, 25);
+
+   bson_message_reset(message);
+   bson_init(&b);
+   append_doc(&b, 0);
+   assert(bson_message_append(message, &b));
+   bson_destroy(&b);
+   send_to_server(message, BSON_MESSAGE_OP_INSERT, "db.c", 1024, 10,
+                  INT32_MIN + 1, 1);
+
+   bson_message_destroy(message);
+}
+
+
+static void
+test_message_errors (void)
+{
+   bson_message_t *message;
+   bson_t b;
+
+   bson_init(&b);
+
+   assert(!bson_message_new(BSON_MESSAGE_OP_INSERT, 0, "db.c", NULL, 24, 0));
+   assert(!bson_message_new(BSON_MESSAGE_OP_MSG, 0, "documents", &b,
+                            (size_t)INT32_MAX + 1, 0));
+   assert(!bson_message_new((bson_message_opcode_t)1, 0, "db.c", NULL,
+                            1024, 0));
+
+   message = bson_message_new(BSON_MESSAGE_OP_INSERT, 0, "db.c", NULL, 30, 0);
+   assert(message);
+   assert(bson_message_append(message, &b));
+   assert(bson_append_int32(&b, "a", -1, 1));
+   assert(!bson_message_append(message, &b));
+   assert(bson_message_get_n_frames(message) == 1);
+   bson_message_destroy(message);
+
+   bson_destroy(&b);
+}
+
+
+/*
+ * A frame built by hand, for the parser tests.
+ */
+typedef struct
+{
+   bson_uint8_t  data[2048];
+   bson_uint32_t len;
+} frame_t;
+
+
+static void
+frame_put (frame_t    *frame,
+           const void *data,
+           size_t      len)
+{
+   assert(frame->len + len <= sizeof frame->data);
+   memcpy(frame->data + frame->len, data, len);
+   frame->len += len;
+}
+
+
+static void
+frame_put_int32 (frame_t       *frame,
+                 bson_uint32_t  v)
+{
+   v = BSON_UINT32_TO_LE(v);
+   frame_put(frame, &v, 4);
+}
+
+
+static void
+frame_put_doc (frame_t *frame,
+               int      i)
+{
+   bson_t b;
+
+   bson_init(&b);
+   append_doc(&b, i);
+   frame_put(frame, bson_get_data(&b), b.len);
+   bson_destroy(&b);
+}
+
+
+static void
+frame_init (frame_t               *frame,
+            bson_message_opcode_t  opcode,
+            bson_uint32_t          flags)
+{
+   memset(frame, 0, sizeof *frame);
+   frame_put_int32(frame, 0);
+   frame_put_int32(frame, 7);
+   frame_put_int32(frame, 3);
+   frame_put_int32(frame, opcode);
+   frame_put_int32(frame, flags);
+}
+
+
+static void
+frame_finish (frame_t *frame)
+{
+   bson_uint32_t len = BSON_UINT32_TO_LE(frame->len);
+
+   memcpy(frame->data, &len, 4);
+}
+
+
+/*
+ * A body and two document sequences with a checksum: "a" holds documents
+ * 0 and 1, "b" holds none and "c" holds 2.
+ */
+static void
+build_msg_frame (frame_t *frame)
+{
+   bson_uint32_t start;
+   bson_uint32_t size;
+
+   frame_init(frame, BSON_MESSAGE_OP_MSG, BSON_MESSAGE_MSG_CHECKSUM_PRESENT);
+
+   frame_put(frame, "\0", 1);
+   frame_put_doc(frame, -1);
+
+   frame_put(frame, "\1", 1);
+   start = frame->len;
+   frame_put_int32(frame, 0);
+   frame_put(frame, "a", 2);
+   frame_put_doc(frame, 0);
+   frame_put_doc(frame, 1);
+   size = BSON_UINT32_TO_LE(frame->len - start);
+   memcpy(frame->data + start, &size, 4);
+
+   frame_put(frame, "\1", 1);
+   frame_put_int32(frame, 6);
+   frame_put(frame, "b", 2);
+
+   frame_put(frame, "\1", 1);
+   start = frame->len;
+   frame_put_int32(frame, 0);
+   frame_put(frame, "c", 2);
+   frame_put_doc(frame, 2);
+   size = BSON_UINT32_TO_LE(frame->len - start);
+   memcpy(frame->data + start, &size, 4);
+
+   frame_put_int32(frame, 0xdeadbeef);
+   frame_finish(frame);
+}
+
+
+static int
+get_i (const bson_t *b)
+{
+   bson_iter_t iter;
+
+   assert(bson_iter_init_find(&iter, b, "i"));
+   return bson_iter_int32(&iter);
+}
+
+
+static void
+test_message_parse_msg (void)
+{
+   bson_message_parser_t parser;
+   const char *identifier;
+   bson_bool_t incomplete;
+   frame_t frame;
+   bson_t b;
+
+   build_msg_frame(&frame);
+
+   assert(bson_message_parser_init(&parser, frame.data, frame.len,
+                                   &incomplete));
+   assert(!incomplete);
+   assert(parser.length == frame.len);
+   assert(parser.request_id == 7);
+   assert(parser.response_to == 3);
+   assert(parser.opcode == BSON_MESSAGE_OP_MSG);
+   assert(parser.flags == BSON_MESSAGE_MSG_CHECKSUM_PRESENT);
+
+   assert(bson_message_parser_next(&parser, &b, &identifier));
+   assert(!identifier);
+   assert(get_i(&b) == -1);
+   assert(bson_get_data(&b) == frame.data + 21);
+
+   assert(bson_message_parser_next(&parser, &b, &identifier));
+   assert(!strcmp(identifier, "a"));
+   assert(get_i(&b) == 0);
+   assert(bson_message_parser_next(&parser, &b, &identifier));
+   assert(!strcmp(identifier, "a"));
+   assert(get_i(&b) == 1);
+   assert(bson_message_parser_next(&parser, &b, &identifier));
+   assert(!strcmp(identifier, "c"));
+   assert(get_i(&b) == 2);
+
+   assert(!bson_message_parser_next(&parser, &b, &identifier));
+   assert(!bson_message_parser_get_error_offset(&parser));
+   assert(!bson_message_parser_next(&parser, &b, NULL));
+
+   /* Partial frames ask for more data. */
+   assert(!bson_message_parser_init(&parser, frame.data, frame.len - 1,
+                                    &incomplete));
+   assert(incomplete);
+   assert(parser.length == frame.len);
+   assert(!bson_message_parser_next(&parser, &b, NULL));
+   assert(!bson_message_parser_init(&parser, frame.data, 3, &incomplete));
+   assert(incomplete);
+   assert(parser.length == 0);
+}
+
+
+static void
+test_message_parse_reply (void)
+{
+   bson_message_parser_t parser;
+   const char *identifier;
+   frame_t frame;
+   bson_uint64_t cursor_id = BSON_UINT64_TO_LE(1234567890123ULL);
+   bson_t b;
+   int i;
+
+   frame_init(&frame, BSON_MESSAGE_OP_REPLY, 8);
+   frame_put(&frame, &cursor_id, 8);
+   frame_put_int32(&frame, 10);
+   frame_put_int32(&frame, 3);
+   for (i = 0; i < 3; i++) {
+      frame_put_doc(&frame, i);
+   }
+   frame_finish(&frame);
+
+   assert(bson_message_parser_init(&parser, frame.data, frame.len, NULL));
+   assert(parser.opcode == BSON_MESSAGE_OP_REPLY);
+   assert(parser.flags == 8);
+   assert(parser.cursor_id == 1234567890123LL);
+   assert(parser.starting_from == 10);
+   assert(parser.number_returned == 3);
+
+   for (i = 0; i < 3; i++) {
+      assert(bson_message_parser_next(&parser, &b, &identifier));
+      assert(!identifier);
+      assert(get_i(&b) == i);
+   }
+   assert(!bson_message_parser_next(&parser, &b, NULL));
+   assert(!bson_message_parser_get_error_offset(&parser));
+
+   /* numberReturned does not match the documents. */
+   frame.data[32] = 4;
+   assert(bson_message_parser_init(&parser, frame.data, frame.len, NULL));
+   for (i = 0; i < 3; i++) {
+      assert(bson_message_parser_next(&parser, &b, NULL));
+   }
+   assert(!bson_message_parser_next(&parser, &b, NULL));
+   assert(bson_message_parser_get_error_offset(&parser) == frame.len);
+}
+
+
+/*
+ * Walks a corrupted copy of @frame and returns the error offset.
+ */
+static size_t
+parse_corrupt (const frame_t *frame,
+               bson_uint32_t  offset,
+               bson_uint8_t   value)
+{
+   bson_message_parser_t parser;
+   frame_t copy = *frame;
+   bson_t b;
+
+   copy.data[offset] = value;
+   assert(bson_message_parser_init(&parser, copy.data, copy.len, NULL));
+   while (bson_message_parser_next(&parser, &b, NULL)) {
+   }
+
+   return bson_message_parser_get_error_offset(&parser);
+}
+
+
+static void
+test_message_parse_corrupt (void)
+{
+   bson_message_parser_t parser;
+   bson_bool_t incomplete;
+   bson_uint32_t seq;
+   bson_uint32_t seq_b;
+   bson_uint32_t body_len;
+   frame_t frame;
+   frame_t copy;
+
+   build_msg_frame(&frame);
+   body_len = frame.data[21];
+   seq = 21 + body_len;
+   seq_b = seq + 1 + get_int32(frame.data + seq + 1);
+   assert(frame.data[seq_b] == 1);
+
+   /* Unknown section kind. */
+   assert(parse_corrupt(&frame, seq, 2) == seq);
+   /* Sequence larger than the frame. */
+   assert(parse_corrupt(&frame, seq + 2, 0x10) == seq);
+   /* Sequence too small for its identifier. */
+   assert(parse_corrupt(&frame, seq + 1, 5) == seq);
+   /* Identifier without a NUL, in the empty sequence "b". */
+   assert(parse_corrupt(&frame, seq_b + 6, 'x') == seq_b);
+   /* Document running past its sequence. */
+   assert(parse_corrupt(&frame, seq + 7, 0x7f) == seq + 7);
+   /* Body missing its trailing NUL. */
+   assert(parse_corrupt(&frame, seq - 1, 1) == 21);
+   /* A second body instead of a sequence. */
+   assert(parse_corrupt(&frame, seq, 0));
+   /* No body, only an empty sequence. */
+   frame_init(&copy, BSON_MESSAGE_OP_MSG, 0);
+   frame_put(&copy, "\1", 1);
+   frame_put_int32(&copy, 6);
+   frame_put(&copy, "b", 2);
+   frame_finish(&copy);
+   assert(parse_corrupt(&copy, 20, 1) == copy.len);
+
+   /* Unknown required flag. */
+   copy = frame;
+   copy.data[16] |= 4;
+   assert(!bson_message_parser_init(&parser, copy.data, copy.len, &incomplete));
+   assert(!incomplete);
+
+   /* Bad length. */
+   copy = frame;
+   copy.data[0] = 15;
+   copy.data[1] = 0;
+   assert(!bson_message_parser_init(&parser, copy.data, copy.len, &incomplete));
+   assert(!incomplete);
+
+   /* Not a reply. */
+   copy = frame;
+   copy.data[12] = 0xd2;
+   copy.data[13] = 0x07;
+   assert(!bson_message_parser_init(&parser, copy.data, copy.len, &incomplete));
+   assert(!incomplete);
+}
+
+
+/*
+ * Concatenates the frames of @message as they would arrive in a receive
+ * buffer.
+ */
+static bson_uint8_t *
+receive_frames (bson_message_t *message,
+                size_t         *len)
+{
+   struct iovec iov[128];
+   bson_uint8_t *buf;
+   size_t n;
+   size_t i;
+
+   n = bson_message_get_iovecs(message, iov, 128);
+   assert(n < 128);
+
+   for (*len = 0, i = 0; i < n; i++) {
+      *len += iov[i].iov_len;
+   }
+
+   buf = bson_malloc(*len);
+   for (*len = 0, i = 0; i < n; i++) {
+      memcpy(buf + *len, iov[i].iov_base, iov[i].iov_len);
+      *len += iov[i].iov_len;
+   }
+
+   return buf;
+}
+
+
+#define N_FRAME_DOCS 10000
+
+
+static bson_uint8_t *gFrames;
+static size_t gFramesLen;
+
+
+static void
+build_frames (void)
+{
+   bson_message_t *message;
+   bson_t body;
+   bson_t *b;
+   int i;
+
+   bson_init(&body);
+   assert(bson_append_utf8(&body, "insert", -1, "collection", -1));
+
+   message = bson_message_new(BSON_MESSAGE_OP_MSG, 0, "documents", &body,
+                              48000000, 1000);
+   for (i = 0; i < N_FRAME_DOCS; i++) {
+      bson_message_begin_document(message, &b);
+      append_doc(b, i);
+      assert(bson_message_end_document(message));
+   }
+
+   gFrames = receive_frames(message, &gFramesLen);
+
+   bson_message_destroy(message);
+   bson_destroy(&body);
+}
+
+
+static void
+test_message_parse_roundtrip (void)
+{
+   bson_message_parser_t parser;
+   const char *identifier;
+   const bson_uint8_t *p;
+   size_t left;
+   int n_frames = 0;
+   int n = 0;
+   bson_t b;
+
+   for (p = gFrames, left = gFramesLen; left; ) {
+      assert(bson_message_parser_init(&parser, p, left, NULL));
+      assert(parser.request_id == n_frames);
+      assert(bson_message_parser_next(&parser, &b, &identifier));
+      assert(!identifier);
+      while (bson_message_parser_next(&parser, &b, &identifier)) {
+         assert(!strcmp(identifier, "documents"));
+         assert(get_i(&b) == n++);
+      }
+      assert(!bson_message_parser_get_error_offset(&parser));
+      p += parser.length;
+      left -= parser.length;
+      n_frames++;
+   }
+
+   assert(n_frames == N_FRAME_DOCS / 1000);
+   assert(n == N_FRAME_DOCS);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   run_test("/bson/message/insert", test_message_insert);
+   run_test("/bson/message/msg", test_message_msg);
+   run_test("/bson/message/in_place", test_message_in_place);
+   run_test("/bson/message/reset", test_message_reset);
+   run_test("/bson/message/errors", test_message_errors);
+
+   build_frames();
+   run_test("/bson/message/parse_msg", test_message_parse_msg);
+   run_test("/bson/message/parse_reply", test_message_parse_reply);
+   run_test("/bson/message/parse_corrupt", test_message_parse_corrupt);
+   run_test("/bson/message/parse_roundtrip", test_message_parse_roundtrip);
+   bson_free(gFrames);
+
+   return 0;
+}
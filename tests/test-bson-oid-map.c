@@ -0,0 +1,234 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+
+#include "bson-tests.h"
+
+
+static bson_oid_t *
+make_oids (size_t n)
+{
+   bson_context_t *context;
+   bson_oid_t *oids;
+   size_t i;
+
+   context = bson_context_new(BSON_CONTEXT_NONE);
+   oids = bson_malloc(n * sizeof *oids);
+
+   for (i = 0; i < n; i++) {
+      bson_oid_init(&oids[i], context);
+   }
+
+   bson_context_destroy(context);
+
+   return oids;
+}
+
+
+static void
+test_oid_map_basic (void)
+{
+   bson_oid_map_t *map;
+   bson_uint64_t value;
+   bson_oid_t *oids;
+   size_t i;
+
+   oids = make_oids(1000);
+   map = bson_oid_map_new(0);
+
+   assert(!bson_oid_map_lookup(map, &oids[0], &value));
+   assert(!bson_oid_map_remove(map, &oids[0]));
+   assert_cmpint(bson_oid_map_get_memory_usage(map), ==, 0);
+
+   for (i = 0; i < 1000; i++) {
+      assert(bson_oid_map_insert(map, &oids[i], i));
+      assert_cmpint(bson_oid_map_count(map), ==, i + 1);
+   }
+
+   for (i = 0; i < 1000; i++) {
+      assert(!bson_oid_map_insert(map, &oids[i], i * 2));
+   }
+
+   assert_cmpint(bson_oid_map_count(map), ==, 1000);
+
+   for (i = 0; i < 1000; i++) {
+      assert(bson_oid_map_lookup(map, &oids[i], &value));
+      assert_cmpint(value, ==, i * 2);
+   }
+
+   for (i = 0; i < 1000; i += 2) {
+      assert(bson_oid_map_remove(map, &oids[i]));
+      assert(!bson_oid_map_remove(map, &oids[i]));
+   }
+
+   assert_cmpint(bson_oid_map_count(map), ==, 500);
+
+   for (i = 0; i < 1000; i++) {
+      assert(bson_oid_map_lookup(map, &oids[i], NULL) == (i % 2));
+   }
+
+   /*
+    * 2048 slots of 21 bytes plus the cloned control bytes.
+    */
+   assert_cmpint(bson_oid_map_get_memory_usage(map), ==, (2048 * 21) + 16);
+
+   bson_oid_map_destroy(map);
+   bson_free(oids);
+}
+
+
+static void
+test_oid_map_churn (void)
+{
+   bson_oid_map_t *map;
+   bson_uint64_t value;
+   bson_oid_t *oids;
+   size_t usage;
+   size_t i;
+
+   oids = make_oids(100000);
+   map = bson_oid_map_new(100);
+   usage = bson_oid_map_get_memory_usage(map);
+
+   /*
+    * A sliding window of 50 live entries must not grow the table even
+    * though every removal leaves a tombstone behind.
+    */
+   for (i = 0; i < 100000; i++) {
+      assert(bson_oid_map_insert(map, &oids[i], i));
+      if (i >= 50) {
+         assert(bson_oid_map_remove(map, &oids[i - 50]));
+      }
+   }
+
+   assert_cmpint(bson_oid_map_count(map), ==, 50);
+   assert_cmpint(bson_oid_map_get_memory_usage(map), ==, usage);
+
+   for (i = 0; i < 100000; i++) {
+      assert(bson_oid_map_lookup(map, &oids[i], &value) == (i >= 99950));
+   }
+
+   bson_oid_map_destroy(map);
+   bson_free(oids);
+}
+
+
+static void
+test_oid_map_many (void)
+{
+   bson_oid_map_t *map;
+   bson_uint64_t *values;
+   bson_uint64_t *out;
+   bson_bool_t *found;
+   bson_oid_t *oids;
+   size_t i;
+
+   oids = make_oids(10000);
+   values = bson_malloc(10000 * sizeof *values);
+   out = bson_malloc0(10000 * sizeof *out);
+   found = bson_malloc0(10000 * sizeof *found);
+
+   for (i = 0; i < 10000; i++) {
+      values[i] = i + 1;
+   }
+
+   map = bson_oid_map_new(0);
+   assert_cmpint(bson_oid_map_insert_many(map, oids, values, 5000), ==, 5000);
+   assert_cmpint(bson_oid_map_insert_many(map, oids, values, 10000), ==, 5000);
+   assert_cmpint(bson_oid_map_count(map), ==, 10000);
+
+   assert(bson_oid_map_remove(map, &oids[1234]));
+   assert_cmpint(bson_oid_map_lookup_many(map, oids, out, found, 10000), ==,
+                 9999);
+
+   for (i = 0; i < 10000; i++) {
+      if (i == 1234) {
+         assert(!found[i]);
+         assert_cmpint(out[i], ==, 0);
+      } else {
+         assert(found[i]);
+         assert_cmpint(out[i], ==, i + 1);
+      }
+   }
+
+   bson_oid_map_destroy(map);
+   bson_free(oids);
+   bson_free(values);
+   bson_free(out);
+   bson_free(found);
+}
+
+
+static void
+test_oid_set (void)
+{
+   bson_oid_set_t *set;
+   bson_bool_t *found;
+   bson_oid_t *oids;
+   size_t i;
+
+   oids = make_oids(10000);
+   found = bson_malloc0(10000 * sizeof *found);
+   set = bson_oid_set_new(10000);
+
+   /*
+    * Reserving 10000 entries takes 16384 slots of 13 bytes.
+    */
+   assert_cmpint(bson_oid_set_get_memory_usage(set), ==, (16384 * 13) + 16);
+
+   for (i = 0; i < 5000; i++) {
+      assert(bson_oid_set_add(set, &oids[i]));
+      assert(!bson_oid_set_add(set, &oids[i]));
+   }
+
+   assert_cmpint(bson_oid_set_add_many(set, oids, 10000), ==, 5000);
+   assert_cmpint(bson_oid_set_count(set), ==, 10000);
+   assert_cmpint(bson_oid_set_get_memory_usage(set), ==, (16384 * 13) + 16);
+
+   for (i = 0; i < 10000; i += 3) {
+      assert(bson_oid_set_remove(set, &oids[i]));
+   }
+
+   for (i = 0; i < 10000; i++) {
+      assert(bson_oid_set_contains(set, &oids[i]) == !!(i % 3));
+   }
+
+   assert_cmpint(bson_oid_set_contains_many(set, oids, found, 10000), ==,
+                 6666);
+
+   for (i = 0; i < 10000; i++) {
+      assert(found[i] == !!(i % 3));
+   }
+
+   bson_oid_set_destroy(set);
+   bson_free(oids);
+   bson_free(found);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   run_test("/bson/oid_map/basic", test_oid_map_basic);
+   run_test("/bson/oid_map/churn", test_oid_map_churn);
+   run_test("/bson/oid_map/many", test_oid_map_many);
+   run_test("/bson/oid_set/basic", test_oid_set);
+
+   return 0;
+}
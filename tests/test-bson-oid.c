@@ -16,8 +16,10 @@
 
 
 #include <assert.h>
+#include <bson/bson-context-private.h>
 #include <bson/bson-thread.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -95,6 +97,265 @@ test_bson_oid_init_from_string (void)
 }
 
 
+static void
+test_bson_oid_to_string_many (void)
+{
+   bson_oid_t oids[100];
+   char strs[100 * 25];
+   char str[25];
+   int i;
+   int j;
+
+   for (i = 0; i < 100; i++) {
+      for (j = 0; j < 12; j++) {
+         oids[i].bytes[j] = (i * 12 + j) * 7;
+      }
+   }
+
+   bson_oid_to_string_many(oids, 100, strs);
+
+   for (i = 0; i < 100; i++) {
+      bson_oid_to_string(&oids[i], str);
+      assert(!strcmp(str, strs + (25 * i)));
+   }
+
+   bson_oid_to_string_many(NULL, 0, NULL);
+}
+
+
+static void
+test_bson_oid_init_from_string_many (void)
+{
+   const char *strs[32];
+   bson_bool_t valid[32];
+   bson_oid_t oids[32];
+   bson_oid_t oid;
+   char buf[32 * 25];
+   char bad[25];
+   char *short_str;
+   int n = 0;
+   int i;
+
+   for (i = 0; gTestOids[i]; i++) {
+      strs[n++] = gTestOids[i];
+   }
+
+   for (i = 0; gTestOidsFail[i]; i++) {
+      strs[n++] = gTestOidsFail[i];
+   }
+
+   strs[n++] = "0123456789ABCDEF01234567";
+   strs[n++] = "0123456789abcdef0123456/";
+   strs[n++] = "0123456789abcdef0123456:";
+   strs[n++] = "`123456789abcdef01234567";
+   strs[n++] = "g123456789abcdef01234567";
+
+   memcpy(bad, "0123456789abcdef01234567", 25);
+   bad[20] = (char)0xB0;
+   strs[n++] = bad;
+
+   /*
+    * Wrong lengths, the short ones at the very end of their allocation.
+    */
+   strs[n++] = "0123456789abcdef012345678";
+   strs[n++] = "0123456789abcdef0123456";
+   strs[n++] = "";
+   short_str = bson_malloc(4);
+   memcpy(short_str, "012", 4);
+   strs[n++] = short_str;
+
+   assert_cmpint(bson_oid_init_from_string_many(oids, strs, n, valid), ==, 4);
+
+   for (i = 0; i < n; i++) {
+      assert(valid[i] == bson_oid_is_valid(strs[i], strlen(strs[i])));
+      if (valid[i]) {
+         bson_oid_init_from_string(&oid, strs[i]);
+         assert(bson_oid_equal(&oid, &oids[i]));
+      } else {
+         bson_oid_init_from_string(&oid, "000000000000000000000000");
+         assert(bson_oid_equal(&oid, &oids[i]));
+      }
+   }
+
+   bson_free(short_str);
+
+   /*
+    * Round trip through both batch functions.
+    */
+   for (i = 0; i < 32; i++) {
+      bson_oid_init(&oids[i], NULL);
+   }
+
+   bson_oid_to_string_many(oids, 32, buf);
+
+   for (i = 0; i < 32; i++) {
+      strs[i] = buf + (25 * i);
+      memset(&oids[i], 0, sizeof oids[i]);
+   }
+
+   assert_cmpint(bson_oid_init_from_string_many(oids, strs, 32, NULL), ==, 32);
+
+   for (i = 0; i < 32; i++) {
+      bson_oid_to_string(&oids[i], bad);
+      assert(!strcmp(bad, strs[i]));
+   }
+}
+
+
+static int
+oid_qsort_compare (const void *a,
+                   const void *b)
+{
+   return bson_oid_compare(a, b);
+}
+
+
+static void
+oid_fill_random (bson_oid_t *oids,
+                 size_t      n_oids,
+                 int         n_random_bytes)
+{
+   size_t i;
+   int j;
+
+   bson_oid_init_many(oids, n_oids, NULL);
+
+   for (i = 0; i < n_oids; i++) {
+      for (j = 12 - n_random_bytes; j < 12; j++) {
+         oids[i].bytes[j] = rand();
+      }
+   }
+}
+
+
+static void
+test_bson_oid_sort (void)
+{
+   static const size_t sizes[] = { 0, 1, 2, 63, 64, 1000, 10000 };
+   bson_oid_t *oids;
+   bson_oid_t *orig;
+   bson_oid_t *expected;
+   size_t *perm;
+   size_t n;
+   size_t i;
+   int s;
+   int r;
+
+   for (s = 0; s < (int)(sizeof sizes / sizeof sizes[0]); s++) {
+      for (r = 1; r <= 12; r += 11) {
+         n = sizes[s];
+         oids = bson_malloc((n + 1) * sizeof *oids);
+         orig = bson_malloc((n + 1) * sizeof *orig);
+         expected = bson_malloc((n + 1) * sizeof *expected);
+         perm = bson_malloc((n + 1) * sizeof *perm);
+
+         /*
+          * Only randomize the low byte in the first round so that there
+          * are plenty of duplicates to check stability with.
+          */
+         oid_fill_random(oids, n, r);
+         memcpy(orig, oids, n * sizeof *oids);
+         memcpy(expected, oids, n * sizeof *oids);
+         qsort(expected, n, sizeof *expected, oid_qsort_compare);
+
+         bson_oid_sort(oids, n, perm);
+
+         for (i = 0; i < n; i++) {
+            assert(bson_oid_equal(&oids[i], &expected[i]));
+            assert(bson_oid_equal(&oids[i], &orig[perm[i]]));
+            if (i && bson_oid_equal(&oids[i], &oids[i - 1])) {
+               assert(perm[i] > perm[i - 1]);
+            }
+         }
+
+         memcpy(oids, orig, n * sizeof *oids);
+         bson_oid_sort(oids, n, NULL);
+         assert(!n || !memcmp(oids, expected, n * sizeof *oids));
+
+         bson_free(oids);
+         bson_free(orig);
+         bson_free(expected);
+         bson_free(perm);
+      }
+   }
+}
+
+
+static void
+test_bson_oid_bsearch (void)
+{
+   bson_oid_t oids[100];
+   bson_oid_t oid;
+   size_t index;
+   int i;
+
+   for (i = 0; i < 100; i++) {
+      memset(&oids[i], 0, sizeof oids[i]);
+      oids[i].bytes[11] = (i / 2) * 4 + 2;
+   }
+
+   assert(!bson_oid_bsearch(oids, 0, &oids[0], &index));
+   assert_cmpint(index, ==, 0);
+
+   for (i = 0; i < 100; i++) {
+      assert(bson_oid_bsearch(oids, 100, &oids[i], &index));
+      assert_cmpint(index, ==, i & ~1);
+   }
+
+   memset(&oid, 0, sizeof oid);
+
+   for (i = 0; i < 50; i++) {
+      oid.bytes[11] = i * 4;
+      assert(!bson_oid_bsearch(oids, 100, &oid, &index));
+      assert_cmpint(index, ==, i * 2);
+   }
+
+   oid.bytes[11] = 255;
+   assert(!bson_oid_bsearch(oids, 100, &oid, NULL));
+   assert(!bson_oid_bsearch(oids, 100, &oid, &index));
+   assert_cmpint(index, ==, 100);
+}
+
+
+static void
+test_bson_oid_intersect_union (void)
+{
+   bson_oid_t a[6];
+   bson_oid_t b[5];
+   bson_oid_t out[11];
+   static const int av[] = { 1, 2, 2, 2, 5, 9 };
+   static const int bv[] = { 2, 2, 3, 9, 10 };
+   static const int iv[] = { 2, 2, 9 };
+   static const int uv[] = { 1, 2, 2, 2, 3, 5, 9, 10 };
+   int i;
+
+   memset(a, 0, sizeof a);
+   memset(b, 0, sizeof b);
+
+   for (i = 0; i < 6; i++) {
+      a[i].bytes[11] = av[i];
+   }
+
+   for (i = 0; i < 5; i++) {
+      b[i].bytes[11] = bv[i];
+   }
+
+   assert_cmpint(bson_oid_intersect(a, 6, b, 5, out), ==, 3);
+   for (i = 0; i < 3; i++) {
+      assert_cmpint(out[i].bytes[11], ==, iv[i]);
+   }
+
+   assert_cmpint(bson_oid_union(a, 6, b, 5, out), ==, 8);
+   for (i = 0; i < 8; i++) {
+      assert_cmpint(out[i].bytes[11], ==, uv[i]);
+   }
+
+   assert_cmpint(bson_oid_intersect(a, 6, NULL, 0, out), ==, 0);
+   assert_cmpint(bson_oid_union(NULL, 0, b, 5, out), ==, 5);
+   assert(!memcmp(out, b, sizeof b));
+}
+
+
 static void
 test_bson_oid_hash (void)
 {
@@ -163,6 +424,310 @@ test_bson_oid_init (void)
 }
 
 
+static bson_uint32_t
+oid_get_seq32 (const bson_oid_t *oid)
+{
+   return ((oid->bytes[9] << 16) | (oid->bytes[10] << 8) | oid->bytes[11]);
+}
+
+
+static void
+test_bson_oid_init_many (void)
+{
+   bson_context_t *context;
+   bson_oid_t oids[1000];
+   bson_oid_t oid;
+   bson_uint32_t seq;
+   int i;
+
+   context = bson_context_new(BSON_CONTEXT_NONE);
+   bson_oid_init(&oid, context);
+   bson_oid_init_many(oids, 1000, context);
+
+   seq = oid_get_seq32(&oid);
+
+   for (i = 0; i < 1000; i++) {
+      assert(!memcmp(&oids[i].bytes[4], &oid.bytes[4], 5));
+      assert(bson_oid_get_time_t(&oids[i]) >= bson_oid_get_time_t(&oid));
+      assert_cmpint(oid_get_seq32(&oids[i]), ==, (seq + i + 1) & 0xFFFFFF);
+   }
+
+   bson_oid_init(&oid, context);
+   assert_cmpint(oid_get_seq32(&oid), ==, (seq + 1001) & 0xFFFFFF);
+
+   bson_context_destroy(context);
+
+   /*
+    * The 24-bit counter must wrap the same way bson_oid_init() does.
+    */
+   context = bson_context_new(BSON_CONTEXT_THREAD_SAFE);
+   context->seq32 = 0xFFFFFE;
+   bson_oid_init_many(oids, 4, context);
+   assert_cmpint(oid_get_seq32(&oids[0]), ==, 0xFFFFFE);
+   assert_cmpint(oid_get_seq32(&oids[1]), ==, 0xFFFFFF);
+   assert_cmpint(oid_get_seq32(&oids[2]), ==, 0);
+   assert_cmpint(oid_get_seq32(&oids[3]), ==, 1);
+   bson_oid_init(&oid, context);
+   assert_cmpint(oid_get_seq32(&oid), ==, 2);
+   bson_context_destroy(context);
+
+   bson_oid_init_many(oids, 10, NULL);
+   bson_oid_init_many(NULL, 0, NULL);
+}
+
+
+static void *
+oid_many_worker (void *data)
+{
+   bson_context_t *context = data;
+   bson_oid_t *oids;
+   int i;
+
+   oids = bson_malloc(1000 * sizeof *oids);
+
+   for (i = 0; i < 100; i++) {
+      bson_oid_init_many(oids, 1000, context);
+   }
+
+   bson_free(oids);
+
+   return NULL;
+}
+
+
+static void
+test_bson_oid_init_many_with_threads (void)
+{
+   bson_context_t *context;
+   bson_thread_t threads[N_THREADS];
+   bson_oid_t oid;
+   bson_uint32_t seq;
+   int i;
+
+   context = bson_context_new(BSON_CONTEXT_THREAD_SAFE);
+   bson_oid_init(&oid, context);
+   seq = oid_get_seq32(&oid);
+
+   for (i = 0; i < N_THREADS; i++) {
+      bson_thread_create(&threads[i], NULL, oid_many_worker, context);
+   }
+
+   for (i = 0; i < N_THREADS; i++) {
+      bson_thread_join(threads[i], NULL);
+   }
+
+   /*
+    * No sequence numbers may be lost or handed out twice.
+    */
+   bson_oid_init(&oid, context);
+   assert_cmpint(oid_get_seq32(&oid), ==,
+                 (seq + 1 + (N_THREADS * 100 * 1000)) & 0xFFFFFF);
+
+   bson_context_destroy(context);
+}
+
+
+#define N_PER_THREAD_OIDS 100000
+
+
+typedef struct
+{
+   bson_context_t *context;
+   bson_oid_t     *oids;
+   int             n_oids;
+} oid_worker_t;
+
+
+static void *
+oid_fill_worker (void *data)
+{
+   oid_worker_t *worker = data;
+   int i;
+
+   for (i = 0; i < worker->n_oids; i++) {
+      bson_oid_init(&worker->oids[i], worker->context);
+   }
+
+   return NULL;
+}
+
+
+static void
+test_bson_oid_init_per_thread (void)
+{
+   bson_context_t *context;
+   bson_thread_t threads[N_THREADS];
+   bson_oid_set_t *set;
+   oid_worker_t workers[N_THREADS];
+   bson_oid_t oid;
+   int i;
+   int j;
+
+   context = bson_context_new(BSON_CONTEXT_SEQ_PER_THREAD);
+
+   for (i = 0; i < N_THREADS; i++) {
+      workers[i].context = context;
+      workers[i].oids = bson_malloc(N_PER_THREAD_OIDS * sizeof(bson_oid_t));
+      workers[i].n_oids = N_PER_THREAD_OIDS;
+      bson_thread_create(&threads[i], NULL, oid_fill_worker, &workers[i]);
+   }
+
+   for (i = 0; i < N_THREADS; i++) {
+      bson_thread_join(threads[i], NULL);
+   }
+
+   /*
+    * No id may be handed out twice, across all of the threads.
+    */
+   set = bson_oid_set_new(N_THREADS * N_PER_THREAD_OIDS);
+
+   for (i = 0; i < N_THREADS; i++) {
+      for (j = 1; j < N_PER_THREAD_OIDS; j++) {
+         assert(oid_get_seq32(&workers[i].oids[j]) !=
+                oid_get_seq32(&workers[i].oids[j - 1]));
+      }
+      assert_cmpint(bson_oid_set_add_many(set, workers[i].oids,
+                                          N_PER_THREAD_OIDS), ==,
+                    N_PER_THREAD_OIDS);
+      bson_free(workers[i].oids);
+   }
+
+   bson_oid_set_destroy(set);
+   bson_context_destroy(context);
+
+   /*
+    * A new context must not keep using the block this thread reserved from
+    * a previous one, even when allocated at the same address.
+    */
+   context = bson_context_new(BSON_CONTEXT_SEQ_PER_THREAD);
+   context->seq32 = 0;
+   bson_oid_init(&oid, context);
+   assert_cmpint(oid_get_seq32(&oid), ==, 0);
+   bson_context_destroy(context);
+
+   context = bson_context_new(BSON_CONTEXT_SEQ_PER_THREAD);
+   context->seq32 = 5000;
+   bson_oid_init(&oid, context);
+   assert_cmpint(oid_get_seq32(&oid), ==, 5000);
+   bson_oid_init_many(&oid, 1, context);
+   assert_cmpint(oid_get_seq32(&oid), ==, 5000 + BSON_CONTEXT_SEQ_BLOCK);
+   bson_context_destroy(context);
+}
+
+
+/*
+ * Generates ObjectIds from @n_contexts per-thread contexts in turn, enough
+ * times to wrap the 24-bit counter if a block were dropped on every switch,
+ * and checks that no context hands out the same sequence number twice.
+ */
+static void
+oid_interleave_contexts (int n_contexts)
+{
+   bson_context_t *contexts[8];
+   bson_uint32_t *seqs;
+   bson_uint8_t *seen;
+   bson_uint32_t seq;
+   bson_oid_t oid;
+   int n_rounds;
+   int i;
+   int j;
+
+   assert(n_contexts <= 8);
+
+   n_rounds = (1 << 24) / BSON_CONTEXT_SEQ_BLOCK + 4000;
+   seqs = bson_malloc(n_contexts * n_rounds * sizeof *seqs);
+   seen = bson_malloc((1 << 24) / 8);
+
+   for (i = 0; i < n_contexts; i++) {
+      contexts[i] = bson_context_new(BSON_CONTEXT_SEQ_PER_THREAD);
+   }
+
+   for (j = 0; j < n_rounds; j++) {
+      for (i = 0; i < n_contexts; i++) {
+         bson_oid_init(&oid, contexts[i]);
+         seqs[i * n_rounds + j] = oid_get_seq32(&oid);
+      }
+   }
+
+   for (i = 0; i < n_contexts; i++) {
+      memset(seen, 0, (1 << 24) / 8);
+      for (j = 0; j < n_rounds; j++) {
+         seq = seqs[i * n_rounds + j];
+         assert(!(seen[seq / 8] & (1 << (seq % 8))));
+         seen[seq / 8] |= (1 << (seq % 8));
+      }
+      bson_context_destroy(contexts[i]);
+   }
+
+   bson_free(seen);
+   bson_free(seqs);
+}
+
+
+static void
+test_bson_oid_init_per_thread_interleaved (void)
+{
+   oid_interleave_contexts(2);
+   oid_interleave_contexts(8);
+}
+
+
+static void
+oid_get_pid (const bson_oid_t *oid,
+             bson_uint16_t    *pid)
+{
+   memcpy(pid, &oid->bytes[7], 2);
+   *pid = BSON_UINT16_FROM_BE(*pid);
+}
+
+
+static void
+test_bson_oid_init_after_fork (void)
+{
+   bson_uint16_t parent_pid;
+   bson_uint16_t pid;
+   bson_oid_t oid;
+   bson_oid_t child_oid;
+   pid_t child;
+   int fds[2];
+   int status;
+
+   bson_oid_init(&oid, NULL);
+   oid_get_pid(&oid, &parent_pid);
+   assert_cmpint(parent_pid, ==, (bson_uint16_t)getpid());
+
+   assert(pipe(fds) == 0);
+
+   child = fork();
+   assert(child != -1);
+
+   if (child == 0) {
+      bson_oid_init(&child_oid, NULL);
+      if (write(fds[1], &child_oid, sizeof child_oid) != sizeof child_oid) {
+         _exit(1);
+      }
+      _exit(0);
+   }
+
+   close(fds[1]);
+   assert(read(fds[0], &child_oid, sizeof child_oid) == sizeof child_oid);
+   close(fds[0]);
+
+   assert(waitpid(child, &status, 0) == child);
+   assert(WIFEXITED(status) && !WEXITSTATUS(status));
+
+   oid_get_pid(&child_oid, &pid);
+   assert_cmpint(pid, ==, (bson_uint16_t)child);
+
+   /*
+    * The parent keeps its own pid.
+    */
+   bson_oid_init(&oid, NULL);
+   oid_get_pid(&oid, &pid);
+   assert_cmpint(pid, ==, parent_pid);
+}
+
+
 static void
 test_bson_oid_init_sequence (void)
 {
@@ -300,12 +865,24 @@ main (int   argc,
 {
    run_test("/bson/oid/init", test_bson_oid_init);
    run_test("/bson/oid/init_from_string", test_bson_oid_init_from_string);
+   run_test("/bson/oid/init_many", test_bson_oid_init_many);
+   run_test("/bson/oid/init_many_with_threads", test_bson_oid_init_many_with_threads);
+   run_test("/bson/oid/init_per_thread", test_bson_oid_init_per_thread);
+   run_test("/bson/oid/init_per_thread_interleaved",
+            test_bson_oid_init_per_thread_interleaved);
+   run_test("/bson/oid/init_after_fork", test_bson_oid_init_after_fork);
    run_test("/bson/oid/init_sequence", test_bson_oid_init_sequence);
    run_test("/bson/oid/init_sequence_thread_safe", test_bson_oid_init_sequence_thread_safe);
 #if defined(__linux__)
    run_test("/bson/oid/init_sequence_with_tid", test_bson_oid_init_sequence_with_tid);
 #endif
    run_test("/bson/oid/init_with_threads", test_bson_oid_init_with_threads);
+   run_test("/bson/oid/to_string_many", test_bson_oid_to_string_many);
+   run_test("/bson/oid/init_from_string_many",
+            test_bson_oid_init_from_string_many);
+   run_test("/bson/oid/sort", test_bson_oid_sort);
+   run_test("/bson/oid/bsearch", test_bson_oid_bsearch);
+   run_test("/bson/oid/intersect_union", test_bson_oid_intersect_union);
    run_test("/bson/oid/hash", test_bson_oid_hash);
    run_test("/bson/oid/compare", test_bson_oid_compare);
    run_test("/bson/oid/copy", test_bson_oid_copy);
@@ -219,6 +219,177 @@ test_reader_grow_buffer (void)
 }
 
 
+/*
+ * Builds a stream of @n documents of varying size for the iovec tests.
+ */
+static bson_uint8_t *
+build_stream (bson_uint32_t  n,
+              size_t        *len)
+{
+   bson_writer_t *writer;
+   bson_uint8_t *buf = NULL;
+   size_t buflen = 0;
+   bson_uint32_t i;
+   bson_uint32_t j;
+   bson_t *b;
+
+   writer = bson_writer_new(&buf, &buflen, 0, bson_realloc);
+
+   for (i = 0; i < n; i++) {
+      bson_writer_begin(writer, &b);
+      assert(bson_append_int32(b, "i", -1, i));
+      for (j = 0; j < (i % 7); j++) {
+         assert(bson_append_utf8(b, "s", -1, "some string data", -1));
+      }
+      bson_writer_end(writer);
+   }
+
+   *len = bson_writer_get_length(writer);
+   bson_writer_destroy(writer);
+
+   return buf;
+}
+
+
+/*
+ * Splits @len bytes at @data into segments of @seg bytes, with an empty
+ * segment after every third one.
+ */
+static struct iovec *
+split_stream (bson_uint8_t *data,
+              size_t        len,
+              size_t        seg,
+              size_t       *n_iov)
+{
+   struct iovec *iov;
+   size_t offset;
+   size_t n = 0;
+
+   iov = bson_malloc0(((len / seg) + 1) * 2 * sizeof *iov);
+
+   for (offset = 0; offset < len; offset += seg) {
+      iov[n].iov_base = data + offset;
+      iov[n].iov_len = MIN(seg, len - offset);
+      n++;
+      if ((n % 3) == 2) {
+         iov[n].iov_base = data;
+         iov[n].iov_len = 0;
+         n++;
+      }
+   }
+
+   *n_iov = n;
+
+   return iov;
+}
+
+
+static void
+test_reader_from_iovec (void)
+{
+   static const size_t segs[] = { 1, 3, 7, 64, 4096, 1 << 20 };
+   bson_reader_t *reader;
+   bson_reader_t *expected;
+   struct iovec *iov;
+   const bson_uint8_t *data;
+   bson_uint8_t *stream;
+   const bson_t *a;
+   const bson_t *b;
+   bson_bool_t eof;
+   bson_bool_t expected_eof;
+   bson_bool_t contained;
+   size_t n_iov;
+   size_t len;
+   size_t i;
+   size_t k;
+   size_t n;
+
+   stream = build_stream(1000, &len);
+
+   for (i = 0; i < sizeof segs / sizeof segs[0]; i++) {
+      iov = split_stream(stream, len, segs[i], &n_iov);
+      reader = bson_reader_new_from_iovec(iov, n_iov);
+      expected = bson_reader_new_from_data(stream, len);
+
+      for (n = 0; (b = bson_reader_read(reader, &eof)); n++) {
+         a = bson_reader_read(expected, &expected_eof);
+         assert(a);
+         assert(a->len == b->len);
+         assert(!memcmp(bson_get_data(a), bson_get_data(b), a->len));
+         assert(eof == expected_eof);
+         assert(bson_reader_tell(reader) == bson_reader_tell(expected));
+
+         /*
+          * The segments alias @stream, so documents within a segment must
+          * be returned in place and only the others copied.
+          */
+         data = bson_get_data(a);
+         k = (data - stream) / segs[i];
+         contained = ((data - stream + a->len) <= ((k + 1) * segs[i]));
+         assert(contained == (bson_get_data(b) == data));
+      }
+
+      assert(n == 1000);
+      assert(eof);
+      assert(!bson_reader_read(expected, &expected_eof));
+
+      bson_reader_destroy(expected);
+      bson_reader_destroy(reader);
+      bson_free(iov);
+   }
+
+   bson_free(stream);
+}
+
+
+static void
+test_reader_from_iovec_truncated (void)
+{
+   bson_reader_t *reader;
+   struct iovec iov[3];
+   bson_uint8_t *stream;
+   const bson_t *b;
+   bson_bool_t eof;
+   size_t last;
+   size_t len;
+   size_t n;
+
+   bson_free(build_stream(9, &last));
+   stream = build_stream(10, &len);
+
+   /*
+    * Cut the last document short, once within its length field and once
+    * just before its end.
+    */
+   iov[0].iov_base = stream;
+   iov[0].iov_len = last - 10;
+   iov[1].iov_base = stream + last - 10;
+   iov[1].iov_len = 0;
+   iov[2].iov_base = stream + last - 10;
+   iov[2].iov_len = 12;
+
+   reader = bson_reader_new_from_iovec(iov, 3);
+   for (n = 0; (b = bson_reader_read(reader, &eof)); n++) { }
+   assert(n == 9);
+   assert(!eof);
+   bson_reader_destroy(reader);
+
+   iov[2].iov_len = len - last + 9;
+   reader = bson_reader_new_from_iovec(iov, 3);
+   for (n = 0; (b = bson_reader_read(reader, &eof)); n++) { }
+   assert(n == 9);
+   assert(!eof);
+   bson_reader_destroy(reader);
+
+   reader = bson_reader_new_from_iovec(NULL, 0);
+   assert(!bson_reader_read(reader, &eof));
+   assert(eof);
+   bson_reader_destroy(reader);
+
+   bson_free(stream);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -231,6 +402,9 @@ main (int   argc,
    run_test("/bson/reader/new_from_fd_corrupt",
             test_reader_from_fd_corrupt);
    run_test("/bson/reader/grow_buffer", test_reader_grow_buffer);
+   run_test("/bson/reader/new_from_iovec", test_reader_from_iovec);
+   run_test("/bson/reader/new_from_iovec_truncated",
+            test_reader_from_iovec_truncated);
 
    return 0;
 }
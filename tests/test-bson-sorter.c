@@ -0,0 +1,382 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "bson-tests.h"
+
+
+static int gSortData;
+
+
+typedef struct
+{
+   bson_uint8_t *buf;
+   size_t        len;
+   size_t        alloc;
+} buffer_t;
+
+
+typedef struct
+{
+   bson_uint32_t n_docs;
+   bson_int32_t  last_a;
+   bson_int32_t  last_seq;
+   bson_bool_t   descending;
+} check_t;
+
+
+static void
+buffer_append (buffer_t     *buffer,
+               const bson_t *b)
+{
+   if ((buffer->len + b->len) > buffer->alloc) {
+      buffer->alloc = buffer->alloc ? buffer->alloc * 2 : 4096;
+      buffer->buf = bson_realloc(buffer->buf, buffer->alloc);
+   }
+
+   memcpy(buffer->buf + buffer->len, bson_get_data(b), b->len);
+   buffer->len += b->len;
+}
+
+
+static void
+build_input (buffer_t      *buffer,
+             bson_uint32_t  n_docs,
+             bson_int32_t   n_distinct)
+{
+   bson_uint32_t i;
+   bson_t b;
+
+   memset(buffer, 0, sizeof *buffer);
+   srand(1234);
+
+   for (i = 0; i < n_docs; i++) {
+      bson_init(&b);
+      bson_append_utf8(&b, "name", -1, "some padding for the run", -1);
+      bson_append_int32(&b, "a", -1, rand() % n_distinct);
+      bson_append_int32(&b, "seq", -1, i);
+      buffer_append(buffer, &b);
+      bson_destroy(&b);
+   }
+}
+
+
+static bson_bool_t
+check_emit (const bson_t *b,
+            void         *data)
+{
+   check_t *check = data;
+   bson_iter_t iter;
+   bson_int32_t a;
+   bson_int32_t seq;
+
+   assert(bson_iter_init_find(&iter, b, "a"));
+   a = bson_iter_int32(&iter);
+   assert(bson_iter_init_find(&iter, b, "seq"));
+   seq = bson_iter_int32(&iter);
+
+   if (check->n_docs) {
+      if (check->descending) {
+         assert_cmpint(a, <=, check->last_a);
+      } else {
+         assert_cmpint(a, >=, check->last_a);
+      }
+      if (a == check->last_a) {
+         assert_cmpint(seq, >, check->last_seq);
+      }
+   }
+
+   check->last_a = a;
+   check->last_seq = seq;
+   check->n_docs++;
+
+   return TRUE;
+}
+
+
+static void
+test_sorter_in_memory (void)
+{
+   bson_sorter_stats_t stats;
+   bson_sorter_t *sorter;
+   bson_reader_t *reader;
+   bson_error_t error;
+   buffer_t buffer;
+   check_t check = { 0 };
+
+   build_input(&buffer, 1000, 100);
+
+   sorter = bson_sorter_new(0, 0);
+   assert(bson_sorter_add_key(sorter, "a", TRUE));
+
+   reader = bson_reader_new_from_data(buffer.buf, buffer.len);
+   assert(bson_sorter_sort(sorter, reader, check_emit, &check, &error));
+   assert_cmpint(check.n_docs, ==, 1000);
+
+   bson_sorter_get_stats(sorter, &stats);
+   assert_cmpint(stats.n_docs, ==, 1000);
+   assert_cmpint(stats.n_bytes, ==, buffer.len);
+   assert_cmpint(stats.n_runs, ==, 1);
+
+   bson_reader_destroy(reader);
+   bson_sorter_destroy(sorter);
+   bson_free(buffer.buf);
+}
+
+
+static void
+test_sorter_spill (void)
+{
+   bson_sorter_stats_t stats;
+   bson_sorter_t *sorter;
+   bson_reader_t *reader;
+   bson_error_t error;
+   buffer_t buffer;
+   check_t check = { 0 };
+
+   build_input(&buffer, 20000, 500);
+
+   sorter = bson_sorter_new(16 * 1024, 4);
+   assert(bson_sorter_add_key(sorter, "a", FALSE));
+   check.descending = TRUE;
+
+   reader = bson_reader_new_from_data(buffer.buf, buffer.len);
+   assert(bson_sorter_sort(sorter, reader, check_emit, &check, &error));
+   assert_cmpint(check.n_docs, ==, 20000);
+
+   bson_sorter_get_stats(sorter, &stats);
+   assert_cmpint(stats.n_docs, ==, 20000);
+   assert_cmpint(stats.n_runs, >, 1);
+
+   bson_reader_destroy(reader);
+   bson_sorter_destroy(sorter);
+   bson_free(buffer.buf);
+}
+
+
+static bson_bool_t
+collect_emit (const bson_t *b,
+              void         *data)
+{
+   bson_string_t *str = data;
+   bson_iter_t iter;
+
+   assert(bson_iter_init_find(&iter, b, "id"));
+   bson_string_append_c(str, (char)bson_iter_int32(&iter));
+
+   return TRUE;
+}
+
+
+static void
+test_sorter_types (void)
+{
+   bson_sorter_t *sorter;
+   bson_reader_t *reader;
+   bson_string_t *str;
+   bson_error_t error;
+   buffer_t buffer;
+   bson_oid_t oid;
+   bson_t child;
+   bson_t b;
+   int spill;
+
+   memset(&buffer, 0, sizeof buffer);
+   bson_oid_init_from_string(&oid, "000000000000000000000000");
+
+#define ADD_DOC(id, code) \
+   do { \
+      bson_init(&b); \
+      bson_append_int32(&b, "id", -1, id); \
+      bson_append_document_begin(&b, "x", -1, &child); \
+      code; \
+      bson_append_document_end(&b, &child); \
+      buffer_append(&buffer, &b); \
+      bson_destroy(&b); \
+   } while (0)
+
+   ADD_DOC('g', bson_append_oid(&child, "y", -1, &oid));
+   ADD_DOC('e', bson_append_utf8(&child, "y", -1, "b", -1));
+   ADD_DOC('b', bson_append_null(&child, "y", -1));
+   ADD_DOC('c', bson_append_double(&child, "y", -1, 1.5));
+   ADD_DOC('a', bson_append_minkey(&child, "y", -1));
+   ADD_DOC('d', bson_append_int64(&child, "y", -1, 2));
+   ADD_DOC('h', bson_append_bool(&child, "y", -1, TRUE));
+   ADD_DOC('B', (void)0);
+   ADD_DOC('D', bson_append_int32(&child, "y", -1, 2));
+   ADD_DOC('f', bson_append_utf8(&child, "y", -1, "bb", -1));
+   ADD_DOC('C', bson_append_int32(&child, "y", -1, 1));
+   ADD_DOC('i', bson_append_maxkey(&child, "y", -1));
+
+#undef ADD_DOC
+
+   /*
+    * Run once in memory and once spilling every document.
+    */
+   for (spill = 0; spill < 2; spill++) {
+      sorter = bson_sorter_new(spill ? 1 : 0, 2);
+      assert(bson_sorter_add_key(sorter, "x.y", TRUE));
+      str = bson_string_new(NULL);
+      reader = bson_reader_new_from_data(buffer.buf, buffer.len);
+      assert(bson_sorter_sort(sorter, reader, collect_emit, str, &error));
+      assert_cmpstr(str->str, "abBCcdDefghi");
+      bson_string_free(str, TRUE);
+      bson_reader_destroy(reader);
+      bson_sorter_destroy(sorter);
+   }
+
+   bson_free(buffer.buf);
+}
+
+
+static int
+compare_seq (const bson_t *a,
+             const bson_t *b,
+             void         *data)
+{
+   bson_iter_t iter;
+   bson_int32_t aseq;
+   bson_int32_t bseq;
+
+   assert(data == &gSortData);
+
+   assert(bson_iter_init_find(&iter, a, "seq"));
+   aseq = bson_iter_int32(&iter);
+   assert(bson_iter_init_find(&iter, b, "seq"));
+   bseq = bson_iter_int32(&iter);
+
+   return bseq - aseq;
+}
+
+
+static bson_bool_t
+count_emit (const bson_t *b,
+            void         *data)
+{
+   bson_iter_t iter;
+   bson_int32_t *expected = data;
+
+   assert(bson_iter_init_find(&iter, b, "seq"));
+   assert_cmpint(bson_iter_int32(&iter), ==, *expected);
+   (*expected)--;
+
+   return TRUE;
+}
+
+
+static void
+test_sorter_compare_func (void)
+{
+   bson_sorter_t *sorter;
+   bson_reader_t *reader;
+   bson_error_t error;
+   bson_int32_t expected = 2999;
+   buffer_t buffer;
+
+   build_input(&buffer, 3000, 10);
+
+   sorter = bson_sorter_new(8 * 1024, 3);
+   bson_sorter_set_compare_func(sorter, compare_seq, &gSortData);
+
+   reader = bson_reader_new_from_data(buffer.buf, buffer.len);
+   assert(bson_sorter_sort(sorter, reader, count_emit, &expected, &error));
+   assert_cmpint(expected, ==, -1);
+
+   bson_reader_destroy(reader);
+   bson_sorter_destroy(sorter);
+   bson_free(buffer.buf);
+}
+
+
+static bson_bool_t
+abort_emit (const bson_t *b,
+            void         *data)
+{
+   int *count = data;
+
+   return (++(*count) < 10);
+}
+
+
+static void
+test_sorter_abort (void)
+{
+   bson_sorter_t *sorter;
+   bson_reader_t *reader;
+   bson_error_t error;
+   buffer_t buffer;
+   int count = 0;
+
+   build_input(&buffer, 1000, 10);
+
+   sorter = bson_sorter_new(4096, 2);
+   assert(bson_sorter_add_key(sorter, "a", TRUE));
+
+   reader = bson_reader_new_from_data(buffer.buf, buffer.len);
+   assert(!bson_sorter_sort(sorter, reader, abort_emit, &count, &error));
+   assert_cmpint(count, ==, 10);
+   assert_cmpint(error.domain, ==, BSON_ERROR_SORTER);
+   assert_cmpint(error.code, ==, BSON_SORTER_ERROR_ABORTED);
+
+   bson_reader_destroy(reader);
+   bson_sorter_destroy(sorter);
+   bson_free(buffer.buf);
+}
+
+
+static void
+test_sorter_corrupt (void)
+{
+   bson_sorter_t *sorter;
+   bson_reader_t *reader;
+   bson_error_t error;
+   buffer_t buffer;
+   check_t check = { 0 };
+
+   build_input(&buffer, 100, 10);
+   buffer.buf[buffer.len - 1] = 0xFF;
+
+   sorter = bson_sorter_new(0, 0);
+   assert(bson_sorter_add_key(sorter, "a", TRUE));
+
+   reader = bson_reader_new_from_data(buffer.buf, buffer.len);
+   assert(!bson_sorter_sort(sorter, reader, check_emit, &check, &error));
+   assert_cmpint(error.domain, ==, BSON_ERROR_SORTER);
+   assert_cmpint(error.code, ==, BSON_SORTER_ERROR_READ);
+   assert_cmpint(check.n_docs, ==, 0);
+
+   bson_reader_destroy(reader);
+   bson_sorter_destroy(sorter);
+   bson_free(buffer.buf);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   run_test("/bson/sorter/in_memory", test_sorter_in_memory);
+   run_test("/bson/sorter/spill", test_sorter_spill);
+   run_test("/bson/sorter/types", test_sorter_types);
+   run_test("/bson/sorter/compare_func", test_sorter_compare_func);
+   run_test("/bson/sorter/abort", test_sorter_abort);
+   run_test("/bson/sorter/corrupt", test_sorter_corrupt);
+
+   return 0;
+}
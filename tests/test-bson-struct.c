@@ -0,0 +1,343 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+
+#include "bson-tests.h"
+
+
+typedef struct
+{
+   char          host[16];
+   bson_int32_t  port;
+} endpoint_t;
+
+
+typedef struct
+{
+   bson_oid_t    id;
+   bson_int32_t  seq;
+   bson_int64_t  bytes;
+   double        latency;
+   bson_bool_t   ok;
+   bson_int64_t  ts;
+   char         *name;
+   endpoint_t    peer;
+   bson_int32_t *samples;
+   size_t        n_samples;
+   char        **tags;
+   size_t        n_tags;
+   endpoint_t   *hops;
+   size_t        n_hops;
+} event_t;
+
+
+static const bson_struct_field_t gEndpointFields[] = {
+   BSON_STRUCT_FIELD_CHARS(endpoint_t, host),
+   BSON_STRUCT_FIELD(endpoint_t, port, BSON_STRUCT_INT32),
+};
+
+
+static const bson_struct_desc_t gEndpointDesc = {
+   sizeof(endpoint_t), gEndpointFields, 2
+};
+
+
+static const bson_struct_field_t gEventFields[] = {
+   { "_id", offsetof(event_t, id), BSON_STRUCT_OID, (bson_struct_type_t)0, 0, 0,
+     NULL },
+   BSON_STRUCT_FIELD(event_t, seq, BSON_STRUCT_INT32),
+   BSON_STRUCT_FIELD(event_t, bytes, BSON_STRUCT_INT64),
+   BSON_STRUCT_FIELD(event_t, latency, BSON_STRUCT_DOUBLE),
+   BSON_STRUCT_FIELD(event_t, ok, BSON_STRUCT_BOOL),
+   BSON_STRUCT_FIELD(event_t, ts, BSON_STRUCT_DATE_TIME),
+   BSON_STRUCT_FIELD(event_t, name, BSON_STRUCT_STRING),
+   BSON_STRUCT_FIELD_DOCUMENT(event_t, peer, &gEndpointDesc),
+   BSON_STRUCT_FIELD_ARRAY(event_t, samples, n_samples, BSON_STRUCT_INT32,
+                           NULL),
+   BSON_STRUCT_FIELD_ARRAY(event_t, tags, n_tags, BSON_STRUCT_STRING, NULL),
+   BSON_STRUCT_FIELD_ARRAY(event_t, hops, n_hops, BSON_STRUCT_DOCUMENT,
+                           &gEndpointDesc),
+};
+
+
+static const bson_struct_desc_t gEventDesc = {
+   sizeof(event_t), gEventFields, 11
+};
+
+
+static char *gTags[] = { (char *)"a", (char *)"bb", (char *)"ccc" };
+static bson_int32_t gSamples[] = { 5, 4, 3, 2, 1 };
+static endpoint_t gHops[] = { { "10.0.0.1", 1 }, { "10.0.0.2", 2 } };
+
+
+static void
+init_event (event_t *e,
+            int      i)
+{
+   memset(e, 0, sizeof *e);
+   bson_oid_init_sequence(&e->id, NULL);
+   e->seq = i;
+   e->bytes = i * 1000000000LL;
+   e->latency = i / 4.0;
+   e->ok = i & 1;
+   e->ts = 1000LL * i;
+   e->name = (i % 3) ? (char *)"query" : NULL;
+   strcpy(e->peer.host, "db.example.com");
+   e->peer.port = 27017 + i;
+   e->samples = gSamples;
+   e->n_samples = i % 6;
+   e->tags = gTags;
+   e->n_tags = i % 4;
+   e->hops = gHops;
+   e->n_hops = i % 3;
+}
+
+
+/*
+ * The hand-written mapping the descriptor replaces.
+ */
+static void
+encode_event (const event_t *e,
+              bson_t        *b)
+{
+   bson_t child;
+   char key[16];
+   size_t i;
+
+   bson_append_oid(b, "_id", -1, &e->id);
+   bson_append_int32(b, "seq", -1, e->seq);
+   bson_append_int64(b, "bytes", -1, e->bytes);
+   bson_append_double(b, "latency", -1, e->latency);
+   bson_append_bool(b, "ok", -1, e->ok);
+   bson_append_date_time(b, "ts", -1, e->ts);
+   if (e->name) {
+      bson_append_utf8(b, "name", -1, e->name, -1);
+   } else {
+      bson_append_null(b, "name", -1);
+   }
+   bson_append_document_begin(b, "peer", -1, &child);
+   bson_append_utf8(&child, "host", -1, e->peer.host, -1);
+   bson_append_int32(&child, "port", -1, e->peer.port);
+   bson_append_document_end(b, &child);
+   bson_append_array_begin(b, "samples", -1, &child);
+   for (i = 0; i < e->n_samples; i++) {
+      snprintf(key, sizeof key, "%u", (unsigned)i);
+      bson_append_int32(&child, key, -1, e->samples[i]);
+   }
+   bson_append_array_end(b, &child);
+   bson_append_array_begin(b, "tags", -1, &child);
+   for (i = 0; i < e->n_tags; i++) {
+      snprintf(key, sizeof key, "%u", (unsigned)i);
+      bson_append_utf8(&child, key, -1, e->tags[i], -1);
+   }
+   bson_append_array_end(b, &child);
+   bson_append_array_begin(b, "hops", -1, &child);
+   for (i = 0; i < e->n_hops; i++) {
+      bson_t hop;
+
+      snprintf(key, sizeof key, "%u", (unsigned)i);
+      bson_append_document_begin(&child, key, -1, &hop);
+      bson_append_utf8(&hop, "host", -1, e->hops[i].host, -1);
+      bson_append_int32(&hop, "port", -1, e->hops[i].port);
+      bson_append_document_end(&child, &hop);
+   }
+   bson_append_array_end(b, &child);
+}
+
+
+static void
+assert_events_equal (const event_t *a,
+                     const event_t *b)
+{
+   size_t i;
+
+   assert(bson_oid_equal(&a->id, &b->id));
+   assert_cmpint(a->seq, ==, b->seq);
+   assert(a->bytes == b->bytes);
+   assert(a->latency == b->latency);
+   assert_cmpint(a->ok, ==, b->ok);
+   assert(a->ts == b->ts);
+   if (a->name || b->name) {
+      assert_cmpstr(a->name, b->name);
+   }
+   assert_cmpstr(a->peer.host, b->peer.host);
+   assert_cmpint(a->peer.port, ==, b->peer.port);
+   assert_cmpint(a->n_samples, ==, b->n_samples);
+   for (i = 0; i < a->n_samples; i++) {
+      assert_cmpint(a->samples[i], ==, b->samples[i]);
+   }
+   assert_cmpint(a->n_tags, ==, b->n_tags);
+   for (i = 0; i < a->n_tags; i++) {
+      assert_cmpstr(a->tags[i], b->tags[i]);
+   }
+   assert_cmpint(a->n_hops, ==, b->n_hops);
+   for (i = 0; i < a->n_hops; i++) {
+      assert_cmpstr(a->hops[i].host, b->hops[i].host);
+      assert_cmpint(a->hops[i].port, ==, b->hops[i].port);
+   }
+}
+
+
+static void
+test_struct_roundtrip (void)
+{
+   bson_t expected;
+   event_t e;
+   event_t d;
+   bson_t b;
+   int i;
+
+   for (i = 0; i < 24; i++) {
+      init_event(&e, i);
+
+      bson_init(&expected);
+      encode_event(&e, &expected);
+
+      bson_init(&b);
+      assert(bson_struct_encode(&gEventDesc, &e, &b));
+      assert(bson_equal(&b, &expected));
+
+      memset(&d, 0, sizeof d);
+      assert(bson_struct_decode(&gEventDesc, &b, &d));
+      assert_events_equal(&e, &d);
+      bson_struct_clear(&gEventDesc, &d);
+      assert(!d.name);
+      assert(!d.tags);
+      assert_cmpint(d.n_tags, ==, 0);
+
+      bson_destroy(&b);
+      bson_destroy(&expected);
+   }
+}
+
+
+static void
+test_struct_out_of_order (void)
+{
+   endpoint_t e;
+   bson_t b;
+
+   bson_init(&b);
+   bson_append_utf8(&b, "unknown", -1, "skipped", -1);
+   bson_append_int32(&b, "port", -1, 80);
+   bson_append_int32(&b, "extra", -1, 0);
+   bson_append_utf8(&b, "host", -1, "a host name that does not fit", -1);
+
+   memset(&e, 0, sizeof e);
+   assert(bson_struct_decode(&gEndpointDesc, &b, &e));
+   assert_cmpint(e.port, ==, 80);
+   assert(!memcmp(e.host, "a host name that", 16));
+
+   bson_destroy(&b);
+
+   /* Missing fields are left alone. */
+   bson_init(&b);
+   bson_append_int32(&b, "port", -1, 81);
+   strcpy(e.host, "kept");
+   assert(bson_struct_decode(&gEndpointDesc, &b, &e));
+   assert_cmpint(e.port, ==, 81);
+   assert_cmpstr(e.host, "kept");
+   bson_destroy(&b);
+}
+
+
+static void
+test_struct_mismatch (void)
+{
+   bson_t child;
+   event_t e;
+   bson_t b;
+
+   bson_init(&b);
+   bson_append_utf8(&b, "name", -1, "allocated", -1);
+   bson_append_array_begin(&b, "tags", -1, &child);
+   bson_append_utf8(&child, "0", -1, "x", -1);
+   bson_append_int32(&child, "1", -1, 1);
+   bson_append_array_end(&b, &child);
+
+   memset(&e, 0, sizeof e);
+   assert(!bson_struct_decode(&gEventDesc, &b, &e));
+   assert_cmpstr(e.name, "allocated");
+   assert_cmpint(e.n_tags, ==, 2);
+   assert_cmpstr(e.tags[0], "x");
+   bson_struct_clear(&gEventDesc, &e);
+   bson_destroy(&b);
+
+   bson_init(&b);
+   bson_append_utf8(&b, "seq", -1, "1", -1);
+   memset(&e, 0, sizeof e);
+   assert(!bson_struct_decode(&gEventDesc, &b, &e));
+   bson_destroy(&b);
+
+   /* int32 values widen into int64 members. */
+   bson_init(&b);
+   bson_append_int32(&b, "bytes", -1, -5);
+   assert(bson_struct_decode(&gEventDesc, &b, &e));
+   assert(e.bytes == -5);
+   bson_destroy(&b);
+}
+
+
+static void
+test_struct_array (void)
+{
+   bson_iter_t iter;
+   event_t events[10];
+   event_t *decoded;
+   size_t n_decoded;
+   bson_t b;
+   int i;
+
+   for (i = 0; i < 10; i++) {
+      init_event(&events[i], i);
+   }
+
+   bson_init(&b);
+   assert(bson_struct_encode_array(&gEventDesc, events, 10, &b, "events", -1));
+   assert(bson_struct_encode_array(&gEventDesc, NULL, 0, &b, "none", -1));
+
+   assert(bson_iter_init_find(&iter, &b, "events"));
+   assert(bson_struct_decode_array(&gEventDesc, &iter, (void **)&decoded,
+                                   &n_decoded));
+   assert_cmpint(n_decoded, ==, 10);
+   for (i = 0; i < 10; i++) {
+      assert_events_equal(&events[i], &decoded[i]);
+   }
+   bson_struct_free_array(&gEventDesc, decoded, n_decoded);
+
+   assert(bson_iter_init_find(&iter, &b, "none"));
+   assert(bson_struct_decode_array(&gEventDesc, &iter, (void **)&decoded,
+                                   &n_decoded));
+   assert_cmpint(n_decoded, ==, 0);
+   assert(!decoded);
+
+   bson_destroy(&b);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   run_test("/bson/struct/roundtrip", test_struct_roundtrip);
+   run_test("/bson/struct/out_of_order", test_struct_out_of_order);
+   run_test("/bson/struct/mismatch", test_struct_mismatch);
+   run_test("/bson/struct/array", test_struct_array);
+
+   return 0;
+}
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+
+#include "bson-tests.h"
+
+
+static bson_oid_t gOid;
+
+
+/*
+ * Builds an event document the way an emitter would without a template.
+ */
+static void
+build_event (bson_t       *b,
+             bson_int32_t  seq,
+             bson_int64_t  ts,
+             const char   *name,
+             const bson_t *tags)
+{
+   bson_init(b);
+   bson_append_oid(b, "_id", -1, &gOid);
+   bson_append_int32(b, "seq", -1, seq);
+   bson_append_date_time(b, "ts", -1, ts);
+   bson_append_utf8(b, "name", -1, name, -1);
+   bson_append_double(b, "value", -1, seq / 2.0);
+   bson_append_int64(b, "bytes", -1, ts * 3);
+   bson_append_document(b, "tags", -1, tags);
+   bson_append_bool(b, "ok", -1, seq & 1);
+}
+
+
+static void
+test_template_fixed (void)
+{
+   bson_template_t *tmpl;
+   bson_t expected;
+   bson_t tags;
+   bson_t b;
+   int seq;
+   int ts;
+   int value;
+   int bytes;
+   int ok;
+   int i;
+
+   bson_init(&tags);
+   build_event(&expected, 0, 1, "event", &tags);
+
+   tmpl = bson_template_new(&expected);
+   assert(tmpl);
+   bson_destroy(&expected);
+
+   assert_cmpint(bson_template_slot(tmpl, "_id"), ==, 0);
+   assert_cmpint(bson_template_slot(tmpl, "ok"), ==, 7);
+   assert_cmpint(bson_template_slot(tmpl, "missing"), ==, -1);
+   assert_cmpint(bson_template_slot(tmpl, "se"), ==, -1);
+
+   seq = bson_template_slot(tmpl, "seq");
+   ts = bson_template_slot(tmpl, "ts");
+   value = bson_template_slot(tmpl, "value");
+   bytes = bson_template_slot(tmpl, "bytes");
+   ok = bson_template_slot(tmpl, "ok");
+
+   for (i = 0; i < 100; i++) {
+      bson_oid_init_sequence(&gOid, NULL);
+
+      assert(bson_template_set_oid(tmpl, 0, &gOid));
+      assert(bson_template_set_int32(tmpl, seq, i));
+      assert(bson_template_set_date_time(tmpl, ts, (i + 1) * 1000LL));
+      assert(bson_template_set_double(tmpl, value, i / 2.0));
+      assert(bson_template_set_int64(tmpl, bytes, (i + 1) * 3000LL));
+      assert(bson_template_set_bool(tmpl, ok, i & 1));
+
+      build_event(&expected, i, (i + 1) * 1000LL, "event", &tags);
+      assert(bson_template_build(tmpl, &b));
+      assert(bson_equal(&b, &expected));
+
+      bson_destroy(&b);
+      bson_destroy(&expected);
+   }
+
+   bson_template_destroy(tmpl);
+   bson_destroy(&tags);
+}
+
+
+static void
+test_template_variable (void)
+{
+   bson_template_t *tmpl;
+   bson_t expected;
+   bson_t values;
+   bson_iter_t iter;
+   bson_t tags;
+   bson_t big;
+   bson_t b;
+   int name;
+   int i;
+
+   bson_init(&tags);
+   bson_init(&big);
+   bson_append_utf8(&big, "host", -1, "db1.example.com", -1);
+   bson_append_int32(&big, "port", -1, 27017);
+
+   build_event(&expected, 7, 7000, "event", &tags);
+   tmpl = bson_template_new(&expected);
+   bson_destroy(&expected);
+
+   name = bson_template_slot(tmpl, "name");
+
+   /* Longer and shorter than the prototype, then the empty string. */
+   assert(bson_template_set_utf8(tmpl, name, "a much longer event name", -1));
+   build_event(&expected, 7, 7000, "a much longer event name", &tags);
+   assert(bson_template_build(tmpl, &b));
+   assert(bson_equal(&b, &expected));
+   bson_destroy(&b);
+   bson_destroy(&expected);
+
+   assert(bson_template_set_utf8(tmpl, name, "ev", 2));
+   assert(bson_template_set_document(tmpl, bson_template_slot(tmpl, "tags"),
+                                     &big));
+   build_event(&expected, 7, 7000, "ev", &big);
+   assert(bson_template_build(tmpl, &b));
+   assert(bson_equal(&b, &expected));
+   bson_destroy(&b);
+   bson_destroy(&expected);
+
+   assert(bson_template_set_utf8(tmpl, name, "", -1));
+   build_event(&expected, 7, 7000, "", &big);
+   assert(bson_template_build(tmpl, &b));
+   assert(bson_equal(&b, &expected));
+   bson_destroy(&b);
+   bson_destroy(&expected);
+
+   /* Values from an iter, for fixed and variable slots alike. */
+   bson_init(&values);
+   bson_append_int32(&values, "seq", -1, 42);
+   bson_append_utf8(&values, "name", -1, "from iter", -1);
+   bson_append_document(&values, "tags", -1, &tags);
+   bson_append_double(&values, "value", -1, 21.0);
+   bson_append_bool(&values, "ok", -1, FALSE);
+   assert(bson_iter_init(&iter, &values));
+   while (bson_iter_next(&iter)) {
+      i = bson_template_slot(tmpl, bson_iter_key(&iter));
+      assert(bson_template_set_iter(tmpl, i, &iter));
+   }
+   bson_destroy(&values);
+
+   build_event(&expected, 42, 7000, "from iter", &tags);
+   assert(bson_template_build(tmpl, &b));
+   assert(bson_equal(&b, &expected));
+   bson_destroy(&b);
+   bson_destroy(&expected);
+
+   /* Back to the prototype. */
+   bson_template_reset(tmpl);
+   build_event(&expected, 7, 7000, "event", &tags);
+   assert(bson_template_build(tmpl, &b));
+   assert(bson_equal(&b, &expected));
+   bson_destroy(&b);
+   bson_destroy(&expected);
+
+   bson_template_destroy(tmpl);
+   bson_destroy(&tags);
+   bson_destroy(&big);
+}
+
+
+static void
+test_template_append (void)
+{
+   bson_uint8_t buf[22];
+   bson_template_t *tmpl;
+   bson_t prototype;
+   bson_t expected;
+   bson_t child;
+   bson_t b;
+
+   bson_init(&prototype);
+   bson_append_utf8(&prototype, "s", -1, "x", -1);
+   bson_append_int32(&prototype, "i", -1, 1);
+   tmpl = bson_template_new(&prototype);
+   bson_destroy(&prototype);
+
+   assert(bson_template_set_utf8(tmpl, 0, "yy", -1));
+   assert(bson_template_set_int32(tmpl, 1, 2));
+
+   bson_init(&expected);
+   bson_append_int32(&expected, "first", -1, 0);
+   bson_append_document_begin(&expected, "sub", -1, &child);
+   bson_append_utf8(&child, "s", -1, "yy", -1);
+   bson_append_int32(&child, "i", -1, 2);
+   bson_append_document_end(&expected, &child);
+
+   bson_init(&b);
+   bson_append_int32(&b, "first", -1, 0);
+   assert(bson_append_document_begin(&b, "sub", -1, &child));
+   assert(bson_template_append(tmpl, &child));
+   assert(bson_append_document_end(&b, &child));
+
+   assert(bson_equal(&b, &expected));
+
+   bson_destroy(&b);
+   bson_destroy(&expected);
+
+   /*
+    * A buffer that cannot grow either takes the whole template or nothing.
+    * The fields take 17 bytes.
+    */
+   assert(bson_init_with_buffer(&b, buf, 21, FALSE));
+   assert(!bson_template_append(tmpl, &b));
+   assert_cmpint(b.len, ==, 5);
+   bson_destroy(&b);
+
+   assert(bson_template_build(tmpl, &expected));
+   assert(bson_init_with_buffer(&b, buf, 22, FALSE));
+   assert(bson_template_append(tmpl, &b));
+   assert(bson_get_data(&b) == buf);
+   assert(bson_equal(&b, &expected));
+   bson_destroy(&b);
+   bson_destroy(&expected);
+
+   bson_template_destroy(tmpl);
+}
+
+
+static void
+test_template_null (void)
+{
+   bson_template_t *tmpl;
+   bson_t prototype;
+   bson_t expected;
+   bson_t values;
+   bson_iter_t iter;
+   bson_t b;
+
+   bson_init(&prototype);
+   bson_append_null(&prototype, "n", -1);
+   bson_append_utf8(&prototype, "s", -1, "x", -1);
+   bson_append_minkey(&prototype, "m", -1);
+   tmpl = bson_template_new(&prototype);
+   assert(tmpl);
+
+   /* Slots after a value without data still land on their values. */
+   assert(bson_template_set_utf8(tmpl, 1, "yy", -1));
+   bson_init(&expected);
+   bson_append_null(&expected, "n", -1);
+   bson_append_utf8(&expected, "s", -1, "yy", -1);
+   bson_append_minkey(&expected, "m", -1);
+   assert(bson_template_build(tmpl, &b));
+   assert(bson_equal(&b, &expected));
+   bson_destroy(&b);
+
+   bson_init(&values);
+   bson_append_null(&values, "n", -1);
+   assert(bson_iter_init_find(&iter, &values, "n"));
+   assert(bson_template_set_iter(tmpl, 0, &iter));
+   assert(bson_template_build(tmpl, &b));
+   assert(bson_equal(&b, &expected));
+   bson_destroy(&b);
+
+   bson_destroy(&values);
+   bson_destroy(&expected);
+   bson_destroy(&prototype);
+   bson_template_destroy(tmpl);
+}
+
+
+static void
+test_template_errors (void)
+{
+   bson_template_t *tmpl;
+   bson_t prototype;
+   bson_t b;
+
+   bson_init(&prototype);
+   bson_append_int32(&prototype, "i", -1, 1);
+   bson_append_utf8(&prototype, "s", -1, "x", -1);
+   tmpl = bson_template_new(&prototype);
+   bson_destroy(&prototype);
+
+   assert(!bson_template_set_int64(tmpl, 0, 1));
+   assert(!bson_template_set_int32(tmpl, 1, 1));
+   assert(!bson_template_set_int32(tmpl, 2, 1));
+   assert(!bson_template_set_int32(tmpl, -1, 1));
+
+   bson_init(&prototype);
+   assert(!bson_template_set_document(tmpl, 1, &prototype));
+
+   assert(bson_template_build(tmpl, &b));
+   assert_cmpint(bson_count_keys(&b), ==, 2);
+   bson_destroy(&b);
+
+   bson_template_destroy(tmpl);
+
+   /* An empty prototype produces empty documents. */
+   tmpl = bson_template_new(&prototype);
+   assert(tmpl);
+   assert(bson_template_build(tmpl, &b));
+   assert(bson_equal(&b, &prototype));
+   bson_destroy(&b);
+   bson_template_destroy(tmpl);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   bson_oid_init_sequence(&gOid, NULL);
+
+   run_test("/bson/template/fixed", test_template_fixed);
+   run_test("/bson/template/variable", test_template_variable);
+   run_test("/bson/template/append", test_template_append);
+   run_test("/bson/template/null", test_template_null);
+   run_test("/bson/template/errors", test_template_errors);
+
+   return 0;
+}
@@ -0,0 +1,347 @@
+/*
+ * Copyright 2013 MongoDB Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bson-tests.h"
+
+
+static bson_t *
+get_bson (const char *filename)
+{
+   bson_uint32_t len;
+   bson_uint8_t buf[4096];
+   bson_t *b;
+   char real_filename[256];
+   int fd;
+
+   snprintf(real_filename, sizeof real_filename,
+            "tests/binary/%s", filename);
+   real_filename[sizeof real_filename - 1] = '\0';
+
+   if (-1 == (fd = open(real_filename, O_RDONLY))) {
+      fprintf(stderr, "Failed to open: %s\n", real_filename);
+      abort();
+   }
+   len = read(fd, buf, sizeof buf);
+   b = bson_new_from_data(buf, len);
+   close(fd);
+
+   return b;
+}
+
+
+typedef struct
+{
+   bson_walker_event_t  event;
+   bson_uint32_t        depth;
+   const char          *key;
+   bson_bool_t          in_array;
+} expected_event_t;
+
+
+/*
+ * { "a": 1, "b": { "c": 2, "d": [ 3, { "e": 4 } ] }, "f": "x" }
+ */
+static bson_t *
+build_nested (void)
+{
+   bson_t *b;
+   bson_t b1;
+   bson_t b2;
+   bson_t b3;
+
+   b = bson_new();
+   assert(bson_append_int32(b, "a", -1, 1));
+   assert(bson_append_document_begin(b, "b", -1, &b1));
+   assert(bson_append_int32(&b1, "c", -1, 2));
+   assert(bson_append_array_begin(&b1, "d", -1, &b2));
+   assert(bson_append_int32(&b2, "0", -1, 3));
+   assert(bson_append_document_begin(&b2, "1", -1, &b3));
+   assert(bson_append_int32(&b3, "e", -1, 4));
+   assert(bson_append_document_end(&b2, &b3));
+   assert(bson_append_array_end(&b1, &b2));
+   assert(bson_append_document_end(b, &b1));
+   assert(bson_append_utf8(b, "f", -1, "x", -1));
+
+   return b;
+}
+
+
+static void
+test_walker_events (void)
+{
+   static const expected_event_t expected[] = {
+      { BSON_WALKER_VALUE, 0, "a", FALSE },
+      { BSON_WALKER_ENTER_DOCUMENT, 0, "b", FALSE },
+      { BSON_WALKER_VALUE, 1, "c", FALSE },
+      { BSON_WALKER_ENTER_ARRAY, 1, "d", FALSE },
+      { BSON_WALKER_VALUE, 2, "0", TRUE },
+      { BSON_WALKER_ENTER_DOCUMENT, 2, "1", TRUE },
+      { BSON_WALKER_VALUE, 3, "e", FALSE },
+      { BSON_WALKER_LEAVE, 2, NULL, TRUE },
+      { BSON_WALKER_LEAVE, 1, NULL, FALSE },
+      { BSON_WALKER_LEAVE, 0, NULL, FALSE },
+      { BSON_WALKER_VALUE, 0, "f", FALSE },
+   };
+   bson_walker_event_t event;
+   bson_walker_t walker;
+   const bson_iter_t *iter;
+   bson_t *b;
+   size_t i;
+   int pass;
+
+   b = build_nested();
+
+   /* The second pass goes through the unchecked path. */
+   for (pass = 0; pass < 2; pass++) {
+      if (pass) {
+         bson_mark_validated(b);
+      }
+
+      assert(bson_walker_init(&walker, b));
+
+      for (i = 0; bson_walker_next(&walker, &event); i++) {
+         assert(i < sizeof expected / sizeof expected[0]);
+         assert(event == expected[i].event);
+         assert(bson_walker_depth(&walker) == expected[i].depth);
+         assert(bson_walker_in_array(&walker) == expected[i].in_array);
+         if (expected[i].key) {
+            iter = bson_walker_iter(&walker);
+            assert(!strcmp(bson_iter_key(iter), expected[i].key));
+            if (event == BSON_WALKER_VALUE && BSON_ITER_HOLDS_INT32(iter)) {
+               assert(bson_iter_int32(iter) == (bson_int32_t)expected[i].depth + 1);
+            }
+         }
+      }
+
+      assert(i == sizeof expected / sizeof expected[0]);
+      assert(!bson_walker_get_error_offset(&walker));
+      assert(!bson_walker_next(&walker, &event));
+      bson_walker_destroy(&walker);
+   }
+
+   bson_destroy(b);
+}
+
+
+static void
+test_walker_skip (void)
+{
+   bson_walker_event_t event;
+   bson_walker_t walker;
+   const char *keys[8];
+   bson_t *b;
+   int n = 0;
+
+   b = build_nested();
+
+   assert(bson_walker_init(&walker, b));
+   while (bson_walker_next(&walker, &event)) {
+      if (event == BSON_WALKER_LEAVE) {
+         keys[n++] = "leave";
+         continue;
+      }
+      keys[n++] = bson_iter_key(bson_walker_iter(&walker));
+      if (event == BSON_WALKER_ENTER_ARRAY) {
+         bson_walker_skip(&walker);
+      }
+   }
+   bson_walker_destroy(&walker);
+
+   assert(n == 6);
+   assert(!strcmp(keys[0], "a"));
+   assert(!strcmp(keys[1], "b"));
+   assert(!strcmp(keys[2], "c"));
+   assert(!strcmp(keys[3], "d"));
+   assert(!strcmp(keys[4], "leave"));
+   assert(!strcmp(keys[5], "f"));
+
+   bson_destroy(b);
+}
+
+
+static void
+test_walker_deep (void)
+{
+   bson_walker_event_t event;
+   bson_walker_t walker;
+   bson_t *docs[100];
+   bson_uint32_t depth = 0;
+   int enters = 0;
+   int leaves = 0;
+   int values = 0;
+   int i;
+
+   /* Builds 100 levels from the inside out, well past the inline frames. */
+   docs[99] = bson_new();
+   assert(bson_append_int32(docs[99], "leaf", -1, 1));
+   for (i = 98; i >= 0; i--) {
+      docs[i] = bson_new();
+      if ((i % 2)) {
+         assert(bson_append_array(docs[i], "0", -1, docs[i + 1]));
+      } else {
+         assert(bson_append_document(docs[i], "doc", -1, docs[i + 1]));
+      }
+   }
+
+   assert(bson_walker_init(&walker, docs[0]));
+   while (bson_walker_next(&walker, &event)) {
+      switch (event) {
+      case BSON_WALKER_ENTER_DOCUMENT:
+      case BSON_WALKER_ENTER_ARRAY:
+         assert(bson_walker_depth(&walker) == depth);
+         depth++;
+         enters++;
+         break;
+      case BSON_WALKER_LEAVE:
+         depth--;
+         assert(bson_walker_depth(&walker) == depth);
+         leaves++;
+         break;
+      case BSON_WALKER_VALUE:
+         assert(bson_walker_depth(&walker) == 99);
+         values++;
+         break;
+      default:
+         assert(FALSE);
+         break;
+      }
+   }
+   assert(!bson_walker_get_error_offset(&walker));
+   bson_walker_destroy(&walker);
+
+   assert(enters == 99);
+   assert(leaves == 99);
+   assert(values == 1);
+   assert(depth == 0);
+
+   for (i = 0; i < 100; i++) {
+      bson_destroy(docs[i]);
+   }
+}
+
+
+static size_t
+count_recursive (bson_iter_t *iter)
+{
+   bson_iter_t child;
+   size_t n = 0;
+
+   while (bson_iter_next(iter)) {
+      n++;
+      if ((BSON_ITER_HOLDS_DOCUMENT(iter) || BSON_ITER_HOLDS_ARRAY(iter)) &&
+          bson_iter_recurse(iter, &child)) {
+         n += count_recursive(&child);
+      }
+   }
+
+   return n;
+}
+
+
+static void
+test_walker_files (void)
+{
+   bson_walker_event_t event;
+   bson_walker_t walker;
+   char filename[64];
+   bson_iter_t iter;
+   size_t n;
+   bson_t *b;
+   int i;
+
+   for (i = 1; i <= 38; i++) {
+      snprintf(filename, sizeof filename, "test%u.bson", i);
+      b = get_bson(filename);
+
+      assert(bson_walker_init(&walker, b));
+      n = 0;
+      while (bson_walker_next(&walker, &event)) {
+         if (event != BSON_WALKER_LEAVE) {
+            n++;
+         }
+      }
+      assert(!bson_walker_get_error_offset(&walker));
+      bson_walker_destroy(&walker);
+
+      assert(bson_iter_init(&iter, b));
+      assert(n == count_recursive(&iter));
+
+      bson_destroy(b);
+   }
+}
+
+
+static void
+test_walker_corrupt (void)
+{
+   static const char *files[] = {
+      "overflow2.bson", "overflow3.bson", "test40.bson", "test41.bson",
+      "test42.bson", "test43.bson",
+   };
+   bson_walker_event_t event;
+   bson_walker_t walker;
+   bson_uint8_t *data;
+   bson_t *b;
+   size_t i;
+
+   for (i = 0; i < sizeof files / sizeof files[0]; i++) {
+      b = get_bson(files[i]);
+      if (b) {
+         assert(bson_walker_init(&walker, b));
+         while (bson_walker_next(&walker, &event)) {
+         }
+         assert(bson_walker_get_error_offset(&walker));
+         bson_walker_destroy(&walker);
+         bson_destroy(b);
+      }
+   }
+
+   /*
+    * Stretch the length of "b" by one so it swallows the terminator of
+    * "d", which still fits inside the top-level document.
+    */
+   b = build_nested();
+   data = (bson_uint8_t *)bson_get_data(b);
+   assert(data[4 + 1 + 2 + 4] == 0x03);
+   data[4 + 1 + 2 + 4 + 3]++;
+   assert(bson_walker_init(&walker, b));
+   while (bson_walker_next(&walker, &event)) {
+   }
+   assert(bson_walker_get_error_offset(&walker));
+   bson_walker_destroy(&walker);
+   bson_destroy(b);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   run_test("/bson/walker/events", test_walker_events);
+   run_test("/bson/walker/skip", test_walker_skip);
+   run_test("/bson/walker/deep", test_walker_deep);
+   run_test("/bson/walker/files", test_walker_files);
+   run_test("/bson/walker/corrupt", test_walker_corrupt);
+
+   return 0;
+}
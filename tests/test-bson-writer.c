@@ -90,12 +90,134 @@ test_bson_writer_empty_sequence (void)
 }
 
 
+/*
+ * Checks that @buf holds @n_docs documents whose "i" fields count up from
+ * *@next.
+ */
+static void
+check_batch (const bson_uint8_t *buf,
+             size_t              buflen,
+             int                 n_docs,
+             int                *next)
+{
+   bson_reader_t *reader;
+   const bson_t *b;
+   bson_bool_t eof = FALSE;
+   bson_iter_t iter;
+   int i;
+
+   reader = bson_reader_new_from_data(buf, buflen);
+   for (i = 0; i < n_docs; i++) {
+      assert((b = bson_reader_read(reader, &eof)));
+      assert(bson_iter_init_find(&iter, b, "i"));
+      assert(bson_iter_int32(&iter) == (*next)++);
+   }
+   assert(!bson_reader_read(reader, &eof));
+   assert(eof);
+   bson_reader_destroy(reader);
+}
+
+
+static void
+test_bson_writer_fixed (void)
+{
+   static const char str[] = "0123456789012345678901234567890123456789";
+   bson_writer_t *writer;
+   bson_uint8_t *buf = bson_malloc0(1024);
+   bson_uint8_t *orig = buf;
+   size_t buflen = 1024;
+   size_t remaining;
+   bson_t *b;
+   int n_flushes = 0;
+   int n_docs = 0;
+   int next = 0;
+   int i = 0;
+
+   writer = bson_writer_new(&buf, &buflen, 0, NULL);
+   assert(bson_writer_get_remaining(writer) == 1024);
+
+   while (i < 1000) {
+      remaining = bson_writer_get_remaining(writer);
+      if (bson_writer_begin(writer, &b)) {
+         if (bson_append_int32(b, "i", -1, i) &&
+             bson_append_utf8(b, "s", -1, str, i % 40)) {
+            assert(bson_writer_get_remaining(writer) == remaining - b->len);
+            bson_writer_end(writer);
+            n_docs++;
+            i++;
+            continue;
+         }
+         bson_writer_rollback(writer);
+      } else {
+         assert(remaining < 5);
+      }
+
+      /* Flush the batch and retry the document. */
+      assert(bson_writer_get_remaining(writer) == remaining);
+      assert(n_docs);
+      check_batch(buf, bson_writer_get_length(writer), n_docs, &next);
+      bson_writer_destroy(writer);
+      writer = bson_writer_new(&buf, &buflen, 0, NULL);
+      n_docs = 0;
+      n_flushes++;
+   }
+
+   check_batch(buf, bson_writer_get_length(writer), n_docs, &next);
+   bson_writer_destroy(writer);
+
+   assert(next == 1000);
+   assert(n_flushes > 20);
+   assert(buf == orig);
+   assert(buflen == 1024);
+
+   /* Not even an empty document fits. */
+   writer = bson_writer_new(&buf, &buflen, 1020, NULL);
+   assert(bson_writer_get_remaining(writer) == 4);
+   assert(!bson_writer_begin(writer, &b));
+   bson_writer_destroy(writer);
+
+   writer = bson_writer_new(&buf, &buflen, 1019, NULL);
+   assert(bson_writer_begin(writer, &b));
+   assert(!bson_append_null(b, "a", -1));
+   bson_writer_end(writer);
+   assert(bson_writer_get_remaining(writer) == 0);
+   assert(bson_writer_get_length(writer) == 1024);
+   bson_writer_destroy(writer);
+
+   bson_free(buf);
+}
+
+
+static void
+test_bson_writer_remaining (void)
+{
+   bson_writer_t *writer;
+   bson_uint8_t *buf = NULL;
+   size_t buflen = 0;
+   bson_t *b;
+
+   writer = bson_writer_new(&buf, &buflen, 0, bson_realloc);
+   assert(bson_writer_get_remaining(writer) == 0);
+   assert(bson_writer_begin(writer, &b));
+   assert(bson_writer_get_remaining(writer) == 64 - 5);
+   assert(bson_append_int32(b, "a", -1, 1));
+   assert(bson_writer_get_remaining(writer) == 64 - 12);
+   bson_writer_end(writer);
+   assert(bson_writer_get_remaining(writer) == 64 - 12);
+   bson_writer_destroy(writer);
+
+   bson_free(buf);
+}
+
+
 int
 main (int   argc,
       char *argv[])
 {
    run_test("/bson/writer/shared_buffer", test_bson_writer_shared_buffer);
    run_test("/bson/writer/empty_sequence", test_bson_writer_empty_sequence);
+   run_test("/bson/writer/fixed", test_bson_writer_fixed);
+   run_test("/bson/writer/remaining", test_bson_writer_remaining);
 
    return 0;
 }
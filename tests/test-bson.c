@@ -192,6 +192,32 @@ test_bson_append_null (void)
 }
 
 
+static void
+test_bson_append_now_utc_coarse (void)
+{
+   bson_iter_t iter;
+   bson_int64_t before;
+   bson_int64_t value;
+   bson_t *b;
+
+   before = (bson_int64_t)time(NULL) * 1000;
+
+   b = bson_new();
+   assert(bson_append_now_utc_coarse(b, "now", -1));
+   assert(bson_iter_init_find(&iter, b, "now"));
+   assert(BSON_ITER_HOLDS_DATE_TIME(&iter));
+
+   /*
+    * The coarse clock may trail the wall clock by a few milliseconds.
+    */
+   value = bson_iter_date_time(&iter);
+   assert(value >= before - 1000);
+   assert(value <= ((bson_int64_t)time(NULL) + 1) * 1000);
+
+   bson_destroy(b);
+}
+
+
 static void
 test_bson_append_bool (void)
 {
@@ -540,6 +566,119 @@ test_bson_append_iter (void)
 }
 
 
+static void
+test_bson_append_iter_range (void)
+{
+   bson_iter_t first;
+   bson_iter_t last;
+   bson_t child;
+   bson_t b;
+   bson_t c;
+   bson_t d;
+
+   bson_init(&d);
+   bson_append_int32(&d, "x", 1, 1);
+
+   bson_init(&b);
+   bson_append_int32(&b, "a", 1, 1);
+   bson_append_utf8(&b, "b", 1, "hello", 5);
+   bson_append_document(&b, "c", 1, &d);
+   bson_append_int64(&b, "d", 1, 4);
+   bson_append_null(&b, "e", 1);
+
+   assert(bson_iter_init_find(&first, &b, "b"));
+   assert(bson_iter_init_find(&last, &b, "d"));
+
+   bson_init(&c);
+   assert(bson_append_iter_range(&c, &first, &last));
+   assert(bson_append_iter_range(&c, &first, &first));
+   assert_cmpint(bson_count_keys(&c), ==, 2);
+   assert(bson_iter_init_find(&last, &c, "c"));
+   assert(BSON_ITER_HOLDS_DOCUMENT(&last));
+   bson_destroy(&c);
+
+   /*
+    * Through the end of the document, into a hashed document.
+    */
+   bson_init_hashed(&c);
+   assert(bson_append_iter_range(&c, &first, NULL));
+   assert_cmpint(bson_count_keys(&c), ==, 4);
+   assert(bson_hash(&c) ==
+          bson_hash_data(bson_get_data(&c) + 4, c.len - 5, 0));
+   bson_destroy(&c);
+
+   /*
+    * Into a child, then back out of it with a range over a child iter.
+    */
+   bson_init(&c);
+   bson_append_document_begin(&c, "x", 1, &child);
+   assert(bson_append_iter_range(&child, &first, NULL));
+   bson_append_document_end(&c, &child);
+
+   assert(bson_iter_init_find(&last, &c, "x"));
+   assert(bson_iter_recurse(&last, &first));
+   assert(bson_iter_next(&first));
+   assert_cmpstr(bson_iter_key(&first), "b");
+   assert(bson_iter_next(&first));
+
+   bson_reinit(&d);
+   assert(bson_append_iter_range(&d, &first, NULL));
+   assert_cmpint(bson_count_keys(&d), ==, 3);
+   assert(bson_iter_init(&last, &d));
+   assert(bson_iter_next(&last));
+   assert_cmpstr(bson_iter_key(&last), "c");
+
+   bson_destroy(&d);
+   bson_destroy(&c);
+   bson_destroy(&b);
+}
+
+
+static void
+test_bson_concat (void)
+{
+   bson_iter_t iter;
+   bson_t expected;
+   bson_t empty;
+   bson_t a;
+   bson_t b;
+   bson_t c;
+
+   bson_init(&a);
+   bson_append_int32(&a, "a", 1, 1);
+   bson_append_utf8(&a, "b", 1, "hello", 5);
+
+   bson_init(&b);
+   bson_append_double(&b, "c", 1, 1.5);
+   bson_append_document(&b, "d", 1, &a);
+
+   bson_init(&expected);
+   bson_append_int32(&expected, "ok", 2, 1);
+   bson_append_int32(&expected, "a", 1, 1);
+   bson_append_utf8(&expected, "b", 1, "hello", 5);
+   bson_append_double(&expected, "c", 1, 1.5);
+   bson_append_document(&expected, "d", 1, &a);
+
+   bson_init(&empty);
+
+   bson_init(&c);
+   bson_append_int32(&c, "ok", 2, 1);
+   assert(bson_concat(&c, &a));
+   assert(bson_concat(&c, &empty));
+   assert(bson_concat(&c, &b));
+   assert_bson_equal(&c, &expected);
+
+   assert(bson_iter_init_find(&iter, &c, "d"));
+   assert(BSON_ITER_HOLDS_DOCUMENT(&iter));
+
+   bson_destroy(&c);
+   bson_destroy(&expected);
+   bson_destroy(&empty);
+   bson_destroy(&a);
+   bson_destroy(&b);
+}
+
+
 static void
 test_bson_append_timestamp (void)
 {
@@ -1079,15 +1218,19 @@ test_bson_copy_to_excluding (void)
    bson_init(&b);
    bson_append_int32(&b, "a", 1, 1);
    bson_append_int32(&b, "b", 1, 2);
+   bson_append_null(&b, "c", 1);
+   bson_append_minkey(&b, "d", 1);
 
-   bson_copy_to_excluding(&b, &c, "b", NULL);
+   bson_copy_to_excluding(&b, &c, "b", "c", "d", NULL);
    r = bson_iter_init_find(&iter, &c, "a");
    assert(r);
    r = bson_iter_init_find(&iter, &c, "b");
    assert(!r);
+   r = bson_iter_init_find(&iter, &c, "c");
+   assert(!r);
 
    i = bson_count_keys(&b);
-   assert_cmpint(i, ==, 2);
+   assert_cmpint(i, ==, 4);
 
    i = bson_count_keys(&c);
    assert_cmpint(i, ==, 1);
@@ -1146,6 +1289,880 @@ init_rand (void)
 }
 
 
+/*
+ * Builds { "a": 1, "ab": { "x": "hello", "y": [ 1, 2 ] }, "c": <c> } with
+ * the value of "ab.x" and the contents of "ab.y" under the caller's control.
+ */
+static void
+build_edit_doc (bson_t     *b,
+                const char *x,
+                int         n_y,
+                bson_bool_t with_c)
+{
+   bson_t ab;
+   bson_t y;
+   char key[12];
+   int i;
+
+   bson_init(b);
+   bson_append_int32(b, "a", -1, 1);
+   bson_append_document_begin(b, "ab", -1, &ab);
+   if (x) {
+      bson_append_utf8(&ab, "x", -1, x, -1);
+   }
+   bson_append_array_begin(&ab, "y", -1, &y);
+   for (i = 0; i < n_y; i++) {
+      snprintf(key, sizeof key, "%d", i);
+      bson_append_int32(&y, key, -1, i + 1);
+   }
+   bson_append_array_end(&ab, &y);
+   bson_append_document_end(b, &ab);
+   if (with_c) {
+      bson_append_utf8(b, "c", -1, "tail", -1);
+   }
+}
+
+
+static void
+test_bson_remove (void)
+{
+   bson_t expected;
+   bson_t b;
+
+   build_edit_doc(&b, "hello", 2, TRUE);
+
+   assert(!bson_remove(&b, "missing"));
+   assert(!bson_remove(&b, "a.b"));
+   assert(!bson_remove(&b, "ab.x.z"));
+   assert(!bson_remove(&b, "ab.y.2"));
+
+   assert(bson_remove(&b, "ab.y.1"));
+   build_edit_doc(&expected, "hello", 1, TRUE);
+   assert_bson_equal(&b, &expected);
+   bson_destroy(&expected);
+
+   assert(bson_remove(&b, "ab.x"));
+   build_edit_doc(&expected, NULL, 1, TRUE);
+   assert_bson_equal(&b, &expected);
+   bson_destroy(&expected);
+
+   assert(bson_remove(&b, "c"));
+   build_edit_doc(&expected, NULL, 1, FALSE);
+   assert_bson_equal(&b, &expected);
+   bson_destroy(&expected);
+
+   assert(bson_remove(&b, "ab"));
+   assert(bson_remove(&b, "a"));
+   assert_cmpint(b.len, ==, 5);
+   assert(!bson_remove(&b, "a"));
+
+   bson_destroy(&b);
+}
+
+
+static void
+test_bson_replace_iter (void)
+{
+   bson_iter_t iter;
+   bson_t expected;
+   bson_t values;
+   bson_t b;
+   char big[300];
+
+   memset(big, 'z', sizeof big - 1);
+   big[sizeof big - 1] = '\0';
+
+   bson_init(&values);
+   bson_append_utf8(&values, "v", -1, "a much longer string", -1);
+   bson_append_utf8(&values, "big", -1, big, -1);
+
+   build_edit_doc(&b, "hello", 2, TRUE);
+
+   assert(bson_iter_init_find(&iter, &values, "v"));
+   assert(!bson_replace_iter(&b, "ab.z", &iter));
+   assert(bson_replace_iter(&b, "ab.x", &iter));
+   build_edit_doc(&expected, "a much longer string", 2, TRUE);
+   assert_bson_equal(&b, &expected);
+   bson_destroy(&expected);
+
+   /*
+    * Shrinking, with a value that points into the document being edited.
+    */
+   assert(bson_iter_init_find(&iter, &b, "c"));
+   assert(bson_replace_iter(&b, "ab.x", &iter));
+   build_edit_doc(&expected, "tail", 2, TRUE);
+   assert_bson_equal(&b, &expected);
+   bson_destroy(&expected);
+
+   /*
+    * Growing past the inline buffer.
+    */
+   assert(bson_iter_init_find(&iter, &values, "big"));
+   assert(bson_replace_iter(&b, "ab.x", &iter));
+   build_edit_doc(&expected, big, 2, TRUE);
+   assert_bson_equal(&b, &expected);
+   bson_destroy(&expected);
+
+   /*
+    * Changing the type of a value.
+    */
+   assert(bson_iter_init_find(&iter, &b, "a"));
+   assert(bson_replace_iter(&b, "ab.x", &iter));
+   assert(bson_iter_init(&iter, &b));
+   assert(bson_iter_find_descendant(&iter, "ab.x", &iter));
+   assert(BSON_ITER_HOLDS_INT32(&iter));
+   assert_cmpint(bson_iter_int32(&iter), ==, 1);
+   assert(bson_validate(&b, BSON_VALIDATE_NONE, NULL));
+
+   /*
+    * Values without data, such as null.
+    */
+   bson_append_null(&values, "null", -1);
+   assert(bson_iter_init_find(&iter, &values, "null"));
+   assert(bson_replace_iter(&b, "ab.x", &iter));
+   assert(bson_iter_init(&iter, &b));
+   assert(bson_iter_find_descendant(&iter, "ab.x", &iter));
+   assert(BSON_ITER_HOLDS_NULL(&iter));
+   assert(bson_validate(&b, BSON_VALIDATE_NONE, NULL));
+
+   bson_destroy(&b);
+   bson_destroy(&values);
+}
+
+
+static void
+test_bson_insert_iter (void)
+{
+   bson_iter_t iter;
+   bson_t expected;
+   bson_t values;
+   bson_t b;
+
+   bson_init(&values);
+   bson_append_int32(&values, "0", -1, 1);
+   bson_append_int32(&values, "1", -1, 2);
+   bson_append_utf8(&values, "x", -1, "hello", -1);
+   bson_append_utf8(&values, "c", -1, "tail", -1);
+
+   build_edit_doc(&b, NULL, 0, FALSE);
+
+   assert(bson_iter_init_find(&iter, &values, "0"));
+   assert(!bson_insert_iter(&b, "missing", "0", -1, &iter));
+   assert(!bson_insert_iter(&b, "a", "0", -1, &iter));
+   assert(bson_insert_iter(&b, "ab.y", "0", -1, &iter));
+   assert(bson_iter_init_find(&iter, &values, "1"));
+   assert(bson_insert_iter(&b, "ab.y", "1xx", 1, &iter));
+   build_edit_doc(&expected, NULL, 2, FALSE);
+   assert_bson_equal(&b, &expected);
+   bson_destroy(&expected);
+
+   assert(bson_iter_init_find(&iter, &values, "c"));
+   assert(bson_insert_iter(&b, NULL, "c", -1, &iter));
+   build_edit_doc(&expected, NULL, 2, TRUE);
+   assert_bson_equal(&b, &expected);
+   bson_destroy(&expected);
+
+   bson_append_minkey(&values, "min", -1);
+   assert(bson_iter_init_find(&iter, &values, "min"));
+   assert(bson_insert_iter(&b, NULL, "min", -1, &iter));
+   assert(bson_iter_init_find(&iter, &b, "min"));
+   assert(bson_iter_type(&iter) == BSON_TYPE_MINKEY);
+   assert(!bson_iter_next(&iter));
+   assert(bson_validate(&b, BSON_VALIDATE_NONE, NULL));
+
+   bson_destroy(&b);
+   bson_destroy(&values);
+}
+
+
+static void
+test_bson_edit_hashed (void)
+{
+   bson_iter_t iter;
+   bson_t values;
+   bson_t b;
+   char key[12];
+   int i;
+
+   bson_init(&values);
+   bson_append_utf8(&values, "v", -1, "replacement value", -1);
+
+   bson_init_hashed(&b);
+   for (i = 0; i < 100; i++) {
+      snprintf(key, sizeof key, "k%d", i);
+      bson_append_int32(&b, key, -1, i);
+   }
+
+   assert(bson_iter_init_find(&iter, &values, "v"));
+   assert(bson_replace_iter(&b, "k10", &iter));
+   assert(bson_hash(&b) ==
+          bson_hash_data(bson_get_data(&b) + 4, b.len - 5, 0));
+
+   assert(bson_remove(&b, "k3"));
+   assert(bson_hash(&b) ==
+          bson_hash_data(bson_get_data(&b) + 4, b.len - 5, 0));
+
+   assert(bson_insert_iter(&b, NULL, "k3", -1, &iter));
+   assert(bson_hash(&b) ==
+          bson_hash_data(bson_get_data(&b) + 4, b.len - 5, 0));
+
+   bson_append_int32(&b, "last", -1, 0);
+   assert(bson_hash(&b) ==
+          bson_hash_data(bson_get_data(&b) + 4, b.len - 5, 0));
+
+   bson_destroy(&b);
+   bson_destroy(&values);
+}
+
+
+static void
+test_bson_uint32_to_string (void)
+{
+   static const bson_uint32_t values[] = {
+      1001, 9999, 10000, 65535, 99999, 100000, 123456789, 1000000000,
+      4294967295U,
+   };
+   const char *key;
+   char expected[16];
+   char str[16];
+   bson_uint32_t i;
+
+   for (i = 0; i < 20000; i++) {
+      snprintf(expected, sizeof expected, "%u", i);
+      bson_uint32_to_string(i, &key, str, sizeof str);
+      assert_cmpstr(key, expected);
+   }
+
+   for (i = 0; i < sizeof values / sizeof values[0]; i++) {
+      snprintf(expected, sizeof expected, "%u", values[i]);
+      bson_uint32_to_string(values[i], &key, str, sizeof str);
+      assert_cmpstr(key, expected);
+      assert(key == str);
+
+      /* Too small for the fast path, so snprintf() truncates. */
+      bson_uint32_to_string(values[i], &key, str, 5);
+      assert(key == str);
+      assert(!strncmp(key, expected, 4));
+      assert_cmpint(strlen(key), ==, 4);
+   }
+}
+
+
+static void
+test_bson_array_builder (void)
+{
+   bson_array_builder_t builder;
+   bson_oid_t oid;
+   bson_t expected;
+   bson_t child;
+   bson_t sub;
+   bson_t b;
+   const char *key;
+   char str[16];
+   int key_length;
+   int i;
+
+   bson_oid_init_from_string(&oid, "1234567890abcdef12345678");
+   bson_init(&sub);
+   bson_append_int32(&sub, "a", -1, 1);
+
+   bson_init(&expected);
+   bson_append_array_begin(&expected, "array", -1, &child);
+   for (i = 0; i < 1500; i++) {
+      bson_uint32_to_string(i, &key, str, sizeof str);
+      switch (i % 10) {
+      case 0: bson_append_int32(&child, key, -1, i); break;
+      case 1: bson_append_int64(&child, key, -1, i); break;
+      case 2: bson_append_double(&child, key, -1, i); break;
+      case 3: bson_append_bool(&child, key, -1, i & 4); break;
+      case 4: bson_append_null(&child, key, -1); break;
+      case 5: bson_append_utf8(&child, key, -1, "value", -1); break;
+      case 6: bson_append_oid(&child, key, -1, &oid); break;
+      case 7: bson_append_date_time(&child, key, -1, i); break;
+      case 8: bson_append_document(&child, key, -1, &sub); break;
+      default: bson_append_minkey(&child, key, -1); break;
+      }
+   }
+   bson_append_array_end(&expected, &child);
+
+   bson_init(&b);
+   assert(bson_append_array_builder_begin(&b, "array", -1, &builder));
+   for (i = 0; i < 1500; i++) {
+      switch (i % 10) {
+      case 0: assert(bson_array_builder_append_int32(&builder, i)); break;
+      case 1: assert(bson_array_builder_append_int64(&builder, i)); break;
+      case 2: assert(bson_array_builder_append_double(&builder, i)); break;
+      case 3: assert(bson_array_builder_append_bool(&builder, i & 4)); break;
+      case 4: assert(bson_array_builder_append_null(&builder)); break;
+      case 5:
+         assert(bson_array_builder_append_utf8(&builder, "value", -1));
+         break;
+      case 6: assert(bson_array_builder_append_oid(&builder, &oid)); break;
+      case 7:
+         assert(bson_array_builder_append_date_time(&builder, i));
+         break;
+      case 8:
+         assert(bson_array_builder_append_document(&builder, &sub));
+         break;
+      default:
+         key = bson_array_builder_next_key(&builder, &key_length);
+         assert_cmpint(key_length, ==, strlen(key));
+         assert(bson_append_minkey(&builder.array, key, key_length));
+         break;
+      }
+   }
+   assert_cmpint(builder.index, ==, 1500);
+   assert(bson_append_array_builder_end(&b, &builder));
+
+   assert_cmpint(b.len, ==, expected.len);
+   assert(bson_equal(&b, &expected));
+
+   bson_destroy(&b);
+   bson_destroy(&expected);
+   bson_destroy(&sub);
+}
+
+
+static void
+test_bson_array_builder_iter (void)
+{
+   bson_array_builder_t builder;
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_t arr;
+   bson_t *b;
+   bson_t c;
+
+   b = bson_new();
+   bson_append_array_begin(b, "a", -1, &arr);
+   bson_append_int32(&arr, "0", -1, 1);
+   bson_append_utf8(&arr, "1", -1, "two", -1);
+   bson_append_double(&arr, "2", -1, 3.0);
+   bson_append_array_end(b, &arr);
+
+   bson_init(&c);
+   assert(bson_append_array_builder_begin(&c, "a", -1, &builder));
+   assert(bson_iter_init_find(&iter, b, "a"));
+   assert(bson_iter_recurse(&iter, &child));
+   while (bson_iter_next(&child)) {
+      assert(bson_array_builder_append_iter(&builder, &child));
+   }
+   assert(bson_append_array_builder_end(&c, &builder));
+
+   assert(bson_equal(b, &c));
+
+   bson_destroy(&c);
+   bson_destroy(b);
+}
+
+
+static void
+test_bson_append_array_fixed (void)
+{
+   static const size_t counts[] = { 0, 1, 10, 11, 1234 };
+   bson_array_builder_t builder;
+   bson_int32_t *i32;
+   bson_int64_t *i64;
+   bson_oid_t *oids;
+   double *dbl;
+   bson_t expected;
+   bson_t b;
+   size_t n;
+   size_t i;
+   size_t j;
+
+   i32 = bson_malloc(1234 * sizeof *i32);
+   i64 = bson_malloc(1234 * sizeof *i64);
+   dbl = bson_malloc(1234 * sizeof *dbl);
+   oids = bson_malloc(1234 * sizeof *oids);
+
+   for (i = 0; i < 1234; i++) {
+      i32[i] = (bson_int32_t)(i * 2654435761U);
+      i64[i] = (bson_int64_t)(i * 0x9E3779B97F4A7C15ULL);
+      dbl[i] = i / 3.0;
+      for (j = 0; j < 12; j++) {
+         oids[i].bytes[j] = (bson_uint8_t)(i + j);
+      }
+   }
+
+   for (j = 0; j < sizeof counts / sizeof counts[0]; j++) {
+      n = counts[j];
+
+      bson_init(&expected);
+      bson_append_int32(&expected, "before", -1, 1);
+      bson_append_array_builder_begin(&expected, "i32", -1, &builder);
+      for (i = 0; i < n; i++) {
+         bson_array_builder_append_int32(&builder, i32[i]);
+      }
+      bson_append_array_builder_end(&expected, &builder);
+      bson_append_array_builder_begin(&expected, "i64", -1, &builder);
+      for (i = 0; i < n; i++) {
+         bson_array_builder_append_int64(&builder, i64[i]);
+      }
+      bson_append_array_builder_end(&expected, &builder);
+      bson_append_array_builder_begin(&expected, "dbl", -1, &builder);
+      for (i = 0; i < n; i++) {
+         bson_array_builder_append_double(&builder, dbl[i]);
+      }
+      bson_append_array_builder_end(&expected, &builder);
+      bson_append_array_builder_begin(&expected, "oid", -1, &builder);
+      for (i = 0; i < n; i++) {
+         bson_array_builder_append_oid(&builder, &oids[i]);
+      }
+      bson_append_array_builder_end(&expected, &builder);
+      bson_append_int32(&expected, "after", -1, 2);
+
+      bson_init_hashed(&b);
+      assert(bson_append_int32(&b, "before", -1, 1));
+      assert(bson_append_array_int32(&b, "i32", -1, i32, n));
+      assert(bson_append_array_int64(&b, "i64", 3, i64, n));
+      assert(bson_append_array_double(&b, "dbl", -1, dbl, n));
+      assert(bson_append_array_oid(&b, "oid", -1, oids, n));
+      assert(bson_append_int32(&b, "after", -1, 2));
+
+      assert(bson_validate(&b, BSON_VALIDATE_NONE, NULL));
+      assert_cmpint(b.len, ==, expected.len);
+      assert(bson_equal(&b, &expected));
+      assert(bson_hash(&b) == bson_hash(&expected));
+
+      bson_destroy(&b);
+      bson_destroy(&expected);
+   }
+
+   bson_free(i32);
+   bson_free(i64);
+   bson_free(dbl);
+   bson_free(oids);
+}
+
+
+static void
+test_bson_validated (void)
+{
+   bson_t *b;
+   bson_t child;
+   size_t offset;
+
+   b = bson_new();
+   assert(!bson_is_validated(b));
+   assert(bson_append_int32(b, "a", -1, 1));
+   assert(bson_validate(b, BSON_VALIDATE_NONE, &offset));
+   assert(!bson_is_validated(b));
+   bson_mark_validated(b);
+   assert(bson_is_validated(b));
+
+   /* Appending drops the mark, including through a child document. */
+   assert(bson_append_int32(b, "b", -1, 2));
+   assert(!bson_is_validated(b));
+   bson_mark_validated(b);
+   assert(bson_is_validated(b));
+   assert(bson_append_document_begin(b, "c", -1, &child));
+   assert(!bson_is_validated(b));
+   assert(bson_append_int32(&child, "d", -1, 3));
+   assert(bson_append_document_end(b, &child));
+   assert(!bson_is_validated(b));
+   bson_destroy(b);
+
+   /*
+    * A marked document is still checked in full. bson_validate() does not
+    * modify it, so the wrong mark stays.
+    */
+   b = get_bson("overflow2.bson");
+   bson_mark_validated(b);
+   assert(!bson_validate(b, BSON_VALIDATE_NONE, &offset));
+   assert(offset == 9);
+   assert(bson_is_validated(b));
+   bson_destroy(b);
+}
+
+
+/*
+ * Walks @checked and @marked, which iterate the same data, in lockstep and
+ * checks that the trusted path decodes every element the same way.
+ */
+static void
+assert_iters_match (bson_iter_t *checked,
+                    bson_iter_t *marked)
+{
+   bson_iter_t checked_child;
+   bson_iter_t marked_child;
+
+   while (bson_iter_next(checked)) {
+      assert(bson_iter_next(marked));
+      assert(checked->offset == marked->offset);
+      assert(checked->next_offset == marked->next_offset);
+      assert(checked->type == marked->type);
+      assert(checked->key == marked->key);
+      assert(checked->data1 == marked->data1);
+      assert(checked->data2 == marked->data2);
+      assert(checked->data3 == marked->data3);
+      assert(checked->data4 == marked->data4);
+
+      if (BSON_ITER_HOLDS_DOCUMENT(checked) ||
+          BSON_ITER_HOLDS_ARRAY(checked)) {
+         assert(bson_iter_recurse(checked, &checked_child));
+         assert(bson_iter_recurse(marked, &marked_child));
+         assert(bson_is_validated(marked_child.bson));
+         assert(!bson_is_validated(checked_child.bson));
+         assert_iters_match(&checked_child, &marked_child);
+      }
+   }
+
+   assert(!bson_iter_next(marked));
+   assert(!checked->err_offset);
+   assert(!marked->err_offset);
+}
+
+
+static void
+test_bson_iter_validated (void)
+{
+   const bson_uint8_t binary[] = { 0, 1, 2, 3, 4 };
+   char filename[64];
+   bson_iter_t checked;
+   bson_iter_t marked;
+   bson_oid_t oid;
+   bson_t view;
+   bson_t *scope;
+   bson_t *b;
+   int i;
+
+   bson_oid_init_from_string(&oid, "123412341234abcdabcdabcd");
+
+   scope = bson_new();
+   assert(bson_append_int32(scope, "x", -1, 1));
+
+   b = bson_new();
+   assert(bson_append_utf8(b, "utf8", -1, "bar", -1));
+   assert(bson_append_int32(b, "int32", -1, 1234));
+   assert(bson_append_int64(b, "int64", -1, 4321));
+   assert(bson_append_double(b, "double", -1, 123.4));
+   assert(bson_append_undefined(b, "undefined", -1));
+   assert(bson_append_null(b, "null", -1));
+   assert(bson_append_oid(b, "oid", -1, &oid));
+   assert(bson_append_bool(b, "true", -1, TRUE));
+   assert(bson_append_time_t(b, "date", -1, 1234567890));
+   assert(bson_append_timestamp(b, "timestamp", -1, 1234567890, 1234));
+   assert(bson_append_regex(b, "regex", -1, "^abcd", "xi"));
+   assert(bson_append_dbpointer(b, "dbpointer", -1, "mycollection", &oid));
+   assert(bson_append_minkey(b, "minkey", -1));
+   assert(bson_append_maxkey(b, "maxkey", -1));
+   assert(bson_append_symbol(b, "symbol", -1, "var a = {};", -1));
+   assert(bson_append_code(b, "code", -1, "var b = {};"));
+   assert(bson_append_code_with_scope(b, "codewscope", -1, "x", scope));
+   assert(bson_append_document(b, "document", -1, scope));
+   assert(bson_append_array(b, "array", -1, scope));
+   assert(bson_append_binary(b, "binary", -1, BSON_SUBTYPE_BINARY,
+                             binary, sizeof binary));
+
+   for (i = 0; i <= 38; i++) {
+      if (i) {
+         bson_destroy(b);
+         snprintf(filename, sizeof filename, "test%u.bson", i);
+         b = get_bson(filename);
+      }
+
+      assert(bson_validate(b, BSON_VALIDATE_NONE, NULL));
+      bson_mark_validated(b);
+      assert(bson_init_static(&view, bson_get_data(b), b->len));
+      assert(bson_iter_init(&checked, &view));
+      assert(bson_iter_init(&marked, b));
+      assert_iters_match(&checked, &marked);
+   }
+
+   bson_destroy(b);
+   bson_destroy(scope);
+}
+
+
+static bson_bool_t
+visit_sum_int32 (const bson_iter_t *iter,
+                 const char        *key,
+                 bson_int32_t       v_int32,
+                 void              *data)
+{
+   *(bson_int64_t *)data += v_int32;
+   return FALSE;
+}
+
+
+static bson_bool_t
+visit_sum_document (const bson_iter_t *iter,
+                    const char        *key,
+                    const bson_t      *v_document,
+                    void              *data);
+
+
+static const bson_visitor_t gSumVisitor = {
+   .visit_int32 = visit_sum_int32,
+   .visit_document = visit_sum_document,
+   .visit_array = visit_sum_document,
+};
+
+
+static bson_bool_t
+visit_sum_document (const bson_iter_t *iter,
+                    const char        *key,
+                    const bson_t      *v_document,
+                    void              *data)
+{
+   bson_iter_t child;
+
+   if (bson_iter_init(&child, v_document)) {
+      bson_iter_visit_all(&child, &gSumVisitor, data);
+   }
+
+   return FALSE;
+}
+
+
+/*
+ * Sums the int32 fields of ten documents of ten ints and ten strings each
+ * with bson_iter_visit_all(), with and without bson_mark_validated().
+ */
+static void
+visit_all_nested (bson_bool_t validated)
+{
+   bson_int64_t sum = 0;
+   bson_iter_t iter;
+   bson_t child;
+   bson_t *b;
+   char key[16];
+   int i;
+   int j;
+
+   b = bson_new();
+   for (i = 0; i < 10; i++) {
+      snprintf(key, sizeof key, "doc%d", i);
+      assert(bson_append_document_begin(b, key, -1, &child));
+      for (j = 0; j < 10; j++) {
+         snprintf(key, sizeof key, "field_%d", j);
+         assert(bson_append_int32(&child, key, -1, j));
+         assert(bson_append_utf8(&child, "str", -1, "value", -1));
+      }
+      assert(bson_append_document_end(b, &child));
+   }
+
+   if (validated) {
+      bson_mark_validated(b);
+   }
+
+   assert(bson_iter_init(&iter, b));
+   bson_iter_visit_all(&iter, &gSumVisitor, &sum);
+   assert(sum == 10 * 45);
+
+   bson_destroy(b);
+}
+
+
+static void
+test_bson_visit_all (void)
+{
+   visit_all_nested(FALSE);
+}
+
+
+static void
+test_bson_visit_all_validated (void)
+{
+   visit_all_nested(TRUE);
+}
+
+
+/*
+ * Appends the same medium sized document to @b each time, with a child
+ * document so that growth also happens from inside a child.
+ */
+static bson_bool_t
+append_medium_doc (bson_t *b)
+{
+   static const char *keys[] = {
+      "key0", "key1", "key2", "key3", "key4", "key5", "key6", "key7",
+   };
+   bson_t child;
+   int i;
+
+   for (i = 0; i < 8; i++) {
+      if (!bson_append_int32(b, keys[i], 4, i)) {
+         return FALSE;
+      }
+   }
+
+   if (!bson_append_document_begin(b, "child", 5, &child)) {
+      return FALSE;
+   }
+   for (i = 0; i < 8; i++) {
+      if (!bson_append_utf8(&child, keys[i], 4, "a string value", 14)) {
+         bson_append_document_end(b, &child);
+         return FALSE;
+      }
+   }
+
+   return bson_append_document_end(b, &child);
+}
+
+
+static void
+test_bson_init_with_buffer (void)
+{
+   bson_uint8_t buf[4096];
+   bson_uint8_t small[64];
+   bson_uint32_t len;
+   bson_t expected;
+   bson_t child;
+   bson_t b;
+
+   bson_init(&expected);
+   assert(append_medium_doc(&expected));
+
+   assert(!bson_init_with_buffer(&b, buf, 4, FALSE));
+
+   /* The document fits, so it is built in place. */
+   assert(bson_init_with_buffer(&b, buf, sizeof buf, FALSE));
+   assert(b.len == 5);
+   assert(append_medium_doc(&b));
+   assert(bson_get_data(&b) == buf);
+   assert(b.len == expected.len);
+   assert(!memcmp(buf, bson_get_data(&expected), expected.len));
+   assert(bson_validate(&b, BSON_VALIDATE_NONE, NULL));
+   bson_destroy(&b);
+
+   /* A fixed buffer refuses appends that do not fit and keeps its data. */
+   assert(bson_init_with_buffer(&b, small, sizeof small, FALSE));
+   assert(bson_append_utf8(&b, "a", -1, "0123456789", -1));
+   len = b.len;
+   bson_mark_validated(&b);
+   assert(!bson_append_utf8(&b, "b", -1,
+                            "0123456789012345678901234567890123456789",
+                            -1));
+   assert(b.len == len);
+   assert(bson_is_validated(&b));
+   assert(bson_append_document_begin(&b, "c", -1, &child));
+   assert(bson_append_int32(&child, "x", -1, 1));
+   assert(!bson_append_utf8(&child, "y", -1,
+                            "0123456789012345678901234567890123456789",
+                            -1));
+   assert(bson_append_document_end(&b, &child));
+   assert(bson_get_data(&b) == small);
+   assert(bson_validate(&b, BSON_VALIDATE_NONE, NULL));
+   assert(bson_count_keys(&b) == 2);
+   assert(!bson_reserve(&b, sizeof small + 1));
+   bson_destroy(&b);
+
+   bson_destroy(&expected);
+}
+
+
+static void
+test_bson_init_with_buffer_grow (void)
+{
+   bson_uint8_t small[64];
+   bson_t expected;
+   bson_t b;
+
+   bson_init(&expected);
+   assert(append_medium_doc(&expected));
+   assert(append_medium_doc(&expected));
+
+   /*
+    * The first growth happens inside the child document and moves the
+    * document to the heap, which bson_destroy() must then free.
+    */
+   memset(small, 0xff, sizeof small);
+   assert(bson_init_with_buffer(&b, small, sizeof small, TRUE));
+   assert(append_medium_doc(&b));
+   assert(bson_get_data(&b) != small);
+   assert(append_medium_doc(&b));
+   assert(b.len == expected.len);
+   assert(!memcmp(bson_get_data(&b), bson_get_data(&expected), b.len));
+   bson_destroy(&b);
+
+   bson_destroy(&expected);
+}
+
+
+static void
+test_bson_reserve (void)
+{
+   const bson_uint8_t *data;
+   bson_t b;
+
+   bson_init(&b);
+   assert(bson_reserve(&b, 5));
+   assert(bson_reserve(&b, 4096));
+   data = bson_get_data(&b);
+   while (b.len + 512 < 4096) {
+      assert(append_medium_doc(&b));
+      assert(bson_get_data(&b) == data);
+   }
+   assert(!bson_reserve(&b, BSON_MAX_SIZE + 1));
+
+   assert(bson_validate(&b, BSON_VALIDATE_NONE, NULL));
+   bson_mark_validated(&b);
+   assert(bson_reserve(&b, 8192));
+   assert(bson_is_validated(&b));
+
+   bson_destroy(&b);
+}
+
+
+static void
+test_bson_reset (void)
+{
+   const bson_uint8_t *data;
+   bson_uint8_t buf[64];
+   bson_t expected;
+   bson_t b;
+   int i;
+
+   data = NULL;
+
+   bson_init(&expected);
+   assert(append_medium_doc(&expected));
+
+   /* Inline */
+   bson_init(&b);
+   assert(bson_append_int32(&b, "a", -1, 1));
+   bson_reset(&b);
+   assert(b.len == 5);
+   assert(bson_empty(&b));
+   bson_destroy(&b);
+
+   /* Heap */
+   bson_init(&b);
+   for (i = 0; i < 3; i++) {
+      assert(append_medium_doc(&b));
+      assert(b.len == expected.len);
+      assert(!memcmp(bson_get_data(&b), bson_get_data(&expected), b.len));
+      if (i) {
+         assert(bson_get_data(&b) == data);
+      }
+      data = bson_get_data(&b);
+      bson_reset(&b);
+      assert(b.len == 5);
+   }
+   bson_destroy(&b);
+
+   /* Caller supplied */
+   assert(bson_init_with_buffer(&b, buf, sizeof buf, FALSE));
+   assert(bson_append_int32(&b, "a", -1, 1));
+   bson_reset(&b);
+   assert(bson_get_data(&b) == buf);
+   assert(bson_empty(&b));
+   bson_destroy(&b);
+
+   /* Hashed */
+   bson_init_hashed(&b);
+   assert(bson_append_int32(&b, "a", -1, 1));
+   bson_reset(&b);
+   assert(append_medium_doc(&b));
+   assert(bson_hash(&b) == bson_hash(&expected));
+   bson_destroy(&b);
+
+   bson_destroy(&expected);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -1169,9 +2186,11 @@ main (int   argc,
    run_test("/bson/append_int32", test_bson_append_int32);
    run_test("/bson/append_int64", test_bson_append_int64);
    run_test("/bson/append_iter", test_bson_append_iter);
+   run_test("/bson/append_iter_range", test_bson_append_iter_range);
    run_test("/bson/append_maxkey", test_bson_append_maxkey);
    run_test("/bson/append_minkey", test_bson_append_minkey);
    run_test("/bson/append_null", test_bson_append_null);
+   run_test("/bson/append_now_utc_coarse", test_bson_append_now_utc_coarse);
    run_test("/bson/append_oid", test_bson_append_oid);
    run_test("/bson/append_regex", test_bson_append_regex);
    run_test("/bson/append_utf8", test_bson_append_utf8);
@@ -1195,6 +2214,23 @@ main (int   argc,
    run_test("/bson/copy_to", test_bson_copy_to);
    run_test("/bson/copy_to_excluding", test_bson_copy_to_excluding);
    run_test("/bson/initializer", test_bson_initializer);
+   run_test("/bson/remove", test_bson_remove);
+   run_test("/bson/replace_iter", test_bson_replace_iter);
+   run_test("/bson/insert_iter", test_bson_insert_iter);
+   run_test("/bson/edit_hashed", test_bson_edit_hashed);
+   run_test("/bson/concat", test_bson_concat);
+   run_test("/bson/uint32_to_string", test_bson_uint32_to_string);
+   run_test("/bson/array_builder", test_bson_array_builder);
+   run_test("/bson/array_builder_iter", test_bson_array_builder_iter);
+   run_test("/bson/append_array_fixed", test_bson_append_array_fixed);
+   run_test("/bson/validated", test_bson_validated);
+   run_test("/bson/iter_validated", test_bson_iter_validated);
+   run_test("/bson/visit_all", test_bson_visit_all);
+   run_test("/bson/visit_all_validated", test_bson_visit_all_validated);
+   run_test("/bson/init_with_buffer", test_bson_init_with_buffer);
+   run_test("/bson/init_with_buffer_grow", test_bson_init_with_buffer_grow);
+   run_test("/bson/reserve", test_bson_reserve);
+   run_test("/bson/reset", test_bson_reset);
 
    return 0;
 }